@@ -0,0 +1,641 @@
+/**
+ * Microbenchmarks for the primitives inside lilx.c - the lexer
+ * (__lilx_compare, __lilx_get_next_state), the action handlers, the tree
+ * building functions, the stack, and the query functions, on trees of a
+ * known shape - so that each one can be measured on its own.
+ *
+ * usage: lilxbench_micro [-r repetitions] [name ...]
+ *
+ * Only the benchmarks whose names contain one of the given names are run.
+ * Each benchmark is run for long enough to take about 10ms, and then
+ * repeated (11 times by default). The median time per operation is
+ * reported, along with the median absolute deviation as a percentage of it.
+ * If the deviation is over 5%, the benchmark is run again (up to 3 times),
+ * and if it is still over 5%, the result is marked as unstable.
+ *
+ * Some primitives can't be run on their own - an end tag needs an open
+ * element, for example. These are timed along with what they need, and the
+ * time for that (a baseline sequence) is subtracted.
+ *
+ * Paul McCarthy <paul.mccarthy@gmail.com>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*the private functions are static, so lilx.c is built into the benchmark*/
+#include "lilx.c"
+#include "stack.h"
+#include "names.h"
+
+/**
+ * Time each benchmark run should take, in seconds.
+ */
+#define RUN_TIME 0.01
+
+/**
+ * Maximum acceptable median absolute deviation, as a fraction of the median.
+ */
+#define MAX_SPREAD 0.05
+
+/**
+ * Number of times to run an unstable benchmark before giving up.
+ */
+#define MAX_ATTEMPTS 3
+
+/**
+ * Number of operations between frees of the tree, in the action benchmarks.
+ */
+#define BATCH_SIZE 4096
+
+/**
+ * A benchmark - runs the given number of operations, and returns the time
+ * taken, in seconds. Set up and tear down are not included.
+ */
+typedef double (*bench_fn_t)(uint64_t ops, void *arg);
+
+typedef struct __bench {
+
+  char       *name; /**< benchmark name                 */
+  bench_fn_t  fn;   /**< the benchmark                  */
+  void       *arg;  /**< passed to the benchmark        */
+} bench_t;
+
+/**
+ * Results are added to this, so the compiler can't optimise the work away.
+ */
+static volatile uint64_t sink;
+
+static double now(void) {
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*******
+ * Lexer
+ ******/
+
+typedef struct __compare_arg {
+
+  char    *xml;        /**< the input          */
+  char    *transition; /**< the transition     */
+  uint8_t  final;      /**< end of the input?  */
+} compare_arg_t;
+
+static double bench_compare(uint64_t ops, void *arg) {
+
+  compare_arg_t *a   = (compare_arg_t *)arg;
+  char          *end = a->xml + strlen(a->xml);
+  uint32_t       offset;
+  uint64_t       i, sum = 0;
+  double         start;
+
+  start = now();
+  for (i = 0; i < ops; i++) {
+    sum += __lilx_compare(a->xml, end, a->final, a->transition, &offset);
+    sum += offset;
+  }
+
+  sink += sum;
+  return now() - start;
+}
+
+typedef struct __next_state_arg {
+
+  uint8_t  state; /**< the current state  */
+  char    *xml;   /**< the input          */
+} next_state_arg_t;
+
+static double bench_next_state(uint64_t ops, void *arg) {
+
+  next_state_arg_t *a   = (next_state_arg_t *)arg;
+  char             *end = a->xml + strlen(a->xml);
+  char             *transition;
+  uint32_t          offset;
+  uint8_t           state;
+  uint64_t          i, sum = 0;
+  double            start;
+
+  start = now();
+  for (i = 0; i < ops; i++) {
+    state = a->state;
+    sum  += __lilx_get_next_state(
+      &state, a->xml, end, 0, &offset, &transition);
+    sum  += state;
+  }
+
+  sink += sum;
+  return now() - start;
+}
+
+/*********
+ * Actions
+ ********/
+
+/**
+ * Sequences of actions, each of which is timed as a whole.
+ */
+enum {
+  SEQ_OPEN_SELF_CLOSING = 0, /**< <a/>                            */
+  SEQ_OPEN_CLOSE,            /**< <a></a>                         */
+  SEQ_OPEN_TEXT_CLOSE,       /**< <a>text</a>                     */
+  SEQ_OPEN_ATTRS_CLOSE,      /**< <a k="v" ... (8 attributes) />  */
+  SEQ_NONE
+};
+
+typedef struct __action_arg {
+
+  uint8_t seq;      /**< the sequence to time                      */
+  uint8_t baseline; /**< sequence whose time is subtracted, or
+                         SEQ_NONE                                  */
+  uint8_t per;      /**< operations in each sequence               */
+} action_arg_t;
+
+/**
+ * Runs the given sequence n times, freeing the tree every BATCH_SIZE runs.
+ *
+ * \return the time taken, not including the frees.
+ */
+static double run_sequence(uint8_t seq, uint64_t n) {
+
+  parser_t  parser;
+  element_t root;
+  uint64_t  i, batch;
+  uint8_t   j, result = 0;
+  double    start, total = 0;
+
+  while (n > 0) {
+
+    batch = (n < BATCH_SIZE) ? n : BATCH_SIZE;
+    n    -= batch;
+
+    lilx_parser_init(&parser, &root);
+
+    start = now();
+    for (i = 0; i < batch; i++) {
+
+      switch (seq) {
+
+        case SEQ_OPEN_SELF_CLOSING:
+          result |= __lilx_elem_name_start_action(&parser, "item", 4, "/>");
+          break;
+
+        case SEQ_OPEN_CLOSE:
+          result |= __lilx_elem_name_start_action(&parser, "item", 4, ">");
+          result |= __lilx_elem_name_end_action(  &parser, "item", 4, ">");
+          break;
+
+        case SEQ_OPEN_TEXT_CLOSE:
+          result |= __lilx_elem_name_start_action(&parser, "item", 4, ">");
+          result |= __lilx_elem_action(&parser, "some text", 9, "</a");
+          result |= __lilx_elem_name_end_action(  &parser, "item", 4, ">");
+          break;
+
+        case SEQ_OPEN_ATTRS_CLOSE:
+          result |= __lilx_elem_name_start_action(&parser, "item", 4, "Ssa");
+          for (j = 0; j < 8; j++) {
+            result |= __lilx_attr_name_action(&parser, "key", 3, "=\"sA");
+            result |= __lilx_attr_val_action(
+              &parser, "value", 5, (j == 7) ? "\"s/>s<a" : "\"Ssa");
+          }
+          break;
+      }
+    }
+    total += now() - start;
+
+    lilx_free_tree(&root);
+  }
+
+  if (result != 0) {
+    printf("action sequence %u failed\n", seq);
+    exit(1);
+  }
+
+  return total;
+}
+
+static double bench_action(uint64_t ops, void *arg) {
+
+  action_arg_t *a = (action_arg_t *)arg;
+  uint64_t      n = (ops + a->per - 1) / a->per;
+  double        t;
+
+  t = run_sequence(a->seq, n);
+  if (a->baseline != SEQ_NONE) t -= run_sequence(a->baseline, n);
+
+  return t;
+}
+
+/**************
+ * Tree growing
+ *************/
+
+static double bench_add_child(uint64_t ops, void *arg) {
+
+  uint32_t  fanout = *(uint32_t *)arg;
+  element_t parent, child;
+  uint64_t  done;
+  uint32_t  i;
+  double    start, total = 0;
+
+  __lilx_init_element(&child);
+
+  for (done = 0; done < ops; done += fanout) {
+
+    __lilx_init_element(&parent);
+
+    start = now();
+    for (i = 0; i < fanout; i++) __lilx_add_child(&parent, &child);
+    total += now() - start;
+
+    sink += parent.num_children;
+    free(parent.children);
+  }
+
+  return total;
+}
+
+static double bench_add_attr(uint64_t ops, void *arg) {
+
+  uint32_t    fanout = *(uint32_t *)arg;
+  element_t   element;
+  attribute_t attr;
+  uint64_t    done;
+  uint32_t    i;
+  double      start, total = 0;
+
+  for (done = 0; done < ops; done += fanout) {
+
+    __lilx_init_element(&element);
+
+    start = now();
+    for (i = 0; i < fanout; i++) __lilx_add_attr(&element, &attr);
+    total += now() - start;
+
+    sink += element.num_attributes;
+    free(element.attributes);
+  }
+
+  return total;
+}
+
+static double bench_stack(uint64_t ops, void *arg) {
+
+  stack_t  stack;
+  uint64_t i;
+  uint8_t  j;
+  double   start;
+
+  stack_create(&stack, 64);
+
+  start = now();
+  for (i = 0; i < ops; i += 64) {
+    for (j = 0; j < 64; j++) stack_push(&stack, &stack);
+    for (j = 0; j < 64; j++) sink += (uintptr_t)stack_pop(&stack) & 1;
+  }
+  start = now() - start;
+
+  stack_free(&stack);
+  return start;
+}
+
+/*********
+ * Queries
+ ********/
+
+/**
+ * Trees which the queries are run on.
+ */
+static element_t wide;  /**< 1024 children, c0 to c15, 8 attributes each */
+static element_t deep;  /**< 64 nested elements, with a leaf at the end  */
+static element_t mixed; /**< an element with mixed content               */
+static element_t nswide;/**< like wide, but namespaced                   */
+static names_t   names;
+
+/**
+ * Names looked up by the ns queries.
+ */
+static uint16_t ns_uri, ns_local, ns_attr;
+
+enum {
+  Q_COUNT_WIDE = 0,
+  Q_COUNT_DEEP,
+  Q_GET_ELEMENTS_WIDE,
+  Q_GET_CHILD,
+  Q_GET_CHILDREN,
+  Q_GET_CHILD_NS,
+  Q_GET_ATTRIBUTE,
+  Q_GET_ATTRIBUTE_NS,
+  Q_GET_SEGMENT,
+  Q_GET_TEXT
+};
+
+/**
+ * Parses the given XML into the given tree, or exits.
+ */
+static void build(element_t *root, char *xml, names_t *names) {
+
+  parser_t parser;
+
+  lilx_parser_init(&parser, root);
+  parser.names = names;
+
+  if (lilx_parse(&parser, xml, strlen(xml), 1) != LILX_OK) {
+    printf("couldn't build tree\n");
+    exit(1);
+  }
+}
+
+static void build_trees(void) {
+
+  char    *xml = malloc(1 << 20);
+  uint32_t i, off;
+
+  off = sprintf(xml, "<r>");
+  for (i = 0; i < 1024; i++)
+    off += sprintf(xml + off, "<c%u a=\"1\" b=\"2\" c=\"3\" d=\"4\" "
+      "e=\"5\" f=\"6\" g=\"7\" h=\"8\">text</c%u>", i % 16, i % 16);
+  sprintf(xml + off, "</r>");
+  build(&wide, xml, NULL);
+
+  off = 0;
+  for (i = 0; i < 64; i++) off += sprintf(xml + off, "<d>");
+  off += sprintf(xml + off, "<leaf/>");
+  for (i = 0; i < 64; i++) off += sprintf(xml + off, "</d>");
+  build(&deep, xml, NULL);
+
+  build(&mixed, "<p>one<b/>two<b/>three<b/>four</p>", NULL);
+
+  names_init(&names);
+  off = sprintf(xml, "<r xmlns=\"urn:x\" xmlns:p=\"urn:p\">");
+  for (i = 0; i < 1024; i++)
+    off += sprintf(xml + off, "<c%u p:a=\"1\" p:h=\"8\"/>", i % 16);
+  sprintf(xml + off, "</r>");
+  build(&nswide, xml, &names);
+
+  ns_uri   = names_find(&names, "urn:x");
+  ns_local = names_find(&names, "c15");
+  ns_attr  = names_find(&names, "h");
+
+  free(xml);
+}
+
+static double bench_query(uint64_t ops, void *arg) {
+
+  uint8_t    query = *(uint8_t *)arg;
+  element_t *r     = wide.children[0];
+  element_t *found[255];
+  element_t *child;
+  uint16_t   it, len = 0;
+  uint64_t   i, sum = 0;
+  double     start;
+
+  start = now();
+  for (i = 0; i < ops; i++) {
+
+    switch (query) {
+
+      case Q_COUNT_WIDE:
+        sum += lilx_count_elements_by_name(&wide, "c3");
+        break;
+
+      case Q_COUNT_DEEP:
+        sum += lilx_count_elements_by_name(&deep, "leaf");
+        break;
+
+      case Q_GET_ELEMENTS_WIDE:
+        sum += lilx_get_elements_by_name(&wide, "c3", found, 255);
+        break;
+
+      case Q_GET_CHILD:
+        sum += (uintptr_t)lilx_get_child(r, "c15");
+        break;
+
+      case Q_GET_CHILDREN:
+        it = 0;
+        while ((child = lilx_get_children(r, "c3", &it)) != NULL)
+          sum += (uintptr_t)child;
+        break;
+
+      case Q_GET_CHILD_NS:
+        sum += (uintptr_t)lilx_get_child_ns(
+          nswide.children[0], ns_uri, ns_local);
+        break;
+
+      case Q_GET_ATTRIBUTE:
+        sum += (uintptr_t)lilx_get_attribute_by_name(r->children[0], "h");
+        break;
+
+      case Q_GET_ATTRIBUTE_NS:
+        sum += (uintptr_t)lilx_get_attribute_ns(
+          nswide.children[0]->children[0], names_find(&names, "urn:p"),
+          ns_attr);
+        break;
+
+      case Q_GET_SEGMENT:
+        sum += (uintptr_t)lilx_get_segment(mixed.children[0], 3, &len, NULL);
+        sum += len;
+        break;
+
+      case Q_GET_TEXT:
+        sum += (uintptr_t)lilx_get_text(mixed.children[0]);
+        break;
+    }
+  }
+
+  sink += sum;
+  return now() - start;
+}
+
+/************
+ * Benchmarks
+ ***********/
+
+static compare_arg_t cmp_literal = {"-->x",     "-->",    0};
+static compare_arg_t cmp_alnum   = {"x",        "a",      0};
+static compare_arg_t cmp_body    = {".",        "A",      0};
+static compare_arg_t cmp_space   = {" ",        "S",      0};
+static compare_arg_t cmp_run4    = {"    >",    "s>",     0};
+static compare_arg_t cmp_run64   = {
+  "                                                                >",
+  "s>", 0};
+static compare_arg_t cmp_end     = {"",         "0",      1};
+static compare_arg_t cmp_miss    = {"x",        "s>s</a", 0};
+
+static next_state_arg_t ns_start_tkn = {ELEM_NAME_START, "ame>"     };
+static next_state_arg_t ns_start_tr  = {ELEM_NAME_START, "><b>"     };
+static next_state_arg_t ns_end_tkn   = {ELEM_NAME_END,   "ame>"     };
+static next_state_arg_t ns_end_tr    = {ELEM_NAME_END,   "><b>"     };
+static next_state_arg_t ns_aname_tkn = {ATTR_NAME,       "ey=\"v\"" };
+static next_state_arg_t ns_aname_tr  = {ATTR_NAME,       "=\"v\""   };
+static next_state_arg_t ns_aval_tkn  = {ATTR_VAL,        "alue\">"  };
+static next_state_arg_t ns_aval_tr   = {ATTR_VAL,        "\"><b>"   };
+static next_state_arg_t ns_elem_tkn  = {ELEM,            "ext</a>"  };
+static next_state_arg_t ns_elem_tr   = {ELEM,            "</a>"     };
+static next_state_arg_t ns_cmt_tkn   = {COMMENT,         "ext-->"   };
+static next_state_arg_t ns_cmt_tr    = {COMMENT,         "--><b>"   };
+
+static action_arg_t act_start =
+  {SEQ_OPEN_SELF_CLOSING, SEQ_NONE,              1};
+static action_arg_t act_end   =
+  {SEQ_OPEN_CLOSE,        SEQ_OPEN_SELF_CLOSING, 1};
+static action_arg_t act_text  =
+  {SEQ_OPEN_TEXT_CLOSE,   SEQ_OPEN_CLOSE,        1};
+static action_arg_t act_attr  =
+  {SEQ_OPEN_ATTRS_CLOSE,  SEQ_OPEN_SELF_CLOSING, 8};
+
+static uint32_t fan_1     = 1;
+static uint32_t fan_16    = 16;
+static uint32_t fan_256   = 256;
+static uint32_t fan_4096  = 4096;
+static uint32_t fan_65535 = 65535;
+static uint32_t fan_8     = 8;
+static uint32_t fan_64    = 64;
+static uint32_t fan_255   = 255;
+
+static uint8_t q_count_wide    = Q_COUNT_WIDE;
+static uint8_t q_count_deep    = Q_COUNT_DEEP;
+static uint8_t q_get_elements  = Q_GET_ELEMENTS_WIDE;
+static uint8_t q_get_child     = Q_GET_CHILD;
+static uint8_t q_get_children  = Q_GET_CHILDREN;
+static uint8_t q_get_child_ns  = Q_GET_CHILD_NS;
+static uint8_t q_get_attribute = Q_GET_ATTRIBUTE;
+static uint8_t q_get_attr_ns   = Q_GET_ATTRIBUTE_NS;
+static uint8_t q_get_segment   = Q_GET_SEGMENT;
+static uint8_t q_get_text      = Q_GET_TEXT;
+
+static bench_t benches[] = {
+
+  {"compare/literal",                  bench_compare,    &cmp_literal},
+  {"compare/alnum",                    bench_compare,    &cmp_alnum},
+  {"compare/body",                     bench_compare,    &cmp_body},
+  {"compare/space",                    bench_compare,    &cmp_space},
+  {"compare/space_run_4",              bench_compare,    &cmp_run4},
+  {"compare/space_run_64",             bench_compare,    &cmp_run64},
+  {"compare/end",                      bench_compare,    &cmp_end},
+  {"compare/mismatch",                 bench_compare,    &cmp_miss},
+
+  {"next_state/elem_name_start/token", bench_next_state, &ns_start_tkn},
+  {"next_state/elem_name_start/trans", bench_next_state, &ns_start_tr},
+  {"next_state/elem_name_end/token",   bench_next_state, &ns_end_tkn},
+  {"next_state/elem_name_end/trans",   bench_next_state, &ns_end_tr},
+  {"next_state/attr_name/token",       bench_next_state, &ns_aname_tkn},
+  {"next_state/attr_name/trans",       bench_next_state, &ns_aname_tr},
+  {"next_state/attr_val/token",        bench_next_state, &ns_aval_tkn},
+  {"next_state/attr_val/trans",        bench_next_state, &ns_aval_tr},
+  {"next_state/elem/token",            bench_next_state, &ns_elem_tkn},
+  {"next_state/elem/trans",            bench_next_state, &ns_elem_tr},
+  {"next_state/comment/token",         bench_next_state, &ns_cmt_tkn},
+  {"next_state/comment/trans",         bench_next_state, &ns_cmt_tr},
+
+  {"action/elem_name_start",           bench_action,     &act_start},
+  {"action/elem_name_end",             bench_action,     &act_end},
+  {"action/elem",                      bench_action,     &act_text},
+  {"action/attr_name+attr_val",        bench_action,     &act_attr},
+
+  {"add_child/1",                      bench_add_child,  &fan_1},
+  {"add_child/16",                     bench_add_child,  &fan_16},
+  {"add_child/256",                    bench_add_child,  &fan_256},
+  {"add_child/4096",                   bench_add_child,  &fan_4096},
+  {"add_child/65535",                  bench_add_child,  &fan_65535},
+  {"add_attr/1",                       bench_add_attr,   &fan_1},
+  {"add_attr/8",                       bench_add_attr,   &fan_8},
+  {"add_attr/64",                      bench_add_attr,   &fan_64},
+  {"add_attr/255",                     bench_add_attr,   &fan_255},
+
+  {"stack/push+pop",                   bench_stack,      NULL},
+
+  {"query/count_elements_by_name/wide", bench_query,     &q_count_wide},
+  {"query/count_elements_by_name/deep", bench_query,     &q_count_deep},
+  {"query/get_elements_by_name/wide",   bench_query,     &q_get_elements},
+  {"query/get_child/wide",              bench_query,     &q_get_child},
+  {"query/get_children/wide",           bench_query,     &q_get_children},
+  {"query/get_child_ns/wide",           bench_query,     &q_get_child_ns},
+  {"query/get_attribute_by_name",       bench_query,     &q_get_attribute},
+  {"query/get_attribute_ns",            bench_query,     &q_get_attr_ns},
+  {"query/get_segment",                 bench_query,     &q_get_segment},
+  {"query/get_text/mixed",              bench_query,     &q_get_text},
+};
+
+static int compare_doubles(const void *a, const void *b) {
+
+  double x = *(double *)a;
+  double y = *(double *)b;
+
+  return (x > y) - (x < y);
+}
+
+/**
+ * Runs a benchmark, and prints the median ns/op and its spread.
+ */
+static void run(bench_t *b, int reps) {
+
+  double   samples[reps], dev[reps];
+  double   median = 0, spread = 0;
+  uint64_t ops = 1;
+  int      i, attempt;
+
+  /*find a number of operations which takes about RUN_TIME*/
+  while (b->fn(ops, b->arg) < RUN_TIME && ops < (1ull << 40)) ops *= 2;
+
+  for (attempt = 0; attempt < MAX_ATTEMPTS; attempt++) {
+
+    for (i = 0; i < reps; i++) samples[i] = b->fn(ops, b->arg) * 1e9 / ops;
+
+    qsort(samples, reps, sizeof(double), compare_doubles);
+    median = samples[reps / 2];
+
+    for (i = 0; i < reps; i++)
+      dev[i] = (samples[i] > median) ?
+        samples[i] - median : median - samples[i];
+
+    qsort(dev, reps, sizeof(double), compare_doubles);
+    spread = (median > 0) ? dev[reps / 2] / median : 0;
+
+    if (spread <= MAX_SPREAD) break;
+  }
+
+  printf("%-36s %10.2f ns/op  +/- %5.1f%%%s\n", b->name, median,
+    spread * 100, (spread > MAX_SPREAD) ? "  UNSTABLE" : "");
+}
+
+int main(int argc, char *argv[]) {
+
+  int    reps = 11;
+  int    i, j, first = 1;
+  size_t n    = sizeof(benches) / sizeof(benches[0]);
+
+  if (argc > 2 && strcmp(argv[1], "-r") == 0) {
+    reps   = atoi(argv[2]);
+    first += 2;
+  }
+
+  if (reps <= 0) {
+    printf("usage: %s [-r repetitions] [name ...]\n", argv[0]);
+    return 1;
+  }
+
+  build_trees();
+
+  for (i = 0; i < (int)n; i++) {
+
+    if (first < argc) {
+      for (j = first; j < argc; j++)
+        if (strstr(benches[i].name, argv[j]) != NULL) break;
+      if (j == argc) continue;
+    }
+
+    run(&benches[i], reps);
+  }
+
+  lilx_free_tree(&wide);
+  lilx_free_tree(&deep);
+  lilx_free_tree(&mixed);
+  lilx_free_tree(&nswide);
+  names_free(&names);
+
+  return 0;
+}
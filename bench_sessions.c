@@ -0,0 +1,248 @@
+/**
+ * Benchmark for the resumable parser - drives a large number of interleaved
+ * sessions, each over its own local socketpair, with epoll. Every session
+ * receives the same message, a few bytes at a time, and keeps a parser_t
+ * between reads, like a server holding many partially received messages.
+ * After each read, the input which the parser is finished with is dropped
+ * (see lilx_parser_discard), so each session only holds on to the token in
+ * progress.
+ *
+ * usage: lilxbench_sessions [sessions] [chunk size]
+ *
+ * Linux only.
+ *
+ * Paul McCarthy <paul.mccarthy@gmail.com>
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#include "lilx.h"
+
+/**
+ * Server side state for one session.
+ */
+typedef struct __session {
+
+  parser_t  parser; /**< resumable parser state             */
+  element_t root;   /**< root of the tree being built       */
+  char     *buf;    /**< input received so far              */
+  uint32_t  len;    /**< number of bytes received so far    */
+  uint32_t  cap;    /**< capacity of buf                    */
+  int       fd;     /**< server end of the socketpair       */
+} session_t;
+
+static char *message = "<device id=\"4711\" model=\"xr-9\">\n\
+ <status>\n\
+  <uptime>1234567</uptime>\n\
+  <temperature unit=\"C\">41</temperature>\n\
+  <fan speed=\"2200\"/>\n\
+ </status>\n\
+ <interfaces>\n\
+  <interface name=\"eth0\" state=\"up\"><rx>99812</rx><tx>1233</tx></interface>\n\
+  <interface name=\"eth1\" state=\"down\"><rx>0</rx><tx>0</tx></interface>\n\
+ </interfaces>\n\
+</device>";
+
+static double now(void) {
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Returns the resident set size of this process in kB, or 0 if it can't
+ * be read.
+ */
+static long rss_kb(void) {
+
+  char line[256];
+  long kb = 0;
+  FILE *f = fopen("/proc/self/status", "r");
+
+  if (f == NULL) return 0;
+
+  while (fgets(line, sizeof(line), f) != NULL)
+    if (sscanf(line, "VmRSS: %ld", &kb) == 1) break;
+
+  fclose(f);
+  return kb;
+}
+
+/**
+ * Reads whatever is available on the given session, and feeds it to the
+ * session's parser.
+ *
+ * \return 0 if the session is still in progress, 1 if it has finished
+ * successfully, -1 if it failed.
+ */
+static int session_read(session_t *s) {
+
+  char chunk[512];
+  ssize_t n;
+  uint8_t result;
+  uint32_t discard;
+
+  n = read(s->fd, chunk, sizeof(chunk));
+  if (n < 0) return 0;
+
+  if (n > 0) {
+
+    if (s->len + n > s->cap) {
+      s->cap = (s->len + n) * 2;
+      s->buf = realloc(s->buf, s->cap);
+      if (s->buf == NULL) return -1;
+    }
+    memcpy(s->buf + s->len, chunk, n);
+    s->len += n;
+  }
+
+  /*n == 0 means the peer has shut down - the message is complete*/
+  result = lilx_parse(&s->parser, s->buf, s->len, n == 0);
+
+  if (result == LILX_MORE) {
+
+    discard = lilx_parser_discard(&s->parser);
+    memmove(s->buf, s->buf + discard, s->len - discard);
+    s->len -= discard;
+    return 0;
+  }
+
+  free(s->buf);
+  s->buf = NULL;
+  close(s->fd);
+
+  if (result != LILX_OK) return -1;
+
+  lilx_free_tree(&s->root);
+  return 1;
+}
+
+int main(int argc, char *argv[]) {
+
+  long nsessions = 100000;
+  long chunk     = 16;
+  long msglen    = strlen(message);
+  long i, off, done = 0, failed = 0;
+  long rss_start, rss_idle;
+  int ep, n, fds[2];
+  int *clients;
+  session_t *sessions;
+  struct epoll_event ev, events[1024];
+  struct rlimit rl;
+  double start, elapsed;
+
+  if (argc > 1) nsessions = atol(argv[1]);
+  if (argc > 2) chunk     = atol(argv[2]);
+  if (nsessions <= 0 || chunk <= 0) {
+    printf("usage: %s [sessions] [chunk size]\n", argv[0]);
+    return 1;
+  }
+
+  /*two descriptors per session, plus a few spare*/
+  getrlimit(RLIMIT_NOFILE, &rl);
+  rl.rlim_cur = rl.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &rl);
+  getrlimit(RLIMIT_NOFILE, &rl);
+  if ((rlim_t)(2 * nsessions + 16) > rl.rlim_cur) {
+    nsessions = (rl.rlim_cur - 16) / 2;
+    printf("descriptor limit is %lu - limiting to %ld sessions\n",
+      (unsigned long)rl.rlim_cur, nsessions);
+  }
+
+  sessions = calloc(nsessions, sizeof(session_t));
+  clients  = calloc(nsessions, sizeof(int));
+  ep       = epoll_create1(0);
+  if (sessions == NULL || clients == NULL || ep < 0) {
+    printf("setup failed\n");
+    return 1;
+  }
+
+  rss_start = rss_kb();
+
+  for (i = 0; i < nsessions; i++) {
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+      perror("socketpair");
+      return 1;
+    }
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+    sessions[i].fd = fds[0];
+    clients[i]     = fds[1];
+
+    if (lilx_parser_init(&sessions[i].parser, &sessions[i].root) != 0) {
+      printf("lilx_parser_init failed\n");
+      return 1;
+    }
+
+    ev.events   = EPOLLIN;
+    ev.data.ptr = &sessions[i];
+    epoll_ctl(ep, EPOLL_CTL_ADD, fds[0], &ev);
+  }
+
+  start = now();
+  rss_idle = 0;
+
+  /*send every session the next chunk of the message, then let
+    the server side catch up, so all sessions are interleaved*/
+  for (off = 0; off < msglen; off += chunk) {
+
+    for (i = 0; i < nsessions; i++) {
+      n = (msglen - off < chunk) ? (msglen - off) : chunk;
+      if (write(clients[i], message + off, n) != n) perror("write");
+      if (off + n >= msglen) shutdown(clients[i], SHUT_WR);
+    }
+
+    while ((n = epoll_wait(ep, events, 1024, 0)) > 0) {
+      for (i = 0; i < n; i++) {
+        switch (session_read(events[i].data.ptr)) {
+          case  1: done++;   break;
+          case -1: failed++; break;
+        }
+      }
+    }
+
+    /*halfway through, every session is idle mid-message*/
+    if (rss_idle == 0 && off >= msglen / 2) rss_idle = rss_kb();
+  }
+
+  while (done + failed < nsessions) {
+    n = epoll_wait(ep, events, 1024, 1000);
+    if (n <= 0) break;
+    for (i = 0; i < n; i++) {
+      switch (session_read(events[i].data.ptr)) {
+        case  1: done++;   break;
+        case -1: failed++; break;
+      }
+    }
+  }
+
+  elapsed = now() - start;
+
+  printf("sessions:            %ld\n",    nsessions);
+  printf("message size:        %ld bytes, %ld byte chunks\n", msglen, chunk);
+  printf("sizeof(parser_t):    %lu bytes\n", (unsigned long)sizeof(parser_t));
+  printf("parsed:              %ld ok, %ld failed\n", done, failed);
+  printf("elapsed:             %.3f s\n", elapsed);
+  printf("throughput:          %.0f messages/s, %.1f MB/s\n",
+    done / elapsed, done * msglen / elapsed / 1e6);
+  printf("RSS mid-message:     %ld kB over baseline (%.0f bytes/session)\n",
+    rss_idle - rss_start, (rss_idle - rss_start) * 1024.0 / nsessions);
+
+  for (i = 0; i < nsessions; i++) close(clients[i]);
+  close(ep);
+  free(sessions);
+  free(clients);
+
+  return failed != 0;
+}
@@ -0,0 +1,460 @@
+/**
+ * Soak benchmark - parses and frees a mix of messages for a long time, like
+ * a server which runs for weeks between restarts, and watches for the heap
+ * growing or fragmenting, and for parsing getting slower.
+ *
+ * usage: lilxbench_soak [-d seconds] [-i interval] [-l live] [-s seed]
+ *
+ * A pool of messages of different shapes is generated up front - small
+ * status messages, wide lists, deep nesting, lots of attributes, and long
+ * text - and messages are picked from it at random. A number of trees are
+ * kept alive at once, each replaced by a new one at random, so that trees
+ * are freed in a different order from the one they were created in, as they
+ * would be in a server handling many requests at once.
+ *
+ * Every interval, one line is printed with the RSS, the allocator's view of
+ * the heap (bytes in use, bytes held, and the free fraction of what is
+ * held), and the median and 99th percentile parse latency over the interval.
+ * The message pool is allocated before the first sample, and never freed,
+ * so it is left out of the heap figures (it is printed once, at the start),
+ * leaving what the trees use. The RSS includes whatever of it is resident.
+ * At the end, a straight line is fitted to each of RSS, heap held, and
+ * median latency, leaving out the first quarter of the run as warm up, and
+ * the benchmark fails if any of them grows by more than the allowed amount
+ * over the rest of the run.
+ *
+ *   -d seconds   how long to run for (default: 3600)
+ *   -i interval  seconds between samples (default: 60)
+ *   -l live      number of trees kept alive at once (default: 64)
+ *   -s seed      random seed (default: 1)
+ *
+ * Linux/glibc only (RSS comes from /proc, heap statistics from mallinfo2).
+ *
+ * Paul McCarthy <paul.mccarthy@gmail.com>
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <malloc.h>
+
+#include "lilx.h"
+
+/**
+ * Number of messages in the pool.
+ */
+#define POOL_SIZE 256
+
+/**
+ * Largest message which is generated.
+ */
+#define MAX_MESSAGE 65536
+
+/**
+ * Maximum number of parse latencies which are kept per interval - beyond
+ * this, latencies are sampled.
+ */
+#define MAX_LATENCIES 65536
+
+/**
+ * Maximum number of samples (intervals) in a run.
+ */
+#define MAX_SAMPLES 4096
+
+/**
+ * Growth allowed in RSS and in heap held over the measured part of the run,
+ * as a fraction of the mean, and in kB - both must be exceeded to fail, so
+ * that tiny heaps don't fail on a page or two.
+ */
+#define MAX_MEM_GROWTH    0.05
+#define MAX_MEM_GROWTH_KB 1024
+
+/**
+ * Growth allowed in median latency over the measured part of the run, as a
+ * fraction of the mean.
+ */
+#define MAX_LAT_GROWTH 0.10
+
+/**
+ * One message in the pool.
+ */
+typedef struct __message {
+
+  char     *data; /**< the message, nul terminated */
+  uint32_t  len;  /**< its length                  */
+} message_t;
+
+/**
+ * Everything recorded at the end of one interval.
+ */
+typedef struct __sample {
+
+  double   t;      /**< seconds since the start                   */
+  long     rss;    /**< resident set size, kB                     */
+  long     used;   /**< heap bytes in use, kB                     */
+  long     held;   /**< heap bytes held by the allocator, kB      */
+  double   median; /**< median parse latency, ns                  */
+  double   p99;    /**< 99th percentile parse latency, ns         */
+} sample_t;
+
+static message_t pool[POOL_SIZE];
+static double    latencies[MAX_LATENCIES];
+static sample_t  samples[MAX_SAMPLES];
+static uint64_t  rng;
+
+static double now(void) {
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Returns the resident set size of this process in kB, or 0 if it can't
+ * be read.
+ */
+static long rss_kb(void) {
+
+  char line[256];
+  long kb = 0;
+  FILE *f = fopen("/proc/self/status", "r");
+
+  if (f == NULL) return 0;
+
+  while (fgets(line, sizeof(line), f) != NULL)
+    if (sscanf(line, "VmRSS: %ld", &kb) == 1) break;
+
+  fclose(f);
+  return kb;
+}
+
+/**
+ * xorshift64* - deterministic for a given seed, unlike rand().
+ */
+static uint32_t rand32(void) {
+
+  rng ^= rng >> 12;
+  rng ^= rng << 25;
+  rng ^= rng >> 27;
+  return (uint32_t)((rng * 2685821657736338717ull) >> 32);
+}
+
+/**
+ * Returns a random number in [lo, hi].
+ */
+static uint32_t between(uint32_t lo, uint32_t hi) {
+
+  return lo + rand32() % (hi - lo + 1);
+}
+
+/**
+ * Appends formatted text to a message being generated, unless it would
+ * overflow.
+ */
+static void put(message_t *m, const char *fmt, ...)
+  __attribute__((format(printf, 2, 3)));
+
+static void put(message_t *m, const char *fmt, ...) {
+
+  va_list ap;
+  int n;
+
+  va_start(ap, fmt);
+  n = vsnprintf(m->data + m->len, MAX_MESSAGE - m->len, fmt, ap);
+  va_end(ap);
+
+  if (n > 0 && m->len + n < MAX_MESSAGE) m->len += n;
+  else                                   m->data[m->len] = '\0';
+}
+
+/**
+ * Appends a random run of text.
+ */
+static void put_text(message_t *m, uint32_t len) {
+
+  uint32_t i;
+
+  if (m->len + len >= MAX_MESSAGE) return;
+
+  for (i = 0; i < len; i++)
+    m->data[m->len++] = (i % 7 == 6) ? ' ' : 'a' + rand32() % 26;
+
+  m->data[m->len] = '\0';
+}
+
+/**
+ * Generates a message of the given kind.
+ */
+static void generate(message_t *m, int kind) {
+
+  uint32_t i, j, n;
+
+  m->len     = 0;
+  m->data[0] = '\0';
+
+  switch (kind) {
+
+    /*small status message - the bulk of the traffic*/
+    case 0:
+      put(m, "<status id=\"%u\"><uptime>%u</uptime>"
+        "<temperature unit=\"C\">%u</temperature><fan speed=\"%u\"/></status>",
+        rand32(), rand32(), between(20, 90), between(1000, 3000));
+      break;
+
+    /*wide list - lots of siblings, so the child arrays grow*/
+    case 1:
+      n = between(16, 400);
+      put(m, "<interfaces count=\"%u\">", n);
+      for (i = 0; i < n; i++)
+        put(m, "<interface name=\"eth%u\" state=\"%s\"><rx>%u</rx>"
+          "<tx>%u</tx></interface>", i, (i & 1) ? "up" : "down",
+          rand32(), rand32());
+      put(m, "</interfaces>");
+      break;
+
+    /*deep nesting*/
+    case 2:
+      n = between(8, LILX_STACK_SIZE / 2);
+      for (i = 0; i < n; i++) put(m, "<level%u depth=\"%u\">", i % 10, i);
+      put_text(m, between(1, 64));
+      for (i = n; i > 0; i--) put(m, "</level%u>", (i - 1) % 10);
+      break;
+
+    /*lots of attributes*/
+    case 3:
+      n = between(4, 40);
+      put(m, "<config>");
+      for (i = 0; i < n; i++) {
+        put(m, "<option");
+        for (j = between(1, 20); j > 0; j--)
+          put(m, " key%u=\"%u\"", j, rand32());
+        put(m, "/>");
+      }
+      put(m, "</config>");
+      break;
+
+    /*long text bodies, of varying size*/
+    default:
+      n = between(1, 32);
+      put(m, "<log>");
+      for (i = 0; i < n; i++) {
+        put(m, "<entry seq=\"%u\">", i);
+        put_text(m, between(1, LILX_MAX_TOKEN_LENGTH - 1));
+        put(m, "</entry>");
+      }
+      put(m, "</log>");
+      break;
+  }
+}
+
+static int cmp_double(const void *a, const void *b) {
+
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * Least squares slope of y against t over the given samples.
+ */
+static double slope(sample_t *s, int n, double (*y)(sample_t *)) {
+
+  double mt = 0, my = 0, num = 0, den = 0;
+  int i;
+
+  for (i = 0; i < n; i++) { mt += s[i].t; my += y(&s[i]); }
+  mt /= n;
+  my /= n;
+
+  for (i = 0; i < n; i++) {
+    num += (s[i].t - mt) * (y(&s[i]) - my);
+    den += (s[i].t - mt) * (s[i].t - mt);
+  }
+
+  return den > 0 ? num / den : 0;
+}
+
+static double mean(sample_t *s, int n, double (*y)(sample_t *)) {
+
+  double m = 0;
+  int i;
+
+  for (i = 0; i < n; i++) m += y(&s[i]);
+  return m / n;
+}
+
+static double y_rss   (sample_t *s) { return s->rss;    }
+static double y_held  (sample_t *s) { return s->held;   }
+static double y_median(sample_t *s) { return s->median; }
+
+/**
+ * Checks that the given statistic doesn't grow by more than the given
+ * fraction of its mean (and, if kb is non-0, by more than kb) over the
+ * given samples.
+ *
+ * \return 0 if it doesn't, 1 if it does.
+ */
+static int check(const char *name, sample_t *s, int n,
+                 double (*y)(sample_t *), double frac, double kb) {
+
+  double m      = mean(s, n, y);
+  double growth = slope(s, n, y) * (s[n - 1].t - s[0].t);
+  int    fail   = growth > frac * m && growth > kb;
+
+  printf("%-15s mean %12.1f, trend %+12.1f over the run (%+.2f%%)%s\n",
+    name, m, growth, m > 0 ? 100 * growth / m : 0, fail ? " - FAIL" : "");
+
+  return fail;
+}
+
+static void usage(char *name) {
+
+  printf("usage: %s [-d seconds] [-i interval] [-l live] [-s seed]\n", name);
+}
+
+int main(int argc, char *argv[]) {
+
+  double     duration = 3600, interval = 60;
+  long       nlive    = 64;
+  double     start, last, t0, t;
+  uint64_t   parses, failed = 0;
+  uint32_t   nlat;
+  int        i, c, nsamples = 0, first, fail = 0;
+  element_t *live;
+  uint8_t   *used;
+  message_t *m;
+  struct mallinfo2 mi;
+  size_t     pool_used;
+
+  rng = 1;
+
+  while ((c = getopt(argc, argv, "d:i:l:s:")) != -1) {
+    switch (c) {
+      case 'd': duration = atof(optarg);               break;
+      case 'i': interval = atof(optarg);               break;
+      case 'l': nlive    = atol(optarg);               break;
+      case 's': rng      = strtoull(optarg, NULL, 10); break;
+      default:  usage(argv[0]); return 1;
+    }
+  }
+
+  if (optind != argc || duration <= 0 || interval <= 0 || nlive <= 0 ||
+      duration / interval > MAX_SAMPLES || rng == 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  live = calloc(nlive, sizeof(element_t));
+  used = calloc(nlive, 1);
+  if (live == NULL || used == NULL) {
+    printf("setup failed\n");
+    return 1;
+  }
+
+  /*two in three messages are small status messages*/
+  for (i = 0; i < POOL_SIZE; i++) {
+
+    pool[i].data = malloc(MAX_MESSAGE);
+    if (pool[i].data == NULL) {
+      printf("setup failed\n");
+      return 1;
+    }
+
+    generate(&pool[i], (i % 3 != 0) ? 0 : between(1, 4));
+  }
+
+  /*everything in use so far is the pool (and the arrays above)*/
+  mi        = mallinfo2();
+  pool_used = mi.uordblks;
+
+  printf("message pool: %lu kB, not counted in used or held\n\n",
+    (unsigned long)(pool_used / 1024));
+  printf("%8s %10s %10s %10s %6s %10s %10s %10s\n", "time", "rss kB",
+    "used kB", "held kB", "free%", "median ns", "p99 ns", "parses/s");
+
+  start  = now();
+  last   = start;
+  parses = 0;
+  nlat   = 0;
+
+  for (;;) {
+
+    /*replace a random live tree*/
+    c = rand32() % nlive;
+    m = &pool[rand32() % POOL_SIZE];
+
+    if (used[c]) lilx_free_tree(&live[c]);
+
+    t0      = now();
+    used[c] = lilx_create_tree(m->data, &live[c]) == 0;
+    t       = now();
+
+    if (!used[c]) failed++;
+
+    /*reservoir sample, once there are too many to keep*/
+    parses++;
+    if (nlat < MAX_LATENCIES)
+      latencies[nlat++] = (t - t0) * 1e9;
+    else if ((c = rand32() % parses) < MAX_LATENCIES)
+      latencies[c] = (t - t0) * 1e9;
+
+    if (t - last < interval) continue;
+
+    qsort(latencies, nlat, sizeof(double), cmp_double);
+    mi = mallinfo2();
+
+    samples[nsamples].t      = t - start;
+    samples[nsamples].rss    = rss_kb();
+    samples[nsamples].used   = (mi.uordblks - pool_used) / 1024;
+    samples[nsamples].held   = (mi.arena + mi.hblkhd - pool_used) / 1024;
+    samples[nsamples].median = latencies[nlat / 2];
+    samples[nsamples].p99    = latencies[nlat * 99 / 100];
+
+    printf("%8.0f %10ld %10ld %10ld %5.1f%% %10.0f %10.0f %10.0f\n",
+      samples[nsamples].t, samples[nsamples].rss, samples[nsamples].used,
+      samples[nsamples].held,
+      mi.arena > pool_used ? 
+        100.0 * mi.fordblks / (mi.arena - pool_used) : 0.0,
+      samples[nsamples].median, samples[nsamples].p99, parses / (t - last));
+    fflush(stdout);
+
+    nsamples++;
+    parses = 0;
+    nlat   = 0;
+    last   = t;
+
+    if (t - start >= duration || nsamples == MAX_SAMPLES) break;
+  }
+
+  for (i = 0; i < nlive; i++) if (used[i]) lilx_free_tree(&live[i]);
+  for (i = 0; i < POOL_SIZE; i++) free(pool[i].data);
+  free(live);
+  free(used);
+
+  printf("\n");
+
+  if (failed > 0) {
+    printf("%llu parses failed\n", (unsigned long long)failed);
+    fail = 1;
+  }
+
+  /*the first quarter is warm up - the heap fills up to its working size*/
+  first = nsamples / 4;
+  if (nsamples - first < 3) {
+    printf("too few samples to look for trends - run for longer\n");
+    return fail;
+  }
+
+  fail |= check("rss kB",       samples + first, nsamples - first, &y_rss,
+                MAX_MEM_GROWTH, MAX_MEM_GROWTH_KB);
+  fail |= check("heap held kB", samples + first, nsamples - first, &y_held,
+                MAX_MEM_GROWTH, MAX_MEM_GROWTH_KB);
+  fail |= check("median ns",    samples + first, nsamples - first, &y_median,
+                MAX_LAT_GROWTH, 0);
+
+  return fail;
+}
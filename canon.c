@@ -0,0 +1,300 @@
+/**
+ * Streaming canonicalisation for lilx.
+ *
+ * The parser's event handler writes the canonical form out as elements are
+ * opened and closed. A start tag can only be written once all of its
+ * attributes have been parsed, which is certain by the time of the next
+ * event, and the text of an element is written a segment at a time, as
+ * each child is opened, and when the element is closed.
+ *
+ * Paul McCarthy <paul.mccarthy@gmail.com>
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lilx.h"
+#include "canon.h"
+
+/*****************************
+ * Private function prototypes
+ ****************************/
+
+/**
+ * Event handler - writes out each element as it is opened and closed, and
+ * then drops it.
+ */
+static uint8_t __canon_handler(
+  parser_t  *parser, /**< the parser              */
+  uint8_t    event,  /**< the event               */
+  element_t *element /**< the element in question */
+);
+
+/**
+ * Writes out the start tag of the innermost open element, with its
+ * attributes sorted by name.
+ *
+ * \return 0 on success, non-0 if the output function failed.
+ */
+static uint8_t __canon_start_tag(
+  canon_t *canon /**< the canonicaliser */
+);
+
+/**
+ * Writes out the text segments of the innermost open element which have
+ * not been written yet.
+ *
+ * \return 0 on success, non-0 if the output function failed.
+ */
+static uint8_t __canon_text(
+  canon_t *canon /**< the canonicaliser */
+);
+
+/**
+ * Writes the given data to the output buffer, passing the buffer to the
+ * output function whenever it fills up.
+ *
+ * \return 0 on success, non-0 if the output function failed.
+ */
+static uint8_t __canon_emit(
+  canon_t  *canon, /**< the canonicaliser   */
+  char     *data,  /**< the data            */
+  uint32_t  len    /**< length of the data  */
+);
+
+/**
+ * Passes the output buffer to the output function.
+ *
+ * \return 0 on success, non-0 if the output function failed.
+ */
+static uint8_t __canon_flush(
+  canon_t *canon /**< the canonicaliser */
+);
+
+/****************************
+ * Public interface functions
+ ***************************/
+
+uint8_t canon_init(canon_t *canon, canon_write_t write, void *context) {
+
+  if (lilx_parser_init(&canon->parser, &canon->root) != 0) return 1;
+
+  canon->parser.handler = &__canon_handler;
+  canon->parser.context = canon;
+
+  canon->write   = write;
+  canon->context = context;
+  canon->buf     = NULL;
+  canon->len     = 0;
+  canon->cap     = 0;
+  canon->depth   = 0;
+  canon->pending = 0;
+  canon->error   = 0;
+  canon->olen    = 0;
+
+  return 0;
+}
+
+uint8_t canon_feed(canon_t *canon, char *data, uint32_t len, uint8_t final) {
+
+  parser_t *parser = &canon->parser;
+  uint32_t discard;
+  uint8_t result;
+  char *buf;
+
+  /*the parser needs all of the input it hasn't finished with*/
+  if (canon->len + len > canon->cap) {
+
+    buf = (char *)realloc(canon->buf, (canon->len + len) * 2);
+    if (buf == NULL) return LILX_ERROR;
+
+    canon->buf = buf;
+    canon->cap = (canon->len + len) * 2;
+  }
+
+  memcpy(canon->buf + canon->len, data, len);
+  canon->len += len;
+
+  result = lilx_parse(parser, canon->buf, canon->len, final);
+
+  /*the handler only stops the parser if the output function fails*/
+  if (result == LILX_ERROR || result == LILX_LIMIT) return LILX_ERROR;
+  if (result == LILX_STOPPED || canon->error) {
+    lilx_free_tree(&canon->root);
+    return LILX_ERROR;
+  }
+
+  if (result == LILX_OK) {
+    result = __canon_flush(canon);
+    lilx_free_tree(&canon->root);
+    return result ? LILX_ERROR : LILX_OK;
+  }
+
+  /*all of the output so far has been written, so
+    only the current token needs to be kept*/
+  discard = lilx_parser_discard(parser);
+
+  memmove(canon->buf, canon->buf + discard, canon->len - discard);
+  canon->len -= discard;
+
+  return LILX_MORE;
+}
+
+void canon_free(canon_t *canon) {
+
+  free(canon->buf);
+  canon->buf = NULL;
+  canon->len = 0;
+  canon->cap = 0;
+}
+
+void canon_hash_init(canon_hash_t *hash) {
+
+  hash->hash = 14695981039346656037ull;
+}
+
+uint8_t canon_hash_write(void *context, char *data, uint32_t len) {
+
+  canon_hash_t *hash = (canon_hash_t *)context;
+  uint64_t      h    = hash->hash;
+  uint32_t      i;
+
+  for (i = 0; i < len; i++) {
+    h ^= (uint8_t)data[i];
+    h *= 1099511628211ull;
+  }
+
+  hash->hash = h;
+  return 0;
+}
+
+/*******************
+ * Private functions
+ ******************/
+
+uint8_t __canon_handler(parser_t *parser, uint8_t event, element_t *element) {
+
+  canon_t *canon = (canon_t *)parser->context;
+
+  /*the innermost start tag must be complete by now*/
+  if (canon->pending && __canon_start_tag(canon) != 0) return LILX_STOP;
+
+  if (event == LILX_EVENT_START) {
+
+    /*the text of the parent which precedes this element*/
+    if (canon->depth > 0 && __canon_text(canon) != 0) return LILX_STOP;
+
+    canon->frames[canon->depth].element  = element;
+    canon->frames[canon->depth].segments = 0;
+    canon->depth++;
+    canon->pending = 1;
+
+    return LILX_CONTINUE;
+  }
+
+  /*the rest of the text, and the end tag*/
+  if (__canon_text(canon)                                        != 0 ||
+      __canon_emit(canon, "</", 2)                               != 0 ||
+      __canon_emit(canon, element->name, strlen(element->name)) != 0 ||
+      __canon_emit(canon, ">", 1)                                != 0)
+    return LILX_STOP;
+
+  canon->depth--;
+  return LILX_DROP;
+}
+
+uint8_t __canon_start_tag(canon_t *canon) {
+
+  element_t   *element = canon->frames[canon->depth - 1].element;
+  attribute_t *sorted[UINT8_MAX];
+  attribute_t *attr;
+  char        *value, *quote;
+  uint8_t      i, j;
+
+  canon->pending = 0;
+
+  /*insertion sort - elements don't have many attributes*/
+  for (i = 0; i < element->num_attributes; i++) {
+
+    attr = element->attributes[i];
+
+    for (j = i; j > 0 && strcmp(sorted[j - 1]->name, attr->name) > 0; j--)
+      sorted[j] = sorted[j - 1];
+
+    sorted[j] = attr;
+  }
+
+  if (__canon_emit(canon, "<", 1)                                != 0 ||
+      __canon_emit(canon, element->name, strlen(element->name)) != 0)
+    return 1;
+
+  for (i = 0; i < element->num_attributes; i++) {
+
+    if (__canon_emit(canon, " ", 1)                                    != 0 ||
+        __canon_emit(canon, sorted[i]->name, strlen(sorted[i]->name)) != 0 ||
+        __canon_emit(canon, "=\"", 2)                                  != 0)
+      return 1;
+
+    /*double quotes can only be in the value with LILX_USE_SINGLE_QUOTES*/
+    value = sorted[i]->value;
+    while ((quote = strchr(value, '"')) != NULL) {
+
+      if (__canon_emit(canon, value, quote - value) != 0 ||
+          __canon_emit(canon, "&quot;", 6)          != 0)
+        return 1;
+
+      value = quote + 1;
+    }
+
+    if (__canon_emit(canon, value, strlen(value)) != 0 ||
+        __canon_emit(canon, "\"", 1)              != 0)
+      return 1;
+  }
+
+  return __canon_emit(canon, ">", 1);
+}
+
+uint8_t __canon_text(canon_t *canon) {
+
+  canon_frame_t *frame = &canon->frames[canon->depth - 1];
+  uint16_t       len;
+  char          *text;
+
+  for (; frame->segments < frame->element->num_segments; frame->segments++) {
+
+    text = lilx_get_segment(frame->element, frame->segments, &len, NULL);
+    if (__canon_emit(canon, text, len) != 0) return 1;
+  }
+
+  return 0;
+}
+
+uint8_t __canon_emit(canon_t *canon, char *data, uint32_t len) {
+
+  /*big pieces bypass the buffer*/
+  if (len > CANON_BUFFER_SIZE - canon->olen) {
+
+    if (__canon_flush(canon) != 0) return 1;
+
+    if (len >= CANON_BUFFER_SIZE) {
+      if (canon->write(canon->context, data, len) != 0) canon->error = 1;
+      return canon->error;
+    }
+  }
+
+  memcpy(canon->out + canon->olen, data, len);
+  canon->olen += len;
+
+  return 0;
+}
+
+uint8_t __canon_flush(canon_t *canon) {
+
+  if (canon->olen == 0) return 0;
+
+  if (canon->write(canon->context, canon->out, canon->olen) != 0)
+    canon->error = 1;
+
+  canon->olen = 0;
+  return canon->error;
+}
@@ -0,0 +1,146 @@
+/**
+ * Streaming canonicalisation for lilx. A canonicaliser takes XML in pieces,
+ * and writes out a canonical form of it as it goes, without building a
+ * tree - each element is dropped as soon as it has been closed. Two
+ * documents which differ only in layout have the same canonical form, so
+ * it can be hashed or signed. In the canonical form:
+ *
+ *   - there is no whitespace in tags, apart from a single space before
+ *     each attribute
+ *   - attributes are sorted by name (strcmp order)
+ *   - attribute values are in double quotes, with any double quotes in the
+ *     value written as &quot;
+ *   - self closing elements are written as a start tag and an end tag
+ *   - comments, and whitespace between elements, are left out
+ *   - text is written as it appears in the input, minus leading and
+ *     trailing whitespace (entities are not expanded)
+ *
+ * The output goes to a function, e.g. canon_hash_write, which feeds it to a
+ * 64 bit FNV-1a hash.
+ *
+ * Paul McCarthy <paul.mccarthy@gmail.com>
+ */
+#ifndef __CANON_H__
+#define __CANON_H__
+
+#include <stdint.h>
+
+#include "lilx.h"
+
+/**
+ * Size of the output buffer - output is passed to the output function in
+ * pieces of at most this size.
+ */
+#define CANON_BUFFER_SIZE 4096
+
+/*******
+ * Types
+ ******/
+
+/**
+ * Called with each piece of output.
+ *
+ * \return 0 on success, non-0 on failure, which stops the canonicaliser.
+ */
+typedef uint8_t (*canon_write_t)(
+  void     *context, /**< the context given to canon_init */
+  char     *data,    /**< the output                      */
+  uint32_t  len      /**< length of the output            */
+);
+
+/**
+ * State for one open element.
+ */
+typedef struct __canon_frame {
+
+  element_t *element;  /**< the element                              */
+  uint16_t   segments; /**< number of its text segments written out  */
+} canon_frame_t;
+
+/**
+ * Canonicaliser state. The fields should never be accessed directly. A
+ * canonicaliser must not be moved once it has been initialised.
+ */
+typedef struct __canon {
+
+  parser_t       parser;  /**< the parser                               */
+  element_t      root;    /**< root of the (mostly empty) tree          */
+  canon_write_t  write;   /**< output function                          */
+  void          *context; /**< passed to write                          */
+  char          *buf;     /**< input which is still needed             */
+  uint32_t       len;     /**< length of buf                            */
+  uint32_t       cap;     /**< capacity of buf                          */
+  uint8_t        depth;   /**< number of open elements                  */
+  uint8_t        pending; /**< non-0 if the innermost start tag has not
+                               been written out yet                     */
+  uint8_t        error;   /**< non-0 if the output function failed      */
+  uint16_t       olen;    /**< length of the output in out              */
+
+  /** output which has not been passed to the output function yet */
+  char out[CANON_BUFFER_SIZE];
+
+  /** the open elements */
+  canon_frame_t frames[LILX_STACK_SIZE];
+} canon_t;
+
+/**
+ * Incremental hash, for use with canon_hash_write.
+ */
+typedef struct __canon_hash {
+
+  uint64_t hash; /**< the hash of the output so far */
+} canon_hash_t;
+
+/**
+ * Initialises a canonicaliser.
+ *
+ * \return 0 on success, non-0 on failure.
+ */
+uint8_t canon_init(
+  canon_t       *canon,  /**< the canonicaliser to initialise   */
+  canon_write_t  write,  /**< output function                   */
+  void          *context /**< passed to the output function     */
+);
+
+/**
+ * Passes the next piece of input through the canonicaliser. Set \p final
+ * with the last piece of input.
+ *
+ * \return LILX_OK once the whole document has been written out, LILX_MORE
+ * if more input is needed, or LILX_ERROR if the input is not valid XML, or
+ * the output function failed.
+ */
+uint8_t canon_feed(
+  canon_t  *canon, /**< the canonicaliser                         */
+  char     *data,  /**< the next piece of input                   */
+  uint32_t  len,   /**< length of the input                       */
+  uint8_t   final  /**< non-0 if there is no more input to come   */
+);
+
+/**
+ * Frees the memory that has been allocated for the given canonicaliser.
+ */
+void canon_free(
+  canon_t *canon /**< the canonicaliser */
+);
+
+/**
+ * Initialises a hash.
+ */
+void canon_hash_init(
+  canon_hash_t *hash /**< the hash */
+);
+
+/**
+ * Output function which adds the output to a hash - pass a canon_hash_t as
+ * the context.
+ *
+ * \return 0.
+ */
+uint8_t canon_hash_write(
+  void     *context, /**< a canon_hash_t   */
+  char     *data,    /**< the output       */
+  uint32_t  len      /**< its length       */
+);
+
+#endif /* __CANON_H__ */
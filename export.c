@@ -0,0 +1,552 @@
+/**
+ * Parallel export of large trees as XML.
+ *
+ * The tree is planned first, on the calling thread: a walk which lists the
+ * units in document order, collapsing the units of any subtree which turns
+ * out to be small enough into a single unit as the walk leaves it. The list
+ * is then cut into runs of roughly equal weight (number of elements), a few
+ * per thread. Workers take the runs in order, and the calling thread passes
+ * each run's buffer on once it and all of the runs before it are ready.
+ * Workers don't get more than a few runs ahead of the output, so the
+ * buffers don't grow to the size of the whole document when the output is
+ * slow.
+ *
+ * Paul McCarthy <paul.mccarthy@gmail.com>
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#include "lilx.h"
+#include "export.h"
+
+/**
+ * Number of runs per thread - more runs balance the load better, at the
+ * cost of more hand-offs.
+ */
+#define EXPORT_RUNS_PER_THREAD 4
+
+/**
+ * Maximum number of buffers passed to one writev call.
+ */
+#define EXPORT_MAX_IOV 64
+
+/**
+ * State of a run.
+ */
+#define EXPORT_PENDING 0 /**< not yet written                */
+#define EXPORT_READY   1 /**< written into its buffer        */
+#define EXPORT_FAILED  2 /**< couldn't be written (malloc)   */
+
+/**
+ * A unit - a part of an element (see lilx_serialise_part), at a depth.
+ */
+typedef struct __export_unit {
+
+  element_t *element; /**< the element                          */
+  uint32_t   weight;  /**< number of elements which it writes,
+                           at least 1                           */
+  uint16_t   child;   /**< the child, for LILX_PART_GAP         */
+  uint16_t   depth;   /**< depth of the element                 */
+  uint8_t    part;    /**< LILX_PART_*                          */
+} export_unit_t;
+
+/**
+ * A run of units, which are written into one buffer.
+ */
+typedef struct __export_run {
+
+  uint32_t first; /**< index of the first unit          */
+  uint32_t last;  /**< index after the last unit        */
+  char    *data;  /**< the buffer                       */
+  uint32_t len;   /**< number of bytes in the buffer    */
+  uint32_t cap;   /**< capacity of the buffer           */
+  uint8_t  state; /**< EXPORT_PENDING, READY or FAILED  */
+} export_run_t;
+
+/**
+ * State shared by the calling thread and the workers.
+ */
+typedef struct __export {
+
+  export_options_t *options;   /**< the options                         */
+  export_unit_t    *units;     /**< the units, in document order        */
+  uint32_t          num_units; /**< number of units                     */
+  uint32_t          cap_units; /**< capacity of units                   */
+  export_run_t     *runs;      /**< the runs, in document order         */
+  uint32_t          num_runs;  /**< number of runs                      */
+  uint32_t          taken;     /**< number of runs taken by workers     */
+  uint32_t          written;   /**< number of runs passed on            */
+  uint32_t          window;    /**< how far workers may get ahead       */
+  uint8_t           stop;      /**< non-0 if the output has failed      */
+  pthread_mutex_t   lock;      /**< protects taken, written, stop and
+                                    the state of each run               */
+  pthread_cond_t    ready;     /**< signalled when a run is ready       */
+  pthread_cond_t    passed;    /**< signalled when runs are passed on,
+                                    and when stop is set                */
+} export_t;
+
+/*****************************
+ * Private function prototypes
+ ****************************/
+
+/**
+ * Counts the elements in a subtree, stopping once there are \p limit.
+ *
+ * \return the number of elements, or \p limit, whichever is smaller.
+ */
+static uint32_t __export_count(
+  element_t *element, /**< root of the subtree     */
+  uint32_t   limit    /**< when to stop counting   */
+);
+
+/**
+ * Adds a unit to the end of the list.
+ *
+ * \return 0 on success, non-0 on malloc failure.
+ */
+static uint8_t __export_add(
+  export_t  *export,  /**< the export              */
+  element_t *element, /**< the element             */
+  uint8_t    part,    /**< LILX_PART_*             */
+  uint16_t   child,   /**< the child, for GAP      */
+  uint16_t   depth,   /**< depth of the element    */
+  uint32_t   weight   /**< weight of the unit      */
+);
+
+/**
+ * Lists the units of the given subtree.
+ *
+ * \return the number of elements in the subtree, or 0 on malloc failure.
+ */
+static uint32_t __export_plan(
+  export_t  *export,  /**< the export              */
+  element_t *element, /**< root of the subtree     */
+  uint16_t   depth    /**< depth of the element    */
+);
+
+/**
+ * Cuts the units into runs.
+ *
+ * \return 0 on success, non-0 on malloc failure.
+ */
+static uint8_t __export_cut(
+  export_t *export, /**< the export                     */
+  uint64_t  weight  /**< total weight of all the units  */
+);
+
+/**
+ * lilx_write_t which appends to the buffer of a run.
+ */
+static uint8_t __export_append(
+  void     *context, /**< the run                */
+  char     *data,    /**< the output             */
+  uint32_t  len      /**< length of the output   */
+);
+
+/**
+ * lilx_write_t which writes to a file descriptor, given a pointer to it.
+ */
+static uint8_t __export_write_fd(
+  void     *context, /**< the file descriptor    */
+  char     *data,    /**< the output             */
+  uint32_t  len      /**< length of the output   */
+);
+
+/**
+ * Writes all of the given buffers, carrying on after a short write.
+ *
+ * \return 0 on success, non-0 if a write failed.
+ */
+static uint8_t __export_writev(
+  int           fd,  /**< the file descriptor    */
+  struct iovec *iov, /**< the buffers            */
+  int           n    /**< number of buffers      */
+);
+
+/**
+ * Plans the export, starts the workers, and passes the runs on as they
+ * become ready, either to the output function, or (if it is NULL) to the
+ * file descriptor.
+ *
+ * \return 0 on success, non-0 on failure.
+ */
+static uint8_t __export(
+  element_t        *element, /**< the element to write out      */
+  export_options_t *options, /**< options                        */
+  lilx_write_t      write,   /**< output function, or NULL       */
+  void             *context, /**< passed to the output function  */
+  int               fd       /**< file descriptor, if no write   */
+);
+
+/**
+ * Worker thread - writes runs into their buffers.
+ */
+static void * __export_worker(
+  void *arg /**< the export */
+);
+
+/****************************
+ * Public interface functions
+ ***************************/
+
+void export_defaults(export_options_t *options) {
+
+  long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+  options->nthreads     = (ncpus < 1) ? 1 : (ncpus > 255) ? 255 : ncpus;
+  options->indent       = 0;
+  options->unit_size    = EXPORT_UNIT_SIZE;
+  options->min_elements = EXPORT_MIN_ELEMENTS;
+}
+
+uint8_t export_tree(element_t *element, export_options_t *options,
+lilx_write_t write, void *context) {
+
+  if (options->nthreads <= 1 ||
+      __export_count(element, options->min_elements) < options->min_elements)
+    return lilx_serialise(element, options->indent, write, context);
+
+  return __export(element, options, write, context, -1);
+}
+
+uint8_t export_fd(element_t *element, export_options_t *options, int fd) {
+
+  if (options->nthreads <= 1 ||
+      __export_count(element, options->min_elements) < options->min_elements)
+    return lilx_serialise(element, options->indent, &__export_write_fd, &fd);
+
+  return __export(element, options, NULL, NULL, fd);
+}
+
+/*******************
+ * Private functions
+ ******************/
+
+uint32_t __export_count(element_t *element, uint32_t limit) {
+
+  uint32_t count = 1;
+  uint16_t i;
+
+  for (i = 0; i < element->num_children && count < limit; i++)
+    count += __export_count(element->children[i], limit - count);
+
+  return (count < limit) ? count : limit;
+}
+
+uint8_t __export_add(export_t *export, element_t *element, uint8_t part,
+uint16_t child, uint16_t depth, uint32_t weight) {
+
+  export_unit_t *units;
+  export_unit_t *unit;
+
+  if (export->num_units == export->cap_units) {
+
+    units = (export_unit_t *)realloc(export->units,
+      (export->cap_units ? export->cap_units * 2 : 256) *
+      sizeof(export_unit_t));
+    if (units == NULL) return 1;
+
+    export->units     = units;
+    export->cap_units = export->cap_units ? export->cap_units * 2 : 256;
+  }
+
+  unit          = &export->units[export->num_units++];
+  unit->element = element;
+  unit->weight  = weight;
+  unit->child   = child;
+  unit->depth   = depth;
+  unit->part    = part;
+
+  return 0;
+}
+
+uint32_t __export_plan(export_t *export, element_t *element, uint16_t depth) {
+
+  uint32_t start = export->num_units;
+  uint32_t count = 1, n;
+  uint16_t i;
+  uint8_t  gaps  = export->options->indent != 0 || element->num_segments > 0;
+
+  if (element->num_children > 0) {
+
+    if (__export_add(export, element, LILX_PART_START, 0, depth, 1) != 0)
+      return 0;
+
+    for (i = 0; i <= element->num_children; i++) {
+
+      /*gaps which would be empty are left out*/
+      if (gaps &&
+          __export_add(export, element, LILX_PART_GAP, i, depth, 1) != 0)
+        return 0;
+
+      if (i == element->num_children) break;
+
+      n = __export_plan(export, element->children[i], depth + 1);
+      if (n == 0) return 0;
+
+      count += n;
+    }
+
+    if (__export_add(export, element, LILX_PART_END, 0, depth, 1) != 0)
+      return 0;
+  }
+
+  /*the whole subtree is small enough to be one unit*/
+  if (count <= export->options->unit_size) {
+    export->num_units = start;
+    if (__export_add(export, element, LILX_PART_ELEMENT, 0, depth, count) != 0)
+      return 0;
+  }
+
+  return count;
+}
+
+uint8_t __export_cut(export_t *export, uint64_t weight) {
+
+  uint64_t      target, sum = 0;
+  uint32_t      i, first = 0, max_runs;
+  export_run_t *run;
+
+  max_runs = export->options->nthreads * EXPORT_RUNS_PER_THREAD;
+  target   = weight / max_runs;
+
+  if (target < export->options->unit_size) target = export->options->unit_size;
+
+  export->runs = (export_run_t *)calloc(max_runs, sizeof(export_run_t));
+  if (export->runs == NULL) return 1;
+
+  for (i = 0; i < export->num_units; i++) {
+
+    sum += export->units[i].weight;
+
+    /*the last run takes whatever is left*/
+    if (i < export->num_units - 1 &&
+        (sum < target || export->num_runs == max_runs - 1))
+      continue;
+
+    run        = &export->runs[export->num_runs++];
+    run->first = first;
+    run->last  = i + 1;
+    first      = i + 1;
+    sum        = 0;
+  }
+
+  return 0;
+}
+
+uint8_t __export_append(void *context, char *data, uint32_t len) {
+
+  export_run_t *run = (export_run_t *)context;
+  uint32_t      cap = run->cap;
+  char         *buf;
+
+  if (run->len + len > cap) {
+
+    if (cap == 0) cap = 65536;
+    while (cap < run->len + len) cap *= 2;
+
+    buf = (char *)realloc(run->data, cap);
+    if (buf == NULL) return 1;
+
+    run->data = buf;
+    run->cap  = cap;
+  }
+
+  memcpy(run->data + run->len, data, len);
+  run->len += len;
+
+  return 0;
+}
+
+uint8_t __export_write_fd(void *context, char *data, uint32_t len) {
+
+  struct iovec iov;
+
+  iov.iov_base = data;
+  iov.iov_len  = len;
+
+  return __export_writev(*(int *)context, &iov, 1);
+}
+
+uint8_t __export_writev(int fd, struct iovec *iov, int n) {
+
+  ssize_t done;
+
+  while (n > 0) {
+
+    done = writev(fd, iov, n);
+
+    if (done < 0) {
+      if (errno == EINTR) continue;
+      return 1;
+    }
+
+    /*skip the buffers which were written, and trim the one which wasn't
+      written in full*/
+    while (n > 0 && (size_t)done >= iov->iov_len) {
+      done -= iov->iov_len;
+      iov++;
+      n--;
+    }
+
+    if (n > 0) {
+      iov->iov_base  = (char *)iov->iov_base + done;
+      iov->iov_len  -= done;
+    }
+  }
+
+  return 0;
+}
+
+uint8_t __export(element_t *element, export_options_t *options,
+lilx_write_t write, void *context, int fd) {
+
+  export_t      export;
+  pthread_t     workers[255];
+  struct iovec  iov[EXPORT_MAX_IOV];
+  export_run_t *run;
+  uint64_t      weight = 0;
+  uint32_t      i, next, end, nworkers = 0;
+  uint8_t       result = 0, failed;
+
+  memset(&export, 0, sizeof(export));
+  export.options = options;
+  export.window  = options->nthreads * EXPORT_RUNS_PER_THREAD / 2;
+
+  if (export.window > EXPORT_MAX_IOV) export.window = EXPORT_MAX_IOV;
+
+  if (__export_plan(&export, element, 0) == 0) {
+    free(export.units);
+    return 1;
+  }
+
+  for (i = 0; i < export.num_units; i++) weight += export.units[i].weight;
+
+  if (__export_cut(&export, weight) != 0) {
+    free(export.units);
+    return 1;
+  }
+
+  pthread_mutex_init(&export.lock,   NULL);
+  pthread_cond_init (&export.ready,  NULL);
+  pthread_cond_init (&export.passed, NULL);
+
+  for (; nworkers < options->nthreads && nworkers < export.num_runs;
+       nworkers++)
+    if (pthread_create(&workers[nworkers], NULL, &__export_worker, &export))
+      break;
+
+  if (nworkers == 0) result = 1;
+
+  /*pass the runs on in order, as many at a time as are ready*/
+  for (next = 0; result == 0 && next < export.num_runs; next = end) {
+
+    pthread_mutex_lock(&export.lock);
+
+    while (export.runs[next].state == EXPORT_PENDING)
+      pthread_cond_wait(&export.ready, &export.lock);
+
+    for (end = next; end < export.num_runs && end - next < EXPORT_MAX_IOV &&
+                     export.runs[end].state == EXPORT_READY; end++);
+
+    failed = export.runs[next].state == EXPORT_FAILED;
+
+    pthread_mutex_unlock(&export.lock);
+
+    if (failed) {
+      result = 1;
+      break;
+    }
+
+    for (i = next; i < end; i++) {
+
+      run = &export.runs[i];
+
+      if (write != NULL) {
+        if (run->len > 0 && write(context, run->data, run->len) != 0)
+          result = 1;
+      }
+      else {
+        iov[i - next].iov_base = run->data;
+        iov[i - next].iov_len  = run->len;
+      }
+    }
+
+    if (write == NULL && __export_writev(fd, iov, end - next) != 0)
+      result = 1;
+
+    for (i = next; i < end; i++) {
+      free(export.runs[i].data);
+      export.runs[i].data = NULL;
+    }
+
+    pthread_mutex_lock(&export.lock);
+    export.written = end;
+    pthread_cond_broadcast(&export.passed);
+    pthread_mutex_unlock(&export.lock);
+  }
+
+  /*the workers give up on the runs which are left*/
+  pthread_mutex_lock(&export.lock);
+  export.stop = 1;
+  pthread_cond_broadcast(&export.passed);
+  pthread_mutex_unlock(&export.lock);
+
+  for (i = 0; i < nworkers; i++) pthread_join(workers[i], NULL);
+
+  pthread_mutex_destroy(&export.lock);
+  pthread_cond_destroy (&export.ready);
+  pthread_cond_destroy (&export.passed);
+
+  for (i = 0; i < export.num_runs; i++) free(export.runs[i].data);
+  free(export.runs);
+  free(export.units);
+
+  return result;
+}
+
+void * __export_worker(void *arg) {
+
+  export_t      *export = (export_t *)arg;
+  export_run_t  *run;
+  export_unit_t *unit;
+  uint32_t       i;
+  uint8_t        result;
+
+  while (1) {
+
+    pthread_mutex_lock(&export->lock);
+
+    /*don't get too far ahead of the output*/
+    while (!export->stop && export->taken < export->num_runs &&
+           export->taken >= export->written + export->window)
+      pthread_cond_wait(&export->passed, &export->lock);
+
+    run = NULL;
+    if (!export->stop && export->taken < export->num_runs)
+      run = &export->runs[export->taken++];
+
+    pthread_mutex_unlock(&export->lock);
+
+    if (run == NULL) break;
+
+    result = 0;
+
+    for (i = run->first; i < run->last && result == 0; i++) {
+      unit   = &export->units[i];
+      result = lilx_serialise_part(unit->element, unit->part, unit->child,
+        export->options->indent, unit->depth, &__export_append, run);
+    }
+
+    pthread_mutex_lock(&export->lock);
+    run->state = (result == 0) ? EXPORT_READY : EXPORT_FAILED;
+    pthread_cond_broadcast(&export->ready);
+    pthread_mutex_unlock(&export->lock);
+  }
+
+  return NULL;
+}
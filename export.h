@@ -0,0 +1,84 @@
+/**
+ * Parallel export of large trees as XML. The tree is split into units - a
+ * unit is a subtree of no more than a given number of elements, or the
+ * start tag, end tag, or a gap between the children, of an element which
+ * is too big to be one unit (see lilx_serialise_part). Each unit knows its
+ * depth, so it is indented just as it would be if the whole tree were
+ * written in one go. Runs of units are written by a pool of threads, each
+ * into a buffer of its own, and the buffers are passed on in order as soon
+ * as each is ready, so the output is the same as that of lilx_serialise.
+ *
+ * Small trees aren't worth the threads, and are written by lilx_serialise.
+ *
+ * Paul McCarthy <paul.mccarthy@gmail.com>
+ */
+#ifndef __EXPORT_H__
+#define __EXPORT_H__
+
+#include <stdint.h>
+
+#include "lilx.h"
+
+/**
+ * Default maximum number of elements in a unit.
+ */
+#define EXPORT_UNIT_SIZE 4096
+
+/**
+ * Default number of elements below which a tree is written sequentially.
+ */
+#define EXPORT_MIN_ELEMENTS 65536
+
+/*******
+ * Types
+ ******/
+
+/**
+ * Export options - initialise with export_defaults.
+ */
+typedef struct __export_options {
+
+  uint8_t  nthreads;     /**< number of threads                        */
+  uint8_t  indent;       /**< spaces per level, 0 for none             */
+  uint32_t unit_size;    /**< maximum number of elements in a unit     */
+  uint32_t min_elements; /**< trees with fewer elements are written
+                              sequentially                             */
+} export_options_t;
+
+/**
+ * Sets the given options to the defaults - one thread per CPU, no
+ * indentation, EXPORT_UNIT_SIZE and EXPORT_MIN_ELEMENTS.
+ */
+void export_defaults(
+  export_options_t *options /**< the options */
+);
+
+/**
+ * Writes the given element, and everything below it, out as XML, exactly as
+ * lilx_serialise would. The output function is only ever called from the
+ * calling thread, in order. The tree must not be changed until this returns.
+ *
+ * \return 0 on success, non-0 if the output function failed, or the threads
+ * or buffers couldn't be set up.
+ */
+uint8_t export_tree(
+  element_t        *element, /**< the element to write out      */
+  export_options_t *options, /**< options                        */
+  lilx_write_t      write,   /**< output function                */
+  void             *context  /**< passed to the output function  */
+);
+
+/**
+ * Writes the given element out as XML to a file descriptor. Each run of
+ * buffers which are ready is handed to the kernel in one writev call.
+ *
+ * \return 0 on success, non-0 if a write failed, or the threads or buffers
+ * couldn't be set up.
+ */
+uint8_t export_fd(
+  element_t        *element, /**< the element to write out  */
+  export_options_t *options, /**< options                    */
+  int               fd       /**< the file descriptor        */
+);
+
+#endif /* __EXPORT_H__ */
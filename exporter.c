@@ -0,0 +1,105 @@
+/**
+ * lilxexport - parses an XML file, and writes it back out, in parallel -
+ * see export.h. The time taken to write it out is printed to stderr.
+ *
+ * usage: lilxexport [-j threads] [-i indent] [-u unit] [-s] file
+ *
+ *   -j threads  number of threads (default: number of CPUs)
+ *   -i indent   spaces per level (default: 0, no indentation)
+ *   -u unit     maximum number of elements per unit (default: 4096)
+ *   -s          write the file out sequentially, for comparison
+ *
+ * Paul McCarthy <paul.mccarthy@gmail.com>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "lilx.h"
+#include "export.h"
+
+static double now(void) {
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(void) {
+  printf("usage: lilxexport [-j threads] [-i indent] [-u unit] [-s] file\n");
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+
+  export_options_t options;
+  parser_t  parser;
+  element_t root;
+  FILE     *f;
+  char     *xml;
+  long      len, nthreads = -1, indent = 0, unit = EXPORT_UNIT_SIZE;
+  uint16_t  i;
+  uint8_t   result = 0;
+  double    start;
+  int       opt;
+
+  export_defaults(&options);
+
+  while ((opt = getopt(argc, argv, "j:i:u:s")) != -1) {
+    switch (opt) {
+      case 'j': nthreads = atol(optarg); break;
+      case 'i': indent   = atol(optarg); break;
+      case 'u': unit     = atol(optarg); break;
+      case 's': nthreads = 1;            break;
+      default:  usage();
+    }
+  }
+
+  if (argc - optind != 1 || nthreads == 0 || nthreads > 255 || indent < 0 ||
+      indent > 255 || unit < 1)
+    usage();
+
+  if (nthreads > 0) options.nthreads = nthreads;
+  options.indent    = indent;
+  options.unit_size = unit;
+
+  f = fopen(argv[optind], "rb");
+  if (f == NULL) {
+    perror(argv[optind]);
+    return 1;
+  }
+
+  fseek(f, 0, SEEK_END);
+  len = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  xml = (char *)malloc(len + 1);
+  if (xml == NULL || fread(xml, 1, len, f) != (size_t)len) {
+    fprintf(stderr, "lilxexport: couldn't read %s\n", argv[optind]);
+    return 1;
+  }
+  fclose(f);
+
+  if (lilx_parser_init(&parser, &root)          != 0 ||
+      lilx_parse(&parser, xml, len, 1) != LILX_OK) {
+    fprintf(stderr, "lilxexport: couldn't parse %s\n", argv[optind]);
+    return 1;
+  }
+
+  start = now();
+
+  /*the root is lilx's own - its children are the document*/
+  for (i = 0; i < root.num_children && result == 0; i++)
+    result = export_fd(root.children[i], &options, STDOUT_FILENO);
+
+  if (result == 0 && write(STDOUT_FILENO, "\n", 1) != 1) result = 1;
+
+  fprintf(stderr, "exported in %.3f s\n", now() - start);
+
+  lilx_free_tree(&root);
+  free(xml);
+
+  return result;
+}
@@ -0,0 +1,452 @@
+/**
+ * Streaming rewrite filter for lilx.
+ *
+ * The filter works in terms of offsets into the input. Output is written by
+ * copying input from the offset up to which output is done (copied) to some
+ * later offset, or by writing replacement text and then moving copied past
+ * the input which it replaces. The parser's event handler does the work:
+ *
+ *   - a start tag which needs rewriting can only be rewritten once it is
+ *     complete, which is certain by the time of the next event
+ *   - a dropped subtree is skipped by moving copied from the start of the
+ *     element to the end of it
+ *   - replaced content is skipped by moving copied from the end of the
+ *     start tag to the start of the end tag
+ *
+ * Paul McCarthy <paul.mccarthy@gmail.com>
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "lilx.h"
+#include "filter.h"
+
+/**
+ * Attribute values are quoted with the same character as in lilx.c.
+ */
+#if LILX_USE_SINGLE_QUOTES == 0
+#define FILTER_QUOTE '"'
+#else
+#define FILTER_QUOTE '\''
+#endif
+
+/*****************************
+ * Private function prototypes
+ ****************************/
+
+/**
+ * Event handler - applies the rules to each element as it is opened and
+ * closed, and then drops it.
+ */
+static uint8_t __filter_handler(
+  parser_t  *parser, /**< the parser              */
+  uint8_t    event,  /**< the event               */
+  element_t *element /**< the element in question */
+);
+
+/**
+ * Rewrites the start tag of the innermost open element, which must be
+ * complete.
+ *
+ * \return 0 on success, non-0 if the output function failed.
+ */
+static uint8_t __filter_start_tag(
+  filter_t *filter /**< the filter */
+);
+
+/**
+ * Finds the first rule of the given type which matches the given element
+ * and (unless it is NULL) attribute.
+ *
+ * \return the rule, or NULL if no rule matches.
+ */
+static filter_rule_t * __filter_find_rule(
+  filter_t *filter,  /**< the filter                           */
+  uint8_t   type,    /**< the rule type                        */
+  char     *element, /**< '\0' terminated element name         */
+  char     *attr,    /**< attribute name, or NULL              */
+  uint16_t  len      /**< length of the attribute name         */
+);
+
+/**
+ * Copies the input from filter->copied up to the given offset to the
+ * output.
+ *
+ * \return 0 on success, non-0 if the output function failed.
+ */
+static uint8_t __filter_flush(
+  filter_t *filter, /**< the filter                    */
+  uint32_t  offset  /**< input offset to copy up to    */
+);
+
+/**
+ * Writes the given data to the output.
+ *
+ * \return 0 on success, non-0 if the output function failed.
+ */
+static uint8_t __filter_emit(
+  filter_t *filter, /**< the filter          */
+  char     *data,   /**< the data            */
+  uint32_t  len     /**< length of the data  */
+);
+
+/**
+ * \return a pointer to the given input offset in the filter's buffer.
+ */
+static char * __filter_input(
+  filter_t *filter, /**< the filter       */
+  uint32_t  offset  /**< an input offset  */
+);
+
+/****************************
+ * Public interface functions
+ ***************************/
+
+uint8_t filter_init(filter_t *filter, filter_rule_t *rules,
+uint16_t num_rules, filter_write_t write, void *context) {
+
+  if (lilx_parser_init(&filter->parser, &filter->root) != 0) return 1;
+
+  filter->parser.handler = &__filter_handler;
+  filter->parser.context = filter;
+
+  filter->rules     = rules;
+  filter->num_rules = num_rules;
+  filter->write     = write;
+  filter->context   = context;
+  filter->buf       = NULL;
+  filter->len       = 0;
+  filter->cap       = 0;
+  filter->copied    = 0;
+  filter->depth     = 0;
+  filter->pending   = 0;
+  filter->dropping  = 0;
+  filter->error     = 0;
+
+  return 0;
+}
+
+uint8_t filter_feed(filter_t *filter, char *data, uint32_t len, uint8_t final) {
+
+  parser_t *parser = &filter->parser;
+  uint32_t limit, keep, discard;
+  uint8_t result;
+  char *buf;
+
+  /*the parser needs all of the input it hasn't finished with*/
+  if (filter->len + len > filter->cap) {
+
+    buf = (char *)realloc(filter->buf, (filter->len + len) * 2);
+    if (buf == NULL) return LILX_ERROR;
+
+    filter->buf = buf;
+    filter->cap = (filter->len + len) * 2;
+  }
+
+  memcpy(filter->buf + filter->len, data, len);
+  filter->len += len;
+
+  result = lilx_parse(parser, filter->buf, filter->len, final);
+
+  /*the handler only stops the parser if the output function fails*/
+  if (result == LILX_ERROR || result == LILX_LIMIT) return LILX_ERROR;
+  if (result == LILX_STOPPED || filter->error) {
+    lilx_free_tree(&filter->root);
+    return LILX_ERROR;
+  }
+
+  if (result == LILX_OK) {
+    result = __filter_flush(filter, parser->base + filter->len);
+    lilx_free_tree(&filter->root);
+    return result ? LILX_ERROR : LILX_OK;
+  }
+
+  /*write out everything up to the current token (apart from the '<' or
+    '</' which starts it), unless it is in a start tag which may need
+    rewriting, or it is being dropped*/
+  limit = parser->base + parser->tkn;
+
+  if (limit > parser->base && *__filter_input(filter, limit - 1) == '/')
+    limit--;
+  if (limit > parser->base && *__filter_input(filter, limit - 1) == '<')
+    limit--;
+  if (filter->pending && filter->frames[filter->depth - 1].start < limit)
+    limit = filter->frames[filter->depth - 1].start;
+
+  if (filter->dropping) keep = limit;
+  else {
+
+    if (limit > filter->copied && __filter_flush(filter, limit) != 0) {
+      lilx_free_tree(&filter->root);
+      return LILX_ERROR;
+    }
+
+    keep = filter->copied;
+  }
+
+  /*and then throw away what is no longer needed*/
+  discard = lilx_parser_discard_before(parser, keep);
+
+  memmove(filter->buf, filter->buf + discard, filter->len - discard);
+  filter->len -= discard;
+
+  return LILX_MORE;
+}
+
+void filter_free(filter_t *filter) {
+
+  free(filter->buf);
+  filter->buf = NULL;
+  filter->len = 0;
+  filter->cap = 0;
+}
+
+/*******************
+ * Private functions
+ ******************/
+
+uint8_t __filter_handler(parser_t *parser, uint8_t event, element_t *element) {
+
+  filter_t       *filter = (filter_t *)parser->context;
+  filter_frame_t *frame;
+  filter_rule_t  *rule;
+  uint32_t        offset = parser->base + parser->tkn;
+  char           *end;
+  uint16_t        i;
+
+  /*the innermost start tag must be complete by now*/
+  if (filter->pending && __filter_start_tag(filter) != 0) return LILX_STOP;
+
+  if (event == LILX_EVENT_START) {
+
+    filter->depth++;
+    if (filter->dropping) return LILX_CONTINUE;
+
+    /*the element name is preceded by a '<'*/
+    frame           = &filter->frames[filter->depth - 1];
+    frame->start    = offset - 1;
+    frame->name     = element->name;
+    frame->name_len = strlen(element->name);
+    frame->rename   = NULL;
+    frame->content  = NULL;
+    frame->edit     = 0;
+
+    if (__filter_find_rule(
+          filter, FILTER_DROP_SUBTREE, element->name, NULL, 0) != NULL) {
+
+      if (__filter_flush(filter, frame->start) != 0) return LILX_STOP;
+      filter->dropping = filter->depth;
+      return LILX_CONTINUE;
+    }
+
+    for (i = 0; i < filter->num_rules; i++) {
+
+      rule = &filter->rules[i];
+
+      if (strcmp(rule->element, "*")           != 0 &&
+          strcmp(rule->element, element->name) != 0)
+        continue;
+
+      if (rule->type == FILTER_RENAME && frame->rename == NULL) {
+        frame->rename = rule->value;
+        frame->edit   = 1;
+      }
+      else if (rule->type == FILTER_REPLACE_VALUE && rule->attribute == NULL) {
+        if (frame->content == NULL) frame->content = rule;
+        frame->edit = 1;
+      }
+      else if (rule->type == FILTER_REPLACE_VALUE ||
+               rule->type == FILTER_DROP_ATTRIBUTE)
+        frame->edit = 1;
+    }
+
+    filter->pending = frame->edit;
+    return LILX_CONTINUE;
+  }
+
+  /*an element inside a dropped subtree, or replaced content*/
+  if (filter->dropping && filter->depth > filter->dropping) {
+    filter->depth--;
+    return LILX_DROP;
+  }
+
+  frame = &filter->frames[filter->depth - 1];
+
+  if (filter->dropping == filter->depth) {
+
+    filter->dropping = 0;
+
+    /*a dropped subtree - skip to the end of its end
+      tag (or start tag, if it was self closing); the
+      parser has got as far as the end of the last name
+      or attribute value, so the first '>' after that is
+      the one which closes the tag*/
+    if (frame->content == NULL) {
+
+      end = memchr(__filter_input(filter, parser->base + parser->pos), '>',
+                   filter->len - parser->pos);
+      if (end == NULL) return LILX_STOP;
+
+      filter->copied = parser->base + (end - filter->buf) + 1;
+      filter->depth--;
+      return LILX_DROP;
+    }
+
+    /*replaced content - skip to the '</' of the end tag*/
+    filter->copied = offset - 2;
+  }
+
+  /*rename the end tag (unless the element was self closing, in which case
+    the current token is its name, or the value of its last attribute)*/
+  if (frame->rename != NULL                       &&
+      offset >= parser->base + 2                  &&
+      *__filter_input(filter, offset - 1) == '/' &&
+      *__filter_input(filter, offset - 2) == '<') {
+
+    if (__filter_flush(filter, offset)                              != 0 ||
+        __filter_emit(filter, frame->rename, strlen(frame->rename)) != 0)
+      return LILX_STOP;
+
+    filter->copied = offset + frame->name_len;
+  }
+
+  filter->depth--;
+  return LILX_DROP;
+}
+
+uint8_t __filter_start_tag(filter_t *filter) {
+
+  filter_frame_t *frame = &filter->frames[filter->depth - 1];
+  filter_rule_t  *rule;
+  char    *tag, *pos, *ws, *attr, *value, *tail, *name;
+  uint16_t attr_len;
+
+  filter->pending = 0;
+
+  tag  = __filter_input(filter, frame->start);
+  pos  = tag + 1 + frame->name_len;
+  name = (frame->rename != NULL) ? frame->rename : frame->name;
+
+  /*everything up to the '<', and then the (new) name*/
+  if (__filter_flush(filter, frame->start + 1)      != 0 ||
+      __filter_emit(filter, name, strlen(name))     != 0)
+    return 1;
+
+  /*the attributes - each one is written along with
+    the whitespace which precedes it*/
+  while (1) {
+
+    for (ws = pos; isspace(*pos); pos++);
+    if (*pos == '/' || *pos == '>') break;
+
+    for (attr = pos; !isspace(*pos) && *pos != '='; pos++);
+    attr_len = pos - attr;
+
+    for (; *pos != FILTER_QUOTE; pos++);
+    for (value = ++pos; *pos != FILTER_QUOTE; pos++);
+    pos++;
+
+    if (__filter_find_rule(filter, FILTER_DROP_ATTRIBUTE,
+          frame->name, attr, attr_len) != NULL)
+      continue;
+
+    rule = __filter_find_rule(
+      filter, FILTER_REPLACE_VALUE, frame->name, attr, attr_len);
+
+    if (rule == NULL) {
+      if (__filter_emit(filter, ws, pos - ws) != 0) return 1;
+    }
+    else if (__filter_emit(filter, ws,          value - ws)          != 0 ||
+             __filter_emit(filter, rule->value, strlen(rule->value)) != 0 ||
+             __filter_emit(filter, value - 1,   1)                   != 0)
+      return 1;
+  }
+
+  /*the rest of the tag*/
+  for (tail = ws; *pos != '>'; pos++);
+  pos++;
+
+  filter->copied = frame->start + (pos - tag);
+
+  if (frame->content == NULL) return __filter_emit(filter, tail, pos - tail);
+
+  /*a self closing element with replaced content needs an end tag*/
+  if (pos[-2] == '/') {
+
+    if (__filter_emit(filter, tail, pos - tail - 2)                      != 0 ||
+        __filter_emit(filter, ">", 1)                                    != 0 ||
+        __filter_emit(filter, frame->content->value,
+                      strlen(frame->content->value))                     != 0 ||
+        __filter_emit(filter, "</", 2)                                   != 0 ||
+        __filter_emit(filter, name, strlen(name))                        != 0 ||
+        __filter_emit(filter, ">", 1)                                    != 0)
+      return 1;
+
+    return 0;
+  }
+
+  /*otherwise, the content is skipped until the element is closed*/
+  if (__filter_emit(filter, tail, pos - tail)                       != 0 ||
+      __filter_emit(filter, frame->content->value,
+                    strlen(frame->content->value))                  != 0)
+    return 1;
+
+  filter->dropping = filter->depth;
+  return 0;
+}
+
+filter_rule_t * __filter_find_rule(filter_t *filter,
+uint8_t type, char *element, char *attr, uint16_t len) {
+
+  filter_rule_t *rule;
+  uint16_t i;
+
+  for (i = 0; i < filter->num_rules; i++) {
+
+    rule = &filter->rules[i];
+
+    if (rule->type != type) continue;
+
+    if (strcmp(rule->element, "*")     != 0 &&
+        strcmp(rule->element, element) != 0)
+      continue;
+
+    if (attr == NULL) return rule;
+
+    if (rule->attribute != NULL                   &&
+        strncmp(rule->attribute, attr, len) == 0 &&
+        rule->attribute[len] == '\0')
+      return rule;
+  }
+
+  return NULL;
+}
+
+uint8_t __filter_flush(filter_t *filter, uint32_t offset) {
+
+  uint8_t result;
+
+  if (offset <= filter->copied) return 0;
+
+  result = __filter_emit(filter,
+    __filter_input(filter, filter->copied), offset - filter->copied);
+
+  filter->copied = offset;
+  return result;
+}
+
+uint8_t __filter_emit(filter_t *filter, char *data, uint32_t len) {
+
+  if (len == 0) return 0;
+
+  if (filter->write(filter->context, data, len) != 0) filter->error = 1;
+
+  return filter->error;
+}
+
+char * __filter_input(filter_t *filter, uint32_t offset) {
+
+  return filter->buf + (offset - filter->parser.base);
+}
@@ -0,0 +1,149 @@
+/**
+ * Streaming rewrite filter for lilx. A filter takes XML in pieces, applies
+ * a list of rules to it, and writes the result out as it goes, without
+ * building a tree - each element is dropped as soon as it has been closed.
+ * Input which no rule touches is copied straight to the output, byte for
+ * byte, so comments, whitespace and layout are kept.
+ *
+ * The rules are:
+ *
+ *   FILTER_RENAME          rename an element (both tags)
+ *   FILTER_DROP_ATTRIBUTE  remove an attribute from an element
+ *   FILTER_DROP_SUBTREE    remove an element, and everything in it
+ *   FILTER_REPLACE_VALUE   replace the value of an attribute of an element,
+ *                          or if no attribute is given, the content of the
+ *                          element (its body and any children)
+ *
+ * Rules match elements by name, or "*" for any element. New names and
+ * values are written exactly as given, so must already be escaped.
+ *
+ * Paul McCarthy <paul.mccarthy@gmail.com>
+ */
+#ifndef __FILTER_H__
+#define __FILTER_H__
+
+#include <stdint.h>
+
+#include "lilx.h"
+
+/**
+ * Rule types.
+ */
+#define FILTER_RENAME         0 /**< rename an element                   */
+#define FILTER_DROP_ATTRIBUTE 1 /**< remove an attribute                 */
+#define FILTER_DROP_SUBTREE   2 /**< remove an element and its contents  */
+#define FILTER_REPLACE_VALUE  3 /**< replace an attribute value or body  */
+
+/*******
+ * Types
+ ******/
+
+/**
+ * Called with each piece of output.
+ *
+ * \return 0 on success, non-0 on failure, which stops the filter.
+ */
+typedef uint8_t (*filter_write_t)(
+  void     *context, /**< the context given to filter_init */
+  char     *data,    /**< the output                       */
+  uint32_t  len      /**< length of the output             */
+);
+
+/**
+ * A rewrite rule.
+ */
+typedef struct __filter_rule {
+
+  uint8_t type;      /**< FILTER_RENAME, etc                              */
+  char   *element;   /**< name of the element to match, or "*"           */
+  char   *attribute; /**< the attribute, for FILTER_DROP_ATTRIBUTE and
+                          FILTER_REPLACE_VALUE (NULL for the content)     */
+  char   *value;     /**< the new name (FILTER_RENAME), or the new value
+                          (FILTER_REPLACE_VALUE)                          */
+} filter_rule_t;
+
+/**
+ * State for one open element.
+ */
+typedef struct __filter_frame {
+
+  uint32_t       start;    /**< input offset of the '<' of the start tag */
+  char          *name;     /**< the element name (which belongs to the
+                                element, so only lives while it is open) */
+  uint16_t       name_len; /**< length of the element name               */
+  char          *rename;   /**< new name, or NULL                        */
+  filter_rule_t *content;  /**< content replacement rule, or NULL        */
+  uint8_t        edit;     /**< non-0 if the start tag must be rewritten */
+} filter_frame_t;
+
+/**
+ * Filter state. The fields should never be accessed directly. A filter
+ * must not be moved once it has been initialised.
+ */
+typedef struct __filter {
+
+  parser_t        parser;    /**< the parser                              */
+  element_t       root;      /**< root of the (mostly empty) tree         */
+  filter_rule_t  *rules;     /**< the rules                               */
+  uint16_t        num_rules; /**< number of rules                         */
+  filter_write_t  write;     /**< output function                         */
+  void           *context;   /**< passed to write                         */
+  char           *buf;       /**< input which is still needed             */
+  uint32_t        len;       /**< length of buf                           */
+  uint32_t        cap;       /**< capacity of buf                         */
+  uint32_t        copied;    /**< input offset up to which output is done */
+  uint8_t         depth;     /**< number of open elements                 */
+  uint8_t         pending;   /**< non-0 if the innermost start tag is
+                                  waiting to be rewritten                 */
+  uint8_t         dropping;  /**< depth of the element whose contents are
+                                  being dropped, or 0                     */
+  uint8_t         error;     /**< non-0 if the output function failed     */
+
+  /** the open elements */
+  filter_frame_t frames[LILX_STACK_SIZE];
+} filter_t;
+
+/**
+ * Initialises a filter. The rules are not copied, so must stay around until
+ * the filter is freed.
+ *
+ * \return 0 on success, non-0 on failure.
+ */
+uint8_t filter_init(
+  filter_t       *filter,    /**< the filter to initialise       */
+  filter_rule_t  *rules,     /**< the rules                      */
+  uint16_t        num_rules, /**< number of rules                */
+  filter_write_t  write,     /**< output function                */
+  void           *context    /**< passed to the output function  */
+);
+
+/**
+ * Passes the next piece of input through the filter. Output is written as
+ * soon as the filter knows that no rule will change it. Set \p final with
+ * the last piece of input.
+ *
+ * If the input turns out not to be valid XML, nothing more is written. The
+ * output which has already been written is not taken back: it is the start
+ * of what the output would have been, cut off at or before the start of the
+ * token in which the error was found (which may be part way through a tag).
+ * The caller must check for LILX_ERROR before trusting it.
+ *
+ * \return LILX_OK once the whole document has been filtered, LILX_MORE if
+ * more input is needed, or LILX_ERROR if the input is not valid XML, or the
+ * output function failed.
+ */
+uint8_t filter_feed(
+  filter_t *filter, /**< the filter                                */
+  char     *data,   /**< the next piece of input                   */
+  uint32_t  len,    /**< length of the input                       */
+  uint8_t   final   /**< non-0 if there is no more input to come   */
+);
+
+/**
+ * Frees the memory that has been allocated for the given filter.
+ */
+void filter_free(
+  filter_t *filter /**< the filter */
+);
+
+#endif /* __FILTER_H__ */
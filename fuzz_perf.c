@@ -0,0 +1,568 @@
+/**
+ * Performance fuzzer - searches for inputs which make the parser, or the
+ * query functions, slow or memory hungry for their size, rather than
+ * inputs which crash it.
+ *
+ * usage: lilxfuzz_perf [-n iterations] [-s seed] [-k keep] corpus_dir
+ *        lilxfuzz_perf -r [-t max_score] corpus_dir
+ *
+ * Each input is parsed with lilx_create_tree, and then queried. It is
+ * scored by the number of instructions executed per byte of input (or, if
+ * the instruction counter is not available, CPU nanoseconds per byte), and
+ * by the peak number of bytes allocated per byte of input (inputs shorter
+ * than FUZZ_MIN_SCORED bytes score 0). Inputs are
+ * mutated from the corpus (and a few built in seeds), and the worst
+ * offenders on each score are kept, and mutated further. At the end, the
+ * worst offenders are written to the corpus directory, as slow-N.xml and
+ * mem-N.xml, so that they can be used as regression benchmarks.
+ *
+ * With -r, the inputs in the corpus directory are just run and scored, and
+ * if -t is given, lilxfuzz_perf fails if any of them scores more than
+ * max_score (on either score).
+ *
+ *   -n iterations  number of inputs to try (default: 100000)
+ *   -s seed        random seed (default: 1)
+ *   -k keep        number of worst offenders to keep on each score
+ *                  (default: 8)
+ *
+ * Linux only (the instruction counter uses perf_event_open).
+ *
+ * Paul McCarthy <paul.mccarthy@gmail.com>
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+/*lilx.c is built into the fuzzer, so that its allocations can be counted*/
+static void * fuzz_malloc(size_t size);
+static void * fuzz_realloc(void *ptr, size_t size);
+static void   fuzz_free(void *ptr);
+
+#define malloc  fuzz_malloc
+#define realloc fuzz_realloc
+#define free    fuzz_free
+#include "lilx.c"
+#undef malloc
+#undef realloc
+#undef free
+
+/**
+ * Largest input which the fuzzer will generate.
+ */
+#define FUZZ_MAX_INPUT 65536
+
+/**
+ * Inputs shorter than this are not scored - the fixed cost of a parse
+ * swamps the cost per byte of very short inputs.
+ */
+#define FUZZ_MIN_SCORED 256
+
+/**
+ * Number of times each input is run when scoring by CPU time, which is
+ * noisy - the lowest time is used.
+ */
+#define TIME_RUNS 3
+
+/**
+ * Maximum number of worst offenders which can be kept on each score.
+ */
+#define MAX_KEEP 64
+
+/**
+ * Maximum number of corpus files which are read.
+ */
+#define MAX_CORPUS 1024
+
+/**
+ * Scores.
+ */
+#define SCORE_SLOW 0 /**< instructions (or ns) per byte */
+#define SCORE_MEM  1 /**< peak bytes allocated per byte */
+
+/**
+ * An input, and its scores.
+ */
+typedef struct __input {
+
+  char    *data;     /**< '\0' terminated input */
+  uint32_t len;      /**< length of the input   */
+  double   score[2]; /**< the scores            */
+} input_t;
+
+/**
+ * Bytes allocated by lilx at the moment, and the peak since the last reset.
+ */
+static size_t allocated, peak;
+
+/**
+ * The instruction counter, or -1 if it isn't available.
+ */
+static int counter = -1;
+
+/**
+ * Built in seeds, so that the fuzzer has somewhere to start.
+ */
+static char *seeds[] = {
+  "<a/>",
+  "<a b=\"c\">text</a>",
+  "<a><b><c>deep</c></b><b/><b x=\"1\" y=\"2\"/></a>",
+  "<a>one<b/>two<c/>three</a>",
+  "<a xmlns=\"urn:x\" xmlns:p=\"urn:p\"><p:b p:c=\"d\"/></a>",
+  "<a><!-- comment --><b>x</b></a>",
+  "<a>\n  <b   c=\"d\"   />\n</a>"
+};
+
+/**
+ * Pieces of XML which are spliced into inputs.
+ */
+static char *dictionary[] = {
+  "<a>", "</a>", "<b/>", "<a b=\"c\">", " x=\"y\"", "<!-- c -->", "   ",
+  "text", "<", ">", "/>", "=\"", "\"", "xmlns:p=\"urn:p\"", "<p:a>",
+  "</p:a>"
+};
+
+static void * fuzz_malloc(size_t size) {
+
+  size_t *p = malloc(size + sizeof(size_t) * 2);
+
+  if (p == NULL) return NULL;
+
+  p[0]       = size;
+  allocated += size;
+  if (allocated > peak) peak = allocated;
+
+  return p + 2;
+}
+
+static void * fuzz_realloc(void *ptr, size_t size) {
+
+  size_t *p, old;
+
+  if (ptr == NULL) return fuzz_malloc(size);
+
+  p   = (size_t *)ptr - 2;
+  old = p[0];
+  p   = realloc(p, size + sizeof(size_t) * 2);
+
+  if (p == NULL) return NULL;
+
+  p[0]       = size;
+  allocated += size - old;
+  if (allocated > peak) peak = allocated;
+
+  return p + 2;
+}
+
+static void fuzz_free(void *ptr) {
+
+  size_t *p;
+
+  if (ptr == NULL) return;
+
+  p          = (size_t *)ptr - 2;
+  allocated -= p[0];
+  free(p);
+}
+
+/**
+ * Opens the instruction counter.
+ *
+ * \return a file descriptor, or -1 if it isn't available.
+ */
+static int counter_open(void) {
+
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.type           = PERF_TYPE_HARDWARE;
+  attr.size           = sizeof(attr);
+  attr.config         = PERF_COUNT_HW_INSTRUCTIONS;
+  attr.disabled       = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv     = 1;
+
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/**
+ * \return the number of instructions executed, or the CPU time in ns, since
+ * the counter was last reset.
+ */
+static uint64_t counter_read(void) {
+
+  struct timespec ts;
+  uint64_t count;
+
+  if (counter >= 0 && read(counter, &count, sizeof(count)) == sizeof(count))
+    return count;
+
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Runs the given input through the parser and the query functions.
+ *
+ * \return the number of instructions executed, or the CPU time in ns.
+ */
+static uint64_t run_once(input_t *input) {
+
+  element_t  root;
+  element_t *child;
+  element_t *found[16];
+  uint64_t   start, end;
+  uint16_t   it, i;
+
+  if (counter >= 0) {
+    ioctl(counter, PERF_EVENT_IOC_RESET,  0);
+    ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+  }
+  start = counter_read();
+
+  if (lilx_create_tree(input->data, &root) == 0) {
+
+    lilx_count_elements_by_name(&root, "b");
+    lilx_get_elements_by_name(&root, "a", found, 16);
+
+    if (root.num_children > 0) {
+
+      child = root.children[0];
+
+      lilx_get_child(child, "b");
+      lilx_get_attribute_by_name(child, "x");
+      lilx_get_text(child);
+
+      it = 0;
+      while (lilx_get_children(child, "a", &it) != NULL);
+
+      for (i = 0; i < child->num_children; i++)
+        lilx_get_text(child->children[i]);
+    }
+
+    lilx_free_tree(&root);
+  }
+
+  end = counter_read();
+  if (counter >= 0) ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+
+  return end - start;
+}
+
+/**
+ * Runs the given input, and scores it.
+ */
+static void run(input_t *input) {
+
+  uint64_t cost, best = UINT64_MAX;
+  int      i, runs = (counter >= 0) ? 1 : TIME_RUNS;
+
+  input->score[SCORE_SLOW] = 0;
+  input->score[SCORE_MEM]  = 0;
+
+  if (input->len < FUZZ_MIN_SCORED) return;
+
+  allocated = 0;
+  peak      = 0;
+
+  for (i = 0; i < runs; i++) {
+    cost = run_once(input);
+    if (cost < best) best = cost;
+  }
+
+  input->score[SCORE_SLOW] = (double)best / input->len;
+  input->score[SCORE_MEM]  = (double)peak / input->len;
+}
+
+/**
+ * Makes a mutated copy of the given input.
+ *
+ * \return 0 on success, non-0 on failure.
+ */
+static int mutate(input_t *from, input_t *to) {
+
+  char    *buf = malloc(FUZZ_MAX_INPUT + 1);
+  char    *piece;
+  uint32_t len = from->len;
+  uint32_t pos, n, plen, times, i;
+
+  if (buf == NULL) return 1;
+  memcpy(buf, from->data, len);
+
+  pos = len ? rand() % len : 0;
+
+  switch (rand() % 5) {
+
+    /*change a byte*/
+    case 0:
+      if (len > 0) buf[pos] = dictionary[rand() % 16][0] ^ (rand() % 2);
+      break;
+
+    /*delete a range*/
+    case 1:
+      n = len ? rand() % (len - pos + 1) : 0;
+      if (n > 16) n = rand() % 16;
+      memmove(buf + pos, buf + pos + n, len - pos - n);
+      len -= n;
+      break;
+
+    /*insert a piece from the dictionary, some number of times*/
+    case 2:
+    case 3:
+      piece = dictionary[rand() % (sizeof(dictionary) / sizeof(char *))];
+      plen  = strlen(piece);
+      times = 1 << (rand() % 10);
+
+      if (len + plen * times > FUZZ_MAX_INPUT) times = (FUZZ_MAX_INPUT - len) / plen;
+
+      memmove(buf + pos + plen * times, buf + pos, len - pos);
+      for (i = 0; i < times; i++) memcpy(buf + pos + plen * i, piece, plen);
+      len += plen * times;
+      break;
+
+    /*repeat a range of the input*/
+    case 4:
+      n = len ? 1 + rand() % (len - pos) : 0;
+      if (n > 0 && len + n * 2 <= FUZZ_MAX_INPUT) {
+        memmove(buf + pos + n * 2, buf + pos, len - pos);
+        memcpy(buf + pos + n, buf + pos + n * 2, n);
+        memcpy(buf + pos,     buf + pos + n * 2, n);
+        len += n * 2;
+      }
+      break;
+  }
+
+  /*an empty input scores nothing*/
+  if (len == 0) {
+    free(buf);
+    return 1;
+  }
+
+  buf[len]  = '\0';
+  to->data  = buf;
+  to->len   = len;
+
+  return 0;
+}
+
+/**
+ * Offers an input to the list of worst offenders on the given score.
+ *
+ * \return 1 if it was kept, 0 otherwise.
+ */
+static int offer(input_t *worst, int *num, int keep, int score, input_t *in) {
+
+  int i, lowest = 0;
+
+  if (in->score[score] == 0) return 0;
+
+  /*mutations often come out the same, or undo each other*/
+  for (i = 0; i < *num; i++)
+    if (worst[i].len == in->len &&
+        memcmp(worst[i].data, in->data, in->len) == 0)
+      return 0;
+
+  if (*num < keep) {
+    worst[(*num)++] = *in;
+    return 1;
+  }
+
+  for (i = 1; i < *num; i++)
+    if (worst[i].score[score] < worst[lowest].score[score]) lowest = i;
+
+  if (worst[lowest].score[score] >= in->score[score]) return 0;
+
+  free(worst[lowest].data);
+  worst[lowest] = *in;
+  return 1;
+}
+
+/**
+ * Reads the files in the given directory.
+ *
+ * \return the number of files read.
+ */
+static int read_corpus(char *dir, input_t *inputs, char **names) {
+
+  DIR           *d = opendir(dir);
+  struct dirent *ent;
+  FILE          *f;
+  char           path[4096];
+  int            n = 0;
+  long           len;
+
+  if (d == NULL) return 0;
+
+  while (n < MAX_CORPUS && (ent = readdir(d)) != NULL) {
+
+    if (ent->d_name[0] == '.') continue;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+    f = fopen(path, "rb");
+    if (f == NULL) continue;
+
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    if (len > 0 && len <= FUZZ_MAX_INPUT) {
+
+      inputs[n].data = malloc(len + 1);
+      inputs[n].len  = fread(inputs[n].data, 1, len, f);
+      inputs[n].data[inputs[n].len] = '\0';
+
+      if (names != NULL) names[n] = strdup(ent->d_name);
+      n++;
+    }
+
+    fclose(f);
+  }
+
+  closedir(d);
+  return n;
+}
+
+/**
+ * Writes the worst offenders on a score to the corpus directory.
+ */
+static void write_worst(char *dir, char *prefix, input_t *worst, int num) {
+
+  char  path[4096];
+  FILE *f;
+  int   i;
+
+  for (i = 0; i < num; i++) {
+
+    snprintf(path, sizeof(path), "%s/%s-%d.xml", dir, prefix, i);
+    f = fopen(path, "wb");
+    if (f == NULL) continue;
+
+    fwrite(worst[i].data, 1, worst[i].len, f);
+    fclose(f);
+
+    printf("%s: %u bytes, %.1f %s/byte, %.1f bytes allocated/byte\n",
+      path, worst[i].len, worst[i].score[SCORE_SLOW],
+      (counter >= 0) ? "instructions" : "ns", worst[i].score[SCORE_MEM]);
+  }
+}
+
+/**
+ * Runs and scores each file in the corpus.
+ *
+ * \return 0 if all of the scores are within max_score, 1 otherwise.
+ */
+static int replay(char *dir, double max_score) {
+
+  static input_t inputs[MAX_CORPUS];
+  static char   *names[MAX_CORPUS];
+  int            n, i, status = 0;
+
+  n = read_corpus(dir, inputs, names);
+
+  for (i = 0; i < n; i++) {
+
+    run(&inputs[i]);
+
+    printf("%-24s %6u bytes  %10.1f %s/byte  %8.1f bytes allocated/byte\n",
+      names[i], inputs[i].len, inputs[i].score[SCORE_SLOW],
+      (counter >= 0) ? "instructions" : "ns", inputs[i].score[SCORE_MEM]);
+
+    if (max_score > 0 && (inputs[i].score[SCORE_SLOW] > max_score ||
+                          inputs[i].score[SCORE_MEM]  > max_score))
+      status = 1;
+
+    free(inputs[i].data);
+    free(names[i]);
+  }
+
+  return status;
+}
+
+static void usage(void) {
+  printf("usage: lilxfuzz_perf [-n iterations] [-s seed] [-k keep] "
+         "corpus_dir\n"
+         "       lilxfuzz_perf -r [-t max_score] corpus_dir\n");
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+
+  static input_t corpus[MAX_CORPUS];
+  input_t        slow[MAX_KEEP], mem[MAX_KEEP];
+  input_t        in, *from;
+  char          *copy;
+  long           iterations = 100000;
+  long           i;
+  double         max_score  = 0;
+  int            keep = 8, nslow = 0, nmem = 0, ncorpus, kept;
+  int            replay_only = 0;
+  int            opt;
+
+  srand(1);
+
+  while ((opt = getopt(argc, argv, "n:s:k:rt:")) != -1) {
+    switch (opt) {
+      case 'n': iterations  = atol(optarg);       break;
+      case 's': srand(atoi(optarg));              break;
+      case 'k': keep        = atoi(optarg);       break;
+      case 'r': replay_only = 1;                  break;
+      case 't': max_score   = atof(optarg);       break;
+      default:  usage();
+    }
+  }
+
+  if (optind != argc - 1 || keep <= 0 || keep > MAX_KEEP) usage();
+
+  counter = counter_open();
+  if (counter < 0)
+    printf("instruction counter not available - scoring by CPU time\n");
+
+  if (replay_only) return replay(argv[optind], max_score);
+
+  /*the corpus, and the built in seeds, are the starting points*/
+  ncorpus = read_corpus(argv[optind], corpus, NULL);
+
+  for (i = 0; i < (long)(sizeof(seeds) / sizeof(char *)); i++) {
+    if (ncorpus == MAX_CORPUS) break;
+    corpus[ncorpus].data = strdup(seeds[i]);
+    corpus[ncorpus].len  = strlen(seeds[i]);
+    ncorpus++;
+  }
+
+  for (i = 0; i < ncorpus; i++) run(&corpus[i]);
+
+  for (i = 0; i < iterations; i++) {
+
+    /*mutate either a starting point, or one of the worst offenders*/
+    switch (rand() % 3) {
+      case 0:  from = &corpus[rand() % ncorpus];                    break;
+      case 1:  from = nslow ? &slow[rand() % nslow] : &corpus[0];   break;
+      default: from = nmem  ? &mem[rand() % nmem]   : &corpus[0];   break;
+    }
+
+    if (mutate(from, &in) != 0) continue;
+    run(&in);
+
+    /*an input can be kept on both scores, so needs a copy for one*/
+    kept = offer(slow, &nslow, keep, SCORE_SLOW, &in);
+    if (kept) {
+      copy = malloc(in.len + 1);
+      if (copy == NULL) break;
+      memcpy(copy, in.data, in.len + 1);
+      in.data = copy;
+    }
+    if (!offer(mem, &nmem, keep, SCORE_MEM, &in)) free(in.data);
+  }
+
+  write_worst(argv[optind], "slow", slow, nslow);
+  write_worst(argv[optind], "mem",  mem,  nmem);
+
+  return 0;
+}
@@ -0,0 +1,415 @@
+/**
+ * lilxgrep - searches XML files for elements or attributes matching a path.
+ *
+ * usage: lilxgrep [-j threads] [-l] [-m max] [-t] [-u] path file|dir ...
+ *
+ * Paths look like "/people/person/name" (from the document element),
+ * "//person/name" (anywhere in the document), and may end in an attribute,
+ * e.g. "//person/@id". "*" matches any element name. For each match, the
+ * file name, the offset of the element within the file, and the element
+ * body (or attribute value) is printed.
+ *
+ * Directories are searched recursively. Files are searched in parallel, by a
+ * pool of threads, each of which maps a file into memory and parses it with
+ * an event handler which drops every element as soon as it has been checked,
+ * so the tree never holds more than the currently open elements.
+ *
+ *   -j threads  number of threads (default: number of CPUs)
+ *   -l          only print the names of files which contain a match, and
+ *               stop searching each file at its first match
+ *   -m max      stop searching each file after max matches
+ *   -t          trust the files to be well-formed (see LILX_TRUSTED)
+ *   -u          print matches as they are found, rather than in file order
+ *
+ * Paul McCarthy <paul.mccarthy@gmail.com>
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "lilx.h"
+
+/**
+ * Maximum number of steps in a path.
+ */
+#define MAX_SEGMENTS 32
+
+/**
+ * One file to be searched, and the matches found in it.
+ */
+typedef struct __job {
+
+  char  *path; /**< the file                        */
+  char  *out;  /**< matches, waiting to be printed  */
+  size_t len;  /**< length of out                   */
+  size_t cap;  /**< capacity of out                 */
+  int    done; /**< non-0 once the file is searched */
+} job_t;
+
+/**
+ * State for searching one file.
+ */
+typedef struct __search {
+
+  job_t   *job;                      /**< the file being searched       */
+  char    *names[LILX_STACK_SIZE];   /**< names of the open elements    */
+  uint32_t offsets[LILX_STACK_SIZE]; /**< offsets of the open elements  */
+  uint8_t  depth;                    /**< number of open elements       */
+  long     matches;                  /**< number of matches so far      */
+} search_t;
+
+/*the path*/
+static char *segments[MAX_SEGMENTS];
+static int   nsegments;
+static int   anywhere;
+static char *attribute;
+
+/*options*/
+static int  list_only;
+static int  unordered;
+static int  trusted;
+static long max_matches;
+
+/*the files, and the threads' progress through them*/
+static job_t *jobs;
+static long   njobs;
+static long   jobs_cap;
+static long   next_job;
+static long   next_print;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Splits the given path expression into segments.
+ *
+ * \return 0 on success, non-0 if the path is invalid.
+ */
+static int parse_path(char *path) {
+
+  char *seg;
+
+  if (strncmp(path, "//", 2) == 0) {
+    anywhere = 1;
+    path += 2;
+  }
+  else if (path[0] == '/') path++;
+  else anywhere = 1;
+
+  for (seg = strtok(path, "/"); seg != NULL; seg = strtok(NULL, "/")) {
+
+    if (attribute != NULL) return 1;
+
+    if (seg[0] == '@') attribute = seg + 1;
+    else {
+      if (nsegments == MAX_SEGMENTS) return 1;
+      segments[nsegments++] = seg;
+    }
+  }
+
+  return nsegments == 0;
+}
+
+/**
+ * \return non-0 if the open elements match the path.
+ */
+static int path_matches(search_t *s) {
+
+  int i, first;
+
+  if (s->depth < nsegments)                return 0;
+  if (!anywhere && s->depth != nsegments) return 0;
+
+  first = s->depth - nsegments;
+
+  for (i = 0; i < nsegments; i++) {
+    if (strcmp(segments[i], "*") == 0) continue;
+    if (strcmp(segments[i], s->names[first + i]) != 0) return 0;
+  }
+
+  return 1;
+}
+
+/**
+ * Appends a line of output to the given job, or prints it straight away in
+ * unordered mode.
+ */
+static void emit(job_t *job, char *line, size_t len) {
+
+  if (unordered) {
+    pthread_mutex_lock(&lock);
+    fwrite(line, 1, len, stdout);
+    pthread_mutex_unlock(&lock);
+    return;
+  }
+
+  if (job->len + len > job->cap) {
+    job->cap = (job->len + len) * 2;
+    job->out = realloc(job->out, job->cap);
+    if (job->out == NULL) exit(1);
+  }
+
+  memcpy(job->out + job->len, line, len);
+  job->len += len;
+}
+
+/**
+ * Event handler - keeps track of the open elements, checks each element
+ * against the path when it is closed, and then drops it.
+ */
+static uint8_t handler(parser_t *parser, uint8_t event, element_t *element) {
+
+  search_t *s = (search_t *)parser->context;
+  char *value, *line;
+  uint8_t i;
+  int len;
+
+  /*the element name is preceded by a '<'*/
+  if (event == LILX_EVENT_START) {
+    s->names  [s->depth] = element->name;
+    s->offsets[s->depth] = parser->base + parser->tkn - 1;
+    s->depth++;
+    return LILX_CONTINUE;
+  }
+
+  if (path_matches(s)) {
+
+    value = lilx_get_text(element);
+
+    if (attribute != NULL) {
+      for (i = 0; i < element->num_attributes; i++)
+        if (strcmp(element->attributes[i]->name, attribute) == 0) break;
+
+      if (i == element->num_attributes) value = NULL;
+      else value = element->attributes[i]->value;
+    }
+
+    if (value != NULL || attribute == NULL) {
+
+      s->matches++;
+
+      if (list_only) {
+        len = asprintf(&line, "%s\n", s->job->path);
+      }
+      else {
+        len = asprintf(&line, "%s:%lu:%s\n",
+          s->job->path,
+          (unsigned long)s->offsets[s->depth - 1],
+          value != NULL ? value : "");
+      }
+
+      if (len < 0) exit(1);
+      emit(s->job, line, len);
+      free(line);
+
+      if (list_only || (max_matches > 0 && s->matches >= max_matches)) {
+        s->depth--;
+        return LILX_STOP;
+      }
+    }
+  }
+
+  s->depth--;
+  return LILX_DROP;
+}
+
+/**
+ * Searches one file.
+ */
+static void search(job_t *job) {
+
+  int fd;
+  struct stat st;
+  char *map;
+  parser_t parser;
+  element_t root;
+  search_t s;
+  uint8_t result;
+
+  fd = open(job->path, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    perror(job->path);
+    if (fd >= 0) close(fd);
+    return;
+  }
+
+  if (st.st_size == 0 || st.st_size > UINT32_MAX) {
+    if (st.st_size != 0)
+      fprintf(stderr, "lilxgrep: %s: file too large\n", job->path);
+    close(fd);
+    return;
+  }
+
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (map == MAP_FAILED) {
+    perror(job->path);
+    return;
+  }
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+  memset(&s, 0, sizeof(s));
+  s.job = job;
+
+  if (lilx_parser_init(&parser, &root) != 0) exit(1);
+  parser.handler = &handler;
+  parser.context = &s;
+  if (trusted) parser.flags |= LILX_TRUSTED;
+
+  result = lilx_parse(&parser, map, st.st_size, 1);
+
+  if (result == LILX_ERROR)
+    fprintf(stderr, "lilxgrep: %s: parse error near offset %lu\n",
+      job->path, (unsigned long)(parser.base + parser.pos));
+  else
+    lilx_free_tree(&root);
+
+  munmap(map, st.st_size);
+}
+
+/**
+ * Marks a job as done and, in ordered mode, prints the output of every
+ * finished job which is next in line.
+ */
+static void finish(job_t *job) {
+
+  pthread_mutex_lock(&lock);
+
+  job->done = 1;
+
+  while (next_print < njobs && jobs[next_print].done) {
+
+    job = &jobs[next_print++];
+
+    if (job->len > 0) fwrite(job->out, 1, job->len, stdout);
+    free(job->out);
+    job->out = NULL;
+  }
+
+  pthread_mutex_unlock(&lock);
+}
+
+static void * worker(void *arg) {
+
+  long i;
+
+  while (1) {
+
+    pthread_mutex_lock(&lock);
+    i = next_job++;
+    pthread_mutex_unlock(&lock);
+
+    if (i >= njobs) break;
+
+    search(&jobs[i]);
+    finish(&jobs[i]);
+  }
+
+  return NULL;
+}
+
+/**
+ * Adds the given file to the list of jobs, or if it is a directory, every
+ * file below it, in alphabetical order.
+ */
+static void add_path(char *path) {
+
+  struct stat st;
+  struct dirent **entries;
+  char *child;
+  int i, n;
+
+  if (stat(path, &st) != 0) {
+    perror(path);
+    return;
+  }
+
+  if (S_ISDIR(st.st_mode)) {
+
+    n = scandir(path, &entries, NULL, alphasort);
+    if (n < 0) {
+      perror(path);
+      return;
+    }
+
+    for (i = 0; i < n; i++) {
+
+      if (strcmp(entries[i]->d_name, ".")  != 0 &&
+          strcmp(entries[i]->d_name, "..") != 0) {
+
+        if (asprintf(&child, "%s/%s", path, entries[i]->d_name) < 0) exit(1);
+        add_path(child);
+        free(child);
+      }
+      free(entries[i]);
+    }
+    free(entries);
+    return;
+  }
+
+  if (!S_ISREG(st.st_mode)) return;
+
+  if (njobs == jobs_cap) {
+    jobs_cap = jobs_cap ? jobs_cap * 2 : 64;
+    jobs     = realloc(jobs, jobs_cap * sizeof(job_t));
+    if (jobs == NULL) exit(1);
+  }
+
+  memset(&jobs[njobs], 0, sizeof(job_t));
+  jobs[njobs].path = strdup(path);
+  if (jobs[njobs].path == NULL) exit(1);
+  njobs++;
+}
+
+static void usage(void) {
+  printf("usage: lilxgrep [-j threads] [-l] [-m max] [-t] [-u] "
+         "path file|dir ...\n");
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+
+  long i, nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  pthread_t *threads;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "j:lm:tu")) != -1) {
+    switch (opt) {
+      case 'j': nthreads    = atol(optarg); break;
+      case 'l': list_only   = 1;            break;
+      case 'm': max_matches = atol(optarg); break;
+      case 't': trusted     = 1;            break;
+      case 'u': unordered   = 1;            break;
+      default:  usage();
+    }
+  }
+
+  if (argc - optind < 2 || parse_path(argv[optind]) != 0) usage();
+  if (nthreads < 1) nthreads = 1;
+
+  for (i = optind + 1; i < argc; i++) add_path(argv[i]);
+
+  if (njobs < nthreads) nthreads = njobs;
+
+  threads = calloc(nthreads, sizeof(pthread_t));
+  if (nthreads > 0 && threads == NULL) return 1;
+
+  for (i = 0; i < nthreads; i++)
+    pthread_create(&threads[i], NULL, &worker, NULL);
+  for (i = 0; i < nthreads; i++)
+    pthread_join(threads[i], NULL);
+
+  for (i = 0; i < njobs; i++) free(jobs[i].path);
+  free(jobs);
+  free(threads);
+
+  return 0;
+}
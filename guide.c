@@ -0,0 +1,345 @@
+/**
+ * DataGuide for lilx. The paths form a trie - each path is its parent path
+ * plus a label - which is stored as a hash table keyed on the parent id and
+ * the label.
+ *
+ * Paul McCarthy <paul.mccarthy@gmail.com>
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lilx.h"
+#include "guide.h"
+
+/*****************************
+ * Private function prototypes
+ ****************************/
+
+/**
+ * \return the hash of the given parent id and label.
+ */
+static uint32_t __guide_hash(
+  uint16_t parent, /**< the parent path id   */
+  char    *label,  /**< the label            */
+  uint16_t len     /**< length of the label  */
+);
+
+/**
+ * Finds the hash table slot for the given path - either the slot holding
+ * it, or the empty slot where it belongs.
+ *
+ * \return the slot index.
+ */
+static uint32_t __guide_slot(
+  guide_t *guide,  /**< the guide            */
+  uint16_t parent, /**< the parent path id   */
+  char    *label,  /**< the label            */
+  uint16_t len     /**< length of the label  */
+);
+
+/**
+ * Adds a new path.
+ *
+ * \return the id of the path, or GUIDE_NONE on failure.
+ */
+static uint16_t __guide_new_path(
+  guide_t *guide,  /**< the guide            */
+  uint16_t parent, /**< the parent path id   */
+  char    *label,  /**< the label            */
+  uint16_t len     /**< length of the label  */
+);
+
+/**
+ * Doubles the size of the hash table.
+ *
+ * \return 0 on success, non-0 on malloc failure.
+ */
+static uint8_t __guide_grow(
+  guide_t *guide /**< the guide */
+);
+
+/****************************
+ * Public interface functions
+ ***************************/
+
+uint8_t guide_init(guide_t *guide) {
+
+  guide->num_paths = 0;
+  guide->cap_paths = 0;
+  guide->paths     = NULL;
+  guide->cap_slots = 0;
+  guide->slots     = NULL;
+
+  /*path 0 is the root, which has no parent*/
+  if (__guide_grow(guide)                       != 0 ||
+      __guide_new_path(guide, GUIDE_NONE, "", 0) != 0) {
+    guide_free(guide);
+    return 1;
+  }
+
+  return 0;
+}
+
+uint16_t guide_add(guide_t *guide, element_t *element) {
+
+  guide_path_t *path;
+  element_t   **elements;
+  uint16_t      parent = element->parent ? element->parent->path : 0;
+  uint16_t      len    = strlen(element->name);
+  uint32_t      slot;
+  uint16_t      id;
+
+  /*keep the hash table at most half full*/
+  if ((uint32_t)(guide->num_paths + 1) * 2 > guide->cap_slots &&
+      __guide_grow(guide) != 0)
+    return GUIDE_NONE;
+
+  slot = __guide_slot(guide, parent, element->name, len);
+
+  if (guide->slots[slot] != 0) id = guide->slots[slot] - 1;
+  else {
+    id = __guide_new_path(guide, parent, element->name, len);
+    if (id == GUIDE_NONE) return GUIDE_NONE;
+    guide->slots[slot] = id + 1;
+  }
+
+  path = &guide->paths[id];
+
+  if (path->num_elements == path->cap_elements) {
+
+    elements = (element_t **)realloc(path->elements,
+      (path->cap_elements ? path->cap_elements * 2 : 4) * sizeof(element_t *));
+    if (elements == NULL) return GUIDE_NONE;
+
+    path->elements     = elements;
+    path->cap_elements = path->cap_elements ? path->cap_elements * 2 : 4;
+  }
+
+  path->elements[path->num_elements++] = element;
+  element->path = id;
+
+  return id;
+}
+
+void guide_remove(guide_t *guide, element_t *element) {
+
+  uint16_t i;
+
+  for (i = 0; i < element->num_children; i++)
+    guide_remove(guide, element->children[i]);
+
+  if (element->path < guide->num_paths &&
+      guide->paths[element->path].num_elements > 0)
+    guide->paths[element->path].num_elements--;
+}
+
+uint16_t guide_find(guide_t *guide, char *path) {
+
+  uint16_t id = 0;
+  uint32_t slot;
+  char    *end;
+
+  if (*path != '/') return GUIDE_NONE;
+
+  while (*path == '/' && path[1] != '\0') {
+
+    path++;
+    end = strchr(path, '/');
+    if (end == NULL) end = path + strlen(path);
+
+    slot = __guide_slot(guide, id, path, end - path);
+    if (guide->slots[slot] == 0) return GUIDE_NONE;
+
+    id   = guide->slots[slot] - 1;
+    path = end;
+  }
+
+  return (*path == '\0' || strcmp(path, "/") == 0) ? id : GUIDE_NONE;
+}
+
+element_t ** guide_elements(guide_t *guide, uint16_t id, uint32_t *num) {
+
+  *num = 0;
+  if (id >= guide->num_paths || guide->paths[id].num_elements == 0)
+    return NULL;
+
+  *num = guide->paths[id].num_elements;
+  return guide->paths[id].elements;
+}
+
+uint16_t guide_num_paths(guide_t *guide) {
+  return guide->num_paths;
+}
+
+guide_path_t * guide_path(guide_t *guide, uint16_t id) {
+
+  if (id >= guide->num_paths) return NULL;
+  return &guide->paths[id];
+}
+
+uint8_t guide_path_string(guide_t *guide, uint16_t id, char *buf,
+uint32_t len) {
+
+  uint32_t      total = 0, llen;
+  uint16_t      i;
+  guide_path_t *path;
+
+  if (id >= guide->num_paths || len < 2) return 1;
+
+  /*work out the length first, then fill it in from the end*/
+  for (i = id; i != 0; i = guide->paths[i].parent)
+    total += strlen(guide->paths[i].label) + 1;
+
+  if (total == 0) {
+    strcpy(buf, "/");
+    return 0;
+  }
+
+  if (total + 1 > len) return 1;
+
+  buf[total] = '\0';
+
+  for (i = id; i != 0; i = path->parent) {
+
+    path   = &guide->paths[i];
+    llen   = strlen(path->label);
+    total -= llen;
+    memcpy(buf + total, path->label, llen);
+    buf[--total] = '/';
+  }
+
+  return 0;
+}
+
+void guide_clear(guide_t *guide) {
+
+  uint16_t i;
+
+  for (i = 0; i < guide->num_paths; i++) guide->paths[i].num_elements = 0;
+}
+
+void guide_free(guide_t *guide) {
+
+  uint16_t i;
+
+  for (i = 0; i < guide->num_paths; i++) {
+    free(guide->paths[i].label);
+    free(guide->paths[i].elements);
+  }
+
+  free(guide->paths);
+  free(guide->slots);
+
+  guide->num_paths = 0;
+  guide->cap_paths = 0;
+  guide->paths     = NULL;
+  guide->cap_slots = 0;
+  guide->slots     = NULL;
+}
+
+/*******************
+ * Private functions
+ ******************/
+
+uint32_t __guide_hash(uint16_t parent, char *label, uint16_t len) {
+
+  uint32_t hash = 2166136261u;
+  uint16_t i;
+
+  hash = (hash ^ (parent & 0xff)) * 16777619u;
+  hash = (hash ^ (parent >> 8))   * 16777619u;
+
+  for (i = 0; i < len; i++) {
+    hash ^= (uint8_t)label[i];
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+uint32_t __guide_slot(guide_t *guide, uint16_t parent, char *label,
+uint16_t len) {
+
+  uint32_t      mask = guide->cap_slots - 1;
+  uint32_t      slot = __guide_hash(parent, label, len) & mask;
+  guide_path_t *path;
+
+  /*linear probing*/
+  while (guide->slots[slot] != 0) {
+
+    path = &guide->paths[guide->slots[slot] - 1];
+
+    if (path->parent == parent                  &&
+        strncmp(path->label, label, len) == 0   &&
+        path->label[len] == '\0')
+      break;
+
+    slot = (slot + 1) & mask;
+  }
+
+  return slot;
+}
+
+uint16_t __guide_new_path(guide_t *guide, uint16_t parent, char *label,
+uint16_t len) {
+
+  guide_path_t *paths;
+  guide_path_t *path;
+
+  /*id GUIDE_NONE is reserved*/
+  if (guide->num_paths == GUIDE_NONE - 1) return GUIDE_NONE;
+
+  if (guide->num_paths == guide->cap_paths) {
+
+    paths = (guide_path_t *)realloc(guide->paths,
+      (guide->cap_paths ? guide->cap_paths * 2 : 16) * sizeof(guide_path_t));
+    if (paths == NULL) return GUIDE_NONE;
+
+    guide->paths     = paths;
+    guide->cap_paths = guide->cap_paths ? guide->cap_paths * 2 : 16;
+  }
+
+  path = &guide->paths[guide->num_paths];
+
+  path->label = (char *)malloc(len + 1);
+  if (path->label == NULL) return GUIDE_NONE;
+  memcpy(path->label, label, len);
+  path->label[len] = '\0';
+
+  path->parent       = parent;
+  path->depth        = (parent == GUIDE_NONE) ? 0
+                                              : guide->paths[parent].depth + 1;
+  path->num_elements = 0;
+  path->cap_elements = 0;
+  path->elements     = NULL;
+
+  return guide->num_paths++;
+}
+
+uint8_t __guide_grow(guide_t *guide) {
+
+  uint16_t     *old = guide->slots;
+  uint32_t      cap = guide->cap_slots;
+  uint16_t      i;
+  guide_path_t *path;
+
+  guide->cap_slots = cap ? cap * 2 : 64;
+  guide->slots     = (uint16_t *)calloc(guide->cap_slots, sizeof(uint16_t));
+
+  if (guide->slots == NULL) {
+    guide->slots     = old;
+    guide->cap_slots = cap;
+    return 1;
+  }
+
+  /*path 0 has no parent, so it's never looked up*/
+  for (i = 1; i < guide->num_paths; i++) {
+    path = &guide->paths[i];
+    guide->slots[__guide_slot(guide, path->parent, path->label,
+      strlen(path->label))] = i + 1;
+  }
+
+  free(old);
+  return 0;
+}
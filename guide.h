@@ -0,0 +1,164 @@
+/**
+ * DataGuide for lilx - a summary of the structure of a document. Each
+ * distinct path of element names from the root, e.g. /people/person/name,
+ * gets a small integer id, and the guide keeps a list of the elements on
+ * each path, in document order. A document with millions of elements
+ * usually has only a few hundred paths, so an absolute path query is a
+ * lookup, rather than a walk over the whole tree, and the number of
+ * elements on each path is a handy statistic for planning queries.
+ *
+ * To build a guide, initialise a guide_t, and point the guide field of a
+ * parser at it, after calling lilx_parser_init. Each element's path field is
+ * set to the id of its path as it is opened. Path id 0 is the root element
+ * (the one passed to lilx_parser_init), which is not itself listed - if
+ * there is no guide, every element's path is 0.
+ *
+ * A guide refers to the elements of one tree, so it must be cleared (or
+ * freed) when the tree is freed. Elements which a handler drops are removed
+ * from the guide. The paths are kept when a guide is cleared, so path ids
+ * stay the same across documents which are parsed with the same guide.
+ * The open elements recreated by lilx_parser_restore are not in any guide,
+ * so a guide can only be built by a parser which started from scratch.
+ * Like names_t, a guide is not thread safe.
+ *
+ * Paul McCarthy <paul.mccarthy@gmail.com>
+ */
+#ifndef __GUIDE_H__
+#define __GUIDE_H__
+
+#include <stdint.h>
+
+#include "lilx.h"
+
+/**
+ * Returned by guide_add on failure, and by guide_find for a path which is
+ * not in the guide.
+ */
+#define GUIDE_NONE UINT16_MAX
+
+/*******
+ * Types
+ ******/
+
+/**
+ * One distinct path.
+ */
+typedef struct __guide_path {
+
+  char       *label;        /**< name of the last element on the path   */
+  uint16_t    parent;       /**< id of the path without its last step,
+                                 GUIDE_NONE for path 0                  */
+  uint8_t     depth;        /**< number of steps below the root         */
+  uint32_t    num_elements; /**< number of elements on the path         */
+  uint32_t    cap_elements; /**< capacity of elements                   */
+  element_t **elements;     /**< the elements, in document order        */
+} guide_path_t;
+
+/**
+ * DataGuide. The fields should never be accessed directly.
+ */
+typedef struct __guide {
+
+  uint16_t      num_paths; /**< number of paths                      */
+  uint16_t      cap_paths; /**< capacity of paths                    */
+  guide_path_t *paths;     /**< the paths, indexed by id             */
+  uint32_t      cap_slots; /**< size of the hash table               */
+  uint16_t     *slots;     /**< hash table of id + 1, 0 when empty   */
+} guide_t;
+
+/**
+ * Initialises an empty guide, containing just path 0.
+ *
+ * \return 0 on success, non-0 on malloc failure.
+ */
+uint8_t guide_init(
+  guide_t *guide /**< the guide */
+);
+
+/**
+ * Adds the given element to the guide, adding its path if it is new, and
+ * sets the element's path field. Its parent must already be in the guide.
+ * The parser calls this as each element is opened.
+ *
+ * \return the id of the path, or GUIDE_NONE on failure (malloc failure, or
+ * the guide is full).
+ */
+uint16_t guide_add(
+  guide_t   *guide,  /**< the guide    */
+  element_t *element /**< the element  */
+);
+
+/**
+ * Removes the given element, and everything below it, from the guide. They
+ * must be the last elements to have been added on their paths, as is the
+ * case when an element is dropped as soon as it has been closed.
+ */
+void guide_remove(
+  guide_t   *guide,  /**< the guide                   */
+  element_t *element /**< root of the subtree to remove */
+);
+
+/**
+ * Looks up an absolute path, e.g. "/people/person/name". "/" is path 0.
+ *
+ * \return the id of the path, or GUIDE_NONE if it is not in the guide.
+ */
+uint16_t guide_find(
+  guide_t *guide, /**< the guide                   */
+  char    *path   /**< '\0' terminated path        */
+);
+
+/**
+ * \return the elements on the given path, in document order, or NULL if
+ * there are none.
+ */
+element_t ** guide_elements(
+  guide_t  *guide, /**< the guide                               */
+  uint16_t  id,    /**< the path id                             */
+  uint32_t *num    /**< place to store the number of elements   */
+);
+
+/**
+ * \return the number of paths in the guide.
+ */
+uint16_t guide_num_paths(
+  guide_t *guide /**< the guide */
+);
+
+/**
+ * \return the path with the given id, or NULL if there is no such id. The
+ * path belongs to the guide, and must not be changed.
+ */
+guide_path_t * guide_path(
+  guide_t *guide, /**< the guide   */
+  uint16_t id     /**< the path id */
+);
+
+/**
+ * Writes the given path out as a '\0' terminated string, e.g.
+ * "/people/person".
+ *
+ * \return 0 on success, non-0 if there is no such path, or it doesn't fit.
+ */
+uint8_t guide_path_string(
+  guide_t  *guide, /**< the guide              */
+  uint16_t  id,    /**< the path id            */
+  char     *buf,   /**< buffer for the string  */
+  uint32_t  len    /**< length of the buffer   */
+);
+
+/**
+ * Forgets all of the elements in the guide, keeping the paths.
+ */
+void guide_clear(
+  guide_t *guide /**< the guide */
+);
+
+/**
+ * Frees the memory that has been allocated for the given guide.
+ */
+void guide_free(
+  guide_t *guide /**< the guide */
+);
+
+#endif /* __GUIDE_H__ */
@@ -0,0 +1,103 @@
+/**
+ * lilxhash - prints a hash of the canonical form (see canon.h) of each of
+ * the given XML files, or of standard input, so that messages which differ
+ * only in layout can be recognised as duplicates.
+ *
+ * usage: lilxhash [-c] [file ...]
+ *
+ *   -c  print the canonical form instead of the hash
+ *
+ * Paul McCarthy <paul.mccarthy@gmail.com>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lilx.h"
+#include "canon.h"
+
+static void usage(void) {
+  printf("usage: lilxhash [-c] [file ...]\n");
+  exit(1);
+}
+
+/**
+ * Output function - writes to standard output.
+ */
+static uint8_t write_out(void *context, char *data, uint32_t len) {
+
+  return fwrite(data, 1, len, (FILE *)context) != len;
+}
+
+/**
+ * Canonicalises the given file, and prints its hash, or its canonical form.
+ *
+ * \return 0 on success, non-0 on failure.
+ */
+static int hash_file(FILE *f, char *name, int print) {
+
+  canon_t      canon;
+  canon_hash_t hash;
+  uint8_t      result;
+  char         buf[65536];
+  size_t       len;
+
+  canon_hash_init(&hash);
+
+  if (print) result = canon_init(&canon, &write_out,        stdout);
+  else       result = canon_init(&canon, &canon_hash_write, &hash);
+
+  if (result != 0) return 1;
+
+  do {
+
+    len    = fread(buf, 1, sizeof(buf), f);
+    result = canon_feed(&canon, buf, len, len < sizeof(buf));
+
+  } while (result == LILX_MORE && len == sizeof(buf));
+
+  canon_free(&canon);
+
+  if (result != LILX_OK) {
+    fprintf(stderr, "lilxhash: %s: invalid input\n", name);
+    return 1;
+  }
+
+  if (print) printf("\n");
+  else       printf("%016llx  %s\n", (unsigned long long)hash.hash, name);
+
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+
+  FILE *f;
+  int   print = 0;
+  int   status = 0;
+  int   opt, i;
+
+  while ((opt = getopt(argc, argv, "c")) != -1) {
+    switch (opt) {
+      case 'c': print = 1; break;
+      default:  usage();
+    }
+  }
+
+  if (optind == argc) return hash_file(stdin, "-", print);
+
+  for (i = optind; i < argc; i++) {
+
+    f = fopen(argv[i], "rb");
+    if (f == NULL) {
+      fprintf(stderr, "lilxhash: %s: couldn't open\n", argv[i]);
+      status = 1;
+      continue;
+    }
+
+    status |= hash_file(f, argv[i], print);
+    fclose(f);
+  }
+
+  return status;
+}
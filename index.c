@@ -0,0 +1,1087 @@
+/**
+ * Inverted index over a corpus of XML files.
+ *
+ * An index file is laid out as follows (integers are in native byte order):
+ *
+ *   header     "LILXIDX1", uint32 number of files, uint32 number of terms,
+ *              uint64 offset of the file table, uint64 offset of the term
+ *              directory
+ *   paths      '\0' terminated file paths
+ *   file table for each file, uint64 offset of its path, int64 mtime,
+ *              uint64 size
+ *   terms      for each term, uint16 length, the '\0' terminated term,
+ *              uint32 number of postings, and the postings (uint32 file,
+ *              uint32 offset), in file and offset order
+ *   directory  uint64 offset of each term, in sorted term order
+ *
+ * Paul McCarthy <paul.mccarthy@gmail.com>
+ */
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "lilx.h"
+#include "index.h"
+
+/**
+ * Identifies an index file, and the version of the format.
+ */
+#define INDEX_MAGIC "LILXIDX1"
+
+/**
+ * Size of the index file header.
+ */
+#define INDEX_HEADER_SIZE 32
+
+/**
+ * Size of an entry in the file table.
+ */
+#define INDEX_FILE_SIZE 24
+
+/**
+ * One occurrence of a term, found while scanning a file.
+ */
+typedef struct __index_entry {
+
+  uint32_t offset; /**< offset of the element         */
+  uint32_t term;   /**< offset of the term in the pool */
+} index_entry_t;
+
+/**
+ * State for scanning one file.
+ */
+typedef struct __index_scan {
+
+  uint32_t       offsets[LILX_STACK_SIZE]; /**< offsets of the open elements */
+  uint8_t        depth;                    /**< number of open elements      */
+  uint32_t       num_entries;              /**< number of terms found        */
+  uint32_t       cap_entries;              /**< capacity of entries          */
+  index_entry_t *entries;                  /**< the terms found              */
+  uint32_t       pool_len;                 /**< length of pool               */
+  uint32_t       pool_cap;                 /**< capacity of pool             */
+  char          *pool;                     /**< the term strings             */
+} index_scan_t;
+
+/**
+ * A file which needs to be scanned.
+ */
+typedef struct __index_job {
+
+  char    *path;  /**< the file                 */
+  int64_t  mtime; /**< its modification time   */
+  uint64_t size;  /**< its size                 */
+} index_job_t;
+
+/**
+ * State shared by the threads which scan files.
+ */
+typedef struct __index_work {
+
+  index_t        *index;    /**< the index being built     */
+  index_job_t    *jobs;     /**< the files to scan         */
+  uint32_t        num_jobs; /**< number of files to scan   */
+  uint32_t        next;     /**< next file to scan         */
+  pthread_mutex_t lock;     /**< protects next and index   */
+} index_work_t;
+
+/*****************************
+ * Private function prototypes
+ ****************************/
+
+/**
+ * \return the FNV-1a hash of the given string.
+ */
+static uint32_t __index_hash(
+  char *str /**< the string */
+);
+
+/**
+ * Finds the given term in the hash table, adding it if it's not there.
+ *
+ * \return the term, or NULL on malloc failure.
+ */
+static index_term_t * __index_term(
+  index_t *index, /**< the index */
+  char    *term   /**< the term  */
+);
+
+/**
+ * Adds a posting to the given term, unless it is the same as the last one.
+ *
+ * \return 0 on success, non-0 on malloc failure.
+ */
+static uint8_t __index_add_posting(
+  index_term_t *term,  /**< the term                  */
+  uint32_t      file,  /**< index of the file         */
+  uint32_t      offset /**< offset of the element     */
+);
+
+/**
+ * Adds a file to the file table.
+ *
+ * \return the index of the file, or UINT32_MAX on malloc failure.
+ */
+static uint32_t __index_add_file(
+  index_t *index, /**< the index                  */
+  char    *path,  /**< the file path              */
+  int64_t  mtime, /**< its modification time      */
+  uint64_t size   /**< its size                   */
+);
+
+/**
+ * Adds the given file, or every file below the given directory, to the
+ * given list of jobs.
+ *
+ * \return 0 on success, non-0 on malloc failure.
+ */
+static uint8_t __index_find_files(
+  char         *path,     /**< file or directory */
+  index_job_t **jobs,     /**< the list of jobs  */
+  uint32_t     *num_jobs, /**< number of jobs    */
+  uint32_t     *cap_jobs  /**< capacity of jobs  */
+);
+
+/**
+ * \return non-0 if the given path is one of the given paths, or lies below
+ * one of them.
+ */
+static uint8_t __index_under(
+  char    *path,     /**< the path to check      */
+  char   **paths,    /**< files and directories  */
+  uint32_t num_paths /**< number of paths        */
+);
+
+/**
+ * Records a term found while scanning a file.
+ *
+ * \return 0 on success, non-0 on malloc failure.
+ */
+static uint8_t __index_scan_term(
+  index_scan_t *scan,   /**< the scan                              */
+  char          prefix, /**< '<' or '@', or '\0' for a word        */
+  char         *str,    /**< the term                              */
+  uint32_t      len,    /**< length of the term                    */
+  uint32_t      offset  /**< offset of the element it was found at */
+);
+
+/**
+ * Records every word in the given string.
+ *
+ * \return 0 on success, non-0 on malloc failure.
+ */
+static uint8_t __index_scan_words(
+  index_scan_t *scan,  /**< the scan                              */
+  char         *str,   /**< the string                            */
+  uint32_t      offset /**< offset of the element it was found at */
+);
+
+/**
+ * Event handler used when scanning a file - records the terms for each
+ * element when it is closed, and then drops it.
+ */
+static uint8_t __index_scan_handler(
+  parser_t  *parser, /**< the parser              */
+  uint8_t    event,  /**< the event               */
+  element_t *element /**< the element in question */
+);
+
+/**
+ * Scans a file, recording the terms in it.
+ *
+ * \return 0 on success, non-0 on failure.
+ */
+static uint8_t __index_scan_file(
+  char         *path, /**< the file  */
+  index_scan_t *scan  /**< the scan  */
+);
+
+/**
+ * Thread which scans files, and adds their terms to the index.
+ */
+static void * __index_worker(
+  void *arg /**< the shared index_work_t */
+);
+
+/**
+ * Event handler used by index_extract - stops parsing once the element has
+ * been closed.
+ */
+static uint8_t __index_extract_handler(
+  parser_t  *parser, /**< the parser              */
+  uint8_t    event,  /**< the event               */
+  element_t *element /**< the element in question */
+);
+
+/**
+ * Maps the given file into memory.
+ *
+ * \return a pointer to the mapped file, or NULL on failure.
+ */
+static uint8_t * __index_map(
+  char     *path, /**< the file                      */
+  uint64_t *size  /**< place to store the file size  */
+);
+
+/**
+ * Compares two terms for qsort.
+ */
+static int __index_term_cmp(
+  const void *a, /**< pointer to an index_term_t pointer */
+  const void *b  /**< pointer to an index_term_t pointer */
+);
+
+/**
+ * Compares two postings for qsort.
+ */
+static int __index_posting_cmp(
+  const void *a, /**< pointer to a posting_t */
+  const void *b  /**< pointer to a posting_t */
+);
+
+/**
+ * Compares two job paths for qsort.
+ */
+static int __index_job_cmp(
+  const void *a, /**< pointer to an index_job_t */
+  const void *b  /**< pointer to an index_job_t */
+);
+
+/****************************
+ * Public interface functions
+ ***************************/
+
+uint8_t index_open(index_t *index, char *path) {
+
+  index_reader_t reader;
+  index_term_t *term;
+  uint64_t off, size;
+  int64_t mtime;
+  uint32_t i, j, num_postings;
+  uint16_t len;
+  posting_t posting;
+
+  memset(index, 0, sizeof(index_t));
+
+  /*no index yet - start with an empty one*/
+  if (access(path, F_OK) != 0) return 0;
+
+  if (index_reader_open(&reader, path) != 0) return 1;
+
+  for (i = 0; i < reader.num_files; i++) {
+
+    off = reader.files + (uint64_t)i * INDEX_FILE_SIZE;
+    memcpy(&mtime, reader.map + off + 8,  8);
+    memcpy(&size,  reader.map + off + 16, 8);
+
+    if (__index_add_file(index, index_file_path(&reader, i), mtime, size)
+        == UINT32_MAX) {
+      index_reader_close(&reader);
+      index_free(index);
+      return 1;
+    }
+  }
+
+  for (i = 0; i < reader.num_terms; i++) {
+
+    memcpy(&off, reader.map + reader.dir + i * 8, 8);
+    memcpy(&len, reader.map + off, 2);
+
+    term = __index_term(index, (char *)reader.map + off + 2);
+    if (term == NULL) {
+      index_reader_close(&reader);
+      index_free(index);
+      return 1;
+    }
+
+    off += 2 + len + 1;
+    memcpy(&num_postings, reader.map + off, 4);
+    off += 4;
+
+    for (j = 0; j < num_postings; j++, off += sizeof(posting_t)) {
+
+      memcpy(&posting, reader.map + off, sizeof(posting_t));
+
+      if (__index_add_posting(term, posting.file, posting.offset) != 0) {
+        index_reader_close(&reader);
+        index_free(index);
+        return 1;
+      }
+    }
+  }
+
+  index_reader_close(&reader);
+  return 0;
+}
+
+uint8_t index_add(
+index_t *index, char **paths, uint32_t num_paths, uint8_t nthreads) {
+
+  index_work_t work;
+  index_job_t *all = NULL;
+  index_job_t  key;
+  index_job_t *found;
+  pthread_t   *threads;
+  struct stat  st;
+  uint32_t num_all = 0, cap_all = 0;
+  uint32_t i, j;
+  uint8_t *seen;
+
+  for (i = 0; i < num_paths; i++)
+    if (__index_find_files(paths[i], &all, &num_all, &cap_all) != 0)
+      return 1;
+
+  /*sort the files, so they can be matched against the index*/
+  qsort(all, num_all, sizeof(index_job_t), &__index_job_cmp);
+
+  memset(&work, 0, sizeof(work));
+  work.index = index;
+  work.jobs  = (index_job_t *)malloc((num_all + 1) * sizeof(index_job_t));
+  seen       = (uint8_t *)calloc(num_all + 1, 1);
+  if (work.jobs == NULL || seen == NULL) return 1;
+
+  /*files which have changed, or are no longer in the corpus,
+    are removed from the index - a file which was not found
+    is only gone if it should have been, i.e. if it lies
+    under one of the given paths, or no longer exists*/
+  for (i = 0; i < index->num_files; i++) {
+
+    if (index->files[i].dead) continue;
+
+    key.path = index->files[i].path;
+    found    = bsearch(&key, all, num_all, sizeof(index_job_t),
+                       &__index_job_cmp);
+
+    if (found != NULL                          &&
+        found->mtime == index->files[i].mtime &&
+        found->size  == index->files[i].size)
+      seen[found - all] = 1;
+    else if (found != NULL ||
+             __index_under(key.path, paths, num_paths) ||
+             stat(key.path, &st) != 0)
+      index->files[i].dead = 1;
+  }
+
+  /*everything else needs to be scanned*/
+  for (i = 0, j = 0; i < num_all; i++) {
+    if (seen[i]) free(all[i].path);
+    else         work.jobs[j++] = all[i];
+  }
+  work.num_jobs = j;
+  free(seen);
+  free(all);
+
+  if (nthreads < 1)              nthreads = 1;
+  if (nthreads > work.num_jobs)  nthreads = work.num_jobs;
+
+  threads = (pthread_t *)malloc((nthreads + 1) * sizeof(pthread_t));
+  if (threads == NULL) return 1;
+
+  pthread_mutex_init(&work.lock, NULL);
+
+  for (i = 0; i < nthreads; i++)
+    pthread_create(&threads[i], NULL, &__index_worker, &work);
+  for (i = 0; i < nthreads; i++)
+    pthread_join(threads[i], NULL);
+
+  pthread_mutex_destroy(&work.lock);
+
+  for (i = 0; i < work.num_jobs; i++) free(work.jobs[i].path);
+  free(work.jobs);
+  free(threads);
+
+  return 0;
+}
+
+uint8_t index_save(index_t *index, char *path) {
+
+  FILE *f;
+  uint32_t i, j, k, num_files = 0, num_terms = 0;
+  uint32_t *renumber;
+  uint64_t off, files, *dir;
+  uint16_t len;
+  index_term_t **terms;
+  index_term_t  *term;
+  char tmp[1024];
+
+  renumber = (uint32_t *)malloc((index->num_files + 1) * sizeof(uint32_t));
+  terms    = (index_term_t **)malloc(
+               (index->num_terms + 1) * sizeof(index_term_t *));
+  dir      = (uint64_t *)malloc((index->num_terms + 1) * sizeof(uint64_t));
+
+  if (renumber == NULL || terms == NULL || dir == NULL) {
+    free(renumber);
+    free(terms);
+    free(dir);
+    return 1;
+  }
+
+  /*leave out removed files, and renumber the rest*/
+  for (i = 0; i < index->num_files; i++)
+    renumber[i] = index->files[i].dead ? UINT32_MAX : num_files++;
+
+  /*leave out postings in removed files, and
+    terms which no longer have any postings*/
+  for (i = 0; i < index->cap_terms; i++) {
+
+    term = &index->terms[i];
+    if (term->term == NULL) continue;
+
+    for (j = 0, k = 0; j < term->num_postings; j++) {
+      if (renumber[term->postings[j].file] == UINT32_MAX) continue;
+      term->postings[k].file   = renumber[term->postings[j].file];
+      term->postings[k].offset = term->postings[j].offset;
+      k++;
+    }
+    term->num_postings = k;
+    if (k == 0) continue;
+
+    qsort(term->postings, k, sizeof(posting_t), &__index_posting_cmp);
+    terms[num_terms++] = term;
+  }
+
+  qsort(terms, num_terms, sizeof(index_term_t *), &__index_term_cmp);
+
+  /*the index now only holds live files, numbered as saved*/
+  for (i = 0, j = 0; i < index->num_files; i++) {
+    if (index->files[i].dead) free(index->files[i].path);
+    else                      index->files[j++] = index->files[i];
+  }
+  index->num_files = j;
+
+  /*write to a temporary file, which then replaces the index file*/
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  f = fopen(tmp, "wb");
+  if (f == NULL) {
+    free(renumber);
+    free(terms);
+    free(dir);
+    return 1;
+  }
+
+  /*header - the offsets are filled in at the end*/
+  off = 0;
+  fwrite(INDEX_MAGIC, 1, 8, f);
+  fwrite(&num_files, 4, 1, f);
+  fwrite(&num_terms, 4, 1, f);
+  fwrite(&off, 8, 1, f);
+  fwrite(&off, 8, 1, f);
+  off = INDEX_HEADER_SIZE;
+
+  /*paths - remember where each one went*/
+  for (i = 0; i < num_files; i++) {
+    len = strlen(index->files[i].path) + 1;
+    fwrite(index->files[i].path, 1, len, f);
+    dir[i] = off;
+    off   += len;
+  }
+
+  /*file table*/
+  for (i = 0; i < num_files; i++) {
+    fwrite(&dir[i],                 8, 1, f);
+    fwrite(&index->files[i].mtime, 8, 1, f);
+    fwrite(&index->files[i].size,  8, 1, f);
+  }
+  files = off;
+  off   = off + (uint64_t)num_files * INDEX_FILE_SIZE;
+
+  /*terms*/
+  for (j = 0; j < num_terms; j++) {
+
+    len = strlen(terms[j]->term);
+    fwrite(&len, 2, 1, f);
+    fwrite(terms[j]->term, 1, len + 1, f);
+    fwrite(&terms[j]->num_postings, 4, 1, f);
+    fwrite(terms[j]->postings, sizeof(posting_t), terms[j]->num_postings, f);
+
+    dir[j] = off;
+    off   += 2 + len + 1 + 4 + terms[j]->num_postings * sizeof(posting_t);
+  }
+
+  /*directory*/
+  fwrite(dir, 8, num_terms, f);
+
+  /*fill in the header offsets*/
+  fseek(f, 16, SEEK_SET);
+  fwrite(&files, 8, 1, f);
+  fwrite(&off,   8, 1, f);
+
+  free(renumber);
+  free(terms);
+  free(dir);
+
+  if (ferror(f)) {
+    fclose(f);
+    return 1;
+  }
+  if (fclose(f) != 0) return 1;
+
+  return rename(tmp, path) != 0;
+}
+
+void index_free(index_t *index) {
+
+  uint32_t i;
+
+  for (i = 0; i < index->num_files; i++) free(index->files[i].path);
+
+  for (i = 0; i < index->cap_terms; i++) {
+    free(index->terms[i].term);
+    free(index->terms[i].postings);
+  }
+
+  free(index->files);
+  free(index->terms);
+  memset(index, 0, sizeof(index_t));
+}
+
+uint8_t index_reader_open(index_reader_t *reader, char *path) {
+
+  reader->map = __index_map(path, &reader->size);
+  if (reader->map == NULL) return 1;
+
+  if (reader->size < INDEX_HEADER_SIZE ||
+      memcmp(reader->map, INDEX_MAGIC, 8) != 0) {
+    munmap(reader->map, reader->size);
+    return 1;
+  }
+
+  memcpy(&reader->num_files, reader->map + 8,  4);
+  memcpy(&reader->num_terms, reader->map + 12, 4);
+  memcpy(&reader->files,     reader->map + 16, 8);
+  memcpy(&reader->dir,       reader->map + 24, 8);
+
+  if (reader->files + (uint64_t)reader->num_files * INDEX_FILE_SIZE
+        > reader->size ||
+      reader->dir   + (uint64_t)reader->num_terms * 8
+        > reader->size) {
+    munmap(reader->map, reader->size);
+    return 1;
+  }
+
+  return 0;
+}
+
+void index_reader_close(index_reader_t *reader) {
+
+  munmap(reader->map, reader->size);
+  reader->map = NULL;
+}
+
+uint32_t index_lookup(index_reader_t *reader, char *term,
+posting_t *postings, uint32_t postings_length, uint32_t *total) {
+
+  uint32_t lo = 0, hi = reader->num_terms, mid, num_postings;
+  uint64_t off;
+  int cmp;
+
+  if (total != NULL) *total = 0;
+
+  /*binary search of the term directory*/
+  while (lo < hi) {
+
+    mid = lo + (hi - lo) / 2;
+    memcpy(&off, reader->map + reader->dir + (uint64_t)mid * 8, 8);
+
+    cmp = strcmp(term, (char *)reader->map + off + 2);
+
+    if      (cmp < 0) hi = mid;
+    else if (cmp > 0) lo = mid + 1;
+    else {
+
+      off += 2 + strlen(term) + 1;
+      memcpy(&num_postings, reader->map + off, 4);
+
+      if (total != NULL) *total = num_postings;
+      if (num_postings > postings_length) num_postings = postings_length;
+
+      memcpy(postings, reader->map + off + 4,
+             num_postings * sizeof(posting_t));
+      return num_postings;
+    }
+  }
+
+  return 0;
+}
+
+char * index_file_path(index_reader_t *reader, uint32_t file) {
+
+  uint64_t off;
+
+  if (file >= reader->num_files) return NULL;
+
+  memcpy(&off,
+         reader->map + reader->files + (uint64_t)file * INDEX_FILE_SIZE, 8);
+  return (char *)reader->map + off;
+}
+
+uint8_t index_extract(char *path, uint32_t offset, element_t *root) {
+
+  uint8_t *map;
+  uint64_t size;
+  uint8_t result;
+  parser_t parser;
+
+  map = __index_map(path, &size);
+  if (map == NULL) return 1;
+
+  if (offset >= size || lilx_parser_init(&parser, root) != 0) {
+    munmap(map, size);
+    return 1;
+  }
+
+  /*parse from the start of the element until it is closed*/
+  parser.handler = &__index_extract_handler;
+  result = lilx_parse(&parser, (char *)map + offset, size - offset, 1);
+
+  munmap(map, size);
+
+  if (result == LILX_OK || result == LILX_STOPPED) return 0;
+  if (result != LILX_ERROR) lilx_free_tree(root);
+
+  return 1;
+}
+
+/*******************
+ * Private functions
+ ******************/
+
+uint32_t __index_hash(char *str) {
+
+  uint32_t hash = 2166136261u;
+
+  for (; *str != '\0'; str++) {
+    hash ^= (uint8_t)*str;
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+index_term_t * __index_term(index_t *index, char *term) {
+
+  uint32_t i, cap;
+  index_term_t *old;
+
+  /*keep the table at most half full*/
+  if ((index->num_terms + 1) * 2 > index->cap_terms) {
+
+    old = index->terms;
+    cap = index->cap_terms;
+
+    index->cap_terms = cap ? cap * 2 : 1024;
+    index->terms     = (index_term_t *)calloc(
+                         index->cap_terms, sizeof(index_term_t));
+
+    if (index->terms == NULL) {
+      index->terms     = old;
+      index->cap_terms = cap;
+      return NULL;
+    }
+
+    for (i = 0; i < cap; i++) {
+
+      if (old[i].term == NULL) continue;
+
+      index->num_terms--;
+      *__index_term(index, old[i].term) = old[i];
+      index->num_terms++;
+    }
+    free(old);
+  }
+
+  /*linear probing*/
+  i = __index_hash(term) & (index->cap_terms - 1);
+  while (index->terms[i].term != NULL) {
+    if (strcmp(index->terms[i].term, term) == 0) return &index->terms[i];
+    i = (i + 1) & (index->cap_terms - 1);
+  }
+
+  index->terms[i].term = strdup(term);
+  if (index->terms[i].term == NULL) return NULL;
+  index->num_terms++;
+
+  return &index->terms[i];
+}
+
+uint8_t __index_add_posting(
+index_term_t *term, uint32_t file, uint32_t offset) {
+
+  posting_t *postings;
+  posting_t *last;
+
+  /*a word can occur more than once in the same element*/
+  if (term->num_postings > 0) {
+    last = &term->postings[term->num_postings - 1];
+    if (last->file == file && last->offset == offset) return 0;
+  }
+
+  if (term->num_postings == term->cap_postings) {
+
+    postings = (posting_t *)realloc(term->postings,
+      (term->cap_postings ? term->cap_postings * 2 : 4) * sizeof(posting_t));
+    if (postings == NULL) return 1;
+
+    term->postings      = postings;
+    term->cap_postings  = term->cap_postings ? term->cap_postings * 2 : 4;
+  }
+
+  term->postings[term->num_postings].file   = file;
+  term->postings[term->num_postings].offset = offset;
+  term->num_postings++;
+
+  return 0;
+}
+
+uint32_t __index_add_file(
+index_t *index, char *path, int64_t mtime, uint64_t size) {
+
+  index_file_t *files;
+
+  if (index->num_files == index->cap_files) {
+
+    files = (index_file_t *)realloc(index->files,
+      (index->cap_files ? index->cap_files * 2 : 64) * sizeof(index_file_t));
+    if (files == NULL) return UINT32_MAX;
+
+    index->files     = files;
+    index->cap_files = index->cap_files ? index->cap_files * 2 : 64;
+  }
+
+  index->files[index->num_files].path  = strdup(path);
+  index->files[index->num_files].mtime = mtime;
+  index->files[index->num_files].size  = size;
+  index->files[index->num_files].dead  = 0;
+
+  if (index->files[index->num_files].path == NULL) return UINT32_MAX;
+
+  return index->num_files++;
+}
+
+uint8_t __index_find_files(
+char *path, index_job_t **jobs, uint32_t *num_jobs, uint32_t *cap_jobs) {
+
+  struct stat st;
+  struct dirent **entries;
+  index_job_t *grown;
+  char *child;
+  int i, n;
+  uint8_t result = 0;
+
+  if (stat(path, &st) != 0) {
+    perror(path);
+    return 0;
+  }
+
+  if (S_ISDIR(st.st_mode)) {
+
+    n = scandir(path, &entries, NULL, alphasort);
+    if (n < 0) {
+      perror(path);
+      return 0;
+    }
+
+    for (i = 0; i < n; i++) {
+
+      if (result == 0                           &&
+          strcmp(entries[i]->d_name, ".")  != 0 &&
+          strcmp(entries[i]->d_name, "..") != 0) {
+
+        child = (char *)malloc(strlen(path) + strlen(entries[i]->d_name) + 2);
+        if (child == NULL) result = 1;
+        else {
+          sprintf(child, "%s/%s", path, entries[i]->d_name);
+          result = __index_find_files(child, jobs, num_jobs, cap_jobs);
+          free(child);
+        }
+      }
+      free(entries[i]);
+    }
+    free(entries);
+    return result;
+  }
+
+  if (!S_ISREG(st.st_mode)) return 0;
+
+  if (*num_jobs == *cap_jobs) {
+
+    grown = (index_job_t *)realloc(*jobs,
+      (*cap_jobs ? *cap_jobs * 2 : 64) * sizeof(index_job_t));
+    if (grown == NULL) return 1;
+
+    *jobs     = grown;
+    *cap_jobs = *cap_jobs ? *cap_jobs * 2 : 64;
+  }
+
+  (*jobs)[*num_jobs].path  = strdup(path);
+  (*jobs)[*num_jobs].mtime = st.st_mtime;
+  (*jobs)[*num_jobs].size  = st.st_size;
+  if ((*jobs)[*num_jobs].path == NULL) return 1;
+
+  (*num_jobs)++;
+  return 0;
+}
+
+uint8_t __index_under(char *path, char **paths, uint32_t num_paths) {
+
+  uint32_t i;
+  size_t len;
+
+  for (i = 0; i < num_paths; i++) {
+
+    len = strlen(paths[i]);
+    if (strncmp(path, paths[i], len) != 0) continue;
+
+    if (path[len] == '\0' || path[len] == '/' ||
+        (len > 0 && paths[i][len - 1] == '/'))
+      return 1;
+  }
+
+  return 0;
+}
+
+uint8_t __index_scan_term(index_scan_t *scan,
+char prefix, char *str, uint32_t len, uint32_t offset) {
+
+  index_entry_t *entries;
+  char *pool;
+  uint32_t i;
+
+  if (len > INDEX_MAX_TERM_LENGTH - 2) len = INDEX_MAX_TERM_LENGTH - 2;
+
+  if (scan->num_entries == scan->cap_entries) {
+
+    entries = (index_entry_t *)realloc(scan->entries,
+      (scan->cap_entries ? scan->cap_entries * 2 : 256) *
+      sizeof(index_entry_t));
+    if (entries == NULL) return 1;
+
+    scan->entries     = entries;
+    scan->cap_entries = scan->cap_entries ? scan->cap_entries * 2 : 256;
+  }
+
+  if (scan->pool_len + len + 2 > scan->pool_cap) {
+
+    pool = (char *)realloc(scan->pool, (scan->pool_len + len + 2) * 2);
+    if (pool == NULL) return 1;
+
+    scan->pool     = pool;
+    scan->pool_cap = (scan->pool_len + len + 2) * 2;
+  }
+
+  scan->entries[scan->num_entries].offset = offset;
+  scan->entries[scan->num_entries].term   = scan->pool_len;
+  scan->num_entries++;
+
+  if (prefix != '\0') scan->pool[scan->pool_len++] = prefix;
+
+  /*words are stored in lower case*/
+  for (i = 0; i < len; i++)
+    scan->pool[scan->pool_len++] = prefix ? str[i] : tolower((uint8_t)str[i]);
+
+  scan->pool[scan->pool_len++] = '\0';
+
+  return 0;
+}
+
+uint8_t __index_scan_words(index_scan_t *scan, char *str, uint32_t offset) {
+
+  char *start;
+
+  if (str == NULL) return 0;
+
+  while (*str != '\0') {
+
+    /*non-ASCII bytes are treated as part of a word*/
+    for (; *str != '\0' && !isalnum((uint8_t)*str) && (uint8_t)*str < 0x80;
+         str++);
+
+    for (start = str;
+         *str != '\0' && (isalnum((uint8_t)*str) || (uint8_t)*str >= 0x80);
+         str++);
+
+    if (str > start &&
+        __index_scan_term(scan, '\0', start, str - start, offset) != 0)
+      return 1;
+  }
+
+  return 0;
+}
+
+uint8_t __index_scan_handler(
+parser_t *parser, uint8_t event, element_t *element) {
+
+  index_scan_t *scan = (index_scan_t *)parser->context;
+  uint32_t offset;
+  uint8_t i;
+
+  /*the element name is preceded by a '<'*/
+  if (event == LILX_EVENT_START) {
+
+    offset = parser->base + parser->tkn - 1;
+    scan->offsets[scan->depth++] = offset;
+
+    if (__index_scan_term(
+          scan, '<', element->name, strlen(element->name), offset) != 0)
+      return LILX_STOP;
+
+    return LILX_CONTINUE;
+  }
+
+  offset = scan->offsets[--scan->depth];
+
+  for (i = 0; i < element->num_attributes; i++) {
+
+    if (__index_scan_term(scan, '@', element->attributes[i]->name,
+          strlen(element->attributes[i]->name), offset) != 0)
+      return LILX_STOP;
+
+    if (__index_scan_words(scan, element->attributes[i]->value, offset) != 0)
+      return LILX_STOP;
+  }
+
+  if (__index_scan_words(scan, lilx_get_text(element), offset) != 0)
+    return LILX_STOP;
+
+  return LILX_DROP;
+}
+
+uint8_t __index_scan_file(char *path, index_scan_t *scan) {
+
+  uint8_t *map;
+  uint64_t size;
+  uint8_t result;
+  parser_t parser;
+  element_t root;
+
+  map = __index_map(path, &size);
+  if (map == NULL) return 1;
+
+  if (size > UINT32_MAX || lilx_parser_init(&parser, &root) != 0) {
+    munmap(map, size);
+    return 1;
+  }
+
+  parser.handler = &__index_scan_handler;
+  parser.context = scan;
+
+  result = lilx_parse(&parser, (char *)map, size, 1);
+  munmap(map, size);
+
+  if (result == LILX_ERROR) return 1;
+
+  lilx_free_tree(&root);
+
+  /*the handler stops if it runs out of memory*/
+  return result != LILX_OK;
+}
+
+void * __index_worker(void *arg) {
+
+  index_work_t *work = (index_work_t *)arg;
+  index_job_t  *job;
+  index_scan_t  scan;
+  index_term_t *term;
+  uint32_t i, file;
+
+  memset(&scan, 0, sizeof(scan));
+
+  while (1) {
+
+    pthread_mutex_lock(&work->lock);
+    job = (work->next < work->num_jobs) ? &work->jobs[work->next++] : NULL;
+    pthread_mutex_unlock(&work->lock);
+
+    if (job == NULL) break;
+
+    scan.depth       = 0;
+    scan.num_entries = 0;
+    scan.pool_len    = 0;
+
+    if (__index_scan_file(job->path, &scan) != 0) {
+      fprintf(stderr, "index: couldn't parse %s - skipping\n", job->path);
+      continue;
+    }
+
+    /*merge the terms into the index*/
+    pthread_mutex_lock(&work->lock);
+
+    file = __index_add_file(work->index, job->path, job->mtime, job->size);
+
+    for (i = 0; file != UINT32_MAX && i < scan.num_entries; i++) {
+
+      term = __index_term(work->index, scan.pool + scan.entries[i].term);
+
+      if (term == NULL ||
+          __index_add_posting(term, file, scan.entries[i].offset) != 0) {
+        fprintf(stderr, "index: out of memory adding %s\n", job->path);
+        break;
+      }
+    }
+
+    pthread_mutex_unlock(&work->lock);
+  }
+
+  free(scan.entries);
+  free(scan.pool);
+
+  return NULL;
+}
+
+uint8_t __index_extract_handler(
+parser_t *parser, uint8_t event, element_t *element) {
+
+  if (event == LILX_EVENT_END && parser->depth == 0) return LILX_STOP;
+  return LILX_CONTINUE;
+}
+
+uint8_t * __index_map(char *path, uint64_t *size) {
+
+  int fd;
+  struct stat st;
+  void *map;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0) return NULL;
+
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return NULL;
+  }
+
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (map == MAP_FAILED) return NULL;
+
+  *size = st.st_size;
+  return (uint8_t *)map;
+}
+
+int __index_term_cmp(const void *a, const void *b) {
+
+  return strcmp((*(index_term_t **)a)->term, (*(index_term_t **)b)->term);
+}
+
+int __index_posting_cmp(const void *a, const void *b) {
+
+  posting_t *pa = (posting_t *)a;
+  posting_t *pb = (posting_t *)b;
+
+  if (pa->file   != pb->file)   return pa->file   < pb->file   ? -1 : 1;
+  if (pa->offset != pb->offset) return pa->offset < pb->offset ? -1 : 1;
+  return 0;
+}
+
+int __index_job_cmp(const void *a, const void *b) {
+
+  return strcmp(((index_job_t *)a)->path, ((index_job_t *)b)->path);
+}
@@ -0,0 +1,203 @@
+/**
+ * Inverted index over a corpus of XML files. Building an index scans every
+ * file once (in parallel), and records, for each term, the offsets of the
+ * elements at which it occurs (postings). There are three kinds of terms:
+ *
+ *   - "<name" for an element called name
+ *   - "@name" for an element with an attribute called name
+ *   - "word"  for an element whose body or attribute values contain the
+ *             (lower case) word - words are runs of alphanumeric characters
+ *
+ * The index is saved to a single file, with the terms in sorted order, so a
+ * query only needs to map the file and binary search for the term, and can
+ * then reparse just the matching elements with index_extract. Updating an
+ * index only scans files which are new, or have changed, since it was built.
+ *
+ * Paul McCarthy <paul.mccarthy@gmail.com>
+ */
+#ifndef __INDEX_H__
+#define __INDEX_H__
+
+#include <stdint.h>
+#include <time.h>
+
+#include "lilx.h"
+
+/**
+ * Maximum length of a term.
+ */
+#define INDEX_MAX_TERM_LENGTH 64
+
+/*******
+ * Types
+ ******/
+
+/**
+ * The location of an element within the corpus.
+ */
+typedef struct __posting {
+
+  uint32_t file;   /**< index of the file                  */
+  uint32_t offset; /**< offset of the element in the file  */
+} posting_t;
+
+/**
+ * A file in the corpus.
+ */
+typedef struct __index_file {
+
+  char    *path;  /**< file path                          */
+  int64_t  mtime; /**< modification time when scanned     */
+  uint64_t size;  /**< size when scanned                  */
+  uint8_t  dead;  /**< non-0 if the file has been removed */
+} index_file_t;
+
+/**
+ * A term, and its postings.
+ */
+typedef struct __index_term {
+
+  char      *term;         /**< the term                */
+  uint32_t   num_postings; /**< number of postings      */
+  uint32_t   cap_postings; /**< capacity of postings    */
+  posting_t *postings;     /**< the postings            */
+} index_term_t;
+
+/**
+ * An index which is being built or updated, held in memory. The fields
+ * should never be accessed directly.
+ */
+typedef struct __index {
+
+  uint32_t      num_files; /**< number of files           */
+  uint32_t      cap_files; /**< capacity of files         */
+  index_file_t *files;     /**< the files                 */
+  uint32_t      num_terms; /**< number of terms           */
+  uint32_t      cap_terms; /**< size of the hash table    */
+  index_term_t *terms;     /**< hash table of terms       */
+} index_t;
+
+/**
+ * A saved index, opened for queries. The fields should never be accessed
+ * directly.
+ */
+typedef struct __index_reader {
+
+  uint8_t *map;       /**< the mapped index file          */
+  uint64_t size;      /**< size of the index file         */
+  uint32_t num_files; /**< number of files                */
+  uint32_t num_terms; /**< number of terms                */
+  uint64_t files;     /**< offset of the file table       */
+  uint64_t dir;       /**< offset of the term directory   */
+} index_reader_t;
+
+/********************
+ * Building an index
+ *******************/
+
+/**
+ * Loads the index saved in the given file, so that it can be updated, or
+ * initialises an empty index if the file does not exist.
+ *
+ * \return 0 on success, non-0 on failure.
+ */
+uint8_t index_open(
+  index_t *index, /**< the index            */
+  char    *path   /**< the saved index file */
+);
+
+/**
+ * Adds the given files (and every file below the given directories) to the
+ * index, scanning them with the given number of threads. Files which are
+ * already in the index, and have not changed since, are not scanned again.
+ * Files which are in the index, but no longer exist, are removed. Other
+ * files in the index are left as they are, so a new directory can be added
+ * to an existing index without listing the old ones again.
+ *
+ * \return 0 on success, non-0 on failure. Files which can't be parsed are
+ * reported on stderr and skipped.
+ */
+uint8_t index_add(
+  index_t *index,    /**< the index                   */
+  char   **paths,    /**< files and directories       */
+  uint32_t num_paths,/**< number of paths             */
+  uint8_t  nthreads  /**< number of threads to use    */
+);
+
+/**
+ * Saves the index to the given file.
+ *
+ * \return 0 on success, non-0 on failure.
+ */
+uint8_t index_save(
+  index_t *index, /**< the index         */
+  char    *path   /**< file to save it to */
+);
+
+/**
+ * Frees the memory that has been allocated for the given index.
+ */
+void index_free(
+  index_t *index /**< the index */
+);
+
+/*********************
+ * Querying an index
+ ********************/
+
+/**
+ * Opens a saved index for querying.
+ *
+ * \return 0 on success, non-0 on failure.
+ */
+uint8_t index_reader_open(
+  index_reader_t *reader, /**< the reader           */
+  char           *path    /**< the saved index file */
+);
+
+/**
+ * Closes a saved index.
+ */
+void index_reader_close(
+  index_reader_t *reader /**< the reader */
+);
+
+/**
+ * Looks up the postings for the given term, in file and offset order.
+ *
+ * \return the number of postings which were stored in the given array
+ * (which is at most postings_length), or 0 if the term is not in the index.
+ * If total is not NULL, the total number of postings for the term is stored
+ * in it.
+ */
+uint32_t index_lookup(
+  index_reader_t *reader,          /**< the reader                         */
+  char           *term,            /**< the term                           */
+  posting_t      *postings,        /**< place to store the postings        */
+  uint32_t        postings_length, /**< length of the postings array       */
+  uint32_t       *total            /**< place to store the total, or NULL  */
+);
+
+/**
+ * \return the path of the given file, or NULL if there is no such file.
+ * The string belongs to the reader.
+ */
+char * index_file_path(
+  index_reader_t *reader, /**< the reader         */
+  uint32_t        file    /**< index of the file  */
+);
+
+/**
+ * Parses just the element at the given offset of the given file, creating
+ * a tree with the element as the only child of the given root.
+ *
+ * \return 0 on success, non-0 on failure. On success, the tree must be freed
+ * with lilx_free_tree.
+ */
+uint8_t index_extract(
+  char      *path,   /**< the file                            */
+  uint32_t   offset, /**< offset of the element in the file   */
+  element_t *root    /**< pointer to an element to use as root */
+);
+
+#endif /* __INDEX_H__ */
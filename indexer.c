@@ -0,0 +1,134 @@
+/**
+ * lilxindex - builds, and queries, an inverted index over XML files.
+ *
+ * usage: lilxindex [-j threads] build index file|dir ...
+ *        lilxindex [-m max] [-x] query index term
+ *
+ * build creates the index file, or updates it if it already exists - only
+ * files which are new, or have changed, are scanned. Files which have gone,
+ * from the given directories or from the disk, are removed from the index.
+ * Other files already in the index are kept, so more can be added later.
+ *
+ * query prints the file name and element offset of each posting for the
+ * term (see index.h), e.g. "<person", "@id" or "smith".
+ *
+ *   -j threads  number of threads (default: number of CPUs)
+ *   -m max      print at most max postings (default: all of them)
+ *   -x          reparse each matching element, and print it
+ *
+ * Paul McCarthy <paul.mccarthy@gmail.com>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lilx.h"
+#include "index.h"
+
+static void usage(void) {
+  printf("usage: lilxindex [-j threads] build index file|dir ...\n"
+         "       lilxindex [-m max] [-x] query index term\n");
+  exit(1);
+}
+
+/**
+ * Builds or updates an index.
+ */
+static int build(char *path, char **files, int nfiles, long nthreads) {
+
+  index_t index;
+
+  if (index_open(&index, path) != 0) {
+    fprintf(stderr, "lilxindex: %s: not an index\n", path);
+    return 1;
+  }
+
+  if (nthreads > 255) nthreads = 255;
+
+  if (index_add(&index, files, nfiles, nthreads) != 0 ||
+      index_save(&index, path) != 0) {
+    fprintf(stderr, "lilxindex: %s: couldn't build index\n", path);
+    index_free(&index);
+    return 1;
+  }
+
+  index_free(&index);
+  return 0;
+}
+
+/**
+ * Prints the postings for a term.
+ */
+static int query(char *path, char *term, long max, int extract) {
+
+  index_reader_t reader;
+  posting_t *postings;
+  element_t root;
+  uint32_t i, num, total;
+  char *file;
+
+  if (index_reader_open(&reader, path) != 0) {
+    fprintf(stderr, "lilxindex: %s: not an index\n", path);
+    return 1;
+  }
+
+  index_lookup(&reader, term, NULL, 0, &total);
+  if (max > 0 && max < total) total = max;
+
+  postings = malloc((total + 1) * sizeof(posting_t));
+  if (postings == NULL) return 1;
+
+  num = index_lookup(&reader, term, postings, total, NULL);
+
+  for (i = 0; i < num; i++) {
+
+    file = index_file_path(&reader, postings[i].file);
+
+    printf("%s:%lu\n", file, (unsigned long)postings[i].offset);
+
+    if (!extract) continue;
+
+    if (index_extract(file, postings[i].offset, &root) != 0) {
+      fprintf(stderr, "lilxindex: %s:%lu: couldn't parse element\n",
+        file, (unsigned long)postings[i].offset);
+      continue;
+    }
+
+    lilx_print_tree(root.children[0]);
+    lilx_free_tree(&root);
+  }
+
+  free(postings);
+  index_reader_close(&reader);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+
+  long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  long max      = 0;
+  int  extract  = 0;
+  int  opt;
+
+  while ((opt = getopt(argc, argv, "j:m:x")) != -1) {
+    switch (opt) {
+      case 'j': nthreads = atol(optarg); break;
+      case 'm': max      = atol(optarg); break;
+      case 'x': extract  = 1;            break;
+      default:  usage();
+    }
+  }
+
+  if (argc - optind < 3) usage();
+
+  if (strcmp(argv[optind], "build") == 0)
+    return build(argv[optind + 1], argv + optind + 2, argc - optind - 2,
+                 nthreads);
+
+  if (strcmp(argv[optind], "query") == 0 && argc - optind == 3)
+    return query(argv[optind + 1], argv[optind + 2], max, extract);
+
+  usage();
+  return 1;
+}
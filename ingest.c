@@ -0,0 +1,789 @@
+/**
+ * Bulk ingest of XML files.
+ *
+ * Buffers move between three lists: free, in flight (being read), and
+ * ready (read, and waiting to be parsed). The reader takes a free buffer,
+ * opens the next file into it, and queues a read; when the read completes,
+ * the buffer goes on the ready list, and the worker which parses it puts it
+ * back on the free list. The reader only blocks waiting for a free buffer
+ * when it has no reads in flight - otherwise it waits for completions.
+ *
+ * Once it has been read, a buffer goes on the ready list of its lane. Workers
+ * take small files first, and only take a large file if fewer than
+ * large_threads workers are already parsing one. A worker parsing a large
+ * file in slices parses the small files which were waiting after each slice
+ * (small files are never sliced, so this doesn't go any deeper).
+ *
+ * The io_uring reader maps the submission and completion rings itself, and
+ * uses IORING_OP_READV, which has been there since io_uring first appeared
+ * (5.1). A short read is resubmitted for the rest of the file. Files are
+ * opened and closed synchronously - it's the reads that take the time.
+ *
+ * Paul McCarthy <paul.mccarthy@gmail.com>
+ */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include "lilx.h"
+#include "ingest.h"
+
+/**
+ * Maximum number of pread threads.
+ */
+#define INGEST_MAX_READERS 64
+
+/**
+ * A buffer, and the file that is being read into it.
+ */
+typedef struct __ingest_buffer {
+
+  char                   *data;   /**< the buffer                     */
+  uint32_t                cap;    /**< capacity of the buffer         */
+  uint32_t                len;    /**< number of bytes read so far    */
+  uint32_t                size;   /**< size of the file               */
+  uint32_t                file;   /**< index of the file              */
+  int                     fd;     /**< the open file, or -1           */
+  uint8_t                 fail;   /**< non-0 if the file couldn't be
+                                       read                           */
+  uint8_t                 lane;   /**< INGEST_LANE_*, once read       */
+  uint64_t                queued; /**< when it was put on the ready
+                                       list, in microseconds          */
+  struct iovec            iov;    /**< for IORING_OP_READV            */
+  struct __ingest_buffer *next;   /**< next buffer in the same list   */
+} ingest_buffer_t;
+
+/**
+ * The submission and completion rings of an io_uring.
+ */
+typedef struct __ingest_ring {
+
+  int                  fd;        /**< the io_uring                   */
+  void                *sq_map;    /**< mapped submission ring         */
+  size_t               sq_size;   /**< size of sq_map                 */
+  void                *cq_map;    /**< mapped completion ring         */
+  size_t               cq_size;   /**< size of cq_map                 */
+  struct io_uring_sqe *sqes;      /**< mapped submission entries      */
+  size_t               sqes_size; /**< size of sqes                   */
+  uint32_t            *sq_tail;   /**< submission ring tail           */
+  uint32_t            *sq_mask;   /**< submission ring mask           */
+  uint32_t            *sq_array;  /**< submission ring entries        */
+  uint32_t            *cq_head;   /**< completion ring head           */
+  uint32_t            *cq_tail;   /**< completion ring tail           */
+  uint32_t            *cq_mask;   /**< completion ring mask           */
+  struct io_uring_cqe *cqes;      /**< completion ring entries        */
+} ingest_ring_t;
+
+/**
+ * State shared by the reader and the workers.
+ */
+typedef struct __ingest {
+
+  char             **paths;     /**< the files                        */
+  uint32_t           num_paths; /**< number of files                  */
+  uint32_t           next;      /**< next file to read                */
+  ingest_options_t  *options;   /**< the options                      */
+  ingest_handler_t   handler;   /**< called with each tree            */
+  void              *context;   /**< passed to the handler            */
+  ingest_stats_t     stats;     /**< the stats so far                 */
+  ingest_buffer_t   *buffers;   /**< all of the buffers               */
+  ingest_buffer_t   *free;      /**< free buffers                     */
+  uint8_t            busy;      /**< workers parsing large files      */
+  uint8_t            max_busy;  /**< most workers which may parse
+                                     large files at once              */
+
+  /** buffers waiting to be parsed, and the last of them, per lane */
+  ingest_buffer_t   *ready[INGEST_NUM_LANES];
+  ingest_buffer_t   *last[INGEST_NUM_LANES];
+
+  /** number of buffers waiting to be parsed, per lane */
+  uint32_t           depth[INGEST_NUM_LANES];
+
+  uint8_t            done;      /**< non-0 once every file is read    */
+  pthread_mutex_t    lock;      /**< protects everything above        */
+  pthread_cond_t     freed;     /**< signalled when a buffer is freed */
+  pthread_cond_t     queued;    /**< signalled when a buffer is ready,
+                                     and when done is set             */
+} ingest_t;
+
+/*****************************
+ * Private function prototypes
+ ****************************/
+
+/**
+ * Takes a buffer off the free list.
+ *
+ * \return the buffer, or NULL if there are none and \p wait is 0.
+ */
+static ingest_buffer_t * __ingest_take(
+  ingest_t *ingest, /**< the ingest                                   */
+  uint8_t   wait    /**< non-0 to wait for a buffer if there are none */
+);
+
+/**
+ * Puts a buffer, which has been read, on the ready list of its lane.
+ */
+static void __ingest_queue(
+  ingest_t        *ingest, /**< the ingest  */
+  ingest_buffer_t *buffer  /**< the buffer  */
+);
+
+/**
+ * Takes the next buffer to parse off the ready lists - a small file if there
+ * are any, otherwise, if \p large is non-0 and there is room in the large
+ * lane, a large file - and updates the wait stats. Call with the lock held.
+ *
+ * \return the buffer, or NULL if there is none to take.
+ */
+static ingest_buffer_t * __ingest_next(
+  ingest_t *ingest, /**< the ingest                                */
+  uint8_t   large   /**< non-0 if a large file may be taken        */
+);
+
+/**
+ * Parses the file in a buffer, passes it to the handler, and puts the
+ * buffer back on the free list.
+ */
+static void __ingest_handle(
+  ingest_t        *ingest, /**< the ingest  */
+  ingest_buffer_t *buffer  /**< the buffer  */
+);
+
+/**
+ * \return the time, in microseconds, from an arbitrary starting point.
+ */
+static uint64_t __ingest_now(void);
+
+/**
+ * Opens the given file, and makes sure that the buffer is big enough for
+ * it. If this fails, the buffer's fail flag is set.
+ *
+ * \return 0 if there is something to read, non-0 if the buffer is ready
+ * to be parsed already (the file was empty, or couldn't be opened).
+ */
+static uint8_t __ingest_open(
+  ingest_t        *ingest, /**< the ingest          */
+  ingest_buffer_t *buffer, /**< the buffer          */
+  uint32_t         file    /**< index of the file   */
+);
+
+/**
+ * Sets up an io_uring with the given number of entries.
+ *
+ * \return 0 on success, non-0 if io_uring is not available.
+ */
+static uint8_t __ingest_ring_init(
+  ingest_ring_t *ring,   /**< the ring to set up    */
+  uint32_t       entries /**< size of the ring      */
+);
+
+/**
+ * Unmaps and closes an io_uring.
+ */
+static void __ingest_ring_free(
+  ingest_ring_t *ring /**< the ring */
+);
+
+/**
+ * Adds a read of the rest of the file to the submission ring. Doesn't
+ * submit it.
+ */
+static void __ingest_ring_read(
+  ingest_ring_t   *ring,  /**< the ring    */
+  ingest_buffer_t *buffer /**< the buffer  */
+);
+
+/**
+ * Reads every file through the given io_uring.
+ *
+ * \return 0 on success, non-0 if io_uring_enter failed.
+ */
+static uint8_t __ingest_uring(
+  ingest_t      *ingest, /**< the ingest  */
+  ingest_ring_t *ring    /**< the ring    */
+);
+
+/**
+ * Thread which reads files with pread.
+ */
+static void * __ingest_reader(
+  void *arg /**< the ingest_t */
+);
+
+/**
+ * Thread which parses buffers as they become ready.
+ */
+static void * __ingest_worker(
+  void *arg /**< the ingest_t */
+);
+
+/****************************
+ * Public interface functions
+ ***************************/
+
+void ingest_defaults(ingest_options_t *options) {
+
+  long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+  options->queue_depth   = INGEST_QUEUE_DEPTH;
+  options->num_buffers   = 2 * INGEST_QUEUE_DEPTH;
+  options->buffer_size   = INGEST_BUFFER_SIZE;
+  options->nthreads      = (ncpus < 1) ? 1 : (ncpus > 255) ? 255 : ncpus;
+  options->flags         = 0;
+  options->limits        = NULL;
+  options->large_size    = INGEST_LARGE_SIZE;
+  options->large_threads = 0;
+  options->slice_size    = INGEST_SLICE_SIZE;
+}
+
+uint8_t ingest_files(char **paths, uint32_t num_paths,
+ingest_options_t *options, ingest_handler_t handler, void *context,
+ingest_stats_t *stats) {
+
+  ingest_t       ingest;
+  ingest_ring_t  ring;
+  pthread_t      workers[255];
+  pthread_t      readers[INGEST_MAX_READERS];
+  uint32_t       i, nworkers = 0, nreaders = 0;
+  uint8_t        result = 0;
+
+  if (options->queue_depth == 0 || options->num_buffers == 0 ||
+      options->nthreads    == 0)
+    return 1;
+
+  memset(&ingest, 0, sizeof(ingest));
+  ingest.paths     = paths;
+  ingest.num_paths = num_paths;
+  ingest.options   = options;
+  ingest.handler   = handler;
+  ingest.context   = context;
+
+  /*leave a worker free for small files, if there's more than one*/
+  ingest.max_busy = options->large_threads;
+
+  if (ingest.max_busy == 0)
+    ingest.max_busy = (options->nthreads > 1) ? options->nthreads - 1 : 1;
+  if (ingest.max_busy > options->nthreads)
+    ingest.max_busy = options->nthreads;
+
+  ingest.buffers = calloc(options->num_buffers, sizeof(ingest_buffer_t));
+  if (ingest.buffers == NULL) return 1;
+
+  for (i = 0; i < options->num_buffers; i++) {
+
+    ingest.buffers[i].data = malloc(options->buffer_size);
+    if (ingest.buffers[i].data == NULL) {
+      result = 1;
+      goto out;
+    }
+
+    ingest.buffers[i].cap  = options->buffer_size;
+    ingest.buffers[i].fd   = -1;
+    ingest.buffers[i].next = ingest.free;
+    ingest.free            = &ingest.buffers[i];
+  }
+
+  pthread_mutex_init(&ingest.lock,   NULL);
+  pthread_cond_init (&ingest.freed,  NULL);
+  pthread_cond_init (&ingest.queued, NULL);
+
+  for (; nworkers < options->nthreads; nworkers++)
+    if (pthread_create(&workers[nworkers], NULL, &__ingest_worker, &ingest))
+      break;
+
+  if (nworkers == 0) result = 1;
+
+  else if (!(options->flags & INGEST_PREAD) &&
+      __ingest_ring_init(&ring, options->queue_depth) == 0) {
+
+    ingest.stats.backend = INGEST_BACKEND_URING;
+    result = __ingest_uring(&ingest, &ring);
+    __ingest_ring_free(&ring);
+  }
+  else {
+
+    /*each reader holds a buffer, so there's no point in more than that*/
+    ingest.stats.backend = INGEST_BACKEND_PREAD;
+
+    for (; nreaders < options->queue_depth &&
+           nreaders < options->num_buffers &&
+           nreaders < INGEST_MAX_READERS; nreaders++)
+      if (pthread_create(&readers[nreaders], NULL, &__ingest_reader, &ingest))
+        break;
+
+    if (nreaders == 0) result = 1;
+
+    for (i = 0; i < nreaders; i++) pthread_join(readers[i], NULL);
+  }
+
+  pthread_mutex_lock(&ingest.lock);
+  ingest.done = 1;
+  pthread_cond_broadcast(&ingest.queued);
+  pthread_mutex_unlock(&ingest.lock);
+
+  for (i = 0; i < nworkers; i++) pthread_join(workers[i], NULL);
+
+  pthread_mutex_destroy(&ingest.lock);
+  pthread_cond_destroy (&ingest.freed);
+  pthread_cond_destroy (&ingest.queued);
+
+out:
+  for (i = 0; i < options->num_buffers; i++) free(ingest.buffers[i].data);
+  free(ingest.buffers);
+
+  if (stats != NULL) *stats = ingest.stats;
+
+  return result;
+}
+
+uint64_t ingest_wait_percentile(ingest_lane_stats_t *lane, double p) {
+
+  uint64_t count = 0, target;
+  uint8_t  i;
+
+  if (lane->files == 0) return 0;
+
+  target = (uint64_t)(p * lane->files + 0.5);
+  if (target < 1)           target = 1;
+  if (target > lane->files) target = lane->files;
+
+  for (i = 0; i < INGEST_WAIT_BUCKETS; i++) {
+    count += lane->waits[i];
+    if (count >= target) break;
+  }
+
+  /*the last bucket has no upper bound*/
+  if (i >= INGEST_WAIT_BUCKETS - 1) return lane->max_wait;
+
+  return (uint64_t)1 << i;
+}
+
+/*******************
+ * Private functions
+ ******************/
+
+ingest_buffer_t * __ingest_take(ingest_t *ingest, uint8_t wait) {
+
+  ingest_buffer_t *buffer;
+
+  pthread_mutex_lock(&ingest->lock);
+
+  while (wait && ingest->free == NULL)
+    pthread_cond_wait(&ingest->freed, &ingest->lock);
+
+  buffer = ingest->free;
+  if (buffer != NULL) ingest->free = buffer->next;
+
+  pthread_mutex_unlock(&ingest->lock);
+
+  return buffer;
+}
+
+void __ingest_queue(ingest_t *ingest, ingest_buffer_t *buffer) {
+
+  ingest_lane_stats_t *stats;
+  uint32_t             large = ingest->options->large_size;
+  uint8_t              lane;
+
+  if (buffer->fd >= 0) close(buffer->fd);
+  buffer->fd   = -1;
+  buffer->next = NULL;
+
+  /*files which couldn't be read are quick to deal with*/
+  lane = (large != 0 && !buffer->fail && buffer->len >= large) ?
+    INGEST_LANE_LARGE : INGEST_LANE_SMALL;
+
+  buffer->lane = lane;
+
+  pthread_mutex_lock(&ingest->lock);
+
+  if (ingest->ready[lane] == NULL) ingest->ready[lane]      = buffer;
+  else                             ingest->last[lane]->next = buffer;
+  ingest->last[lane] = buffer;
+
+  stats = &ingest->stats.lanes[lane];
+
+  ingest->depth[lane]++;
+  stats->files++;
+  stats->sum_depth += ingest->depth[lane];
+  if (ingest->depth[lane] > stats->max_depth)
+    stats->max_depth = ingest->depth[lane];
+
+  buffer->queued = __ingest_now();
+
+  pthread_cond_signal(&ingest->queued);
+  pthread_mutex_unlock(&ingest->lock);
+}
+
+ingest_buffer_t * __ingest_next(ingest_t *ingest, uint8_t large) {
+
+  ingest_lane_stats_t *stats;
+  ingest_buffer_t     *buffer;
+  uint64_t             wait;
+  uint8_t              lane = INGEST_LANE_SMALL, bucket = 0;
+
+  if (ingest->ready[INGEST_LANE_SMALL] == NULL) {
+
+    if (!large || ingest->ready[INGEST_LANE_LARGE] == NULL ||
+        ingest->busy >= ingest->max_busy)
+      return NULL;
+
+    lane = INGEST_LANE_LARGE;
+    ingest->busy++;
+  }
+
+  buffer              = ingest->ready[lane];
+  ingest->ready[lane] = buffer->next;
+  ingest->depth[lane]--;
+
+  stats = &ingest->stats.lanes[lane];
+  wait  = __ingest_now() - buffer->queued;
+
+  stats->sum_wait += wait;
+  if (wait > stats->max_wait) stats->max_wait = wait;
+
+  while (wait > 0 && bucket < INGEST_WAIT_BUCKETS - 1) {
+    wait >>= 1;
+    bucket++;
+  }
+  stats->waits[bucket]++;
+
+  return buffer;
+}
+
+uint8_t __ingest_open(ingest_t *ingest, ingest_buffer_t *buffer,
+uint32_t file) {
+
+  struct stat st;
+  char *data;
+
+  buffer->file = file;
+  buffer->len  = 0;
+  buffer->size = 0;
+  buffer->fail = 1;
+  buffer->fd   = open(ingest->paths[file], O_RDONLY);
+
+  if (buffer->fd < 0) return 1;
+
+  if (fstat(buffer->fd, &st) != 0 || st.st_size > UINT32_MAX) return 1;
+
+  if (st.st_size > buffer->cap) {
+
+    data = realloc(buffer->data, st.st_size);
+    if (data == NULL) return 1;
+
+    buffer->data = data;
+    buffer->cap  = st.st_size;
+  }
+
+  buffer->size = st.st_size;
+  buffer->fail = 0;
+
+  return buffer->size == 0;
+}
+
+uint8_t __ingest_ring_init(ingest_ring_t *ring, uint32_t entries) {
+
+  struct io_uring_params params;
+  uint8_t *sq, *cq;
+
+  memset(&params, 0, sizeof(params));
+  memset(ring,    0, sizeof(ingest_ring_t));
+
+  ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+  if (ring->fd < 0) return 1;
+
+  ring->sq_size   = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+  ring->cq_size   = params.cq_off.cqes  +
+                    params.cq_entries * sizeof(struct io_uring_cqe);
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+  /*newer kernels map both rings at once*/
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cq_size > ring->sq_size) ring->sq_size = ring->cq_size;
+    ring->cq_size = 0;
+  }
+
+  ring->sq_map = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sq_map == MAP_FAILED) goto fail;
+
+  if (ring->cq_size == 0) ring->cq_map = ring->sq_map;
+  else {
+    ring->cq_map = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cq_map == MAP_FAILED) goto fail;
+  }
+
+  ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) goto fail;
+
+  sq = ring->sq_map;
+  cq = ring->cq_map;
+
+  ring->sq_tail  = (uint32_t *)(sq + params.sq_off.tail);
+  ring->sq_mask  = (uint32_t *)(sq + params.sq_off.ring_mask);
+  ring->sq_array = (uint32_t *)(sq + params.sq_off.array);
+  ring->cq_head  = (uint32_t *)(cq + params.cq_off.head);
+  ring->cq_tail  = (uint32_t *)(cq + params.cq_off.tail);
+  ring->cq_mask  = (uint32_t *)(cq + params.cq_off.ring_mask);
+  ring->cqes     = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+  return 0;
+
+fail:
+  if (ring->sq_map != NULL && ring->sq_map != MAP_FAILED)
+    munmap(ring->sq_map, ring->sq_size);
+  if (ring->cq_size != 0 && ring->cq_map != NULL && ring->cq_map != MAP_FAILED)
+    munmap(ring->cq_map, ring->cq_size);
+  close(ring->fd);
+  return 1;
+}
+
+void __ingest_ring_free(ingest_ring_t *ring) {
+
+  munmap(ring->sqes,   ring->sqes_size);
+  munmap(ring->sq_map, ring->sq_size);
+  if (ring->cq_size != 0) munmap(ring->cq_map, ring->cq_size);
+  close(ring->fd);
+}
+
+void __ingest_ring_read(ingest_ring_t *ring, ingest_buffer_t *buffer) {
+
+  uint32_t             tail = *ring->sq_tail;
+  uint32_t             idx  = tail & *ring->sq_mask;
+  struct io_uring_sqe *sqe  = &ring->sqes[idx];
+
+  buffer->iov.iov_base = buffer->data + buffer->len;
+  buffer->iov.iov_len  = buffer->size - buffer->len;
+
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  sqe->opcode    = IORING_OP_READV;
+  sqe->fd        = buffer->fd;
+  sqe->addr      = (uint64_t)(uintptr_t)&buffer->iov;
+  sqe->len       = 1;
+  sqe->off       = buffer->len;
+  sqe->user_data = (uint64_t)(uintptr_t)buffer;
+
+  ring->sq_array[idx] = idx;
+
+  /*the kernel must see the entry before it sees the new tail*/
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+uint8_t __ingest_uring(ingest_t *ingest, ingest_ring_t *ring) {
+
+  ingest_buffer_t     *buffer;
+  struct io_uring_cqe *cqe;
+  uint32_t             head, depth = ingest->options->queue_depth;
+  uint32_t             inflight = 0, pending = 0;
+  int                  ret;
+
+  while (1) {
+
+    /*queue reads while there are files, buffers and room in the ring -
+      only wait for a buffer if there's nothing else to wait for*/
+    while (inflight + pending < depth && ingest->next < ingest->num_paths) {
+
+      buffer = __ingest_take(ingest, inflight + pending == 0);
+      if (buffer == NULL) break;
+
+      if (__ingest_open(ingest, buffer, ingest->next++) != 0)
+        __ingest_queue(ingest, buffer);
+      else {
+        __ingest_ring_read(ring, buffer);
+        pending++;
+      }
+    }
+
+    if (inflight + pending == 0) {
+      if (ingest->next >= ingest->num_paths) break;
+      continue;
+    }
+
+    /*submit the new reads, and wait for at least one to complete*/
+    ret = syscall(__NR_io_uring_enter, ring->fd, pending, 1,
+                  IORING_ENTER_GETEVENTS, NULL, 0);
+
+    if (ret < 0) {
+      if (errno == EINTR) continue;
+      return 1;
+    }
+
+    inflight += ret;
+    pending  -= ret;
+
+    head = *ring->cq_head;
+
+    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+
+      cqe    = &ring->cqes[head & *ring->cq_mask];
+      buffer = (ingest_buffer_t *)(uintptr_t)cqe->user_data;
+      head++;
+
+      if      (cqe->res < 0)  buffer->fail = 1;
+      else if (cqe->res == 0) buffer->size = buffer->len; /*truncated*/
+      else                    buffer->len += cqe->res;
+
+      /*the rest of a short read goes back in the ring*/
+      if (!buffer->fail && buffer->len < buffer->size) {
+        __ingest_ring_read(ring, buffer);
+        pending++;
+      }
+      else
+        __ingest_queue(ingest, buffer);
+
+      inflight--;
+    }
+
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+  }
+
+  return 0;
+}
+
+void * __ingest_reader(void *arg) {
+
+  ingest_t        *ingest = (ingest_t *)arg;
+  ingest_buffer_t *buffer;
+  uint32_t         file;
+  ssize_t          n;
+
+  while (1) {
+
+    pthread_mutex_lock(&ingest->lock);
+    file = ingest->next;
+    if (file < ingest->num_paths) ingest->next++;
+    pthread_mutex_unlock(&ingest->lock);
+
+    if (file >= ingest->num_paths) break;
+
+    buffer = __ingest_take(ingest, 1);
+
+    if (__ingest_open(ingest, buffer, file) == 0) {
+
+      while (buffer->len < buffer->size) {
+
+        n = pread(buffer->fd, buffer->data + buffer->len,
+                  buffer->size - buffer->len, buffer->len);
+
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) { buffer->fail = 1;           break; }
+        if (n == 0) { buffer->size = buffer->len; break; }
+
+        buffer->len += n;
+      }
+    }
+
+    __ingest_queue(ingest, buffer);
+  }
+
+  return NULL;
+}
+
+void * __ingest_worker(void *arg) {
+
+  ingest_t        *ingest = (ingest_t *)arg;
+  ingest_buffer_t *buffer;
+
+  while (1) {
+
+    pthread_mutex_lock(&ingest->lock);
+
+    /*a large file may be waiting for room in its lane*/
+    while ((buffer = __ingest_next(ingest, 1)) == NULL &&
+           !(ingest->done && ingest->ready[INGEST_LANE_LARGE] == NULL))
+      pthread_cond_wait(&ingest->queued, &ingest->lock);
+
+    pthread_mutex_unlock(&ingest->lock);
+
+    if (buffer == NULL) break;
+
+    __ingest_handle(ingest, buffer);
+  }
+
+  return NULL;
+}
+
+void __ingest_handle(ingest_t *ingest, ingest_buffer_t *buffer) {
+
+  ingest_buffer_t *small;
+  parser_t         parser;
+  element_t        root;
+  uint32_t         slice = ingest->options->slice_size;
+  uint32_t         n;
+  uint8_t          result = LILX_ERROR;
+
+  if (!buffer->fail && lilx_parser_init(&parser, &root) == 0) {
+
+    parser.limits = ingest->options->limits;
+
+    if (buffer->lane == INGEST_LANE_SMALL || slice == 0)
+      result = lilx_parse(&parser, buffer->data, buffer->len, 1);
+
+    else while ((result = lilx_parse_step(
+                   &parser, buffer->data, buffer->len, slice)) == LILX_MORE) {
+
+      /*let the small files which are waiting go first*/
+      pthread_mutex_lock(&ingest->lock);
+      n = ingest->depth[INGEST_LANE_SMALL];
+      pthread_mutex_unlock(&ingest->lock);
+
+      for (; n > 0; n--) {
+
+        pthread_mutex_lock(&ingest->lock);
+        small = __ingest_next(ingest, 0);
+        pthread_mutex_unlock(&ingest->lock);
+
+        if (small == NULL) break;
+        __ingest_handle(ingest, small);
+      }
+    }
+  }
+
+  /*the handler doesn't stop the parser, so it's either done or failed*/
+  if (result == LILX_OK) {
+    ingest->handler(ingest->context, buffer->file, &root);
+    lilx_free_tree(&root);
+  }
+  else
+    ingest->handler(ingest->context, buffer->file, NULL);
+
+  pthread_mutex_lock(&ingest->lock);
+
+  if (result == LILX_OK) ingest->stats.files++;
+  else                   ingest->stats.failed++;
+  ingest->stats.bytes += buffer->len;
+
+  /*make room in the large lane*/
+  if (buffer->lane == INGEST_LANE_LARGE) {
+    ingest->busy--;
+    pthread_cond_broadcast(&ingest->queued);
+  }
+
+  buffer->next = ingest->free;
+  ingest->free = buffer;
+
+  pthread_cond_signal(&ingest->freed);
+  pthread_mutex_unlock(&ingest->lock);
+}
+
+uint64_t __ingest_now(void) {
+
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
@@ -0,0 +1,188 @@
+/**
+ * Bulk ingest of XML files. Reads are kept in flight in parallel with
+ * parsing: one thread reads files into a fixed pool of buffers, and a pool
+ * of worker threads parses each buffer as soon as its read completes, and
+ * passes the tree to a handler. The reads are submitted in batches through
+ * io_uring (via raw system calls, so there's no dependency on liburing), or,
+ * where io_uring is not available (old kernels, or seccomp filters which
+ * block it), by a pool of threads which use pread.
+ *
+ * Files are sorted into two lanes by size. Small files (messages, usually,
+ * which someone is waiting for) always go first, and only some of the
+ * workers may parse large files at once, so that a few huge documents can't
+ * hold up everything behind them. A large file is also parsed a slice at a
+ * time, and the small files which have arrived in the meantime are parsed
+ * in between slices, so even a single worker doesn't keep small files
+ * waiting for long.
+ *
+ * Linux only.
+ *
+ * Paul McCarthy <paul.mccarthy@gmail.com>
+ */
+#ifndef __INGEST_H__
+#define __INGEST_H__
+
+#include <stdint.h>
+
+#include "lilx.h"
+
+/**
+ * Default number of reads to keep in flight.
+ */
+#define INGEST_QUEUE_DEPTH 64
+
+/**
+ * Default size of each buffer - a buffer grows to fit a larger file, and
+ * then stays that size.
+ */
+#define INGEST_BUFFER_SIZE 65536
+
+/**
+ * Default size, in bytes, from which a file goes in the large lane.
+ */
+#define INGEST_LARGE_SIZE 1048576
+
+/**
+ * Default number of bytes of a large file to parse between looking for
+ * small files.
+ */
+#define INGEST_SLICE_SIZE 262144
+
+/**
+ * The lanes - see ingest_stats_t.
+ */
+#define INGEST_LANE_SMALL 0 /**< files smaller than large_size */
+#define INGEST_LANE_LARGE 1 /**< the rest                      */
+#define INGEST_NUM_LANES  2
+
+/**
+ * Number of buckets in the histogram of wait times - see
+ * ingest_lane_stats_t.
+ */
+#define INGEST_WAIT_BUCKETS 32
+
+/**
+ * Flag which makes ingest_files use pread even if io_uring is available.
+ */
+#define INGEST_PREAD 0x01
+
+/**
+ * How the files were read - see ingest_stats_t.
+ */
+#define INGEST_BACKEND_URING 1 /**< io_uring             */
+#define INGEST_BACKEND_PREAD 2 /**< pool of pread threads */
+
+/*******
+ * Types
+ ******/
+
+/**
+ * Called, from one of the worker threads, with each file once it has been
+ * parsed, roughly in the order in which the reads complete (small files
+ * first) rather than the order of the paths. It may be called by several
+ * workers at once. The tree is freed when the handler returns.
+ */
+typedef void (*ingest_handler_t)(
+  void      *context, /**< the context given to ingest_files        */
+  uint32_t   file,    /**< index of the file in the paths           */
+  element_t *root     /**< root of the tree, or NULL if the file
+                           couldn't be read or parsed               */
+);
+
+/**
+ * Ingest options - initialise with ingest_defaults.
+ */
+typedef struct __ingest_options {
+
+  uint16_t       queue_depth;   /**< number of reads to keep in flight    */
+  uint16_t       num_buffers;   /**< number of buffers - reads in flight
+                                     plus files waiting for, or being,
+                                     parsed                               */
+  uint32_t       buffer_size;   /**< initial size of each buffer          */
+  uint8_t        nthreads;      /**< number of parsing threads            */
+  uint8_t        flags;         /**< INGEST_PREAD                         */
+  lilx_limits_t *limits;        /**< resource limits for each file, or
+                                     NULL                                 */
+  uint32_t       large_size;    /**< files of at least this many bytes go
+                                     in the large lane, 0 for one lane    */
+  uint8_t        large_threads; /**< most workers which may parse large
+                                     files at once, 0 for all but one of
+                                     them (or 1, if there is only one)    */
+  uint32_t       slice_size;    /**< bytes of a large file to parse
+                                     between looking for small files, 0
+                                     to parse large files in one go       */
+} ingest_options_t;
+
+/**
+ * What happened in one lane. A file's wait is the time from when it has
+ * been read until a worker starts to parse it, and the queue depth is the
+ * number of files waiting in the lane, counted as each file joins it.
+ */
+typedef struct __ingest_lane_stats {
+
+  uint32_t files;      /**< number of files in the lane              */
+  uint32_t max_depth;  /**< greatest queue depth                     */
+  uint64_t sum_depth;  /**< sum of the queue depths, for the mean    */
+  uint64_t sum_wait;   /**< total wait, in microseconds              */
+  uint64_t max_wait;   /**< longest wait, in microseconds            */
+
+  /** number of waits of less than 1 microsecond (bucket 0), and of at
+      least 2^(i - 1), but less than 2^i, microseconds (bucket i) */
+  uint32_t waits[INGEST_WAIT_BUCKETS];
+} ingest_lane_stats_t;
+
+/**
+ * What happened during a call to ingest_files.
+ */
+typedef struct __ingest_stats {
+
+  uint32_t files;   /**< number of files parsed            */
+  uint32_t failed;  /**< number which couldn't be read or
+                         parsed                            */
+  uint64_t bytes;   /**< number of bytes read              */
+  uint8_t  backend; /**< INGEST_BACKEND_URING or
+                         INGEST_BACKEND_PREAD              */
+
+  /** per lane stats, indexed by INGEST_LANE_* */
+  ingest_lane_stats_t lanes[INGEST_NUM_LANES];
+} ingest_stats_t;
+
+/**
+ * Sets the given options to the defaults - INGEST_QUEUE_DEPTH reads in
+ * flight, twice as many buffers of INGEST_BUFFER_SIZE bytes, one parsing
+ * thread per CPU, no limits, and files of INGEST_LARGE_SIZE bytes or more
+ * in the large lane, parsed in slices of INGEST_SLICE_SIZE bytes.
+ */
+void ingest_defaults(
+  ingest_options_t *options /**< the options */
+);
+
+/**
+ * Reads and parses the given files, passing each tree to the handler, and
+ * returns once every file has been handled.
+ *
+ * \return 0 on success, non-0 if the threads or buffers couldn't be set up,
+ * or io_uring failed part way through. Files which can't be read or parsed
+ * don't count as failure - they are passed to the handler with a NULL root,
+ * and counted in stats.
+ */
+uint8_t ingest_files(
+  char            **paths,     /**< the files                           */
+  uint32_t          num_paths, /**< number of files                     */
+  ingest_options_t *options,   /**< options                             */
+  ingest_handler_t  handler,   /**< called with each tree               */
+  void             *context,   /**< passed to the handler               */
+  ingest_stats_t   *stats      /**< place to store the stats, or NULL   */
+);
+
+/**
+ * \return an upper bound on the given percentile (e.g. 0.99) of the wait
+ * times in a lane, in microseconds, from the histogram. 0 if the lane had no
+ * files.
+ */
+uint64_t ingest_wait_percentile(
+  ingest_lane_stats_t *lane, /**< the lane stats          */
+  double               p     /**< the percentile, 0 to 1  */
+);
+
+#endif /* __INGEST_H__ */
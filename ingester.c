@@ -0,0 +1,216 @@
+/**
+ * lilxingest - reads and parses a large number of XML files, and reports
+ * how long it took - see ingest.h.
+ *
+ * usage: lilxingest [-j threads] [-q depth] [-b buffers] [-L size] [-S slice]
+ *                   [-p] [-v] file|dir ...
+ *
+ * Directories are read recursively.
+ *
+ *   -j threads  number of parsing threads (default: number of CPUs)
+ *   -q depth    number of reads to keep in flight (default: 64)
+ *   -b buffers  number of buffers (default: twice the queue depth)
+ *   -L size     files of at least this many bytes go in the large lane
+ *               (default: 1048576, 0 for one lane)
+ *   -S slice    bytes of a large file to parse between small files
+ *               (default: 262144, 0 to parse large files in one go)
+ *   -p          use pread threads, even if io_uring is available
+ *   -v          print the name of each file which can't be parsed
+ *
+ * Paul McCarthy <paul.mccarthy@gmail.com>
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "lilx.h"
+#include "ingest.h"
+
+static char  **paths;
+static long    npaths;
+static long    paths_cap;
+static int     verbose;
+static uint64_t elements;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double now(void) {
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * \return the number of elements below the given element.
+ */
+static uint64_t count(element_t *element) {
+
+  uint64_t n = element->num_children;
+  uint16_t i;
+
+  for (i = 0; i < element->num_children; i++)
+    n += count(element->children[i]);
+
+  return n;
+}
+
+static void handler(void *context, uint32_t file, element_t *root) {
+
+  uint64_t n;
+
+  if (root == NULL) {
+    if (verbose)
+      fprintf(stderr, "lilxingest: couldn't parse %s\n", paths[file]);
+    return;
+  }
+
+  n = count(root);
+
+  pthread_mutex_lock(&lock);
+  elements += n;
+  pthread_mutex_unlock(&lock);
+}
+
+/**
+ * Adds the given file to the list, or if it is a directory, every file
+ * below it, in alphabetical order.
+ */
+static void add_path(char *path) {
+
+  struct stat st;
+  struct dirent **entries;
+  char *child;
+  int i, n;
+
+  if (stat(path, &st) != 0) {
+    perror(path);
+    return;
+  }
+
+  if (S_ISDIR(st.st_mode)) {
+
+    n = scandir(path, &entries, NULL, alphasort);
+    if (n < 0) {
+      perror(path);
+      return;
+    }
+
+    for (i = 0; i < n; i++) {
+
+      if (strcmp(entries[i]->d_name, ".")  != 0 &&
+          strcmp(entries[i]->d_name, "..") != 0) {
+
+        if (asprintf(&child, "%s/%s", path, entries[i]->d_name) < 0) exit(1);
+        add_path(child);
+        free(child);
+      }
+      free(entries[i]);
+    }
+    free(entries);
+    return;
+  }
+
+  if (!S_ISREG(st.st_mode)) return;
+
+  if (npaths == paths_cap) {
+    paths_cap = paths_cap ? paths_cap * 2 : 64;
+    paths     = realloc(paths, paths_cap * sizeof(char *));
+    if (paths == NULL) exit(1);
+  }
+
+  paths[npaths] = strdup(path);
+  if (paths[npaths] == NULL) exit(1);
+  npaths++;
+}
+
+static void usage(void) {
+  printf("usage: lilxingest [-j threads] [-q depth] [-b buffers] [-L size] "
+         "[-S slice]\n                  [-p] [-v] file|dir ...\n");
+  exit(1);
+}
+
+/**
+ * Prints the queue depth and wait time stats of a lane.
+ */
+static void print_lane(char *name, ingest_lane_stats_t *lane) {
+
+  if (lane->files == 0) return;
+
+  printf("%s %u files, depth mean %.1f max %u, wait mean %.0f p99 <%llu "
+         "max %llu us\n", name, lane->files,
+    (double)lane->sum_depth / lane->files, lane->max_depth,
+    (double)lane->sum_wait  / lane->files,
+    (unsigned long long)ingest_wait_percentile(lane, 0.99),
+    (unsigned long long)lane->max_wait);
+}
+
+int main(int argc, char *argv[]) {
+
+  ingest_options_t options;
+  ingest_stats_t   stats;
+  long   i, nthreads = -1, depth = INGEST_QUEUE_DEPTH, nbuffers = 0;
+  long   large = INGEST_LARGE_SIZE, slice = INGEST_SLICE_SIZE;
+  double start, elapsed;
+  int    opt;
+
+  ingest_defaults(&options);
+
+  while ((opt = getopt(argc, argv, "j:q:b:L:S:pv")) != -1) {
+    switch (opt) {
+      case 'j': nthreads       = atol(optarg); break;
+      case 'q': depth          = atol(optarg); break;
+      case 'b': nbuffers       = atol(optarg); break;
+      case 'L': large          = atol(optarg); break;
+      case 'S': slice          = atol(optarg); break;
+      case 'p': options.flags |= INGEST_PREAD; break;
+      case 'v': verbose        = 1;            break;
+      default:  usage();
+    }
+  }
+
+  if (argc - optind < 1 || nthreads == 0 || nthreads > 255 || depth < 1 ||
+      depth > 4096 || nbuffers < 0 || nbuffers > UINT16_MAX || large < 0 ||
+      large > UINT32_MAX || slice < 0 || slice > UINT32_MAX)
+    usage();
+
+  if (nthreads > 0) options.nthreads = nthreads;
+  options.queue_depth = depth;
+  options.num_buffers = nbuffers ? nbuffers : 2 * depth;
+  options.large_size  = large;
+  options.slice_size  = slice;
+
+  for (i = optind; i < argc; i++) add_path(argv[i]);
+
+  start = now();
+
+  if (ingest_files(paths, npaths, &options, &handler, NULL, &stats) != 0) {
+    fprintf(stderr, "lilxingest: ingest failed\n");
+    return 1;
+  }
+
+  elapsed = now() - start;
+
+  printf("backend:    %s\n",
+    stats.backend == INGEST_BACKEND_URING ? "io_uring" : "pread");
+  printf("files:      %u parsed, %u failed\n", stats.files, stats.failed);
+  printf("elements:   %llu\n", (unsigned long long)elements);
+  printf("elapsed:    %.3f s\n", elapsed);
+  printf("throughput: %.0f files/s, %.1f MB/s\n",
+    npaths / elapsed, stats.bytes / elapsed / 1e6);
+
+  print_lane("small:     ", &stats.lanes[INGEST_LANE_SMALL]);
+  print_lane("large:     ", &stats.lanes[INGEST_LANE_LARGE]);
+
+  for (i = 0; i < npaths; i++) free(paths[i]);
+  free(paths);
+
+  return stats.failed != 0;
+}
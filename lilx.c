@@ -10,12 +10,108 @@
 #include <ctype.h>
 #include <stdlib.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "lilx.h"
-#include "stack.h"
+#include "schema.h"
+#include "names.h"
+#include "guide.h"
+
+/**
+ * Namespaces which are bound to the xml and xmlns prefixes without being
+ * declared.
+ */
+#define XML_NAMESPACE   "http://www.w3.org/XML/1998/namespace"
+#define XMLNS_NAMESPACE "http://www.w3.org/2000/xmlns/"
+
+/**
+ * Index of the children of an element, sorted by name (and then by position,
+ * so that children with the same name stay in order).
+ */
+struct __lilx_child_map {
+
+  element_t **children;     /**< children array the map was built for */
+  uint16_t    num_children; /**< number of children it was built for  */
+ 
+  /** the children, sorted by name */
+  struct __lilx_child_entry {
+    char    *name;  /**< child name                    */
+    uint16_t index; /**< position in the children array */
+  } *entries;
+};
+
+/**
+ * Rounds a size up so that whatever follows it in a compact subtree (see
+ * lilx_extract_subtree) is suitably aligned.
+ */
+#define LILX_ALIGN(n) (((n) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+/**
+ * Size of each block of a builder's arena - larger allocations get a block
+ * of their own.
+ */
+#define LILX_ARENA_BLOCK_SIZE 65536
+
+/**
+ * Size of the buffer through which lilx_serialise writes its output.
+ */
+#define LILX_OUTPUT_SIZE 4096
+
+/**
+ * A block of memory from which a builder allocates the tree.
+ */
+struct __lilx_arena {
+
+  struct __lilx_arena *next; /**< the next (older) block  */
+  size_t               used; /**< bytes allocated so far  */
+  size_t               size; /**< bytes in the block      */
+};
+
+/**
+ * An element made by a builder, which is linked to its next sibling until
+ * its parent is closed, so that adding a child doesn't copy the children
+ * which are already there.
+ */
+struct __lilx_builder_node {
+
+  element_t                   element; /**< the element          */
+  struct __lilx_builder_node *next;    /**< its next sibling     */
+};
+
+/**
+ * An attribute made by a builder - the value follows it.
+ */
+struct __lilx_builder_attr {
+
+  attribute_t                 attr; /**< the attribute             */
+  struct __lilx_builder_attr *next; /**< the attribute added before */
+};
+
+/**
+ * Output buffer for lilx_serialise.
+ */
+struct __lilx_output {
+
+  lilx_write_t write;                 /**< output function          */
+  void        *context;               /**< its context              */
+  uint8_t      indent;                /**< spaces per level         */
+  uint32_t     len;                   /**< bytes in the buffer      */
+  char         buf[LILX_OUTPUT_SIZE]; /**< the buffer               */
+};
 
 /*uncomment for debug output*/
 /*#define __LILX_DEBUG*/
 
+/*uncomment to check the short cuts taken in trusted mode against the 
+  validating parser, without the rest of the debug output*/
+/*#define LILX_CHECK_TRUSTED*/
+
+#if defined(__LILX_DEBUG) && !defined(LILX_CHECK_TRUSTED)
+#define LILX_CHECK_TRUSTED
+#endif
+
 /*****************************
  * Private function prototypes
  ****************************/
@@ -33,12 +129,28 @@ static void __lilx_init_element(
  * offset pointer. This offset equates to the amount of characters that should
  * be skipped over in the raw xml when processing resumes.
  * 
- * \return 0 if there is a match, non-0 otherwise.
+ * If the input runs out before the comparison can be decided, and the input
+ * is not final, LILX_MORE is returned. If the input is final, the end of the
+ * input is treated as a '\0' character.
+ * 
+ * \return 0 if there is a match, LILX_MORE if more input is needed, 1
+ * otherwise.
  */
 static uint8_t __lilx_compare(
   char    *xml,        /**< the raw xml string                  */
+  char    *end,        /**< end of the available xml            */
+  uint8_t  final,      /**< non-0 if there is no more xml       */
   char    *transition, /**< the string against which to compare */
-  uint8_t *offset      /**< place to store size on a match      */
+  uint32_t *offset     /**< place to store size on a match      */
+);
+
+/**
+ * \return the number of whitespace characters at the start of the given
+ * input. Uses SSE2, where available, to check 16 characters at a time.
+ */
+static uint32_t __lilx_skip_space(
+  char *xml, /**< the input                   */
+  char *end  /**< end of the available input  */
 );
 
 /**
@@ -53,78 +165,85 @@ static uint8_t __lilx_compare(
  * If a state change is detected, the transition string that caused the change
  * is stored in the transition parameter.
  * 
- * \return 0 if the a state change was detected, 1 for no state change.
+ * \return 0 if the a state change was detected, 1 for no state change,
+ * LILX_MORE if more input is needed to tell.
  */
 static uint8_t __lilx_get_next_state(
   uint8_t *current_state, /**< current state, place to store new state      */
   char    *xml,           /**< raw XML input                                */
-  uint8_t *offset,        /**< place to store chars to skip on state change */
+  char    *end,           /**< end of the available XML input               */
+  uint8_t  final,         /**< non-0 if there is no more XML input          */
+  uint32_t *offset,       /**< place to store chars to skip on state change */
   char   **transition     /**< place to store transition on state change    */
 );
 
 /**
  * When we find a new element in the XML, we create an element_t struct, and
- * push it on to the stack. If there is an element already on the stack, the
- * new element is added to it as a child before being pushed on to the
- * stack. If the transition indicates that the element is self-closing, it is
- * not pushed on to the stack.
+ * add it as a child of the innermost open element. Unless the transition
+ * indicates that the element is self-closing, the new element then becomes
+ * the innermost open element.
  * 
- * \return 0 on success, non-0 on failure (malloc or stack_push can fail).
+ * \return 0 on success, non-0 on failure (malloc can fail, or the tree can
+ * get too deep).
  */
 static uint8_t __lilx_elem_name_start_action(
-  stack_t *stack,     /**< the processing stack                        */
-  char    *tkn,       /**< the element name                            */
-  char    *transition /**< the transition which ended the element name */
+  parser_t *parser,    /**< the parser                                  */
+  char     *tkn,       /**< the element name                            */
+  uint16_t  len,       /**< length of the element name                  */
+  char     *transition /**< the transition which ended the element name */
 );
 
 /**
- * When we find an end tag in the XML, make sure the element on top of the
- * stack has the same name as the end tag element, and then pop that element
- * from the stack.
+ * When we find an end tag in the XML, make sure the innermost open element
+ * has the same name as the end tag element, and then close that element.
  * 
  * \return 0 on success, 1 on failure.
  */
 static uint8_t __lilx_elem_name_end_action(
-  stack_t *stack,     /**< the processing stack                   */
-  char    *tkn,       /**< the element name                       */
-  char    *transition /**< the transition which ended the end tag */
+  parser_t *parser,    /**< the parser                             */
+  char     *tkn,       /**< the element name                       */
+  uint16_t  len,       /**< length of the element name             */
+  char     *transition /**< the transition which ended the end tag */
 );
 
 /**
  * When we find an attribute in the XML, create an attribute_t struct, and add
- * it to the element on top of the stack, then push the attribute on to the
- * stack.
+ * it to the innermost open element. The attribute value is filled in by
+ * __lilx_attr_val_action.
  * 
  * \return 0 on success, non-0 on failure.
  */
 static uint8_t __lilx_attr_name_action(
-  stack_t *stack,     /**< the processing stack                          */
-  char    *tkn,       /**< the attribute name                            */
-  char    *transition /**< the transition which ended the attribute name */
+  parser_t *parser,    /**< the parser                                    */
+  char     *tkn,       /**< the attribute name                            */
+  uint16_t  len,       /**< length of the attribute name                  */
+  char     *transition /**< the transition which ended the attribute name */
 );
 
 /**
- * When we find an attribute value, add it to the attribute on top of the
- * stack, and then pop that attribute from the stack.
+ * When we find an attribute value, add it to the last attribute of the
+ * innermost open element. If the transition indicates that the element is
+ * self-closing, the element is closed.
  * 
  * \return 0 on success, non-0 on failure.
  */
 static uint8_t __lilx_attr_val_action(
-  stack_t *stack,     /**< the processing stack                           */
-  char    *tkn,       /**< the attribute value                            */
-  char    *transition /**< the transition which ended the attribute value */
+  parser_t *parser,    /**< the parser                                     */
+  char     *tkn,       /**< the attribute value                            */
+  uint16_t  len,       /**< length of the attribute value                  */
+  char     *transition /**< the transition which ended the attribute value */
 );
 
 /**
- * When we find an element body, add that body to the element on top of the
- * stack.
+ * When we find an element body, add that body to the innermost open element.
  * 
  * \return 0 on success, non-0 on failure.
  */
 static uint8_t __lilx_elem_action(
-  stack_t *stack,     /**< the processing stack                        */
-  char    *tkn,       /**< the element body                            */
-  char    *transition /**< the transition which ended the element body */
+  parser_t *parser,    /**< the parser                                  */
+  char     *tkn,       /**< the element body                            */
+  uint16_t  len,       /**< length of the element body                  */
+  char     *transition /**< the transition which ended the element body */
 );
 
 /**
@@ -133,9 +252,10 @@ static uint8_t __lilx_elem_action(
  * \return 0.
  */
 static uint8_t __lilx_comment_action(
-  stack_t *stack,     /**, the processing stack                         */
-  char    *tkn,       /**< the comment body                             */
-  char    *transition /**< the transition which ended the comment block */
+  parser_t *parser,    /**< the parser                                   */
+  char     *tkn,       /**< the comment body                             */
+  uint16_t  len,       /**< length of the comment body                   */
+  char     *transition /**< the transition which ended the comment block */
 );
 
 /**
@@ -144,9 +264,184 @@ static uint8_t __lilx_comment_action(
  * \return 0.
  */
 static uint8_t __lilx_end_action(
-  stack_t *stack,     /**< the processing stack                */
-  char    *tkn,       /**< not relevant                        */
-  char    *transition /**< the transition that ended the input */
+  parser_t *parser,    /**< the parser                          */
+  char     *tkn,       /**< not relevant                        */
+  uint16_t  len,       /**< not relevant                        */
+  char     *transition /**< the transition that ended the input */
+);
+
+/**
+ * Returns the open element at the given depth, by following the last child
+ * of each element down from the root.
+ * 
+ * \return the open element at the given depth.
+ */
+static element_t * __lilx_open_element(
+  parser_t *parser, /**< the parser                             */
+  uint8_t   depth   /**< depth of the element - 0 is the root   */
+);
+
+/**
+ * Does the work for lilx_parse and lilx_parse_step - carries on parsing from
+ * where the parser left off, stopping once \p max_bytes bytes of input have
+ * been scanned.
+ * 
+ * \return LILX_OK, LILX_MORE or LILX_ERROR, as for lilx_parse.
+ */
+static uint8_t __lilx_parse(
+  parser_t *parser,   /**< the parser                                   */
+  char     *xml,      /**< the input received so far                    */
+  uint32_t  len,      /**< length of the input received so far          */
+  uint8_t   final,    /**< non-0 if there is no more input to come      */
+  uint32_t  max_bytes /**< maximum number of bytes to scan on this call */
+);
+
+/**
+ * Used in trusted mode, when there is no state change at the current
+ * character. Rather than trying every transition at every character, this
+ * function assumes that the input is well-formed, and skips straight to the
+ * next character which could begin a transition out of the current state.
+ * 
+ * \return the offset of the next character at which to look for a state
+ * change, or \p len if there is no such character before it.
+ */
+static uint32_t __lilx_skip(
+  parser_t *parser, /**< the parser                          */
+  char     *xml,    /**< the input received so far           */
+  uint32_t  len     /**< offset at which to stop skipping    */
+);
+
+#ifdef LILX_CHECK_TRUSTED
+/**
+ * Cross-checks __lilx_skip against the validating parser, by making sure
+ * that there would have been no state change at any of the characters
+ * which were skipped over.
+ * 
+ * \return 0 if the skip was valid, non-0 otherwise.
+ */
+static uint8_t __lilx_check_skip(
+  parser_t *parser, /**< the parser                          */
+  char     *xml,    /**< the input received so far           */
+  uint32_t  len,    /**< length of the input received so far */
+  uint8_t   final,  /**< non-0 if there is no more input     */
+  uint32_t  next    /**< offset returned by __lilx_skip      */
+);
+#endif
+
+/**
+ * Passes an event to the parser's handler, if it has one. If the handler
+ * returns LILX_DROP for LILX_EVENT_END, the element is removed from its
+ * parent (which must be the innermost open element) and freed.
+ * 
+ * \return 0, or LILX_STOPPED if the handler wants to stop parsing.
+ */
+static uint8_t __lilx_event(
+  parser_t  *parser, /**< the parser              */
+  uint8_t    event,  /**< the event               */
+  element_t *element /**< the element in question */
+);
+
+/**
+ * Called when parsing fails. Frees the tree, and marks the parser as failed,
+ * so that any further calls to lilx_parse fail.
+ * 
+ * \return LILX_ERROR.
+ */
+static uint8_t __lilx_parse_failed(
+  parser_t *parser /**< the parser */
+);
+
+/**
+ * Adds the given amounts to the parser's counts, and checks them against
+ * its limits (if it has any).
+ * 
+ * \return 0 if the counts are within the limits, LILX_LIMIT otherwise, in
+ * which case the exceeded limit is stored in parser->exceeded.
+ */
+static uint8_t __lilx_charge(
+  parser_t *parser,   /**< the parser                    */
+  uint32_t  elements, /**< number of elements added      */
+  uint32_t  strings,  /**< bytes of strings added        */
+  uint32_t  memory    /**< bytes of memory allocated     */
+);
+
+/**
+ * Takes the given subtree, which is about to be freed, off the parser's
+ * counts.
+ */
+static void __lilx_refund(
+  parser_t  *parser, /**< the parser                        */
+  element_t *element /**< root of the subtree being freed   */
+);
+
+/**
+ * Appends the given string to a checkpoint blob. The string is preceded by a
+ * flag byte, so that NULL strings can be stored.
+ * 
+ * \return 0 on success, 1 if there is not enough room in the blob.
+ */
+static uint8_t __lilx_put_string(
+  uint8_t  *blob, /**< the blob                                */
+  uint32_t  len,  /**< length of the blob                      */
+  uint32_t *off,  /**< current offset into the blob - updated  */
+  char     *str   /**< the string, may be NULL                 */
+);
+
+/**
+ * Reads a string, stored by __lilx_put_string, from a checkpoint blob into
+ * newly malloc'd memory. NULL is stored in \p str if a NULL string was
+ * stored.
+ * 
+ * \return 0 on success, 1 if the blob is bad or malloc fails.
+ */
+static uint8_t __lilx_get_string(
+  uint8_t  *blob, /**< the blob                                */
+  uint32_t  len,  /**< length of the blob                      */
+  uint32_t *off,  /**< current offset into the blob - updated  */
+  char    **str   /**< place to store the string               */
+);
+
+/**
+ * Appends an element to a checkpoint blob - its name and attributes, and
+ * then its text segments and the given number of its children, in document
+ * order. The children are stored in the same way, with all of their own
+ * children, so they are all saved in full.
+ * 
+ * \return 0 on success, 1 if there is not enough room in the blob.
+ */
+static uint8_t __lilx_put_element(
+  uint8_t   *blob,        /**< the blob                               */
+  uint32_t   len,         /**< length of the blob                     */
+  uint32_t  *off,         /**< current offset into the blob - updated */
+  element_t *element,     /**< the element                            */
+  uint16_t   num_children /**< number of children to store            */
+);
+
+/**
+ * Reads an element, stored by __lilx_put_element, from a checkpoint blob
+ * into the given element, which must already be in the tree. The children
+ * which were stored are recreated as closed elements.
+ * 
+ * \return 0 on success, non-0 if the blob is bad or malloc fails.
+ */
+static uint8_t __lilx_get_element(
+  uint8_t   *blob,    /**< the blob                               */
+  uint32_t   len,     /**< length of the blob                     */
+  uint32_t  *off,     /**< current offset into the blob - updated */
+  element_t *element  /**< the element to fill in                 */
+);
+
+/**
+ * Recreates one of the open elements stored in a checkpoint blob, adding it
+ * as a child of the innermost open element, and opening it.
+ * 
+ * \return 0 on success, non-0 on failure.
+ */
+static uint8_t __lilx_restore_element(
+  parser_t *parser, /**< the parser                               */
+  uint8_t  *blob,   /**< the blob                                 */
+  uint32_t  len,    /**< length of the blob                       */
+  uint32_t *off     /**< current offset into the blob - updated   */
 );
 
 /**
@@ -171,298 +466,2609 @@ static uint8_t __lilx_add_child(
 );
 
 /**
- * Adds the given attribute to the given element.
+ * Returns the child map of the given element, building it if the element
+ * doesn't have one, or if the children have changed since it was built.
  * 
- * \return 0 on success, non-0 on failure.
+ * \return the child map, or NULL if the element has too few children to
+ * need one (or malloc failed), in which case the children should be searched
+ * in order.
  */
-static uint8_t __lilx_add_attr(
-  element_t   *element, /**< the element   */
-  attribute_t *attr     /**< the attribute */
+static struct __lilx_child_map * __lilx_get_child_map(
+  element_t *element /**< the element */
 );
 
 /**
- * Recursively prints the given DOM tree via printf.
+ * Finds the first entry in the given child map with the given name.
+ * 
+ * \return the position of the entry, or map->num_children if there is no
+ * child with the given name.
  */
-static void __lilx_print_tree(
-  element_t *root, /**< Root of the tree                   */
-  uint8_t    depth /**< Current depth - pass in 0 to start */
+static uint16_t __lilx_find_child_entry(
+  struct __lilx_child_map *map, /**< the child map         */
+  char                    *name /**< the name to search for */
 );
 
-/****************
- * Private fields
- ***************/
+/**
+ * Compares two child map entries for qsort.
+ */
+static int __lilx_child_entry_cmp(
+  const void *a, /**< pointer to a child map entry */
+  const void *b  /**< pointer to a child map entry */
+);
 
 /**
- * Total number of states
+ * Frees the child map of the given element, if it has one. Called whenever
+ * the children of an element change.
  */
-#define NUM_STATES 7
+static void __lilx_free_child_map(
+  element_t *element /**< the element */
+);
 
 /**
- * The states that can exist during parsing.
+ * \return the bits which the given name sets in an element summary - two
+ * bits, taken from an FNV-1a hash of the name.
  */
-enum {
- 
-  ELEM_NAME_START = 0, /**< Inside a starting (or self closing) tag */
-  ELEM_NAME_END   = 1, /**< Inside an ending tag                    */
-  ATTR_NAME       = 2, /**< Inside an attribute name                */
-  ATTR_VAL        = 3, /**< Inside an attribute value               */
-  ELEM            = 4, /**< Inside an element body                  */
-  COMMENT         = 5, /**< Inside a comment body                   */
-  END             = 6  /**< At the end of the document              */
-};
+static uint64_t __lilx_name_bits(
+  char *name /**< the name */
+);
 
 /**
- * Action handlers. When a state transition is encountered, the handler for
- * the current state is executed. The handler is found by indexing into 
- * this array.
+ * Called when an element is closed, by which time all of its children have
+ * been closed - sets its summary to its own name bits, plus the summaries
+ * of its children.
  */
-static uint8_t (*__lilx_actions[NUM_STATES])
-               (stack_t *stack, char *tkn, char *transition) = {
- 
-  &__lilx_elem_name_start_action,
-  &__lilx_elem_name_end_action,
-  &__lilx_attr_name_action,
-  &__lilx_attr_val_action,
-  &__lilx_elem_action,
-  &__lilx_comment_action,
-  &__lilx_end_action
-};
+static void __lilx_summarise(
+  element_t *element /**< the element */
+);
 
 /**
- * State transition table. This table contains a bunch of strings which,
- * when encountered in the xml input, will trigger a state change. Note 
- * that a state can change to itself (e.g. "<one><two></two></one>" 
- * contains a state change from ELEM_NAME_START to itself, and another 
- * state change from ELEM_NAME_END to itself). 
- * 
- * Also note that more than one transition string is allowed for one state
- * transition.
- * 
- * All the characters in the transition strings represent themselves, 
- * except for the following:
- * 
- *   * a == One alphanumeric character (i.e. [a-zA-Z0-9])
- *   * A == One character which is alphanumeric, or contained in 
- *          XML_BODY_CHARS (see below)
- *   * S == Exactly one whitespace character (i.e. [ \r\n\t])
- *   * s == Any number of whitespace characters (i.e. [ \r\n\t]*)
- *   * 0 == end of file (i.e. $)
+ * Does the work of lilx_count_elements_by_name.
  */
+static uint8_t __lilx_count_elements(
+  element_t *root, /**< root of the (sub)tree to be searched */
+  char      *name, /**< element name to search for           */
+  uint64_t   bits  /**< summary bits of the name             */
+);
 
 /**
- * Characters that element bodies, attribute values, and comment bodies are
- * allowed to start with.
+ * Does the work of lilx_get_elements_by_name.
  */
-#define XML_BODY_CHARS "!@#$%^&*()-_=+[{]}\\/|;:,.?"
+static uint8_t __lilx_get_elements(
+  element_t  *root,            /**< root of the (sub)tree to search         */
+  char       *name,            /**< name of the element to search for       */
+  uint64_t    bits,            /**< summary bits of the name                */
+  element_t **elements,        /**< array to store pointers to the elements */
+  uint8_t     elements_length  /**< length of the elements array            */
+);
 
 /**
- * Number of different transition strings per state transition. If you want to
- * change this to, for example 3, you have to make sure that every element in
- * the table is a 3 field array. ugly, i know. go complain to someone who
- * gives a damn
+ * \return the number of bytes in the body of the given element - the text
+ * segments and their '\0' terminators.
  */
-#define STATE_CHOICES 2
+static uint32_t __lilx_body_size(
+  element_t *element /**< the element */
+);
 
-static char *__lilx_transitions[NUM_STATES][NUM_STATES][STATE_CHOICES] = {
- 
-  /*ELEM_NAME_START*/
-  { 
-    {"s>s<a", "s/>s<a"}, {"s>s</a","s/>s</a"}, {"Ssa",NULL}, 
-    {NULL,NULL}, {"s>sA",NULL}, {"s>s<!--sA", "s/>s<!--sA"},
-    {"s/>s0",NULL}
-  }, 
-  /*ELEM_NAME_END*/
-  { 
-    {"s>s<a",NULL}, {"s>s</a",NULL}, {NULL,NULL}, {NULL,NULL}, 
-    {"s>sA",NULL}, {"s>s<!--", NULL}, {"s>s0",NULL}
-  },
-  #if XML_USE_SINGLE_QUOTES == 0
-  /*ATTR_NAME*/
-  { 
-    {NULL,NULL}, {NULL,NULL}, {NULL,NULL}, {"=\"sA",NULL}, {NULL,NULL},
-    {NULL,NULL}, {NULL,NULL}
-  },
-  /*ATTR_VAL*/
-  { 
-    {"\"s>s<a","\"s/>s<a"}, {"\"s>s</a","\"s/>s</a"}, {"\"Ssa",NULL},
-    {NULL,NULL}, {"\"s>A","\"s/>sA"}, {"\"s>s<!--sA", "\"s/>s<!--sA"},
-    {"\"s/>s0",NULL}
-  },
-  #else
-  /*ATTR_NAME*/
-  { 
-    {NULL,NULL}, {NULL,NULL}, {NULL,NULL}, {"='sA",NULL}, {NULL,NULL},
-    {NULL,NULL}, {NULL,NULL}
-  },
-  /*ATTR_VAL*/
-  {
-    {"'s>s<a","'s/>s<a"}, {"'s>s</a","'s/>s</a"}, {"'Ssa",NULL},
-    {NULL,NULL}, {"'s>A","'s/>sA"}, {"'s>s<!--sA", "'s/>s<!--sA"}, 
-    {"'s/>s0",NULL}
-  },
-  #endif
-  /*ELEM*/
-  { 
-    {"s<a",NULL}, {"s</a",NULL}, {NULL,NULL}, {NULL,NULL}, {NULL,NULL},
-    {"<!--sA",NULL}, {NULL,NULL}
-  },
+/**
+ * \return the number of bytes needed for a compact copy of the given
+ * subtree.
+ */
+static size_t __lilx_subtree_size(
+  element_t *element /**< root of the subtree */
+);
 
-  /*COMMENT*/
-  { 
-    {"-->s<a",NULL}, {"-->s</a",NULL}, {NULL,NULL}, {NULL,NULL}, 
-    {"-->sA",NULL}, {"-->s<!--sA",NULL}, {NULL,NULL}
-  },
-  /*END*/
-  { 
-    {NULL,NULL}, {NULL,NULL}, {NULL,NULL}, {NULL,NULL}, {NULL,NULL},
-    {NULL,NULL}, {NULL,NULL}
-  }
-};
+/**
+ * Copies the given subtree, in preorder, into a compact block, starting at
+ * \p at - each element is followed by its attribute, child and segment
+ * arrays, its child map (if it has enough children), and its strings,
+ * and then by its children.
+ * 
+ * \return the position in the block just after the copy.
+ */
+static char * __lilx_copy_subtree(
+  element_t *element, /**< root of the subtree        */
+  char      *at       /**< where to put the copy      */
+);
 
-/****************************
- * Public interface functions
- ***************************/
+/**
+ * Fills in the given child map, for an element whose children are complete.
+ */
+static void __lilx_fill_child_map(
+  element_t               *element, /**< the element            */
+  struct __lilx_child_map *map      /**< room for the map, and an
+                                         entry per child        */
+);
 
-uint8_t lilx_create_tree(char *xml, element_t *root) {
- 
-  uint8_t state, next_state;
-  uint8_t offset;
-  uint16_t len;
- 
-  stack_t stack;
- 
-  uint16_t tknidx = 0;
-  char *transition;
-  char *token;
- 
-  __lilx_init_element(root);
- 
-  /*save xml length; make sure xml starts with '<'*/
-  len = strlen(xml);
-  if (xml[0] != '<') return 1;
-  xml++;
+/**
+ * Writes the text segments of the given element, one after the other, to
+ * dst, followed by a '\0'.
+ *
+ * \return the byte after the '\0'.
+ */
+static char * __lilx_join_text(
+  element_t *element, /**< the element                       */
+  char      *dst      /**< room for the text and its '\0'    */
+);
+
+/**
+ * Allocates memory from a builder's arena, suitably aligned.
+ *
+ * \return the memory, or NULL on malloc failure.
+ */
+static void * __lilx_arena_alloc(
+  lilx_builder_t *builder, /**< the builder       */
+  size_t          size     /**< bytes to allocate */
+);
+
+/**
+ * \return the entity which stands for the given character, or NULL if it
+ * needn't be escaped. quote is the character which wraps an attribute
+ * value, or '\0' for text.
+ */
+static char * __lilx_entity(
+  char c,    /**< the character                          */
+  char quote /**< XML_QUOTE for attribute values, or '\0' */
+);
+
+/**
+ * \return the length of the given string once it has been escaped.
+ */
+static uint32_t __lilx_escaped_length(
+  char *str,  /**< the string                               */
+  char  quote /**< XML_QUOTE for attribute values, or '\0'  */
+);
+
+/**
+ * Checks that a builder can take another call.
+ *
+ * \return 0 if it can, non-0 (and the builder is failed) if it can't.
+ */
+static uint8_t __lilx_builder_check(
+  lilx_builder_t *builder /**< the builder */
+);
+
+/**
+ * Marks a builder as failed.
+ *
+ * \return 1, for the caller to return.
+ */
+static uint8_t __lilx_builder_fail(
+  lilx_builder_t *builder /**< the builder */
+);
+
+/**
+ * Adds a new, empty, text segment to the innermost open element of a
+ * builder, at the end of its body.
+ *
+ * \return the segment, or NULL on failure.
+ */
+static lilx_text_t * __lilx_builder_segment(
+  lilx_builder_t       *builder, /**< the builder              */
+  lilx_builder_frame_t *frame    /**< the innermost open frame */
+);
+
+/**
+ * Finishes the element of the given frame - its attributes, children and
+ * text are moved into arrays of the exact size, in the arena.
+ *
+ * \return 0 on success, non-0 on malloc failure.
+ */
+static uint8_t __lilx_builder_finish(
+  lilx_builder_t       *builder, /**< the builder         */
+  lilx_builder_frame_t *frame    /**< the frame to finish */
+);
+
+/**
+ * Adds data to the output buffer, flushing it when it is full.
+ *
+ * \return 0 on success, non-0 if the output function failed.
+ */
+static uint8_t __lilx_emit(
+  struct __lilx_output *out,  /**< the output         */
+  char                 *data, /**< the data           */
+  uint32_t              len   /**< length of the data */
+);
+
+/**
+ * Passes whatever is in the output buffer to the output function.
+ *
+ * \return 0 on success, non-0 if the output function failed.
+ */
+static uint8_t __lilx_flush(
+  struct __lilx_output *out /**< the output */
+);
+
+/**
+ * Starts a new line, indented for the given depth.
+ *
+ * \return 0 on success, non-0 if the output function failed.
+ */
+static uint8_t __lilx_newline(
+  struct __lilx_output *out,  /**< the output               */
+  uint16_t              depth /**< depth of the next line   */
+);
+
+/**
+ * Writes the start tag of an element - or, for an element with no children
+ * and no text, the whole of it.
+ *
+ * \return 0 on success, non-0 if the output function failed.
+ */
+static uint8_t __lilx_serialise_start(
+  struct __lilx_output *out,    /**< the output  */
+  element_t            *element /**< the element */
+);
+
+/**
+ * Writes what comes between the start tag or previous child of an element
+ * and child i (or, if i is the number of children, the end tag) - its text
+ * at that position, or, when indenting, a new line.
+ *
+ * \return 0 on success, non-0 if the output function failed.
+ */
+static uint8_t __lilx_serialise_gap(
+  struct __lilx_output *out,     /**< the output             */
+  element_t            *element, /**< the element            */
+  uint16_t              i,       /**< the child              */
+  uint16_t              depth    /**< depth of the element   */
+);
+
+/**
+ * Writes the end tag of an element, if it has one.
+ *
+ * \return 0 on success, non-0 if the output function failed.
+ */
+static uint8_t __lilx_serialise_end(
+  struct __lilx_output *out,    /**< the output  */
+  element_t            *element /**< the element */
+);
+
+/**
+ * Does the work of lilx_serialise.
+ */
+static uint8_t __lilx_serialise(
+  struct __lilx_output *out,     /**< the output                */
+  element_t            *element, /**< the element to write out  */
+  uint16_t              depth    /**< depth of the element      */
+);
+
+/**
+ * Called when the start tag of an element is complete. If namespace
+ * processing is on, sets the namespace and local name ids of the element
+ * and its attributes. There is no stack of namespace declarations - the
+ * declarations in scope are the xmlns attributes of the element and its
+ * ancestors, which are all still in the tree.
+ * 
+ * \return 0 on success, non-0 on failure (an undeclared prefix, or malloc
+ * failure).
+ */
+static uint8_t __lilx_resolve_namespaces(
+  parser_t  *parser,  /**< the parser  */
+  element_t *element  /**< the element */
+);
+
+/**
+ * Sets the namespace and local name ids of the elements recreated by
+ * lilx_parser_restore, below the given element, which are all in the tree by
+ * the time names is set. The innermost open element is left alone if its
+ * start tag is still in progress, as it may yet declare more namespaces.
+ * 
+ * \return 0 on success, non-0 on failure.
+ */
+static uint8_t __lilx_resolve_restored(
+  parser_t  *parser,  /**< the parser  */
+  element_t *element  /**< the element */
+);
+
+/**
+ * Sets the namespace and local name ids for the given element or attribute
+ * name.
+ * 
+ * \return 0 on success, non-0 on failure.
+ */
+static uint8_t __lilx_resolve_name(
+  parser_t  *parser,     /**< the parser                                   */
+  element_t *element,    /**< the element, or the element which has the
+                              attribute                                   */
+  char      *name,       /**< the name                                     */
+  uint8_t    is_element, /**< non-0 for an element name (which gets the
+                              default namespace if it has no prefix)      */
+  uint16_t  *ns,         /**< place to store the namespace URI id          */
+  uint16_t  *local       /**< place to store the local name id             */
+);
+
+/**
+ * Finds the innermost declaration of the given namespace prefix, on the
+ * given element or one of its ancestors.
+ * 
+ * \return the id of the namespace URI, or NAMES_NONE if the prefix has not
+ * been declared.
+ */
+static uint16_t __lilx_find_namespace(
+  names_t   *names,   /**< the interned names                         */
+  element_t *element, /**< the element to start from                  */
+  char      *prefix,  /**< the prefix (need not be '\0' terminated)   */
+  uint16_t   len      /**< length of the prefix, 0 for the default
+                           namespace                                  */
+);
+
+/**
+ * Appends a text segment to the given element. The text is copied onto the
+ * end of the element body, so an element only ever has one body buffer,
+ * however many segments it has.
+ * 
+ * \return 0 on success, non-0 on malloc failure.
+ */
+static uint8_t __lilx_add_text(
+  element_t *element, /**< the element          */
+  char      *text,    /**< the text             */
+  uint16_t   len      /**< length of the text   */
+);
+
+/**
+ * Adds the given attribute to the given element.
+ * 
+ * \return 0 on success, non-0 on failure.
+ */
+static uint8_t __lilx_add_attr(
+  element_t   *element, /**< the element   */
+  attribute_t *attr     /**< the attribute */
+);
+
+/**
+ * Recursively prints the given DOM tree via printf.
+ */
+static void __lilx_print_tree(
+  element_t *root, /**< Root of the tree                   */
+  uint8_t    depth /**< Current depth - pass in 0 to start */
+);
+
+/****************
+ * Private fields
+ ***************/
+
+/**
+ * Total number of states
+ */
+#define NUM_STATES 7
+
+/**
+ * The states that can exist during parsing.
+ */
+enum {
+ 
+  ELEM_NAME_START = 0, /**< Inside a starting (or self closing) tag */
+  ELEM_NAME_END   = 1, /**< Inside an ending tag                    */
+  ATTR_NAME       = 2, /**< Inside an attribute name                */
+  ATTR_VAL        = 3, /**< Inside an attribute value               */
+  ELEM            = 4, /**< Inside an element body                  */
+  COMMENT         = 5, /**< Inside a comment body                   */
+  END             = 6  /**< At the end of the document              */
+};
+
+/**
+ * Version of the checkpoint blob format, stored in its first byte.
+ */
+#define CHECKPOINT_VERSION 1
+
+/**
+ * Size of the fixed part of a checkpoint blob - version, state, depth, and
+ * a 4 byte little-endian offset.
+ */
+#define CHECKPOINT_HEADER_SIZE 7
+
+/**
+ * The text and children of an element in a checkpoint blob are each
+ * preceded by one of these, and the list is ended by CHECKPOINT_END.
+ */
+#define CHECKPOINT_END   0 /**< no more text or children */
+#define CHECKPOINT_TEXT  1 /**< a text segment           */
+#define CHECKPOINT_CHILD 2 /**< a child element          */
+
+/**
+ * Action handlers. When a state transition is encountered, the handler for
+ * the current state is executed. The handler is found by indexing into 
+ * this array.
+ */
+static uint8_t (*__lilx_actions[NUM_STATES])
+               (parser_t *parser, char *tkn, uint16_t len,
+                char *transition) = {
+ 
+  &__lilx_elem_name_start_action,
+  &__lilx_elem_name_end_action,
+  &__lilx_attr_name_action,
+  &__lilx_attr_val_action,
+  &__lilx_elem_action,
+  &__lilx_comment_action,
+  &__lilx_end_action
+};
+
+/**
+ * State transition table. This table contains a bunch of strings which,
+ * when encountered in the xml input, will trigger a state change. Note 
+ * that a state can change to itself (e.g. "<one><two></two></one>" 
+ * contains a state change from ELEM_NAME_START to itself, and another 
+ * state change from ELEM_NAME_END to itself). 
+ * 
+ * Also note that more than one transition string is allowed for one state
+ * transition.
+ * 
+ * All the characters in the transition strings represent themselves, 
+ * except for the following:
+ * 
+ *   * a == One alphanumeric character (i.e. [a-zA-Z0-9])
+ *   * A == One character which is alphanumeric, or contained in 
+ *          XML_BODY_CHARS (see below)
+ *   * S == Exactly one whitespace character (i.e. [ \r\n\t])
+ *   * s == Any number of whitespace characters (i.e. [ \r\n\t]*)
+ *   * 0 == end of file (i.e. $)
+ */
+
+/**
+ * Characters that element bodies, attribute values, and comment bodies are
+ * allowed to start with.
+ */
+#define XML_BODY_CHARS "!@#$%^&*()-_=+[{]}\\/|;:,.?"
+
+/**
+ * The character which wraps attribute values.
+ */
+#if LILX_USE_SINGLE_QUOTES == 0
+#define XML_QUOTE '"'
+#else
+#define XML_QUOTE '\''
+#endif
+
+/**
+ * Number of different transition strings per state transition. If you want to
+ * change this to, for example 3, you have to make sure that every element in
+ * the table is a 3 field array. ugly, i know. go complain to someone who
+ * gives a damn
+ */
+#define STATE_CHOICES 2
+
+static char *__lilx_transitions[NUM_STATES][NUM_STATES][STATE_CHOICES] = {
+ 
+  /*ELEM_NAME_START*/
+  { 
+    {"s>s<a", "s/>s<a"}, {"s>s</a","s/>s</a"}, {"Ssa",NULL}, 
+    {NULL,NULL}, {"s>sA","s/>sA"}, {"s>s<!--sA", "s/>s<!--sA"},
+    {"s/>s0",NULL}
+  }, 
+  /*ELEM_NAME_END*/
+  { 
+    {"s>s<a",NULL}, {"s>s</a",NULL}, {NULL,NULL}, {NULL,NULL}, 
+    {"s>sA",NULL}, {"s>s<!--", NULL}, {"s>s0",NULL}
+  },
+  #if LILX_USE_SINGLE_QUOTES == 0
+  /*ATTR_NAME*/
+  { 
+    {NULL,NULL}, {NULL,NULL}, {NULL,NULL}, {"=\"sA",NULL}, {NULL,NULL},
+    {NULL,NULL}, {NULL,NULL}
+  },
+  /*ATTR_VAL*/
+  { 
+    {"\"s>s<a","\"s/>s<a"}, {"\"s>s</a","\"s/>s</a"}, {"\"Ssa",NULL},
+    {NULL,NULL}, {"\"s>sA","\"s/>sA"}, {"\"s>s<!--sA", "\"s/>s<!--sA"},
+    {"\"s/>s0",NULL}
+  },
+  #else
+  /*ATTR_NAME*/
+  { 
+    {NULL,NULL}, {NULL,NULL}, {NULL,NULL}, {"='sA",NULL}, {NULL,NULL},
+    {NULL,NULL}, {NULL,NULL}
+  },
+  /*ATTR_VAL*/
+  {
+    {"'s>s<a","'s/>s<a"}, {"'s>s</a","'s/>s</a"}, {"'Ssa",NULL},
+    {NULL,NULL}, {"'s>sA","'s/>sA"}, {"'s>s<!--sA", "'s/>s<!--sA"}, 
+    {"'s/>s0",NULL}
+  },
+  #endif
+  /*ELEM*/
+  { 
+    {"s<a",NULL}, {"s</a",NULL}, {NULL,NULL}, {NULL,NULL}, {NULL,NULL},
+    {"<!--sA",NULL}, {NULL,NULL}
+  },
+
+  /*COMMENT*/
+  { 
+    {"-->s<a",NULL}, {"-->s</a",NULL}, {NULL,NULL}, {NULL,NULL}, 
+    {"-->sA",NULL}, {"-->s<!--sA",NULL}, {NULL,NULL}
+  },
+  /*END*/
+  { 
+    {NULL,NULL}, {NULL,NULL}, {NULL,NULL}, {NULL,NULL}, {NULL,NULL},
+    {NULL,NULL}, {NULL,NULL}
+  }
+};
+
+/****************************
+ * Public interface functions
+ ***************************/
+
+uint8_t lilx_create_tree(char *xml, element_t *root) {
+  return lilx_create_tree_limited(xml, root, NULL) != LILX_OK;
+}
+
+uint8_t lilx_create_tree_limited(
+char *xml, element_t *root, lilx_limits_t *limits) {
+ 
+  parser_t parser;
+ 
+  if (lilx_parser_init(&parser, root) != 0) return LILX_ERROR;
+ 
+  parser.limits = limits;
+ 
+  return lilx_parse(&parser, xml, strlen(xml), 1);
+}
+
+uint8_t lilx_parser_init(parser_t *parser, element_t *root) {
+ 
+  /*initialise root element*/
+  __lilx_init_element(root);
+  root->name = (char *)malloc(strlen("root") + 1);
+  if (root->name == NULL) return 1;
+  strcpy(root->name, "root");
+ 
+  parser->root      = root;
+  parser->current   = root;
+  parser->base      = 0;
+  parser->pos       = 0;
+  parser->tkn       = 0;
+  parser->state     = ELEM_NAME_START;
+  parser->depth     = 0;
+  parser->flags     = 0;
+  parser->validator = NULL;
+  parser->names     = NULL;
+  parser->guide     = NULL;
+  parser->handler   = NULL;
+  parser->context   = NULL;
+ 
+ 
+  parser->limits       = NULL;
+  parser->num_elements = 0;
+  parser->num_strings  = 0;
+  parser->num_memory   = 0;
+  parser->exceeded     = 0;
+  parser->pending      = 0;
+  parser->restored     = 0;
+ 
+  return 0;
+}
+
+uint8_t lilx_parse(parser_t *parser, char *xml, uint32_t len, uint8_t final) {
+  return __lilx_parse(parser, xml, len, final, UINT32_MAX);
+}
+
+uint8_t lilx_parse_step(
+parser_t *parser, char *xml, uint32_t len, uint32_t max_bytes) {
+ 
+  /*a budget of 0 would never get anywhere*/
+  if (max_bytes == 0) max_bytes = UINT32_MAX;
+ 
+  return __lilx_parse(parser, xml, len, 1, max_bytes);
+}
+
+uint32_t lilx_parser_discard(parser_t *parser) {
+  return lilx_parser_discard_before(parser, UINT32_MAX);
+}
+
+uint32_t lilx_parser_discard_before(parser_t *parser, uint32_t offset) {
+ 
+  uint32_t discard = parser->tkn;
+ 
+  if (offset < parser->base)                  return 0;
+  if (offset - parser->base < discard) discard = offset - parser->base;
+ 
+  parser->base += discard;
+  parser->pos  -= discard;
+  parser->tkn  -= discard;
+ 
+  return discard;
+}
+
+uint32_t lilx_parser_checkpoint(
+parser_t *parser, uint8_t *blob, uint32_t len) {
+ 
+  uint8_t i, depth;
+  uint32_t off = 0;
+  uint32_t offset;
+  element_t *element;
+ 
+  if (parser->root == NULL || len < CHECKPOINT_HEADER_SIZE) return 0;
+ 
+  /*parsing resumes at the start of the current token*/
+  offset = parser->base + parser->tkn;
+ 
+  blob[off++] = CHECKPOINT_VERSION;
+  blob[off++] = parser->state;
+  blob[off++] = parser->depth;
+  for (i = 0; i < 4; i++) blob[off++] = (offset >> (8 * i)) & 0xFF;
+ 
+  /*save each open element, outermost first, along with the elements 
+    which have been closed inside it (all of its children but the last,
+    which is the next open element, or all of them for the innermost)*/
+  element = parser->root;
+  for (depth = 0; depth < parser->depth; depth++) {
+  
+    element = element->children[element->num_children - 1];
+  
+    if (__lilx_put_element(blob, len, &off, element, 
+          element->num_children - (depth + 1 < parser->depth)) != 0)
+      return 0;
+  }
+ 
+  return off;
+}
+
+uint8_t lilx_parser_restore(
+parser_t *parser, element_t *root, uint8_t *blob, uint32_t len) {
+ 
+  uint8_t i, depth;
+  uint32_t off = CHECKPOINT_HEADER_SIZE;
+  uint32_t offset = 0;
+ 
+  if (len < CHECKPOINT_HEADER_SIZE) return 1;
+  if (blob[0] != CHECKPOINT_VERSION) return 1;
+  if (blob[1] >= NUM_STATES) return 1;
+  if (blob[2] >= LILX_STACK_SIZE) return 1;
+ 
+  if (lilx_parser_init(parser, root) != 0) return 1;
+ 
+  depth = blob[2];
+  for (i = 0; i < 4; i++) offset |= (uint32_t)blob[3 + i] << (8 * i);
+ 
+  /*recreate the open elements, outermost first*/
+  for (i = 0; i < depth; i++) {
+  
+    if (__lilx_restore_element(parser, blob, len, &off) != 0) {
+      lilx_free_tree(root);
+      return 1;
+    }
+  }
+ 
+  /*parsing resumes at the start of the token 
+    which was in progress at the checkpoint*/
+  parser->state    = blob[1];
+  parser->base     = offset;
+  parser->pos      = 0;
+  parser->tkn      = 0;
+  parser->restored = 1;
+ 
+  return 0;
+}
+
+uint8_t lilx_free_tree(element_t *root) {
+  return __lilx_free_tree(root, 1);
+}
+
+element_t * lilx_extract_subtree(element_t *element) {
+ 
+  char *block = (char *)malloc(__lilx_subtree_size(element));
+ 
+  if (block == NULL) return NULL;
+ 
+  __lilx_copy_subtree(element, block);
+ 
+  /*the copy is a tree of its own*/
+  ((element_t *)block)->parent = NULL;
+  ((element_t *)block)->index  = 0;
+ 
+  return (element_t *)block;
+}
+
+uint8_t lilx_count_elements_by_name(element_t *root, char *name) {
+  return __lilx_count_elements(root, name, __lilx_name_bits(name));
+}
+
+uint8_t lilx_get_elements_by_name(
+element_t *root, char *name, element_t **elements, uint8_t elements_length) {
+  return __lilx_get_elements(
+    root, name, __lilx_name_bits(name), elements, elements_length);
+}
+
+void lilx_reset_summary(element_t *element) {
+ 
+  /*each summary covers everything below it, so 
+    the ancestors' summaries are stale too*/
+  for (; element != NULL; element = element->parent) element->summary = 0;
+}
+
+element_t * lilx_get_child(element_t *element, char *name) {
+
+  uint16_t it = 0;
+
+  return lilx_get_children(element, name, &it);
+}
+
+element_t * lilx_get_children(
+element_t *element, char *name, uint16_t *iterator) {
+ 
+  struct __lilx_child_map *map = __lilx_get_child_map(element);
+  uint16_t i;
+ 
+  /*narrow elements - the iterator is the position of the next child*/
+  if (map == NULL) {
+  
+    for (i = *iterator; i < element->num_children; i++) {
+      if (strcmp(element->children[i]->name, name) == 0) {
+        *iterator = i + 1;
+        return element->children[i];
+      }
+    }
+  
+    *iterator = element->num_children;
+    return NULL;
+  }
+ 
+  /*wide elements - children with the same name are next to each other
+    in the map, and the iterator is the position of the next one, plus 1*/
+  i = (*iterator == 0) ? __lilx_find_child_entry(map, name) : *iterator - 1;
+ 
+  if (i >= map->num_children || strcmp(map->entries[i].name, name) != 0) {
+    *iterator = map->num_children + 1;
+    return NULL;
+  }
+ 
+  *iterator = i + 2;
+  return element->children[map->entries[i].index];
+}
+
+element_t * lilx_get_child_ns(element_t *element, uint16_t ns, uint16_t local) {
+ 
+  uint16_t i;
+ 
+  for (i = 0; i < element->num_children; i++)
+    if (element->children[i]->local == local &&
+        element->children[i]->ns    == ns)
+      return element->children[i];
+ 
+  return NULL;
+}
+
+attribute_t * lilx_get_attribute_ns(
+element_t *element, uint16_t ns, uint16_t local) {
+ 
+  uint8_t i;
+ 
+  for (i = 0; i < element->num_attributes; i++)
+    if (element->attributes[i]->local == local &&
+        element->attributes[i]->ns    == ns)
+      return element->attributes[i];
+ 
+  return NULL;
+}
+
+char * lilx_get_segment(
+element_t *element, uint16_t i, uint16_t *length, uint16_t *position) {
+ 
+  lilx_text_t *segment;
+ 
+  if (i >= element->num_segments) return NULL;
+ 
+  segment = (i == 0) ? &element->segment : &element->segments[i - 1];
+ 
+  if (length   != NULL) *length   = segment->length;
+  if (position != NULL) *position = segment->position;
+ 
+  return element->body + segment->offset;
+}
+
+char * lilx_get_text(element_t *element) {
+ 
+  uint16_t i, len;
+  uint32_t total = 0;
+ 
+  if (element->num_segments <= 1) return element->body;
+  if (element->text != NULL)      return element->text;
+ 
+  for (i = 0; i < element->num_segments; i++) {
+    lilx_get_segment(element, i, &len, NULL);
+    total += len;
+  }
+ 
+  element->text = (char *)malloc(total + 1);
+  if (element->text == NULL) return NULL;
+ 
+  __lilx_join_text(element, element->text);
+ 
+  return element->text;
+}
+
+attribute_t * lilx_get_attribute_by_name(element_t *element, char *name) {
+ 
+  uint8_t i;
+  uint8_t len = strlen(name);
+ 
+  for (i = 0; i < element->num_attributes; i++)
+  
+  if (strncmp(element->attributes[i]->name, name, len) == 0)
+    return element->attributes[i];
+ 
+  return NULL;
+}
+
+element_t * lilx_parent(element_t *element) {
+  return element->parent;
+}
+
+element_t * lilx_next_sibling(element_t *element) {
+ 
+  element_t *parent = element->parent;
+ 
+  if (parent == NULL || element->index + 1 >= parent->num_children) 
+    return NULL;
+ 
+  return parent->children[element->index + 1];
+}
+
+element_t * lilx_prev_sibling(element_t *element) {
+ 
+  if (element->parent == NULL || element->index == 0) return NULL;
+ 
+  return element->parent->children[element->index - 1];
+}
+
+element_t * lilx_ancestor_by_name(element_t *element, char *name) {
+ 
+  for (element = element->parent; element != NULL; element = element->parent)
+    if (element->name != NULL && strcmp(element->name, name) == 0) 
+      return element;
+ 
+  return NULL;
+}
+
+void lilx_print_tree(element_t *root) {
+  __lilx_print_tree(root, 0);
+}
+
+uint8_t lilx_builder_init(lilx_builder_t *builder) {
+ 
+  lilx_builder_frame_t *frame;
+  uint16_t id;
+  uint8_t i;
+ 
+  __lilx_init_element(&builder->root);
+  builder->arena = NULL;
+  builder->depth = 0;
+  builder->error = 0;
+  builder->done  = 0;
+ 
+  for (i = 0; i < LILX_STACK_SIZE; i++) {
+    frame               = &builder->frames[i];
+    frame->element      = NULL;
+    frame->first        = NULL;
+    frame->last         = NULL;
+    frame->attrs        = NULL;
+    frame->body         = NULL;
+    frame->body_len     = 0;
+    frame->body_cap     = 0;
+    frame->segments     = NULL;
+    frame->segments_cap = 0;
+  }
+ 
+  builder->frames[0].element = &builder->root;
+ 
+  builder->names = (names_t *)malloc(sizeof(names_t));
+  if (builder->names == NULL) return 1;
+ 
+  if (names_init(builder->names) != 0) {
+    free(builder->names);
+    builder->names = NULL;
+    return 1;
+  }
+ 
+  id = names_intern(builder->names, "root", 4);
+  if (id == NAMES_NONE) {
+    lilx_builder_free(builder);
+    return 1;
+  }
+ 
+  builder->root.name = names_string(builder->names, id);
+  return 0;
+}
+
+uint8_t lilx_builder_begin(lilx_builder_t *builder, char *name) {
+ 
+  lilx_builder_frame_t       *parent;
+  lilx_builder_frame_t       *frame;
+  struct __lilx_builder_node *node;
+  size_t   len = strlen(name);
+  uint16_t id;
+ 
+  if (__lilx_builder_check(builder) != 0) return 1;
+ 
+  parent = &builder->frames[builder->depth];
+ 
+  if (builder->depth + 1 >= LILX_STACK_SIZE           ||
+      parent->element->num_children == UINT16_MAX    ||
+      len == 0 || len >= UINT16_MAX)
+    return __lilx_builder_fail(builder);
+ 
+  id   = names_intern(builder->names, name, len);
+  node = (struct __lilx_builder_node *)
+    __lilx_arena_alloc(builder, sizeof(struct __lilx_builder_node));
+  if (id == NAMES_NONE || node == NULL)
+    return __lilx_builder_fail(builder);
+ 
+  __lilx_init_element(&node->element);
+  node->element.name   = names_string(builder->names, id);
+  node->element.parent = parent->element;
+  node->element.index  = parent->element->num_children++;
+  node->next           = NULL;
+ 
+  /*appending is O(1) - the children array is made when the parent closes*/
+  if (parent->last == NULL) parent->first      = node;
+  else                      parent->last->next = node;
+  parent->last = node;
+ 
+  /*the frame's scratch buffers are kept for the next element at this depth*/
+  frame           = &builder->frames[++builder->depth];
+  frame->element  = &node->element;
+  frame->first    = NULL;
+  frame->last     = NULL;
+  frame->attrs    = NULL;
+  frame->body_len = 0;
+ 
+  return 0;
+}
+
+uint8_t lilx_builder_attr(lilx_builder_t *builder, char *name, char *value) {
+ 
+  lilx_builder_frame_t       *frame;
+  struct __lilx_builder_attr *attr;
+  size_t   len = strlen(name);
+  uint32_t vlen;
+  uint16_t id;
+  char    *entity;
+  char    *dst;
+ 
+  if (__lilx_builder_check(builder) != 0) return 1;
+ 
+  frame = &builder->frames[builder->depth];
+ 
+  if (frame->element->num_attributes == UINT8_MAX || 
+      len == 0 || len >= UINT16_MAX)
+    return __lilx_builder_fail(builder);
+ 
+  vlen = __lilx_escaped_length(value, XML_QUOTE);
+  id   = names_intern(builder->names, name, len);
+  attr = (struct __lilx_builder_attr *)__lilx_arena_alloc(builder, 
+    sizeof(struct __lilx_builder_attr) + vlen + 1);
+  if (id == NAMES_NONE || attr == NULL)
+    return __lilx_builder_fail(builder);
+ 
+  attr->attr.name  = names_string(builder->names, id);
+  attr->attr.value = (char *)(attr + 1);
+  attr->attr.ns    = 0;
+  attr->attr.local = 0;
+ 
+  for (dst = attr->attr.value; *value != '\0'; value++) {
+ 
+    entity = __lilx_entity(*value, XML_QUOTE);
+ 
+    if (entity == NULL) *dst++ = *value;
+    else {
+      strcpy(dst, entity);
+      dst += strlen(entity);
+    }
+  }
+  *dst = '\0';
+ 
+  attr->next   = frame->attrs;
+  frame->attrs = attr;
+  frame->element->num_attributes++;
+ 
+  return 0;
+}
+
+uint8_t lilx_builder_text(lilx_builder_t *builder, char *text) {
+ 
+  lilx_builder_frame_t *frame;
+  element_t            *element;
+  lilx_text_t          *segment = NULL;
+  uint32_t len, need, elen;
+  char    *entity;
+  char    *body;
+ 
+  if (__lilx_builder_check(builder) != 0) return 1;
+ 
+  frame   = &builder->frames[builder->depth];
+  element = frame->element;
+  len     = __lilx_escaped_length(text, '\0');
+ 
+  if (len == 0) return 0;
+ 
+  /*room for the text, plus a '\0' for every segment it might take up*/
+  need = frame->body_len + len + len / (UINT16_MAX - 8) + 2;
+ 
+  if (need < len) return __lilx_builder_fail(builder);
+ 
+  if (need > frame->body_cap) {
+ 
+    if (need < frame->body_cap * 2) need = frame->body_cap * 2;
+ 
+    body = (char *)realloc(frame->body, need);
+    if (body == NULL) return __lilx_builder_fail(builder);
+ 
+    frame->body     = body;
+    frame->body_cap = need;
+  }
+ 
+  /*carry on with the last segment, if no child has been added since*/
+  if (element->num_segments > 0) {
+ 
+    segment = &frame->segments[element->num_segments - 1];
+ 
+    if (segment->position == element->num_children) frame->body_len--;
+    else                                            segment = NULL;
+  }
+ 
+  for (; *text != '\0'; text++) {
+ 
+    entity = __lilx_entity(*text, '\0');
+    elen   = (entity == NULL) ? 1 : strlen(entity);
+ 
+    if (segment == NULL || segment->length + elen > UINT16_MAX) {
+ 
+      if (segment != NULL) frame->body[frame->body_len++] = '\0';
+ 
+      segment = __lilx_builder_segment(builder, frame);
+      if (segment == NULL) return __lilx_builder_fail(builder);
+    }
+ 
+    if (entity == NULL) frame->body[frame->body_len] = *text;
+    else                memcpy(frame->body + frame->body_len, entity, elen);
+ 
+    frame->body_len += elen;
+    segment->length += elen;
+  }
+ 
+  frame->body[frame->body_len++] = '\0';
+  return 0;
+}
+
+uint8_t lilx_builder_end(lilx_builder_t *builder) {
+ 
+  if (__lilx_builder_check(builder) != 0) return 1;
+ 
+  if (builder->depth == 0 ||
+      __lilx_builder_finish(builder, &builder->frames[builder->depth]) != 0)
+    return __lilx_builder_fail(builder);
+ 
+  builder->depth--;
+  return 0;
+}
+
+element_t * lilx_builder_root(lilx_builder_t *builder) {
+ 
+  if (builder->error != 0 || builder->depth != 0) return NULL;
+  if (builder->done  != 0)                        return &builder->root;
+ 
+  if (__lilx_builder_finish(builder, &builder->frames[0]) != 0) {
+    builder->error = 1;
+    return NULL;
+  }
+ 
+  builder->done = 1;
+  return &builder->root;
+}
+
+void lilx_builder_free(lilx_builder_t *builder) {
+ 
+  struct __lilx_arena *arena;
+  uint8_t i;
+ 
+  while (builder->arena != NULL) {
+    arena          = builder->arena;
+    builder->arena = arena->next;
+    free(arena);
+  }
+ 
+  if (builder->names != NULL) {
+    names_free(builder->names);
+    free(builder->names);
+    builder->names = NULL;
+  }
+ 
+  for (i = 0; i < LILX_STACK_SIZE; i++) {
+    free(builder->frames[i].body);
+    free(builder->frames[i].segments);
+    builder->frames[i].body     = NULL;
+    builder->frames[i].segments = NULL;
+  }
+ 
+  __lilx_init_element(&builder->root);
+  builder->depth = 0;
+  builder->error = 1;
+}
+
+uint8_t lilx_serialise(
+element_t *element, uint8_t indent, lilx_write_t write, void *context) {
+  return lilx_serialise_part(
+    element, LILX_PART_ELEMENT, 0, indent, 0, write, context);
+}
+ 
+uint8_t lilx_serialise_part(element_t *element, uint8_t part, uint16_t i, 
+uint8_t indent, uint16_t depth, lilx_write_t write, void *context) {
+ 
+  struct __lilx_output out;
+  uint8_t result = 1;
+ 
+  out.write   = write;
+  out.context = context;
+  out.indent  = indent;
+  out.len     = 0;
+ 
+  switch (part) {
+    case LILX_PART_ELEMENT:
+      result = __lilx_serialise(&out, element, depth);
+      break;
+    case LILX_PART_START:
+      result = __lilx_serialise_start(&out, element);
+      break;
+    case LILX_PART_GAP:
+      if (i <= element->num_children)
+        result = __lilx_serialise_gap(&out, element, i, depth);
+      break;
+    case LILX_PART_END:
+      result = __lilx_serialise_end(&out, element);
+      break;
+  }
+ 
+  if (result != 0) return 1;
+ 
+  return __lilx_flush(&out);
+}
+
+/*******************
+ * Private functions
+ ******************/
+
+uint8_t __lilx_parse(parser_t *parser, 
+char *xml, uint32_t len, uint8_t final, uint32_t max_bytes) {
+ 
+  uint8_t next_state;
+  uint32_t offset;
+  uint8_t result;
+  uint32_t start;
+  uint32_t limit;
+  uint32_t next;
+  char *transition;
+ 
+  /*has parsing already failed?*/
+  if (parser->root == NULL) return LILX_ERROR;
+ 
+  /*is there too much input?*/
+  if (parser->limits            != NULL &&
+      parser->limits->max_bytes != 0    &&
+      parser->base + len > parser->limits->max_bytes) {
+  
+    parser->exceeded = LILX_LIMIT_BYTES;
+    __lilx_parse_failed(parser);
+    return LILX_LIMIT;
+  }
+ 
+  /*make sure xml starts with '<'*/
+  if (parser->base + parser->pos == 0) {
+  
+    if (len == 0) {
+      if (final) return __lilx_parse_failed(parser);
+      return LILX_MORE;
+    }
+  
+    if (xml[0] != '<') return __lilx_parse_failed(parser);
+    parser->pos = 1;
+    parser->tkn = 1;
+  }
+ 
+  /*the names field can only have been set after lilx_parser_restore, 
+    so the ids of the elements which it recreated are set now*/
+  if (parser->restored) {
+  
+    parser->restored = 0;
+    if (__lilx_resolve_restored(parser, parser->root) != 0)
+      return __lilx_parse_failed(parser);
+  }
+ 
+  /*the end of a self closing element, held back by a stop at its start*/
+  if (parser->pending) {
+  
+    parser->pending = 0;
+    if (__lilx_event(parser, LILX_EVENT_END,
+          parser->current->children[parser->current->num_children - 1]) != 0)
+      return LILX_STOPPED;
+  }
+ 
+  start = parser->pos;
+ 
+  /*a trusted skip must not take us past our budget for this call*/
+  if (len - start > max_bytes) limit = start + max_bytes;
+  else                         limit = len;
+ 
+  while (parser->state != END && parser->pos < len) {
+  
+    /*used up our budget for this call?*/
+    if (parser->pos - start >= max_bytes) return LILX_MORE;
+  
+    #ifdef __LILX_DEBUG
+    printf("in state %u: (%.*s)\n", 
+      parser->state, (int)(len - parser->pos), xml + parser->pos);
+    #endif
+  
+    next_state = parser->state;
+    result     = __lilx_get_next_state(
+      &next_state, xml + parser->pos, xml + len, final, &offset, &transition);
+  
+    /*we can't tell what happens next until more input arrives*/
+    if (result == LILX_MORE) return LILX_MORE;
+  
+    /*if there is no state change, the current character is 
+      part of the current token - move on to the next character
+      (or in trusted mode, the next character that matters)*/
+    if (result != 0) {
+   
+      if (parser->flags & LILX_TRUSTED) next = __lilx_skip(parser, xml, limit);
+      else                              next = parser->pos + 1;
+   
+      if (next - parser->tkn > LILX_MAX_TOKEN_LENGTH) {
+    
+        #ifdef __LILX_DEBUG
+        printf("token is too big - aborting\n");
+        #endif
+        return __lilx_parse_failed(parser);
+      }
+   
+      #ifdef LILX_CHECK_TRUSTED
+      if ((parser->flags & LILX_TRUSTED) && 
+          __lilx_check_skip(parser, xml, len, final, next) != 0)
+        return __lilx_parse_failed(parser);
+      #endif
+   
+      parser->pos = next;
+    }
+  
+    /*if there is a state change, execute the appropriate action
+      handler, skip over the xml input by the offset specified by
+      the handler, and change the current state*/
+    else {
+   
+      #ifdef __LILX_DEBUG
+      printf("%u: %.*s -> %u (%s)\n", 
+        parser->state, (int)(parser->pos - parser->tkn), xml + parser->tkn, 
+        next_state, transition);
+      #endif
+   
+      result = __lilx_actions[parser->state](
+        parser, 
+        xml + parser->tkn, 
+        parser->pos - parser->tkn, 
+        transition);
+   
+      /*bail immediately if the action returns an error code*/
+      if (result == LILX_LIMIT) {
+        __lilx_parse_failed(parser);
+        return LILX_LIMIT;
+      }
+      if (result != 0 && result != LILX_STOPPED)
+        return __lilx_parse_failed(parser);
+   
+      parser->pos  += offset;
+      parser->tkn   = parser->pos;
+      parser->state = next_state;
+   
+      /*the handler wants to stop - we've moved on 
+        past the transition, so we can resume later*/
+      if (result == LILX_STOPPED) return LILX_STOPPED;
+    }
+  }
+ 
+  if (parser->state != END && !final) return LILX_MORE;
+ 
+  /*if state != END or there are still open 
+    elements, it means that parsing failed.*/
+  if (parser->state != END || parser->depth != 0) 
+    return __lilx_parse_failed(parser);
+ 
+  /*the root is closed too*/
+  __lilx_summarise(parser->root);
+ 
+  return LILX_OK;
+}
+
+void __lilx_init_element(element_t *element) {
+  element->name = NULL;
+  element->body = NULL;
+  element->children = NULL;
+  element->attributes = NULL;
+  element->num_children = 0;
+  element->num_attributes = 0;
+  element->child_map = NULL;
+  element->parent = NULL;
+  element->index = 0;
+  element->ns = 0;
+  element->local = 0;
+  element->path = 0;
+  element->num_segments = 0;
+  element->segment.offset = 0;
+  element->segment.length = 0;
+  element->segment.position = 0;
+  element->segments = NULL;
+  element->body_cap = 0;
+  element->text = NULL;
+  element->summary = 0;
+}
+
+uint8_t __lilx_compare(
+char *xml, char *end, uint8_t final, char *transition, uint32_t *offset) {
+ 
+  char c;
+  uint32_t n;
+ 
+  #ifdef __LILX_DEBUG
+  printf("cmp (%s), (%.*s)\n", transition, (int)(end - xml), xml);
+  #endif
+ 
+  (*offset) = 0;
+  while (*transition != '\0') {
+  
+    /*past the end of the available input? if there's
+      more to come, we can't decide yet - otherwise, 
+      we're at the end of the input*/
+    if (xml >= end) {
+      if (!final) return LILX_MORE;
+      c = '\0';
+    }
+    else c = *xml;
+  
+    switch (*transition) {
+
+      case 'A':
+        /*if not printing char, fall through 
+          to 'a' for alphanumeric test*/
+        if ( strchr(XML_BODY_CHARS, c) != NULL
+     
+          /*ugly hack - strchr passes when given '\0'*/
+          && c != '\0') 
+          break;
+    
+      case 'a':
+        /*if not alphanumeric, fail*/
+        if (isalnum(c) == 0) return 1;
+        break;
+   
+      case 'S':
+        /*if not whitespace, fail*/
+        if (isspace(c) == 0) return 1;
+        break;
+
+      case 's':
+        /*skip the whole run of whitespace - if it runs to the
+          end of the available input, it might carry on*/
+        n        = __lilx_skip_space(xml, end);
+        xml     += n;
+        *offset += n;
+        if (xml >= end && !final) return LILX_MORE;
+    
+        /*keep xml at the first non-whitespace 
+          char, but move the transition forward*/
+        (*offset)--;
+        xml--;
+        break;
+    
+      case '0':
+        /*if char is not the end of the input, fail*/
+        if (c != '\0') return 1;
+        break;
+    
+      default:
+        /*if transition doesn't match xml, fail*/
+        if (*transition != c) return 1;
+        break;
+    }
+  
+    (*offset)++;
+    xml++;
+    transition++;
+  }
+ 
+  (*offset)--;
+  return 0;
+}
+
+uint32_t __lilx_skip_space(char *xml, char *end) {
+ 
+  char *start = xml;
+ 
+  #ifdef __SSE2__
+  __m128i v, t, ws;
+  int mask;
+ 
+  /*a byte is whitespace (as isspace sees it in the C locale) if 
+    it is a space, or if it is between '\t' and '\r' inclusive*/
+  while (end - xml >= 16) {
+  
+    v    = _mm_loadu_si128((__m128i *)xml);
+    t    = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+    ws   = _mm_or_si128(
+             _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+             _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(4)), t));
+    mask = _mm_movemask_epi8(ws);
+  
+    if (mask != 0xFFFF) return (xml - start) + __builtin_ctz(~mask);
+    xml += 16;
+  }
+  #endif
+ 
+  while (xml < end && isspace(*xml)) xml++;
+ 
+  return xml - start;
+}
+
+uint8_t __lilx_get_next_state(uint8_t *current_state, 
+char *xml, char *end, uint8_t final, uint32_t *offset, char **transition) {
+ 
+  uint8_t i, j, tranlen, result;
+  uint32_t temp_offset;
+  uint8_t more = 0;
+  int8_t last = -1;
+  uint8_t state = *current_state;
+  char *tran;
+ 
+  /*Iterate through all of the possible 
+    state changes for the current state*/
+  for (i = 0; i < NUM_STATES; i++) {
+    for (j = 0; j < STATE_CHOICES; j++) {
+   
+      tran = __lilx_transitions[state][i][j];
+      if (tran == NULL) continue;
+   
+      tranlen = strlen(tran);
+      result  = __lilx_compare(xml, end, final, tran, &temp_offset);
+   
+      /*not enough input to decide on this transition*/
+      if (result == LILX_MORE) more = 1;
+   
+      /*have we found a transition?*/
+      else if (result == 0) {
+    
+        #ifdef __LILX_DEBUG
+        printf("matched (%i,%i)\n", i, j);
+        #endif
+    
+        /*in case of more than one transition matching, we want
+          the transition that matches the most characters (i.e.
+          the transition string with the longest length)*/
+        if (tranlen > last) {
+     
+          *transition = tran;
+          (*offset) = temp_offset;
+          last = tranlen;
+          *current_state = i;
+        }
+      }
+    }
+  }
+ 
+  /*if any transition is undecided, we can't 
+    pick one until more input has arrived*/
+  if (more) {
+    *current_state = state;
+    return LILX_MORE;
+  }
+ 
+  if (last == -1) return 1;
+  return 0;
+}
+
+/*****************
+ * Action handlers
+ ****************/
+
+uint8_t __lilx_elem_name_start_action(
+parser_t *parser, char *tkn, uint16_t len, char *transition) {
+ 
+  element_t *element;
+ 
+  #ifdef __LILX_DEBUG
+  printf("elem_name_start_action %.*s (%s)\n", len, tkn, transition);
+  #endif
+ 
+  /*is the element allowed here?*/
+  if (parser->validator != NULL && 
+      schema_start_element(parser->validator, parser->depth, tkn, len) != 0)
+    return 1;
+ 
+  /*is there room for it?*/
+  if (parser->limits                 != NULL &&
+      parser->limits->max_depth      != 0    &&
+      parser->depth + 1 > parser->limits->max_depth) {
+  
+    parser->exceeded = LILX_LIMIT_DEPTH;
+    return LILX_LIMIT;
+  }
+ 
+  if (__lilx_charge(parser, 1, len, 
+        sizeof(element_t) + sizeof(element_t *) + len + 1) != 0)
+    return LILX_LIMIT;
+ 
+  /*malloc space for a new element*/
+  element = (element_t *)malloc(sizeof(element_t));
+  if (element == NULL) return 1;
+ 
+  /*initialise the element fields*/
+  __lilx_init_element(element);
+ 
+  /*malloc space for the element name*/
+  element->name = (char *)malloc(len + 1);
+  if (element->name == NULL) {
+  
+    free(element);
+    return 1;
+  }
+  memcpy(element->name, tkn, len);
+  element->name[len] = '\0';
+ 
+  /*add the new element as a child of the innermost open element*/
+  if (__lilx_add_child(parser->current, element) != 0) {
+  
+    free(element->name);
+    free(element);
+    return 1;
+  }
+ 
+  /*the element is in the tree now, so it's freed along with it*/
+  if (parser->guide != NULL && guide_add(parser->guide, element) == GUIDE_NONE)
+    return 1;
+ 
+  /*the start tag is complete, unless attributes follow*/
+  if (strchr(transition, '>') != NULL) {
+  
+    if (parser->validator != NULL && schema_start_tag_end(
+          parser->validator, parser->depth + 1, element) != 0)
+      return 1;
+  
+    if (__lilx_resolve_namespaces(parser, element) != 0) return 1;
+  }
+ 
+  /*is the element self closing? if so, don't open it*/
+  if (strstr(transition, "/>") != NULL) {
+  
+    if (parser->validator != NULL && 
+        schema_end_element(parser->validator, parser->depth + 1, element) != 0)
+      return 1;
+  
+    __lilx_summarise(element);
+  
+    /*if the handler stops at the start, the end 
+      is passed on when parsing is resumed*/
+    if (__lilx_event(parser, LILX_EVENT_START, element) != 0) {
+      parser->pending = 1;
+      return LILX_STOPPED;
+    }
+  
+    return __lilx_event(parser, LILX_EVENT_END, element);
+  }
+ 
+  /*the element is now part of the tree, so 
+    it will be freed along with the tree*/
+  if (parser->depth + 1 >= LILX_STACK_SIZE) return 1;
+ 
+  parser->current = element;
+  parser->depth++;
+ 
+  return __lilx_event(parser, LILX_EVENT_START, element);
+}
+
+uint8_t __lilx_elem_name_end_action(
+parser_t *parser, char *tkn, uint16_t len, char *transition) {
+ 
+  element_t *element;
+ 
+  #ifdef __LILX_DEBUG
+  printf("elem_name_end_action %.*s (%s)\n", len, tkn, transition);
+  #endif
+ 
+  element = parser->current;
+ 
+  /*no element open?*/
+  if (parser->depth == 0) return 1;
+ 
+  /*if the innermost open element doesn't match the current closing
+    tag, the XML is invalid - in trusted mode, we assume that it does
+    (but check anyway if LILX_CHECK_TRUSTED is defined)*/
+  #ifndef LILX_CHECK_TRUSTED
+  if ((parser->flags & LILX_TRUSTED) == 0)
+  #endif
+  if (strlen(element->name) != len || memcmp(element->name, tkn, len) != 0) {
+  
+    #ifdef LILX_CHECK_TRUSTED
+    if (parser->flags & LILX_TRUSTED)
+      fprintf(stderr, "trusted mode: </%.*s> does not close <%s>\n", 
+        len, tkn, element->name);
+    #endif
+    return 1;
+  }
+ 
+  if (parser->validator != NULL && 
+      schema_end_element(parser->validator, parser->depth, element) != 0)
+    return 1;
+ 
+  /*the element is closed - its parent is now the innermost open element*/
+  __lilx_summarise(element);
+  parser->depth--;
+  parser->current = __lilx_open_element(parser, parser->depth);
+ 
+  return __lilx_event(parser, LILX_EVENT_END, element);
+}
+
+uint8_t __lilx_attr_name_action(
+parser_t *parser, char *tkn, uint16_t len, char *transition) {
+ 
+  attribute_t *attr;
+ 
+  #ifdef __LILX_DEBUG
+  printf("attr_name_action %.*s (%s)\n", len, tkn, transition);
+  #endif
+ 
+  /*is the attribute allowed?*/
+  if (parser->validator != NULL && 
+      schema_attribute(parser->validator, parser->depth, tkn, len) != 0)
+    return 1;
+ 
+  /*does the element have room for it?*/
+  if (parser->limits                 != NULL &&
+      parser->limits->max_attributes != 0    &&
+      parser->current->num_attributes >= parser->limits->max_attributes) {
+  
+    parser->exceeded = LILX_LIMIT_ATTRIBUTES;
+    return LILX_LIMIT;
+  }
+ 
+  if (__lilx_charge(parser, 0, len,
+        sizeof(attribute_t) + sizeof(attribute_t *) + len + 1) != 0)
+    return LILX_LIMIT;
+ 
+  /*malloc space for the new attribute and initialise its fields*/
+  attr = (attribute_t *)malloc(sizeof(attribute_t));
+  if (attr == NULL) return 1;
+  attr->name = NULL;
+  attr->value = NULL;
+  attr->ns = 0;
+  attr->local = 0;
+ 
+  /*malloc space for the attribute name*/
+  attr->name = (char *)malloc(len + 1);
+  if (attr->name == NULL) {
+  
+    free(attr);
+    return 1;
+  }
+  memcpy(attr->name, tkn, len);
+  attr->name[len] = '\0';
+ 
+  /*add the attribute to the innermost open element*/
+  if (__lilx_add_attr(parser->current, attr) != 0) {
+  
+    free(attr->name);
+    free(attr);
+    return 1;
+  }
+ 
+  return 0;
+}
+
+uint8_t __lilx_attr_val_action(
+parser_t *parser, char *tkn, uint16_t len, char *transition) {
+ 
+  attribute_t *attr;
+  element_t *element;
+ 
+  #ifdef __LILX_DEBUG
+  printf("attr_val_action %.*s (%s)\n", len, tkn, transition);
+  #endif
+ 
+  /*get the attribute most recently added to the innermost open element*/
+  element = parser->current;
+  if (element->num_attributes == 0) return 1;
+  attr = element->attributes[element->num_attributes - 1];
+ 
+  /*weak check that the attribute does not yet have a value (the
+    fields are initialised to null when the attribute is created)*/
+  if (attr->value != NULL) return 1;
+ 
+  /*leading whitespace is never part of the value, but trailing is*/
+  if (parser->flags & LILX_TRIM)
+    while (len > 0 && isspace(tkn[len - 1])) len--;
+ 
+  /*is the value of the right type?*/
+  if (parser->validator != NULL &&
+      schema_attribute_value(
+        parser->validator, parser->depth, attr->name, tkn, len) != 0)
+    return 1;
+ 
+  if (__lilx_charge(parser, 0, len, len + 1) != 0) return LILX_LIMIT;
+ 
+  /*malloc space for the attribute value */
+  attr->value = (char *)malloc(len + 1);
+  if (attr->value == NULL) return 1;
+  memcpy(attr->value, tkn, len);
+  attr->value[len] = '\0';
+ 
+  /*the start tag is complete, unless more attributes follow*/
+  if (strchr(transition, '>') != NULL) {
+  
+    if (parser->validator != NULL && schema_start_tag_end(
+          parser->validator, parser->depth, element) != 0)
+      return 1;
+  
+    if (__lilx_resolve_namespaces(parser, element) != 0) return 1;
+  }
+ 
+  /*if the transition indicates that the  element is self closing, 
+    we need to close the element*/
+  if (strstr(transition, "/>") != NULL) {
+  
+    if (parser->depth == 0) return 1;
+  
+    if (parser->validator != NULL && 
+        schema_end_element(parser->validator, parser->depth, element) != 0)
+      return 1;
+  
+    __lilx_summarise(element);
+    parser->depth--;
+    parser->current = __lilx_open_element(parser, parser->depth);
+  
+    return __lilx_event(parser, LILX_EVENT_END, element);
+  }
+ 
+  return 0;
+}
+
+uint8_t __lilx_elem_action(
+parser_t *parser, char *tkn, uint16_t len, char *transition) {
+ 
+  element_t *element;
+ 
+  #ifdef __LILX_DEBUG
+  printf("elem_action %.*s (%s)\n", len, tkn, transition);
+  #endif
+ 
+  element = parser->current;
+ 
+  /*is the body of the right type?*/
+  if (parser->validator != NULL && 
+      schema_body(parser->validator, parser->depth, tkn, len) != 0)
+    return 1;
+ 
+  if (__lilx_charge(parser, 0, len, len + 1 + sizeof(lilx_text_t)) != 0)
+    return LILX_LIMIT;
+ 
+  /*in mixed content, this is just one of the element's text segments*/
+  return __lilx_add_text(element, tkn, len);
+}
+
+uint8_t __lilx_comment_action(
+parser_t *parser, char *tkn, uint16_t len, char *transition) {
+ 
+  #ifdef __LILX_DEBUG
+   printf("comment_action %.*s:(%s)\n", len, tkn, transition);
+  #endif
+ 
+  return 0;
+}
+
+uint8_t __lilx_end_action(
+parser_t *parser, char *tkn, uint16_t len, char *transition) {
+ 
+  #ifdef __LILX_DEBUG
+  printf("end_action %.*s (%s)\n", len, tkn, transition);
+  #endif
+ 
+  return 0;
+}
+
+/*******************
+ * Utility functions
+ ******************/
+
+uint32_t __lilx_skip(parser_t *parser, char *xml, uint32_t len) {
+ 
+  uint32_t pos = parser->pos + 1;
+  char *next;
+ 
+  switch (parser->state) {
+  
+    /*an element body ends at the next '<', but any whitespace 
+      preceding the '<' is part of the transition, not the body*/
+    case ELEM:
+      next = (char *)memchr(xml + pos, '<', len - pos);
+      pos  = (next == NULL) ? len : (uint32_t)(next - xml);
+      while (pos > parser->pos + 1 && isspace(xml[pos - 1])) pos--;
+      break;
+   
+    /*an attribute value ends at the closing quote*/
+    case ATTR_VAL:
+      next = (char *)memchr(xml + pos, XML_QUOTE, len - pos);
+      pos  = (next == NULL) ? len : (uint32_t)(next - xml);
+      break;
+   
+    /*a comment ends at "-->"*/
+    case COMMENT:
+      next = (char *)memchr(xml + pos, '-', len - pos);
+      pos  = (next == NULL) ? len : (uint32_t)(next - xml);
+      break;
+   
+    /*names end at whitespace, or at one of these characters*/
+    default:
+      while (pos < len         && 
+             !isspace(xml[pos]) && 
+             xml[pos] != '>'    && 
+             xml[pos] != '/'    && 
+             xml[pos] != '=') 
+        pos++;
+      break;
+  }
+ 
+  return pos;
+}
+
+#ifdef LILX_CHECK_TRUSTED
+uint8_t __lilx_check_skip(
+parser_t *parser, char *xml, uint32_t len, uint8_t final, uint32_t next) {
+ 
+  uint32_t pos;
+  uint8_t state;
+  uint32_t offset;
+  char *transition;
+ 
+  for (pos = parser->pos + 1; pos < next; pos++) {
+  
+    state = parser->state;
+    if (__lilx_get_next_state(
+          &state, xml + pos, xml + len, final, &offset, &transition) == 0) {
+   
+      fprintf(stderr, 
+        "trusted mode: skipped over a state change at offset %lu\n", 
+        (unsigned long)(parser->base + pos));
+      return 1;
+    }
+  }
+ 
+  return 0;
+}
+#endif
+
+element_t * __lilx_open_element(parser_t *parser, uint8_t depth) {
+ 
+  element_t *element = parser->root;
+ 
+  /*an open element is always the last child of its parent*/
+  for (; depth > 0; depth--)
+    element = element->children[element->num_children - 1];
+ 
+  return element;
+}
+
+uint8_t __lilx_event(parser_t *parser, uint8_t event, element_t *element) {
+ 
+  element_t *parent;
+  uint8_t result;
+ 
+  if (parser->handler == NULL) return 0;
+ 
+  result = parser->handler(parser, event, element);
+ 
+  /*a closed element is always the last child of the innermost open element*/
+  if (result == LILX_DROP && event == LILX_EVENT_END) {
+  
+    parent = parser->current;
+    parent->num_children--;
+    __lilx_free_child_map(parent);
+  
+    __lilx_refund(parser, element);
+    if (parser->guide != NULL) guide_remove(parser->guide, element);
+    __lilx_free_tree(element, 0);
+  }
+ 
+  if (result == LILX_STOP) return LILX_STOPPED;
+  return 0;
+}
+
+uint8_t __lilx_parse_failed(parser_t *parser) {
+ 
+  /*record where validation failed*/
+  if (parser->validator != NULL) 
+    parser->validator->offset = parser->base + parser->tkn;
+ 
+  lilx_free_tree(parser->root);
+  if (parser->guide != NULL) guide_clear(parser->guide);
+ 
+  parser->root    = NULL;
+  parser->current = NULL;
+ 
+  return LILX_ERROR;
+}
+
+uint8_t __lilx_charge(
+parser_t *parser, uint32_t elements, uint32_t strings, uint32_t memory) {
+ 
+  lilx_limits_t *limits = parser->limits;
+ 
+  if (limits == NULL) return 0;
+ 
+  parser->num_elements += elements;
+  parser->num_strings  += strings;
+  parser->num_memory   += memory;
+ 
+  if      (limits->max_elements != 0 && 
+           parser->num_elements > limits->max_elements)
+    parser->exceeded = LILX_LIMIT_ELEMENTS;
+  else if (limits->max_strings  != 0 && 
+           parser->num_strings  > limits->max_strings)
+    parser->exceeded = LILX_LIMIT_STRINGS;
+  else if (limits->max_memory   != 0 && 
+           parser->num_memory   > limits->max_memory)
+    parser->exceeded = LILX_LIMIT_MEMORY;
+  else
+    return 0;
+ 
+  return LILX_LIMIT;
+}
+
+void __lilx_refund(parser_t *parser, element_t *element) {
+ 
+  attribute_t *attr;
+  uint16_t i, len;
+  uint32_t n;
+ 
+  if (parser->limits == NULL) return;
+ 
+  /*the same amounts that the actions charged*/
+  n = strlen(element->name);
+  parser->num_elements -= 1;
+  parser->num_strings  -= n;
+  parser->num_memory   -= sizeof(element_t) + sizeof(element_t *) + n + 1;
+ 
+  for (i = 0; i < element->num_attributes; i++) {
+  
+    attr = element->attributes[i];
+    n    = strlen(attr->name);
+  
+    parser->num_strings -= n;
+    parser->num_memory  -= sizeof(attribute_t) + sizeof(attribute_t *) + n + 1;
+  
+    if (attr->value == NULL) continue;
+  
+    n = strlen(attr->value);
+    parser->num_strings -= n;
+    parser->num_memory  -= n + 1;
+  }
+ 
+  for (i = 0; i < element->num_segments; i++) {
+  
+    lilx_get_segment(element, i, &len, NULL);
+    parser->num_strings -= len;
+    parser->num_memory  -= len + 1 + sizeof(lilx_text_t);
+  }
+ 
+  for (i = 0; i < element->num_children; i++)
+    __lilx_refund(parser, element->children[i]);
+}
+
+uint8_t __lilx_put_string(
+uint8_t *blob, uint32_t len, uint32_t *off, char *str) {
+ 
+  uint32_t slen;
+ 
+  if (*off >= len) return 1;
+ 
+  if (str == NULL) {
+    blob[(*off)++] = 0;
+    return 0;
+  }
+ 
+  /*flag byte, followed by the string and its terminating '\0'*/
+  slen = strlen(str) + 1;
+  if (len - *off < slen + 1) return 1;
+ 
+  blob[(*off)++] = 1;
+  memcpy(blob + *off, str, slen);
+  (*off) += slen;
+ 
+  return 0;
+}
+
+uint8_t __lilx_get_string(
+uint8_t *blob, uint32_t len, uint32_t *off, char **str) {
+ 
+  uint32_t slen;
+ 
+  *str = NULL;
+ 
+  if (*off >= len) return 1;
+  if (blob[(*off)++] == 0) return 0;
+ 
+  /*make sure the string is terminated within the blob*/
+  for (slen = 0; *off + slen < len && blob[*off + slen] != '\0'; slen++);
+  if (*off + slen >= len) return 1;
+ 
+  *str = (char *)malloc(slen + 1);
+  if (*str == NULL) return 1;
+  memcpy(*str, blob + *off, slen + 1);
+  (*off) += slen + 1;
+ 
+  return 0;
+}
+
+uint8_t __lilx_restore_element(
+parser_t *parser, uint8_t *blob, uint32_t len, uint32_t *off) {
+ 
+  element_t *element;
+ 
+  element = (element_t *)malloc(sizeof(element_t));
+  if (element == NULL) return 1;
+  __lilx_init_element(element);
+ 
+  if (__lilx_add_child(parser->current, element) != 0) {
+    free(element);
+    return 1;
+  }
+ 
+  /*the element is now part of the tree, so anything 
+    allocated from here on is freed along with the tree*/
+  parser->current = element;
+  parser->depth++;
+ 
+  return __lilx_get_element(blob, len, off, element);
+}
+
+uint8_t __lilx_put_element(uint8_t *blob, 
+uint32_t len, uint32_t *off, element_t *element, uint16_t num_children) {
+ 
+  lilx_text_t *segment;
+  uint16_t i, child = 0;
+ 
+  if (__lilx_put_string(blob, len, off, element->name) != 0) return 1;
+ 
+  if (*off >= len) return 1;
+  blob[(*off)++] = element->num_attributes;
+ 
+  for (i = 0; i < element->num_attributes; i++) {
+  
+    if (__lilx_put_string(
+          blob, len, off, element->attributes[i]->name) != 0)
+      return 1;
+    if (__lilx_put_string(
+          blob, len, off, element->attributes[i]->value) != 0)
+      return 1;
+  }
+ 
+  /*a segment comes before the child at its position, so 
+    that the segments are restored at the same positions*/
+  for (i = 0; i <= element->num_segments; i++) {
+  
+    segment = (i == 0) ? &element->segment : &element->segments[i - 1];
+  
+    for (; child < num_children && 
+           (i == element->num_segments || child < segment->position);
+         child++) {
+    
+      if (*off >= len) return 1;
+      blob[(*off)++] = CHECKPOINT_CHILD;
+    
+      if (__lilx_put_element(blob, len, off, element->children[child],
+            element->children[child]->num_children) != 0)
+        return 1;
+    }
+  
+    if (i == element->num_segments) break;
+  
+    if (*off >= len) return 1;
+    blob[(*off)++] = CHECKPOINT_TEXT;
+  
+    if (__lilx_put_string(
+          blob, len, off, element->body + segment->offset) != 0)
+      return 1;
+  }
+ 
+  if (*off >= len) return 1;
+  blob[(*off)++] = CHECKPOINT_END;
+ 
+  return 0;
+}
+
+uint8_t __lilx_get_element(
+uint8_t *blob, uint32_t len, uint32_t *off, element_t *element) {
+ 
+  uint8_t i, num_attributes;
+  element_t *child;
+  attribute_t *attr;
+  char *text;
+ 
+  if (__lilx_get_string(blob, len, off, &element->name) != 0) return 1;
+  if (element->name == NULL) return 1;
+ 
+  if (*off >= len) return 1;
+  num_attributes = blob[(*off)++];
+ 
+  for (i = 0; i < num_attributes; i++) {
+  
+    attr = (attribute_t *)malloc(sizeof(attribute_t));
+    if (attr == NULL) return 1;
+    attr->name  = NULL;
+    attr->value = NULL;
+    attr->ns    = 0;
+    attr->local = 0;
+  
+    if (__lilx_add_attr(element, attr) != 0) {
+      free(attr);
+      return 1;
+    }
+  
+    if (__lilx_get_string(blob, len, off, &attr->name)  != 0) return 1;
+    if (__lilx_get_string(blob, len, off, &attr->value) != 0) return 1;
+    if (attr->name == NULL) return 1;
+  }
+ 
+  /*the text and children, in document order - each segment 
+    gets the position it had, as the children which came 
+    before it have already been added*/
+  while (*off < len && blob[*off] != CHECKPOINT_END) {
+  
+    switch (blob[(*off)++]) {
+    
+      case CHECKPOINT_TEXT:
+      
+        if (__lilx_get_string(blob, len, off, &text) != 0) return 1;
+        if (text == NULL) return 1;
+      
+        if (__lilx_add_text(element, text, strlen(text)) != 0) {
+          free(text);
+          return 1;
+        }
+        free(text);
+        break;
+    
+      case CHECKPOINT_CHILD:
+      
+        child = (element_t *)malloc(sizeof(element_t));
+        if (child == NULL) return 1;
+        __lilx_init_element(child);
+      
+        if (__lilx_add_child(element, child) != 0) {
+          free(child);
+          return 1;
+        }
+      
+        /*the child is in the tree, so it is freed along with it*/
+        if (__lilx_get_element(blob, len, off, child) != 0) return 1;
+        __lilx_summarise(child);
+        break;
+    
+      default: return 1;
+    }
+  }
+ 
+  if (*off >= len) return 1;
+  (*off)++;
+ 
+  return 0;
+}
+
+uint8_t __lilx_free_tree(element_t *element, uint8_t is_root) {
+ 
+  /*just in case*/
+  if (element == NULL) return 0;
+ 
+  /*free the element name and body*/
+  if (element->name != NULL) free(element->name);
+  if (element->body != NULL) free(element->body);
+  if (element->segments != NULL) free(element->segments);
+  if (element->text != NULL) free(element->text);
+ 
+  /*free the element's attributes and the attribute array*/
+  for (; element->num_attributes > 0; element->num_attributes--) {
+    free(element->attributes[element->num_attributes-1]->name);
+    free(element->attributes[element->num_attributes-1]->value);
+    free(element->attributes[element->num_attributes-1]);
+  }
+  if (element->attributes != NULL) free(element->attributes);
+ 
+  /*recursively free the children - this is the terminating 
+    case, as leaf elements will have no children*/
+  for (; element->num_children > 0; element->num_children--)
+    __lilx_free_tree(element->children[element->num_children-1], 0);
+ 
+  /*free children array*/
+  if (element->children != NULL) free(element->children);
+  __lilx_free_child_map(element);
+ 
+  /*if this is the actual root of the entire tree, don't free it - 
+    that's the caller's responsibility*/
+  if (is_root == 0) free(element);
  
-  /*create stack*/
-  if (stack_create(&stack, LILX_STACK_SIZE) != 0) return 1;
+  return 0;
+}
+
+uint8_t __lilx_add_child(element_t *parent, element_t *child) {
  
-  /*malloc space for saving xml tokens*/
-  token = (char *)malloc(LILX_MAX_TOKEN_LENGTH);
-  if (token == NULL) {
-    stack_free(&stack);
-    return 1;
+  /*the child list grows by doubling - it is full whenever the
+    number of children is a power of two (or 0)*/
+ 
+  element_t **new_child_list;
+  uint16_t n = parent->num_children;
+ 
+  if (n == UINT16_MAX) return 1;
+ 
+  if ((n & (n - 1)) == 0) {
+  
+    new_child_list = (element_t **)
+    realloc(parent->children, sizeof(element_t *) * (n ? n * 2 : 1));
+  
+    if (new_child_list == NULL) return 1;
+  
+    parent->children = new_child_list;
   }
  
-  /*initialise root element*/
-  __lilx_init_element(root);
-  root->name = (char *)malloc(strlen("root") + 1);
-  if (root->name == NULL) {
-    stack_free(&stack);
-    free(token);
-    return 1;
+  /*add the new child*/
+  parent->children[n] = child;
+  parent->num_children ++;
+  child->parent = parent;
+  child->index  = n;
+  __lilx_free_child_map(parent);
+ 
+  return 0;
+}
+
+uint8_t __lilx_resolve_namespaces(parser_t *parser, element_t *element) {
+ 
+  names_t *names = parser->names;
+  attribute_t *attr;
+  uint8_t i;
+ 
+  if (names == NULL) return 0;
+ 
+  /*intern the URIs declared by the element, so that 
+    looking them up later on can't run out of memory*/
+  for (i = 0; i < element->num_attributes; i++) {
+  
+    attr = element->attributes[i];
+  
+    if (strcmp (attr->name, "xmlns")     != 0 &&
+        strncmp(attr->name, "xmlns:", 6) != 0)
+      continue;
+  
+    if (names_intern(names, attr->value, strlen(attr->value)) == NAMES_NONE)
+      return 1;
   }
-  strcpy(root->name, "root");
  
-  /*push root element on to stack*/
-  if (stack_push(&stack, root) != 0) {
-    stack_free(&stack);
-    free(token);
-    free(root->name);
+  if (__lilx_resolve_name(parser, element, 
+        element->name, 1, &element->ns, &element->local) != 0)
     return 1;
+ 
+  for (i = 0; i < element->num_attributes; i++) {
+  
+    attr = element->attributes[i];
+  
+    if (__lilx_resolve_name(parser, element, 
+          attr->name, 0, &attr->ns, &attr->local) != 0)
+      return 1;
   }
  
-  /*initialise state, and begin parsing*/
-  state = ELEM_NAME_START;
-  while (state != END && (*xml) != '\0') {
+  return 0;
+}
+
+uint8_t __lilx_resolve_restored(parser_t *parser, element_t *element) {
+ 
+  uint16_t i;
+ 
+  if (parser->names == NULL) return 0;
+ 
+  if (element != parser->root) {
   
-    #ifdef __LILX_DEBUG
-    printf("in state %u: (%s)\n", state, xml);
-    #endif
+    if (element == parser->current && 
+        (parser->state == ATTR_NAME || parser->state == ATTR_VAL))
+      return 0;
+  
+    if (__lilx_resolve_namespaces(parser, element) != 0) return 1;
+  }
+ 
+  for (i = 0; i < element->num_children; i++)
+    if (__lilx_resolve_restored(parser, element->children[i]) != 0)
+      return 1;
+ 
+  return 0;
+}
+
+uint8_t __lilx_resolve_name(parser_t *parser, element_t *element,
+char *name, uint8_t is_element, uint16_t *ns, uint16_t *local) {
+ 
+  names_t *names = parser->names;
+  char *colon = strchr(name, ':');
+ 
+  /*unprefixed attributes are in no namespace, apart 
+    from xmlns itself; unprefixed elements are in the 
+    default namespace, if one has been declared*/
+  if (colon == NULL) {
   
-    next_state = state;
+    *local = names_intern(names, name, strlen(name));
   
-    /*if there is no state change, save the current character 
-      in the current token and move on to the next character*/
-    if (__lilx_get_next_state(&next_state, xml, &offset, &transition) != 0) {
-   
-      if (tknidx == LILX_MAX_TOKEN_LENGTH) {
+    if      (!is_element && strcmp(name, "xmlns") == 0) 
+      *ns = names_intern(names, XMLNS_NAMESPACE, strlen(XMLNS_NAMESPACE));
+    else if (!is_element) 
+      *ns = 0;
+    else {
+      *ns = __lilx_find_namespace(names, element, name, 0);
+      if (*ns == NAMES_NONE) *ns = 0;
+    }
+  
+    return (*local == NAMES_NONE || *ns == NAMES_NONE);
+  }
+ 
+  *local = names_intern(names, colon + 1, strlen(colon + 1));
+  if (*local == NAMES_NONE) return 1;
+ 
+  /*xml and xmlns are bound without being declared*/
+  if (colon - name == 3 && strncmp(name, "xml", 3) == 0) {
+    *ns = names_intern(names, XML_NAMESPACE, strlen(XML_NAMESPACE));
+    return *ns == NAMES_NONE;
+  }
+  if (colon - name == 5 && strncmp(name, "xmlns", 5) == 0) {
+    *ns = names_intern(names, XMLNS_NAMESPACE, strlen(XMLNS_NAMESPACE));
+    return *ns == NAMES_NONE;
+  }
+ 
+  /*an undeclared prefix is an error*/
+  *ns = __lilx_find_namespace(names, element, name, colon - name);
+  return *ns == NAMES_NONE;
+}
+
+uint16_t __lilx_find_namespace(
+names_t *names, element_t *element, char *prefix, uint16_t len) {
+ 
+  attribute_t *attr;
+  uint8_t i;
+ 
+  /*the innermost declaration wins, and an element's 
+    own declarations apply to the element itself*/
+  for (; element != NULL; element = element->parent) {
+    for (i = 0; i < element->num_attributes; i++) {
     
-        #ifdef __LILX_DEBUG
-        printf("token is too big - aborting\n");
-        #endif
-        break;
+      attr = element->attributes[i];
+    
+      if (strncmp(attr->name, "xmlns", 5) != 0) continue;
+    
+      if (len == 0) {
+        if (attr->name[5] != '\0') continue;
       }
-   
-      #ifdef __LILX_DEBUG
-      printf("adding %c to token\n", *xml);
-      #endif
-   
-      token[tknidx++] = *xml;
-      xml++;
+      else if (attr->name[5]         != ':'                          ||
+               strncmp(attr->name + 6, prefix, len) != 0             ||
+               attr->name[6 + len]   != '\0') 
+        continue;
+    
+      return names_intern(names, attr->value, strlen(attr->value));
     }
+  }
+ 
+  return NAMES_NONE;
+}
+
+uint8_t __lilx_add_text(element_t *element, char *text, uint16_t len) {
+ 
+  lilx_text_t *segment;
+  lilx_text_t *segments;
+  uint32_t offset = 0, cap;
+  uint16_t n;
+  char *body;
+ 
+  if (element->num_segments == UINT16_MAX) return 1;
+ 
+  /*the new segment goes after the '\0' of the last one*/
+  if (element->num_segments > 0) {
+    segment = (element->num_segments == 1) ? 
+      &element->segment : &element->segments[element->num_segments - 2];
+    offset  = segment->offset + segment->length + 1;
+  }
+ 
+  /*the body and the segment list grow by doubling, so that mixed content
+    with many text runs doesn't realloc for each one*/
+  if (offset + len + 1 > element->body_cap) {
   
-    /*if there is a state change, execute the appropriate action
-      handler, skip over the xml input by the offset specified by
-      the handler, and change the current state*/
-    else {
-   
-      token[tknidx] = '\0';
-      tknidx = 0;
-   
-      #ifdef __LILX_DEBUG
-      printf("%u: %s -> %u (%s)\n", 
-        state, token, next_state, transition);
-      #endif
-   
-      /*bail immediately if the action returns an error code*/
-      if (__lilx_actions[state](&stack, token, transition) != 0) break;
-   
-      xml += offset;
-      state = next_state;
-    }
+    cap = element->body_cap ? element->body_cap : 16;
+    while (cap < offset + len + 1) cap *= 2;
+  
+    body = (char *)realloc(element->body, cap);
+    if (body == NULL) return 1;
+  
+    element->body     = body;
+    element->body_cap = cap;
   }
  
-  stack_free(&stack);
-  free(token);
+  memcpy(element->body + offset, text, len);
+  element->body[offset + len] = '\0';
+ 
+  /*the first segment is stored in the element itself - the rest of the
+    list is full whenever its length is a power of two (or 0)*/
+  n = element->num_segments - 1;
  
-  /*if state != END or stack size is not 
-    1, it means that parsing failed.*/
-  if (state != END || stack.size != 1) {
+  if (element->num_segments == 0) segment = &element->segment;
+  else {
   
-    lilx_free_tree(root);
-    return 1;
+    if ((n & (n - 1)) == 0) {
+    
+      segments = (lilx_text_t *)realloc(element->segments, 
+        sizeof(lilx_text_t) * (n ? n * 2 : 1));
+      if (segments == NULL) return 1;
+    
+      element->segments = segments;
+    }
+  
+    segment = &element->segments[n];
+  }
+ 
+  segment->offset   = offset;
+  segment->length   = len;
+  segment->position = element->num_children;
+  element->num_segments++;
+ 
+  /*the joined text is out of date*/
+  if (element->text != NULL) {
+    free(element->text);
+    element->text = NULL;
   }
  
   return 0;
 }
 
-uint8_t lilx_free_tree(element_t *root) {
-  return __lilx_free_tree(root, 1);
+uint8_t __lilx_add_attr(element_t *element, attribute_t *attr) {
+ 
+  /*same concept as described in __lilx_add_child*/
+ 
+  int i = 0;
+ 
+  /*num_attributes would wrap around*/
+  if (element->num_attributes == UINT8_MAX) return 1;
+ 
+  /*allocate space for element's new attr list*/
+  attribute_t **new_attr_list = (attribute_t **)
+  malloc( sizeof(attribute_t *) * (element->num_attributes + 1) );
+ 
+  if (new_attr_list == NULL) return 1;
+ 
+  /*copy the old list across*/
+  if (element->attributes != NULL) {
+    for (i = 0; i < element->num_attributes; i++)
+      new_attr_list[i] = element->attributes[i];
+  }
+ 
+  /*add the new child*/
+  new_attr_list[i] = attr;
+ 
+  /*replace the element's old list with the new list*/
+  if (element->attributes != NULL) free(element->attributes);
+  element->attributes = new_attr_list;
+  element->num_attributes ++;
+ 
+  return 0;
 }
 
-uint8_t lilx_count_elements_by_name(element_t *root, char *name) {
+struct __lilx_child_map * __lilx_get_child_map(element_t *element) {
  
-  uint8_t i;
+  struct __lilx_child_map *map = element->child_map;
+ 
+  if (element->num_children < LILX_CHILD_MAP_THRESHOLD) return NULL;
+ 
+  /*the map is out of date if children have been added or removed*/
+  if (map != NULL                                &&
+      map->children     == element->children     &&
+      map->num_children == element->num_children)
+    return map;
+ 
+  __lilx_free_child_map(element);
+ 
+  /*the map and its entries are allocated together*/
+  map = (struct __lilx_child_map *)malloc(sizeof(struct __lilx_child_map) +
+    element->num_children * sizeof(struct __lilx_child_entry));
+  if (map == NULL) return NULL;
+ 
+  __lilx_fill_child_map(element, map);
+  return map;
+}
+
+uint16_t __lilx_find_child_entry(struct __lilx_child_map *map, char *name) {
+ 
+  uint16_t lo = 0;
+  uint16_t hi = map->num_children;
+  uint16_t mid;
+ 
+  /*binary search for the first entry which is not less than name*/
+  while (lo < hi) {
+  
+    mid = lo + (hi - lo) / 2;
+  
+    if (strcmp(map->entries[mid].name, name) < 0) lo = mid + 1;
+    else                                          hi = mid;
+  }
+ 
+  if (lo < map->num_children && strcmp(map->entries[lo].name, name) == 0)
+    return lo;
+ 
+  return map->num_children;
+}
+
+int __lilx_child_entry_cmp(const void *a, const void *b) {
+ 
+  struct __lilx_child_entry *ea = (struct __lilx_child_entry *)a;
+  struct __lilx_child_entry *eb = (struct __lilx_child_entry *)b;
+  int cmp = strcmp(ea->name, eb->name);
+ 
+  if (cmp != 0) return cmp;
+  return (int)ea->index - (int)eb->index;
+}
+
+void __lilx_free_child_map(element_t *element) {
+ 
+  if (element->child_map == NULL) return;
+ 
+  free(element->child_map);
+  element->child_map = NULL;
+}
+
+uint64_t __lilx_name_bits(char *name) {
+ 
+  uint32_t hash = 2166136261u;
+ 
+  for (; *name != '\0'; name++) {
+    hash ^= (uint8_t)*name;
+    hash *= 16777619u;
+  }
+ 
+  return ((uint64_t)1 << (hash & 63)) | ((uint64_t)1 << ((hash >> 6) & 63));
+}
+
+void __lilx_summarise(element_t *element) {
+ 
+  uint64_t summary = 0;
+  uint16_t i;
+ 
+  if (element->name != NULL) summary = __lilx_name_bits(element->name);
+ 
+  for (i = 0; i < element->num_children; i++)
+    summary |= element->children[i]->summary;
+ 
+  element->summary = summary;
+}
+
+uint8_t __lilx_count_elements(element_t *root, char *name, uint64_t bits) {
+ 
+  uint16_t i;
   uint8_t count = 0;
  
+  /*the name can't be anywhere in this subtree*/
+  if (root->summary != 0 && (root->summary & bits) != bits) return 0;
+ 
   /*if the given element has the name, add 1*/
   if (strcmp(root->name, name) == 0) count++;
  
   /*recursively count the rest of the tree - this is the 
     terminating case, as leaf nodes will have no children*/
   for (i = 0; i < root->num_children; i++) 
-    count += lilx_count_elements_by_name(root->children[i], name);
+    count += __lilx_count_elements(root->children[i], name, bits);
  
   return count;
 }
 
-uint8_t lilx_get_elements_by_name(
-element_t *root, char *name, element_t **elements, uint8_t elements_length) {
+uint8_t __lilx_get_elements(element_t *root, 
+char *name, uint64_t bits, element_t **elements, uint8_t elements_length) {
  
-  uint8_t i;
+  uint16_t i;
   uint8_t temp;
   uint8_t found = 0;
    
   if (elements_length == 0) return 0;
+  if (root->summary != 0 && (root->summary & bits) != bits) return 0;
  
   /*does this element match the name?*/
   if (strcmp(root->name, name) == 0) {
@@ -476,8 +3082,8 @@ element_t *root, char *name, element_t **elements, uint8_t elements_length) {
   /*recursively search each of this element's children*/
   for (i = 0; i < root->num_children; i++) {
   
-    temp = lilx_get_elements_by_name(
-      root->children[i], name, elements, elements_length);
+    temp = __lilx_get_elements(
+      root->children[i], name, bits, elements, elements_length);
   
     found += temp;
     elements += temp;
@@ -487,440 +3093,494 @@ element_t *root, char *name, element_t **elements, uint8_t elements_length) {
   return found;
 }
 
-attribute_t * lilx_get_attribute_by_name(element_t *element, char *name) {
- 
-  uint8_t i;
-  uint8_t len = strlen(name);
- 
-  for (i = 0; i < element->num_attributes; i++)
-  
-  if (strncmp(element->attributes[i]->name, name, len) == 0)
-    return element->attributes[i];
- 
-  return NULL;
-}
-
-void lilx_print_tree(element_t *root) {
-  __lilx_print_tree(root, 0);
-}
-
-/*******************
- * Private functions
- ******************/
-
-void __lilx_init_element(element_t *element) {
-  element->name = NULL;
-  element->body = NULL;
-  element->children = NULL;
-  element->attributes = NULL;
-  element->num_children = 0;
-  element->num_attributes = 0;
-}
-
-uint8_t __lilx_compare(char *xml, char *transition, uint8_t *offset) {
- 
-  #ifdef __LILX_DEBUG
-  printf("cmp (%s), (%s)\n", transition, xml);
-  #endif
+uint32_t __lilx_body_size(element_t *element) {
  
-  (*offset) = 0;
-  while (*transition != '\0') {
-  
-    switch (*transition) {
-
-      case 'A':
-        /*if not printing char, fall through 
-          to 'a' for alphanumeric test*/
-        if ( strchr(XML_BODY_CHARS, *xml) != NULL
-     
-          /*ugly hack - strchr passes when given '\0'*/
-          && *xml != '\0') 
-          break;
-    
-      case 'a':
-        /*if not alphanumeric, fail*/
-        if (isalnum(*xml) == 0) return 1;
-        break;
-   
-      case 'S':
-        /*if not whitespace, fail*/
-        if (isspace(*xml) == 0) return 1;
-        break;
-
-      case 's':
-        /*if char is whitespace, stay on the 's' in 
-          the transition, but move the xml forward*/
-        if (isspace(*xml) != 0) 
-          transition--;
-    
-        /*otherwise keep xml at the current char, 
-          but move the transition forward*/
-        else {
-          (*offset)--;
-          xml--;
-        }
-        break;
-    
-      case '0':
-        /*if char is not the end of the input, fail*/
-        if (*xml != '\0') return 1;
-        break;
-    
-      default:
-        /*if transition doesn't match xml, fail*/
-        if (*transition != *xml) return 1;
-        break;
-    }
-  
-    (*offset)++;
-    xml++;
-    transition++;
-  }
+  lilx_text_t *last;
  
-  (*offset)--;
-  return 0;
+  if (element->body == NULL) return 0;
+  if (element->num_segments == 0) return strlen(element->body) + 1;
+ 
+  last = (element->num_segments == 1) ? 
+    &element->segment : &element->segments[element->num_segments - 2];
+ 
+  return last->offset + last->length + 1;
 }
 
-uint8_t __lilx_get_next_state(
-uint8_t *current_state, char *xml, uint8_t *offset, char **transition) {
+size_t __lilx_subtree_size(element_t *element) {
  
-  uint8_t i, j, tranlen, temp_offset;
-  int8_t last = -1;
-  uint8_t state = *current_state;
-  char *tran;
+  size_t size, strings;
+  uint16_t i, len;
  
-  /*Iterate through all of the possible 
-    state changes for the current state*/
-  for (i = 0; i < NUM_STATES; i++) {
-    for (j = 0; j < STATE_CHOICES; j++) {
-   
-      tran = __lilx_transitions[state][i][j];
-      if (tran == NULL) continue;
-   
-      tranlen = strlen(tran);
-   
-      /*have we found a transition?*/
-      if (__lilx_compare(xml, tran, &temp_offset) == 0) {
-    
-        #ifdef __LILX_DEBUG
-        printf("matched (%i,%i)\n", i, j);
-        #endif
-    
-        /*in case of more than one transition matching, we want
-          the transition that matches the most characters (i.e.
-          the transition string with the longest length)*/
-        if (tranlen > last) {
-     
-          *transition = tran;
-          (*offset) = temp_offset;
-          last = tranlen;
-          *current_state = i;
-        }
-      }
+  size = LILX_ALIGN(sizeof(element_t))
+       + LILX_ALIGN(element->num_attributes * sizeof(attribute_t *))
+       + LILX_ALIGN(element->num_attributes * sizeof(attribute_t))
+       + LILX_ALIGN(element->num_children   * sizeof(element_t *));
+ 
+  if (element->num_segments > 1)
+    size += LILX_ALIGN((element->num_segments - 1) * sizeof(lilx_text_t));
+ 
+  if (element->num_children >= LILX_CHILD_MAP_THRESHOLD)
+    size += LILX_ALIGN(sizeof(struct __lilx_child_map) + 
+      element->num_children * sizeof(struct __lilx_child_entry));
+ 
+  strings = __lilx_body_size(element);
+  if (element->name != NULL) strings += strlen(element->name) + 1;
+ 
+  for (i = 0; i < element->num_attributes; i++)
+    strings += strlen(element->attributes[i]->name)  + 1
+            +  strlen(element->attributes[i]->value) + 1;
+ 
+  /*the joined text of mixed content*/
+  if (element->num_segments > 1) {
+    for (i = 0; i < element->num_segments; i++) {
+      lilx_get_segment(element, i, &len, NULL);
+      strings += len;
     }
+    strings++;
   }
  
-  if (last == -1) return 1;
-  return 0;
+  size += LILX_ALIGN(strings);
+ 
+  for (i = 0; i < element->num_children; i++)
+    size += __lilx_subtree_size(element->children[i]);
+ 
+  return size;
 }
 
-/*****************
- * Action handlers
- ****************/
-
-uint8_t __lilx_elem_name_start_action(
-stack_t *stack, char *tkn, char *transition) {
+char * __lilx_copy_subtree(element_t *element, char *at) {
+ 
+  element_t *copy = (element_t *)at;
+  struct __lilx_child_map *map = NULL;
+  attribute_t *attrs;
+  uint32_t len;
+  uint16_t i;
+  char *str;
+ 
+  *copy = *element;
+  copy->attributes = NULL;
+  copy->children   = NULL;
+  copy->segments   = NULL;
+  copy->body_cap   = 0;
+  copy->text       = NULL;
+  copy->child_map  = NULL;
+  at += LILX_ALIGN(sizeof(element_t));
+ 
+  /*fixed size parts first, so that they stay aligned*/
+  if (element->num_attributes > 0) {
+  
+    copy->attributes = (attribute_t **)at;
+    at += LILX_ALIGN(element->num_attributes * sizeof(attribute_t *));
+    attrs = (attribute_t *)at;
+    at += LILX_ALIGN(element->num_attributes * sizeof(attribute_t));
+  
+    for (i = 0; i < element->num_attributes; i++) {
+      attrs[i] = *element->attributes[i];
+      copy->attributes[i] = &attrs[i];
+    }
+  }
  
-  element_t *element, *parent;
+  if (element->num_children > 0) {
+    copy->children = (element_t **)at;
+    at += LILX_ALIGN(element->num_children * sizeof(element_t *));
+  }
  
-  #ifdef __LILX_DEBUG
-  printf("elem_name_start_action %s (%s)\n", tkn, transition);
-  #endif
+  if (element->num_segments > 1) {
+    copy->segments = (lilx_text_t *)at;
+    len = (element->num_segments - 1) * sizeof(lilx_text_t);
+    memcpy(copy->segments, element->segments, len);
+    at += LILX_ALIGN(len);
+  }
  
-  /*malloc space for a new element*/
-  element = (element_t *)malloc(sizeof(element_t));
-  if (element == NULL) return 1;
+  if (element->num_children >= LILX_CHILD_MAP_THRESHOLD) {
+    map = (struct __lilx_child_map *)at;
+    at += LILX_ALIGN(sizeof(struct __lilx_child_map) + 
+      element->num_children * sizeof(struct __lilx_child_entry));
+  }
  
-  /*initialise the element fields*/
-  __lilx_init_element(element);
+  /*then the strings*/
+  str = at;
  
-  /*malloc space for the element name*/
-  element->name = (char *)malloc(strlen(tkn) + 1);
-  if (element->name == NULL) {
-  
-    free(element);
-    return 1;
+  if (element->name != NULL) {
+    len = strlen(element->name) + 1;
+    copy->name = memcpy(str, element->name, len);
+    str += len;
   }
-  strcpy(element->name, tkn);
  
-  /*is there an element already on the stack? if so, add 
-    the new element as a child of the existing element*/
-  parent = (element_t *)stack_peek(stack);
+  if (element->body != NULL) {
+    len = __lilx_body_size(element);
+    copy->body     = memcpy(str, element->body, len);
+    copy->body_cap = len;
+    str += len;
+  }
  
-  if (parent != NULL && __lilx_add_child(parent, element) != 0) {
+  for (i = 0; i < element->num_attributes; i++) {
   
-    free(element->name);
-    free(element);
-    return 1;
+    len = strlen(element->attributes[i]->name) + 1;
+    copy->attributes[i]->name = memcpy(str, element->attributes[i]->name, len);
+    str += len;
+  
+    len = strlen(element->attributes[i]->value) + 1;
+    copy->attributes[i]->value = 
+      memcpy(str, element->attributes[i]->value, len);
+    str += len;
   }
  
-  /*is the element self closing? if so, don't push it on to the stack*/
-  if (strstr(transition, "/>") != NULL) return 0;
+  /*join mixed content now, so that lilx_get_text doesn't allocate later*/
+  if (element->num_segments > 1) {
+    copy->text = str;
+    str = __lilx_join_text(copy, str);
+  }
  
-  /*push the element on the stack*/
-  if (stack_push(stack, (void *)element) != 0) {
-  
-    free(element->name);
-    free(element);
-    return 1;
+  at += LILX_ALIGN(str - at);
+ 
+  for (i = 0; i < element->num_children; i++) {
+    copy->children[i] = (element_t *)at;
+    at = __lilx_copy_subtree(element->children[i], at);
+    copy->children[i]->parent = copy;
   }
-  return 0;
+ 
+  /*likewise the child map, which can only be built once the children's
+    names have been copied*/
+  if (map != NULL) __lilx_fill_child_map(copy, map);
+ 
+  return at;
 }
 
-uint8_t __lilx_elem_name_end_action(
-stack_t *stack, char *tkn, char *transition) {
+void __lilx_fill_child_map(element_t *element, struct __lilx_child_map *map) {
  
-  element_t *element;
+  uint16_t i;
  
-  #ifdef __LILX_DEBUG
-  printf("elem_name_end_action %s (%s)\n", tkn, transition);
-  #endif
+  map->children     = element->children;
+  map->num_children = element->num_children;
+  map->entries      = (struct __lilx_child_entry *)(map + 1);
+ 
+  for (i = 0; i < element->num_children; i++) {
+    map->entries[i].name  = element->children[i]->name;
+    map->entries[i].index = i;
+  }
  
-  element = stack_peek(stack);
+  qsort(map->entries, map->num_children, 
+        sizeof(struct __lilx_child_entry), &__lilx_child_entry_cmp);
  
-  /*no element on stack, or stack corrupt?*/
-  if (element == NULL) return 1;
+  element->child_map = map;
+}
+
+char * __lilx_join_text(element_t *element, char *dst) {
  
-  /*if the element on top of the stack doesn't match the current closing
-    tag, either the XML is invalid, or the stack is corrupt*/
-  if (strncmp(element->name, tkn, strlen(tkn)) != 0) return 1;
+  uint16_t i, len = 0;
+  char *seg;
  
-  /*the element is closed - pop it from the stack*/
-  if (stack_pop(stack) != element) return 1;
+  for (i = 0; i < element->num_segments; i++) {
+    seg = lilx_get_segment(element, i, &len, NULL);
+    memcpy(dst, seg, len);
+    dst += len;
+  }
+  *dst++ = '\0';
  
-  return 0;
+  return dst;
 }
 
-uint8_t __lilx_attr_name_action(
-stack_t *stack, char *tkn, char *transition) {
+void * __lilx_arena_alloc(lilx_builder_t *builder, size_t size) {
  
-  attribute_t *attr;
-  element_t *element;
+  struct __lilx_arena *arena = builder->arena;
+  struct __lilx_arena *block;
+  size_t header = LILX_ALIGN(sizeof(struct __lilx_arena));
+  size_t bsize;
  
-  #ifdef __LILX_DEBUG
-  printf("attr_name_action %s (%s)\n", tkn, transition);
-  #endif
+  size = LILX_ALIGN(size);
  
-  /*malloc space for the new attribute and initialise its fields*/
-  attr = (attribute_t *)malloc(sizeof(attribute_t));
-  if (attr == NULL) return 1;
-  attr->name = NULL;
-  attr->value = NULL;
+  if (arena == NULL || arena->size - arena->used < size) {
  
-  /*malloc space for the attribute name*/
-  attr->name = (char *)malloc(strlen(tkn) + 1);
-  if (attr->name == NULL) {
-  
-    free(attr);
-    return 1;
+    bsize = (size > LILX_ARENA_BLOCK_SIZE / 4) ? size : LILX_ARENA_BLOCK_SIZE;
+    block = (struct __lilx_arena *)malloc(header + bsize);
+    if (block == NULL) return NULL;
+ 
+    block->used = 0;
+    block->size = bsize;
+ 
+    /*a large allocation gets a block to itself, behind the current block,
+      so that what is left of the current block isn't wasted*/
+    if (bsize != LILX_ARENA_BLOCK_SIZE && arena != NULL) {
+      block->next = arena->next;
+      arena->next = block;
+    }
+    else {
+      block->next    = arena;
+      builder->arena = block;
+    }
+ 
+    arena = block;
   }
-  strcpy(attr->name, tkn);
  
-  /*get the attribute's parent from the stack*/
-  element = (element_t *)stack_peek(stack);
-  if (element == NULL || __lilx_add_attr(element, attr) != 0) {
-  
-    free(attr->name);
-    free(attr);
-    return 1;
+  arena->used += size;
+  return (char *)arena + header + arena->used - size;
+}
+
+char * __lilx_entity(char c, char quote) {
+ 
+  switch (c) {
+    case '&':  return "&amp;";
+    case '<':  return "&lt;";
+    case '>':  return (quote == '\0') ? "&gt;"   : NULL;
+    case '"':  return (quote == '"')  ? "&quot;" : NULL;
+    case '\'': return (quote == '\'') ? "&apos;" : NULL;
   }
  
-  /*push the attribute on to the stack*/
-  if (stack_push(stack, (void *)attr) != 0) {
-    free(attr->name);
-    free(attr);
-    return 1;
+  return NULL;
+}
+
+uint32_t __lilx_escaped_length(char *str, char quote) {
+ 
+  uint32_t len = 0;
+  char *entity;
+ 
+  for (; *str != '\0'; str++) {
+    entity = __lilx_entity(*str, quote);
+    len   += (entity == NULL) ? 1 : strlen(entity);
   }
  
+  return len;
+}
+
+uint8_t __lilx_builder_fail(lilx_builder_t *builder) {
+ 
+  builder->error = 1;
+  return 1;
+}
+
+uint8_t __lilx_builder_check(lilx_builder_t *builder) {
+ 
+  if (builder->error != 0 || builder->done != 0)
+    return __lilx_builder_fail(builder);
+ 
   return 0;
 }
 
-uint8_t __lilx_attr_val_action(
-stack_t *stack, char *tkn, char *transition) {
+lilx_text_t * __lilx_builder_segment(
+lilx_builder_t *builder, lilx_builder_frame_t *frame) {
  
-  attribute_t *attr;
+  element_t   *element = frame->element;
+  lilx_text_t *segments;
+  lilx_text_t *segment;
+  uint16_t     cap;
  
-  #ifdef __LILX_DEBUG
-  printf("attr_val_action %s (%s)\n", tkn, transition);
-  #endif
+  if (element->num_segments == UINT16_MAX) return NULL;
  
-  /*get the attribute on top of the stack*/
-  attr = (attribute_t *)stack_peek(stack);
-  if (attr == NULL) return 1;
+  if (element->num_segments == frame->segments_cap) {
  
-  /*weak check that the top of the stack is an attribute (the
-    fields are initialised to null when the attribute is created)*/
-  if (attr->value != NULL) return 1;
+    cap = frame->segments_cap ? frame->segments_cap * 2 : 4;
+    if (cap < frame->segments_cap) cap = UINT16_MAX;
  
-  /*malloc space for the attribute value */
-  attr->value = (char *)malloc(strlen(tkn) + 1);
-  if (attr->value == NULL) return 1;
-  strcpy(attr->value, tkn);
+    segments = (lilx_text_t *)realloc(frame->segments, 
+      cap * sizeof(lilx_text_t));
+    if (segments == NULL) return NULL;
  
-  /*pop the attribute from the stack*/
-  if (stack_pop(stack) != attr) {
-  
-    free(attr->value);
-    return 1;
+    frame->segments     = segments;
+    frame->segments_cap = cap;
   }
  
-  /*if the transition indicates that the  element is self closing, 
-    we need to pop the element from the stack*/
-  if (strstr(transition, "/>") != NULL && stack_pop(stack) == NULL) {
-  
-    free(attr->value);
-    return 1;
-  }
+  segment           = &frame->segments[element->num_segments++];
+  segment->offset   = frame->body_len;
+  segment->length   = 0;
+  segment->position = element->num_children;
  
-  return 0;
+  return segment;
 }
 
-uint8_t __lilx_elem_action(
-stack_t *stack, char *tkn, char *transition) {
+uint8_t __lilx_builder_finish(
+lilx_builder_t *builder, lilx_builder_frame_t *frame) {
  
-  element_t *element;
+  element_t                  *element = frame->element;
+  struct __lilx_builder_node *node;
+  struct __lilx_builder_attr *attr;
+  uint32_t                    len;
+  uint16_t                    i;
  
-  #ifdef __LILX_DEBUG
-  printf("elem_action %s (%s)\n", tkn, transition);
-  #endif
+  if (element->num_attributes > 0) {
  
-  /*get the element on top of the stack*/
-  element = (element_t *)stack_peek(stack);
-  if (element == NULL) return 1;
+    element->attributes = (attribute_t **)__lilx_arena_alloc(builder, 
+      element->num_attributes * sizeof(attribute_t *));
+    if (element->attributes == NULL) return 1;
  
-  /*malloc space for the element body*/
-  if (element->body != NULL) free(element->body);
-  element->body = (char *)malloc(strlen(tkn) + 1);
-  if (element->body == NULL) return 1;
-  strcpy(element->body, tkn);
+    /*the list is newest first*/
+    for (i = element->num_attributes, attr = frame->attrs; 
+         i > 0; i--, attr = attr->next)
+      element->attributes[i - 1] = &attr->attr;
+  }
  
-  return 0;
-}
-
-uint8_t __lilx_comment_action(
-stack_t *stack, char *tkn, char *transition) {
+  if (element->num_children > 0) {
  
-  #ifdef __LILX_DEBUG
-   printf("comment_action %s:(%s)\n", tkn, transition);
-  #endif
+    element->children = (element_t **)__lilx_arena_alloc(builder, 
+      element->num_children * sizeof(element_t *));
+    if (element->children == NULL) return 1;
+ 
+    for (i = 0, node = frame->first; node != NULL; i++, node = node->next)
+      element->children[i] = &node->element;
+  }
+ 
+  if (element->num_segments > 0) {
+ 
+    element->body = (char *)__lilx_arena_alloc(builder, frame->body_len);
+    if (element->body == NULL) return 1;
+ 
+    memcpy(element->body, frame->body, frame->body_len);
+    element->body_cap = frame->body_len;
+    element->segment = frame->segments[0];
+  }
+ 
+  /*mixed content is joined now, so that lilx_get_text doesn't allocate*/
+  if (element->num_segments > 1) {
+ 
+    len = (element->num_segments - 1) * sizeof(lilx_text_t);
+ 
+    element->segments = (lilx_text_t *)__lilx_arena_alloc(builder, len);
+    element->text     = (char *)__lilx_arena_alloc(builder, frame->body_len);
+    if (element->segments == NULL || element->text == NULL) return 1;
+ 
+    memcpy(element->segments, frame->segments + 1, len);
+    __lilx_join_text(element, element->text);
+  }
+ 
+  /*likewise the child map*/
+  if (element->num_children >= LILX_CHILD_MAP_THRESHOLD) {
+ 
+    element->child_map = (struct __lilx_child_map *)__lilx_arena_alloc(
+      builder, sizeof(struct __lilx_child_map) + 
+      element->num_children * sizeof(struct __lilx_child_entry));
+    if (element->child_map == NULL) return 1;
  
+    __lilx_fill_child_map(element, element->child_map);
+  }
+ 
+  __lilx_summarise(element);
   return 0;
 }
 
-uint8_t __lilx_end_action(
-stack_t *stack, char *tkn, char *transition) {
+uint8_t __lilx_emit(struct __lilx_output *out, char *data, uint32_t len) {
  
-  #ifdef __LILX_DEBUG
-  printf("end_action %s (%s)\n", tkn, transition);
-  #endif
+  if (out->len + len > LILX_OUTPUT_SIZE && __lilx_flush(out) != 0) return 1;
+ 
+  /*anything too big for the buffer goes straight out*/
+  if (len > LILX_OUTPUT_SIZE) return out->write(out->context, data, len);
+ 
+  memcpy(out->buf + out->len, data, len);
+  out->len += len;
  
   return 0;
 }
 
-/*******************
- * Utility functions
- ******************/
-
-uint8_t __lilx_free_tree(element_t *element, uint8_t is_root) {
+uint8_t __lilx_flush(struct __lilx_output *out) {
  
-  /*just in case*/
-  if (element == NULL) return 0;
+  uint32_t len = out->len;
  
-  /*free the element name and body*/
-  if (element->name != NULL) free(element->name);
-  if (element->body != NULL) free(element->body);
+  if (len == 0) return 0;
  
-  /*free the element's attributes and the attribute array*/
-  for (; element->num_attributes > 0; element->num_attributes--) {
-    free(element->attributes[element->num_attributes-1]->name);
-    free(element->attributes[element->num_attributes-1]->value);
-    free(element->attributes[element->num_attributes-1]);
-  }
-  if (element->attributes != NULL) free(element->attributes);
+  out->len = 0;
+  return out->write(out->context, out->buf, len);
+}
+
+uint8_t __lilx_newline(struct __lilx_output *out, uint16_t depth) {
  
-  /*recursively free the children - this is the terminating 
-    case, as leaf elements will have no children*/
-  for (; element->num_children > 0; element->num_children--)
-    __lilx_free_tree(element->children[element->num_children-1], 0);
+  uint32_t i;
  
-  /*free children array*/
-  if (element->children != NULL) free(element->children);
+  if (__lilx_emit(out, "\n", 1) != 0) return 1;
  
-  /*if this is the actual root of the entire tree, don't free it - 
-    that's the caller's responsibility*/
-  if (is_root == 0) free(element);
+  for (i = 0; i < (uint32_t)depth * out->indent; i++)
+    if (__lilx_emit(out, " ", 1) != 0) return 1;
  
   return 0;
 }
 
-uint8_t __lilx_add_child(element_t *parent, element_t *child) {
+uint8_t __lilx_serialise_start(struct __lilx_output *out, element_t *element) {
  
-  /*we are creating a new child list, copying the parent's old list
-    over to the new one, appending the new child to the list, and then
-    replacing the parent's old list with the new one*/
+  attribute_t *attr;
+  char         quote[1] = {XML_QUOTE};
+  uint8_t      a;
  
-  int i = 0;
+  if (__lilx_emit(out, "<", 1)                                   != 0 ||
+      __lilx_emit(out, element->name, strlen(element->name))     != 0)
+    return 1;
  
-  /*allocate space for the parent's new child list*/
-  element_t **new_child_list = (element_t **)
-  malloc( sizeof(element_t *) * (parent->num_children + 1) );
+  for (a = 0; a < element->num_attributes; a++) {
  
-  if (new_child_list == NULL) return 1;
+    attr = element->attributes[a];
  
-  /*copy the old list across*/
-  if (parent->children != NULL) {
-    for (i = 0; i < parent->num_children; i++)
-      new_child_list[i] = parent->children[i];
+    if (__lilx_emit(out, " ", 1)                                 != 0 ||
+        __lilx_emit(out, attr->name, strlen(attr->name))         != 0 ||
+        __lilx_emit(out, "=", 1)                                 != 0 ||
+        __lilx_emit(out, quote, 1)                               != 0 ||
+        __lilx_emit(out, attr->value, strlen(attr->value))       != 0 ||
+        __lilx_emit(out, quote, 1)                               != 0)
+      return 1;
   }
  
-  /*add the new child*/
-  new_child_list[i] = child;
+  if (element->num_children == 0 && element->num_segments == 0)
+    return __lilx_emit(out, "/>", 2);
  
-  /*replace the parent's old list with the new list*/
-  if (parent->children != NULL) free(parent->children);
-  parent->children = new_child_list;
-  parent->num_children ++;
+  return __lilx_emit(out, ">", 1);
+}
+ 
+uint8_t __lilx_serialise_gap(
+struct __lilx_output *out, element_t *element, uint16_t i, uint16_t depth) {
+ 
+  char    *seg;
+  uint16_t lo = 0, hi = element->num_segments, mid, len = 0, position = 0;
+ 
+  /*whitespace can only be added where it won't change the text*/
+  if (element->num_segments == 0) {
+  
+    if (out->indent == 0) return 0;
+    return __lilx_newline(out, (i < element->num_children) ? depth + 1 : depth);
+  }
+ 
+  /*binary search for the first segment at position i - segments are in
+    position order*/
+  while (lo < hi) {
+  
+    mid = lo + (hi - lo) / 2;
+    lilx_get_segment(element, mid, NULL, &position);
+  
+    if (position < i) lo = mid + 1;
+    else              hi = mid;
+  }
+ 
+  while ((seg = lilx_get_segment(element, lo++, &len, &position)) != NULL &&
+         position == i)
+    if (__lilx_emit(out, seg, len) != 0) return 1;
  
   return 0;
 }
-
-uint8_t __lilx_add_attr(element_t *element, attribute_t *attr) {
  
-  /*same concept as described in __lilx_add_child*/
+uint8_t __lilx_serialise_end(struct __lilx_output *out, element_t *element) {
  
-  int i = 0;
+  if (element->num_children == 0 && element->num_segments == 0) return 0;
  
-  /*allocate space for element's new attr list*/
-  attribute_t **new_attr_list = (attribute_t **)
-  malloc( sizeof(attribute_t *) * (element->num_attributes + 1) );
+  if (__lilx_emit(out, "</", 2)                               != 0 ||
+      __lilx_emit(out, element->name, strlen(element->name))  != 0 ||
+      __lilx_emit(out, ">", 1)                                != 0)
+    return 1;
  
-  if (new_attr_list == NULL) return 1;
+  return 0;
+}
  
-  /*copy the old list across*/
-  if (element->attributes != NULL) {
-    for (i = 0; i < element->num_attributes; i++)
-      new_attr_list[i] = element->attributes[i];
-  }
+uint8_t __lilx_serialise(
+struct __lilx_output *out, element_t *element, uint16_t depth) {
  
-  /*add the new child*/
-  new_attr_list[i] = attr;
+  uint16_t i;
  
-  /*replace the element's old list with the new list*/
-  if (element->attributes != NULL) free(element->attributes);
-  element->attributes = new_attr_list;
-  element->num_attributes ++;
+  if (__lilx_serialise_start(out, element) != 0) return 1;
  
-  return 0;
+  if (element->num_children == 0 && element->num_segments == 0) return 0;
+ 
+  for (i = 0; i < element->num_children; i++) {
+    if (__lilx_serialise_gap(out, element, i, depth)                != 0 ||
+        __lilx_serialise(out, element->children[i], depth + 1)     != 0)
+      return 1;
+  }
+ 
+  if (__lilx_serialise_gap(out, element, i, depth) != 0) return 1;
+ 
+  return __lilx_serialise_end(out, element);
 }
 
 static void __lilx_print_tree(element_t *root, uint8_t depth) {
@@ -944,7 +3604,7 @@ static void __lilx_print_tree(element_t *root, uint8_t depth) {
   for (i = 0; i < root->num_attributes; i++) 
     printf("(%s=%s) ", root->attributes[i]->name, 
                        root->attributes[i]->value);
-  if (root->body != NULL) printf("%s", root->body);
+  if (root->body != NULL) printf("%s", lilx_get_text(root));
   printf("\n");
  
   /*recursively descend into tree - this is the 
@@ -15,9 +15,7 @@
 #define LILX_MAX_TOKEN_LENGTH 1000
 
 /**
- * The maximum XML tree depth that can be parsed. Attributes are stored on 
- * the same stack, so if you expect individual elements to have lots of 
- * attributes, increase the stack size.
+ * The maximum XML tree depth that can be parsed.
  */
 #define LILX_STACK_SIZE 100
 
@@ -28,37 +26,299 @@
  */
 #define LILX_USE_SINGLE_QUOTES 0
 
+/**
+ * Elements with at least this many children get a child map - an index of
+ * their children, sorted by name - the first time one of their children is
+ * looked up by name, so that lookups on wide elements are O(log n) rather
+ * than O(n).
+ */
+#define LILX_CHILD_MAP_THRESHOLD 16
+
+/**
+ * Return codes for lilx_parse.
+ */
+#define LILX_OK      0 /**< parsing is complete                */
+#define LILX_ERROR   1 /**< parsing failed                     */
+#define LILX_MORE    2 /**< more input is needed to carry on   */
+#define LILX_STOPPED 3 /**< a handler has stopped parsing      */
+#define LILX_LIMIT   4 /**< a resource limit was exceeded      */
+
+/**
+ * Resource limits, one of which is stored in the exceeded field of a parser
+ * when lilx_parse returns LILX_LIMIT - see lilx_limits_t.
+ */
+#define LILX_LIMIT_BYTES      1 /**< max_bytes      */
+#define LILX_LIMIT_ELEMENTS   2 /**< max_elements   */
+#define LILX_LIMIT_ATTRIBUTES 3 /**< max_attributes */
+#define LILX_LIMIT_DEPTH      4 /**< max_depth      */
+#define LILX_LIMIT_STRINGS    5 /**< max_strings    */
+#define LILX_LIMIT_MEMORY     6 /**< max_memory     */
+
+/**
+ * Parser flags, which may be set in the flags field of a parser_t after it
+ * has been initialised.
+ *
+ * LILX_TRUSTED tells the parser to assume that the input is well-formed;
+ * closing tags are matched by depth alone, and rather than looking for a
+ * state change at every character, the parser skips straight to the next
+ * character that could cause one. Only use it on XML from a source you
+ * trust - malformed input will give you a bogus tree rather than an error.
+ * If lilx is built with LILX_CHECK_TRUSTED defined, the short cuts are
+ * checked against the validating parser, and any input on which they go
+ * wrong fails to parse, with a message on stderr.
+ */
+#define LILX_TRUSTED 0x01
+
+/**
+ * Leading and trailing whitespace is never part of an element body (or of a
+ * text segment in mixed content), and whitespace-only text between elements
+ * is dropped. Attribute values lose their leading whitespace, but keep their
+ * trailing whitespace, unless LILX_TRIM is set. Trimming just shortens the
+ * value before it is copied into the tree, so costs nothing extra.
+ */
+#define LILX_TRIM 0x02
+
+/**
+ * Events which are passed to a parser's handler, if it has one. At the start
+ * of an element, only the element name is known. At the end of an element,
+ * its attributes, body and children are complete.
+ */
+#define LILX_EVENT_START 0 /**< an element has been opened */
+#define LILX_EVENT_END   1 /**< an element has been closed */
+
+/**
+ * Values which a handler may return. LILX_DROP removes the element from the
+ * tree and frees it, so that the tree only ever holds the elements you are
+ * interested in; it may only be returned for LILX_EVENT_END. LILX_STOP makes
+ * lilx_parse return LILX_STOPPED; the tree is left as it is, and parsing can
+ * be resumed by calling lilx_parse again. A handler which stops at the
+ * LILX_EVENT_START of a self closing element gets its LILX_EVENT_END as soon
+ * as parsing is resumed.
+ */
+#define LILX_CONTINUE 0 /**< carry on parsing                 */
+#define LILX_DROP     1 /**< remove the element from the tree */
+#define LILX_STOP     2 /**< stop parsing                     */
+
 /*******
  * Types
  ******/
 
 struct __lilx_attribute;
 struct __lilx_element;
+struct __lilx_parser;
+struct __lilx_child_map;
+struct __schema_validator;
+struct __names;
+struct __guide;
+struct __lilx_arena;
+struct __lilx_builder_node;
+struct __lilx_builder_attr;
 typedef struct __lilx_attribute attribute_t;
 typedef struct __lilx_element element_t;
+typedef struct __lilx_parser parser_t;
+
+/**
+ * Event handler - see LILX_EVENT_START and LILX_EVENT_END. During an event,
+ * parser->base + parser->tkn is the input offset of the element name (for
+ * LILX_EVENT_END, the name in the closing tag, unless the element was self
+ * closing).
+ *
+ * \return LILX_CONTINUE, LILX_DROP or LILX_STOP.
+ */
+typedef uint8_t (*handler_t)(
+  parser_t  *parser, /**< the parser              */
+  uint8_t    event,  /**< the event               */
+  element_t *element /**< the element in question */
+);
 
 /**
  * XML element attribute.
  */
 struct __lilx_attribute {
  
-  char *name;  /**< attribute name */
-  char *value; /**< attribute value */
+  char    *name;  /**< attribute name    */
+  char    *value; /**< attribute value   */
+  uint16_t ns;    /**< namespace URI id  */
+  uint16_t local; /**< local name id     */
 };
 
 /**
- * XML element.
+ * A run of text in an element body. An element with mixed content, e.g.
+ * <p>a<b/>c</p>, has a text segment on either side of the child element.
+ */
+typedef struct __lilx_text {
+
+  uint32_t offset;   /**< offset of the text within the element body */
+  uint16_t length;   /**< length of the text                         */
+  uint16_t position; /**< number of child elements which precede it  */
+} lilx_text_t;
+
+/**
+ * XML element. The text segments of the element are stored one after the
+ * other in body, each '\0' terminated, so for an element without mixed
+ * content, body is just the element body. Use lilx_get_segment to get at
+ * the segments of mixed content, or lilx_get_text to get all of it.
  */
 struct __lilx_element {
  
   char          *name;           /**< element name                  */
-  char          *body;           /**< element body, if present      */
+  char          *body;           /**< first text segment, if any    */
   uint8_t        num_attributes; /**< number of attributes          */
   attribute_t ** attributes;     /**< the attributes themselves     */
-  uint8_t        num_children;   /**< number of child elements      */
+  uint16_t       num_children;   /**< number of child elements      */
   element_t   ** children;       /**< the child elements themselves */
+  element_t    * parent;         /**< parent element, NULL for the
+                                      root                          */
+  uint16_t       index;          /**< position in parent->children  */
+  uint16_t       ns;             /**< namespace URI id              */
+  uint16_t       local;          /**< local name id                 */
+  uint16_t       path;           /**< DataGuide path id             */
+  uint16_t       num_segments;   /**< number of text segments       */
+  lilx_text_t    segment;        /**< the first text segment        */
+  uint32_t       body_cap;       /**< bytes allocated for body      */
+  lilx_text_t  * segments;       /**< the rest of the text segments */
+  char         * text;           /**< cached result of lilx_get_text */
+ 
+  /** Bloom style summary of the names of the element and everything below
+      it - 0 (unknown) until the element has been closed, and after
+      lilx_reset_summary */
+  uint64_t summary;
+ 
+  /** index of the children by name, built on demand - see lilx_get_child */
+  struct __lilx_child_map *child_map;
 };
 
+/**
+ * Resource limits for parsing untrusted input - see the limits field of
+ * parser_t. A limit of 0 means no limit. The element, string and memory
+ * counts are of what the tree holds, so elements which a handler drops no
+ * longer count against them. The memory count covers the elements,
+ * attributes and text in the tree, but not spare capacity, or malloc's own
+ * overhead, so leave some headroom.
+ */
+typedef struct __lilx_limits {
+
+  uint32_t max_bytes;      /**< bytes of input                            */
+  uint32_t max_elements;   /**< elements in the tree                      */
+  uint8_t  max_attributes; /**< attributes of any one element             */
+  uint8_t  max_depth;      /**< depth of the tree                         */
+  uint32_t max_strings;    /**< bytes of names, values and text in the
+                                tree                                      */
+  uint32_t max_memory;     /**< bytes allocated for the tree              */
+} lilx_limits_t;
+
+/**
+ * Resumable parser state, for XML which arrives in pieces. The parser does
+ * not copy input into a token buffer; it refers to the caller's input by
+ * offset, so between calls the caller must keep the input it has passed in
+ * at the same offsets. Nor does it keep a stack - an open element is always
+ * the last child of its parent, so the depth is enough to find the open
+ * elements again. Apart from flags, validator, names, handler and context,
+ * the fields should be treated as read-only.
+ *
+ * If names is set, the parser resolves namespace prefixes as it goes, and
+ * sets the ns and local fields of each element and attribute to the ids (in
+ * names) of its namespace URI and local name. An element's ids are set once
+ * its start tag is complete, so they are always set by LILX_EVENT_END, but
+ * at LILX_EVENT_START, only if the element has no attributes. Elements and
+ * unprefixed attributes which are not in a namespace get the id of the empty
+ * string, 0. A prefix which has not been declared is a parse error. If names
+ * is not set, the ids are all 0. The declarations in scope are looked up in
+ * the xmlns attributes of the open elements, so this needs no more parser
+ * state. The ids of the elements recreated by lilx_parser_restore are set
+ * at the start of the next call to lilx_parse, so set names before then.
+ *
+ * If limits is set, the parser keeps count of what it has added to the
+ * tree, and fails with LILX_LIMIT, rather than LILX_ERROR, as soon as a
+ * limit is exceeded. The counts are only updated when an element, attribute
+ * or piece of text is added, so the limits cost nothing per byte of input.
+ * The counts start again from 0 after lilx_parser_restore.
+ */
+struct __lilx_parser {
+
+  element_t *root;    /**< root of the tree being built                */
+  element_t *current; /**< innermost open element                      */
+  uint32_t   base;    /**< offset of the input buffer within the input */
+  uint32_t   pos;     /**< offset of the next character to scan        */
+  uint32_t   tkn;     /**< offset at which the current token starts    */
+  uint8_t    state;   /**< current parser state                        */
+  uint8_t    depth;   /**< number of open elements below the root      */
+  uint8_t    flags;   /**< parser flags - may be set by the caller     */
+ 
+  /** schema validator (see schema.h) - may be set by the caller */
+  struct __schema_validator *validator;
+ 
+  /** interned names (see names.h) - set by the caller to turn on namespace
+      processing */
+  struct __names *names;
+ 
+  /** DataGuide (see guide.h) - set by the caller to build one */
+  struct __guide *guide;
+ 
+  /** resource limits - may be set by the caller */
+  lilx_limits_t *limits;
+  uint32_t       num_elements; /**< elements in the tree               */
+  uint32_t       num_strings;  /**< bytes of strings in the tree       */
+  uint32_t       num_memory;   /**< bytes allocated for the tree       */
+  uint8_t        exceeded;     /**< the limit which was exceeded, if
+                                    lilx_parse returned LILX_LIMIT     */
+  uint8_t        pending;      /**< non-0 if the handler stopped at the
+                                    start of a self closing element,
+                                    whose end is still to be passed on */
+  uint8_t        restored;     /**< non-0 if lilx_parser_restore has
+                                    recreated elements which have not
+                                    had their namespaces resolved yet  */
+ 
+  handler_t  handler; /**< event handler - may be set by the caller    */
+  void      *context; /**< for use by the handler                      */
+};
+
+/**
+ * Called with each piece of output from lilx_serialise.
+ *
+ * \return 0 on success, non-0 on failure, which stops lilx_serialise.
+ */
+typedef uint8_t (*lilx_write_t)(
+  void     *context, /**< the context given to lilx_serialise */
+  char     *data,    /**< the output                          */
+  uint32_t  len      /**< length of the output                */
+);
+
+/**
+ * Builder state for one open element.
+ */
+typedef struct __lilx_builder_frame {
+
+  element_t                  *element;      /**< the element             */
+  struct __lilx_builder_node *first;        /**< its first child         */
+  struct __lilx_builder_node *last;         /**< its last child          */
+  struct __lilx_builder_attr *attrs;        /**< its attributes, newest
+                                                 first                   */
+  char                       *body;         /**< its text so far         */
+  uint32_t                    body_len;     /**< length of body          */
+  uint32_t                    body_cap;     /**< capacity of body        */
+  lilx_text_t                *segments;     /**< its text segments       */
+  uint16_t                    segments_cap; /**< capacity of segments    */
+} lilx_builder_frame_t;
+
+/**
+ * Tree builder - see lilx_builder_init. The fields should never be accessed
+ * directly. A builder must not be moved once it has been initialised.
+ */
+typedef struct __lilx_builder {
+
+  element_t            root;  /**< root of the tree                      */
+  struct __names      *names; /**< interned element and attribute names  */
+  struct __lilx_arena *arena; /**< memory for the tree, newest block
+                                   first                                 */
+  uint8_t              depth; /**< number of open elements               */
+  uint8_t              error; /**< non-0 once a call has failed          */
+  uint8_t              done;  /**< non-0 once the root has been finished */
+
+  /** the root, and the open elements */
+  lilx_builder_frame_t frames[LILX_STACK_SIZE];
+} lilx_builder_t;
+
 /*******************************
  * Tree creation and destruction
  ******************************/
@@ -83,6 +343,133 @@ uint8_t lilx_create_tree(
   element_t *root     /**< pointer to an element to use as the root  */
 );
 
+/**
+ * Like lilx_create_tree, but subject to the given resource limits.
+ *
+ * \return LILX_OK on success, LILX_LIMIT if a limit was exceeded, or
+ * LILX_ERROR on any other failure. Unless LILX_OK is returned, there is
+ * nothing to free.
+ */
+uint8_t lilx_create_tree_limited(
+  char          *raw_text, /**< the raw XML string                        */
+  element_t     *root,     /**< pointer to an element to use as the root  */
+  lilx_limits_t *limits    /**< the limits                                */
+);
+
+/**
+ * Initialises a resumable parser, using the given element as the root of
+ * the tree that it builds.
+ *
+ * \return 0 on success, non-0 on failure.
+ *
+ * \note If the function succeeds, the tree must eventually be freed via
+ * lilx_free_tree, unless lilx_parse fails (in which case the tree has already
+ * been freed).
+ */
+uint8_t lilx_parser_init(
+  parser_t  *parser, /**< the parser to initialise                  */
+  element_t *root    /**< pointer to an element to use as the root  */
+);
+
+/**
+ * Carries on parsing the XML in the given buffer, from where the previous
+ * call left off. The buffer must contain all of the input that was passed in
+ * on previous calls, at the same offsets, followed by any newly received
+ * input. Set \p final once the buffer contains the whole document.
+ *
+ * \return LILX_OK when the whole document has been parsed, LILX_MORE if more
+ * input is needed, LILX_STOPPED if the handler has stopped parsing, or
+ * LILX_ERROR or LILX_LIMIT on failure, in which case the tree has been
+ * freed.
+ */
+uint8_t lilx_parse(
+  parser_t *parser, /**< the parser                                    */
+  char     *xml,    /**< the input received so far                     */
+  uint32_t  len,    /**< length of the input received so far           */
+  uint8_t   final   /**< non-0 if there is no more input to come       */
+);
+
+/**
+ * Like lilx_parse, but for a document which is already entirely in memory,
+ * and stopping after at most \p max_bytes bytes of input have been scanned,
+ * so that a large document can be parsed a bit at a time, in between other
+ * work. Call it repeatedly, with the same buffer, until it returns something
+ * other than LILX_MORE. The resulting tree is the same as that created by
+ * lilx_create_tree. A \p max_bytes of 0 means no limit, i.e. the same as
+ * lilx_parse.
+ *
+ * \return LILX_OK when the whole document has been parsed, LILX_MORE if
+ * parsing is still in progress, or LILX_ERROR or LILX_LIMIT on failure, in
+ * which case the tree has been freed.
+ */
+uint8_t lilx_parse_step(
+  parser_t *parser,   /**< the parser                                   */
+  char     *xml,      /**< the whole document                           */
+  uint32_t  len,      /**< length of the document                       */
+  uint32_t  max_bytes /**< maximum number of bytes to scan on this call,
+                           0 for no limit                               */
+);
+
+/**
+ * Tells the parser that the caller is about to discard the input which the
+ * parser no longer needs, i.e. everything before the start of the current
+ * token. Use this to keep the input buffer small when parsing a long stream.
+ *
+ * \return the number of bytes which the caller must remove from the start of
+ * its input buffer before the next call to lilx_parse.
+ */
+uint32_t lilx_parser_discard(
+  parser_t *parser /**< the parser */
+);
+
+/**
+ * Like lilx_parser_discard, but keeps the input from the given offset (in
+ * the input as a whole, not the buffer) onwards, for callers which still
+ * need some of the input that the parser has finished with.
+ *
+ * \return the number of bytes which the caller must remove from the start of
+ * its input buffer before the next call to lilx_parse.
+ */
+uint32_t lilx_parser_discard_before(
+  parser_t *parser, /**< the parser                          */
+  uint32_t  offset  /**< offset of the first byte to keep    */
+);
+
+/**
+ * Saves the state of the given parser to a small blob, from which parsing
+ * can later be resumed with lilx_parser_restore. The blob contains the
+ * parser state, the names, attributes and text of the open elements, the
+ * elements which have already been closed inside them, and the offset within
+ * the input at which parsing should resume. Closed elements which are still
+ * in the tree are saved in full, so remove the ones you are done with to
+ * keep the blob small.
+ *
+ * \return the size of the blob, or 0 if it wouldn't fit in the given buffer
+ * (or the parser has failed).
+ */
+uint32_t lilx_parser_checkpoint(
+  parser_t *parser, /**< the parser                  */
+  uint8_t  *blob,   /**< buffer to store the blob in */
+  uint32_t  len     /**< length of the buffer        */
+);
+
+/**
+ * Initialises a parser from a blob created by lilx_parser_checkpoint. The
+ * open elements are recreated below the given root. Parsing resumes at the
+ * offset given by the base field of the parser - the first byte of the
+ * buffer passed to the next call to lilx_parse must be the byte at that
+ * offset in the input.
+ *
+ * \return 0 on success, non-0 on failure (a bad blob, or malloc failure), in
+ * which case there is nothing to free.
+ */
+uint8_t lilx_parser_restore(
+  parser_t  *parser, /**< the parser to initialise            */
+  element_t *root,   /**< element to use as the root          */
+  uint8_t   *blob,   /**< blob from lilx_parser_checkpoint    */
+  uint32_t   len     /**< size of the blob                    */
+);
+
 /**
  * Frees the memory that has been allocated for the given tree. Does not free
  * the root element - that is your responsibility.
@@ -93,6 +480,23 @@ uint8_t lilx_free_tree(
   element_t *root /**< the root of the tree to be freed */
 );
 
+/**
+ * Copies the given element, and everything below it, into a single block
+ * of memory, laid out in preorder, so that a small part of a large tree can
+ * be kept after the rest of it has been freed. The child maps of elements
+ * with many children, and the joined text of elements with mixed content,
+ * are built into the copy, so the query functions don't allocate anything
+ * for it.
+ * 
+ * \return the copy, or NULL on malloc failure.
+ * 
+ * \note The copy must not be changed (e.g. by a parser), and is freed with
+ * a single call to free, not lilx_free_tree.
+ */
+element_t * lilx_extract_subtree(
+  element_t *element /**< root of the subtree to copy */
+);
+
 /******************************
  * Tree traversal and utilities
  *****************************/
@@ -101,7 +505,8 @@ uint8_t lilx_free_tree(
  * Returns the number of elements with the given name that exist below the 
  * given (sub)tree root. If you just want to check for the existence of a
  * particular element, use this function, as it doesn't allocate, or 
- * require the allocation of any memory.
+ * require the allocation of any memory. Subtrees whose summary shows that
+ * they can't contain the name are skipped.
  * 
  * \return the number of elements with the given name that exist below the
  * given (sub)tree root.
@@ -115,7 +520,8 @@ uint8_t lilx_count_elements_by_name(
 /**
  * Recursively searches the given (sub)tree starting at \p root for elements
  * of the given \p name. Pointers to elements which are found are stored in
- * the given \p elements array.
+ * the given \p elements array. Subtrees whose summary shows that they can't
+ * contain the name are skipped.
  * 
  * \return 0 if no elements were found, otherwise the number of elements that
  * were stored in the \p elements array.
@@ -127,6 +533,106 @@ uint8_t lilx_get_elements_by_name(
   uint8_t     elements_length /**< length of the elements array            */
 );
 
+/**
+ * Marks the summary of the given element, and of each of its ancestors, as
+ * unknown, so that searches by name look at everything below them. The
+ * summaries are set as elements are closed (or built), and are not updated
+ * when a tree is edited by hand, so call this on an element after renaming
+ * it, or adding children to it - otherwise the new names may not be found.
+ * Removing elements leaves the summaries correct, if less selective.
+ */
+void lilx_reset_summary(
+  element_t *element /**< the element which has been edited */
+);
+
+/**
+ * Searches the children of the given element (but not their children) for
+ * the first element with the given name. Elements with at least
+ * LILX_CHILD_MAP_THRESHOLD children are searched via a child map, which is
+ * built on the first lookup, and rebuilt if the children have changed since.
+ *
+ * \return a pointer to the child, or NULL if there was no such child.
+ */
+element_t * lilx_get_child(
+  element_t *element, /**< the element to search              */
+  char      *name     /**< name of the child to search for    */
+);
+
+/**
+ * Iterates over the children of the given element with the given name, in
+ * order. Set *iterator to 0 before the first call, and then call repeatedly
+ * until NULL is returned, e.g.
+ *
+ *   uint16_t   it = 0;
+ *   element_t *child;
+ *
+ *   while ((child = lilx_get_children(element, "person", &it)) != NULL)
+ *     ...
+ *
+ * The children must not be changed while iterating.
+ *
+ * \return a pointer to the next child with the given name, or NULL if there
+ * are no more.
+ */
+element_t * lilx_get_children(
+  element_t *element, /**< the element to search              */
+  char      *name,    /**< name of the children to search for */
+  uint16_t  *iterator /**< iteration state                    */
+);
+
+/**
+ * Searches the children of the given element for the first element with the
+ * given namespace URI and local name ids - see names.h.
+ *
+ * \return a pointer to the child, or NULL if there was no such child.
+ */
+element_t * lilx_get_child_ns(
+  element_t *element, /**< the element to search              */
+  uint16_t   ns,      /**< namespace URI id                   */
+  uint16_t   local    /**< local name id                      */
+);
+
+/**
+ * Searches in the given element for an attribute with the given namespace
+ * URI and local name ids - see names.h.
+ *
+ * \return a pointer to the attribute, or NULL if there was no such
+ * attribute.
+ */
+attribute_t * lilx_get_attribute_ns(
+  element_t *element, /**< the element to search              */
+  uint16_t   ns,      /**< namespace URI id                   */
+  uint16_t   local    /**< local name id                      */
+);
+
+/**
+ * Gets a text segment of the given element.
+ *
+ * \return a pointer to the '\0' terminated text of the segment (which
+ * belongs to the element), or NULL if there is no such segment. The length
+ * of the text, and the number of child elements which precede it, are
+ * stored in length and position, unless they are NULL.
+ */
+char * lilx_get_segment(
+  element_t *element,  /**< the element                            */
+  uint16_t   i,        /**< index of the segment                   */
+  uint16_t  *length,   /**< place to store the length, or NULL     */
+  uint16_t  *position  /**< place to store the position, or NULL   */
+);
+
+/**
+ * Gets all of the text of the given element (but not of its children), i.e.
+ * its text segments joined together. For an element without mixed content,
+ * this is just the body; otherwise, the segments are joined the first time
+ * this is called, and the result is kept until the element is freed.
+ *
+ * \return the text of the element (which belongs to the element), or NULL
+ * if it has none (or malloc failed).
+ */
+char * lilx_get_text(
+  element_t *element /**< the element */
+);
+
 /**
  * Searches in the given element for an attribute with the given name.
  * 
@@ -138,6 +644,44 @@ attribute_t * lilx_get_attribute_by_name(
   char      *name     /**< name of the attribute to search for */
 );
 
+/**
+ * \return the parent of the given element, or NULL if it is the root.
+ * 
+ * \note Children point at their parent, so the root element must not be
+ * moved once a tree has been built on it.
+ */
+element_t * lilx_parent(
+  element_t *element /**< the element */
+);
+
+/**
+ * \return the sibling which follows the given element, or NULL if it is the
+ * last child of its parent (or the root).
+ */
+element_t * lilx_next_sibling(
+  element_t *element /**< the element */
+);
+
+/**
+ * \return the sibling which precedes the given element, or NULL if it is
+ * the first child of its parent (or the root).
+ */
+element_t * lilx_prev_sibling(
+  element_t *element /**< the element */
+);
+
+/**
+ * Searches upwards from the parent of the given element for an element with
+ * the given name.
+ * 
+ * \return the nearest ancestor with the given name, or NULL if there was no
+ * such ancestor.
+ */
+element_t * lilx_ancestor_by_name(
+  element_t *element, /**< the element to start from          */
+  char      *name     /**< name of the ancestor to search for */
+);
+
 /**
  * Prints a representation of the given tree via printf.
  */
@@ -145,4 +689,146 @@ void lilx_print_tree(
   element_t *root /**< the root of the tree to print                */
 );
 
+/****************
+ * Building trees
+ ***************/
+
+/**
+ * Initialises a tree builder. A builder makes a tree like the ones which
+ * the parser makes, from calls to lilx_builder_begin, lilx_builder_attr,
+ * lilx_builder_text and lilx_builder_end, rather than from XML. The tree
+ * lives in an arena - adding an element or attribute costs a few pointer
+ * bumps, and names are interned, so each distinct name is stored once.
+ * Once the tree is complete, lilx_builder_root returns its root, which can
+ * be queried, or serialised, like any other tree.
+ *
+ * Text and attribute values are given as plain text, and are escaped as they
+ * are added, so that the tree holds them as they would appear in XML, as
+ * the parser does.
+ *
+ * \return 0 on success, non-0 on malloc failure.
+ *
+ * \note The tree must not be changed, and is freed along with the builder,
+ * by lilx_builder_free, not by lilx_free_tree.
+ */
+uint8_t lilx_builder_init(
+  lilx_builder_t *builder /**< the builder to initialise */
+);
+
+/**
+ * Opens a new element, as the last child of the innermost open element (or
+ * of the root).
+ *
+ * \return 0 on success, non-0 on failure (malloc failure, the tree is too
+ * deep, or lilx_builder_root has already been called). A builder stays
+ * failed once a call has failed, so errors can be checked for at the end.
+ */
+uint8_t lilx_builder_begin(
+  lilx_builder_t *builder, /**< the builder       */
+  char           *name     /**< the element name  */
+);
+
+/**
+ * Adds an attribute to the innermost open element.
+ *
+ * \return 0 on success, non-0 on failure.
+ */
+uint8_t lilx_builder_attr(
+  lilx_builder_t *builder, /**< the builder                */
+  char           *name,    /**< the attribute name         */
+  char           *value    /**< the (unescaped) value      */
+);
+
+/**
+ * Adds text to the body of the innermost open element, after any children
+ * it has so far.
+ *
+ * \return 0 on success, non-0 on failure.
+ */
+uint8_t lilx_builder_text(
+  lilx_builder_t *builder, /**< the builder            */
+  char           *text     /**< the (unescaped) text   */
+);
+
+/**
+ * Closes the innermost open element.
+ *
+ * \return 0 on success, non-0 on failure.
+ */
+uint8_t lilx_builder_end(
+  lilx_builder_t *builder /**< the builder */
+);
+
+/**
+ * Finishes the tree. No more elements can be added afterwards.
+ *
+ * \return the root of the tree (the elements which were opened at the top
+ * level are its children), or NULL if a call has failed, or elements are
+ * still open.
+ */
+element_t * lilx_builder_root(
+  lilx_builder_t *builder /**< the builder */
+);
+
+/**
+ * Frees the builder, and the tree which it built.
+ */
+void lilx_builder_free(
+  lilx_builder_t *builder /**< the builder */
+);
+
+/*******************
+ * Serialising trees
+ ******************/
+
+/**
+ * Writes the given element, and everything below it, out as XML. Text and
+ * attribute values are written as they are held in the tree, i.e. as they
+ * appeared in the XML which was parsed (comments, and whitespace in tags,
+ * are lost). If \p indent is non-0, each element which contains only
+ * elements has its children written on lines of their own, indented by
+ * \p indent spaces per level - elements with text are written as they are.
+ *
+ * \return 0 on success, non-0 if the output function failed.
+ */
+uint8_t lilx_serialise(
+  element_t    *element, /**< the element to write out          */
+  uint8_t       indent,  /**< spaces per level, 0 for none      */
+  lilx_write_t  write,   /**< output function                   */
+  void         *context  /**< passed to the output function     */
+);
+
+/**
+ * The parts of an element which lilx_serialise_part can write.
+ */
+#define LILX_PART_ELEMENT 0 /**< the whole element, as lilx_serialise   */
+#define LILX_PART_START   1 /**< its start tag                          */
+#define LILX_PART_GAP     2 /**< what precedes child i, or the end tag  */
+#define LILX_PART_END     3 /**< its end tag                            */
+
+/**
+ * Writes part of the given element, as lilx_serialise would write it if the
+ * element were \p depth levels below the element being written out. Writing
+ * the start tag, then gap 0, child 0, gap 1, ..., child n - 1, gap n (where
+ * n is the number of children), and then the end tag, writes the same as
+ * writing the whole element, so the parts of a large tree can be written
+ * separately (by different threads, say) and joined up afterwards. A gap is
+ * the text at that position, or, when indenting, a new line.
+ *
+ * An element with no children and no text is written as a whole by its
+ * start tag, and has no end tag.
+ *
+ * \return 0 on success, non-0 if the output function failed, or the part is
+ * not valid.
+ */
+uint8_t lilx_serialise_part(
+  element_t    *element, /**< the element                       */
+  uint8_t       part,    /**< LILX_PART_*                       */
+  uint16_t      i,       /**< the child, for LILX_PART_GAP      */
+  uint8_t       indent,  /**< spaces per level, 0 for none      */
+  uint16_t      depth,   /**< depth of the element              */
+  lilx_write_t  write,   /**< output function                   */
+  void         *context  /**< passed to the output function     */
+);
+
 #endif /* __LILX_H__ */
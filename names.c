@@ -0,0 +1,196 @@
+/**
+ * Interned strings for lilx namespace processing.
+ *
+ * Paul McCarthy <paul.mccarthy@gmail.com>
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "names.h"
+
+/*****************************
+ * Private function prototypes
+ ****************************/
+
+/**
+ * \return the FNV-1a hash of the given string.
+ */
+static uint32_t __names_hash(
+  char    *str, /**< the string           */
+  uint16_t len  /**< length of the string */
+);
+
+/**
+ * Finds the hash table slot for the given string - either the slot holding
+ * it, or the empty slot where it belongs.
+ *
+ * \return the slot index.
+ */
+static uint32_t __names_slot(
+  names_t *names, /**< the table            */
+  char    *str,   /**< the string           */
+  uint16_t len    /**< length of the string */
+);
+
+/**
+ * Doubles the size of the hash table.
+ *
+ * \return 0 on success, non-0 on malloc failure.
+ */
+static uint8_t __names_grow(
+  names_t *names /**< the table */
+);
+
+/****************************
+ * Public interface functions
+ ***************************/
+
+uint8_t names_init(names_t *names) {
+
+  names->num_strings = 0;
+  names->cap_strings = 0;
+  names->strings     = NULL;
+  names->cap_slots   = 0;
+  names->slots       = NULL;
+
+  /*the empty string is always id 0*/
+  if (names_intern(names, "", 0) != 0) {
+    names_free(names);
+    return 1;
+  }
+
+  return 0;
+}
+
+uint16_t names_intern(names_t *names, char *str, uint16_t len) {
+
+  uint32_t slot;
+  char   **strings;
+  char    *copy;
+
+  /*keep the hash table at most half full*/
+  if ((uint32_t)(names->num_strings + 1) * 2 > names->cap_slots &&
+      __names_grow(names) != 0)
+    return NAMES_NONE;
+
+  slot = __names_slot(names, str, len);
+  if (names->slots[slot] != 0) return names->slots[slot] - 1;
+
+  /*id NAMES_NONE is reserved*/
+  if (names->num_strings == NAMES_NONE - 1) return NAMES_NONE;
+
+  if (names->num_strings == names->cap_strings) {
+
+    strings = (char **)realloc(names->strings,
+      (names->cap_strings ? names->cap_strings * 2 : 16) * sizeof(char *));
+    if (strings == NULL) return NAMES_NONE;
+
+    names->strings     = strings;
+    names->cap_strings = names->cap_strings ? names->cap_strings * 2 : 16;
+  }
+
+  copy = (char *)malloc(len + 1);
+  if (copy == NULL) return NAMES_NONE;
+  memcpy(copy, str, len);
+  copy[len] = '\0';
+
+  names->strings[names->num_strings] = copy;
+  names->slots[slot]                 = names->num_strings + 1;
+
+  return names->num_strings++;
+}
+
+uint16_t names_find(names_t *names, char *str) {
+
+  uint32_t slot;
+
+  if (names->cap_slots == 0) return NAMES_NONE;
+
+  slot = __names_slot(names, str, strlen(str));
+  if (names->slots[slot] == 0) return NAMES_NONE;
+
+  return names->slots[slot] - 1;
+}
+
+char * names_string(names_t *names, uint16_t id) {
+
+  if (id >= names->num_strings) return NULL;
+  return names->strings[id];
+}
+
+void names_free(names_t *names) {
+
+  uint16_t i;
+
+  for (i = 0; i < names->num_strings; i++) free(names->strings[i]);
+
+  free(names->strings);
+  free(names->slots);
+
+  names->num_strings = 0;
+  names->cap_strings = 0;
+  names->strings     = NULL;
+  names->cap_slots   = 0;
+  names->slots       = NULL;
+}
+
+/*******************
+ * Private functions
+ ******************/
+
+uint32_t __names_hash(char *str, uint16_t len) {
+
+  uint32_t hash = 2166136261u;
+  uint16_t i;
+
+  for (i = 0; i < len; i++) {
+    hash ^= (uint8_t)str[i];
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+uint32_t __names_slot(names_t *names, char *str, uint16_t len) {
+
+  uint32_t slot = __names_hash(str, len) & (names->cap_slots - 1);
+  char    *other;
+
+  /*linear probing*/
+  while (names->slots[slot] != 0) {
+
+    other = names->strings[names->slots[slot] - 1];
+
+    if (strncmp(other, str, len) == 0 && other[len] == '\0') break;
+
+    slot = (slot + 1) & (names->cap_slots - 1);
+  }
+
+  return slot;
+}
+
+uint8_t __names_grow(names_t *names) {
+
+  uint16_t *old = names->slots;
+  uint32_t  cap = names->cap_slots;
+  uint16_t  i;
+  char     *str;
+
+  names->cap_slots = cap ? cap * 2 : 64;
+  names->slots     = (uint16_t *)calloc(names->cap_slots, sizeof(uint16_t));
+
+  if (names->slots == NULL) {
+    names->slots     = old;
+    names->cap_slots = cap;
+    return 1;
+  }
+
+  for (i = 0; i < names->num_strings; i++) {
+    str = names->strings[i];
+    names->slots[__names_slot(names, str, strlen(str))] = i + 1;
+  }
+
+  free(old);
+  return 0;
+}
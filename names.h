@@ -0,0 +1,86 @@
+/**
+ * Interned strings for lilx namespace processing. A names_t gives each
+ * distinct string a small integer id, so that namespace URIs and local names
+ * can be compared with an integer compare instead of a strcmp. Id 0 is
+ * always the empty string, which is used for "no namespace".
+ *
+ * To turn on namespace processing, initialise a names_t, and point the names
+ * field of a parser at it, after calling lilx_parser_init. The same names_t
+ * can be shared by any number of parsers, so that ids can be compared across
+ * documents, but it is not thread safe - parsers running in different
+ * threads need a names_t each (or a lock around every parse).
+ *
+ * Paul McCarthy <paul.mccarthy@gmail.com>
+ */
+#ifndef __NAMES_H__
+#define __NAMES_H__
+
+#include <stdint.h>
+
+/**
+ * Returned by names_intern on failure, and by names_find for a string which
+ * has not been interned.
+ */
+#define NAMES_NONE UINT16_MAX
+
+/**
+ * Interned string table. The fields should never be accessed directly.
+ */
+typedef struct __names {
+
+  uint16_t  num_strings; /**< number of interned strings          */
+  uint16_t  cap_strings; /**< capacity of strings                 */
+  char    **strings;     /**< the strings, indexed by id          */
+  uint32_t  cap_slots;   /**< size of the hash table              */
+  uint16_t *slots;       /**< hash table of id + 1, 0 when empty  */
+} names_t;
+
+/**
+ * Initialises an empty table, containing just the empty string.
+ *
+ * \return 0 on success, non-0 on malloc failure.
+ */
+uint8_t names_init(
+  names_t *names /**< the table */
+);
+
+/**
+ * Interns the given string, which need not be '\0' terminated.
+ *
+ * \return the id of the string, or NAMES_NONE on failure (malloc failure,
+ * or the table is full).
+ */
+uint16_t names_intern(
+  names_t *names, /**< the table             */
+  char    *str,   /**< the string            */
+  uint16_t len    /**< length of the string  */
+);
+
+/**
+ * Looks up the id of the given string, without interning it. Use this to
+ * turn the namespace URIs and local names that you want to match into ids -
+ * if a string has not been interned, no element has it.
+ *
+ * \return the id of the string, or NAMES_NONE if it has not been interned.
+ */
+uint16_t names_find(
+  names_t *names, /**< the table                 */
+  char    *str    /**< '\0' terminated string    */
+);
+
+/**
+ * \return the string with the given id, or NULL if there is no such id.
+ */
+char * names_string(
+  names_t *names, /**< the table     */
+  uint16_t id     /**< the string id */
+);
+
+/**
+ * Frees the memory that has been allocated for the given table.
+ */
+void names_free(
+  names_t *names /**< the table */
+);
+
+#endif /* __NAMES_H__ */
@@ -0,0 +1,139 @@
+/**
+ * lilxrelay - copies XML from standard input to standard output, rewriting
+ * it on the way through (see filter.h). The output is written as the input
+ * arrives, so lilxrelay can sit in the middle of a stream of messages.
+ *
+ * If the input turns out not to be valid XML, lilxrelay stops with an error
+ * on stderr and a non-0 exit status. The output which was written before
+ * the error was found stays written, and is cut off at or before the point
+ * of the error, so a reader must check the exit status before trusting it.
+ *
+ * usage: lilxrelay [-r elem=name] [-a elem@attr] [-d elem]
+ *                  [-v elem=value] [-v elem@attr=value] ...
+ *
+ *   -r elem=name        rename elem to name
+ *   -a elem@attr        remove attribute attr from elem
+ *   -d elem             remove elem, and everything in it
+ *   -v elem=value       replace the content of elem with value
+ *   -v elem@attr=value  replace the value of attribute attr of elem
+ *
+ * elem may be "*" to match any element.
+ *
+ * Paul McCarthy <paul.mccarthy@gmail.com>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "lilx.h"
+#include "filter.h"
+
+/**
+ * Maximum number of rules.
+ */
+#define MAX_RULES 64
+
+static void usage(void) {
+  printf("usage: lilxrelay [-r elem=name] [-a elem@attr] [-d elem]\n"
+         "                 [-v elem=value] [-v elem@attr=value] ...\n");
+  exit(1);
+}
+
+/**
+ * Output function - writes to standard output.
+ */
+static uint8_t write_out(void *context, char *data, uint32_t len) {
+
+  return fwrite(data, 1, len, (FILE *)context) != len;
+}
+
+/**
+ * Splits an option argument of the form elem[@attr][=value] into a rule.
+ * The argument is modified in place.
+ */
+static void parse_rule(filter_rule_t *rule, uint8_t type, char *arg) {
+
+  char *at = strchr(arg, '@');
+  char *eq = strchr(arg, '=');
+
+  rule->type      = type;
+  rule->element   = arg;
+  rule->attribute = NULL;
+  rule->value     = NULL;
+
+  if (eq != NULL) {
+    *eq = '\0';
+    rule->value = eq + 1;
+  }
+
+  if (at != NULL && (eq == NULL || at < eq)) {
+    *at = '\0';
+    rule->attribute = at + 1;
+  }
+
+  switch (type) {
+    case FILTER_RENAME:         if (!eq || at)  usage(); break;
+    case FILTER_DROP_ATTRIBUTE: if (eq  || !at) usage(); break;
+    case FILTER_DROP_SUBTREE:   if (eq  || at)  usage(); break;
+    case FILTER_REPLACE_VALUE:  if (!eq)        usage(); break;
+  }
+}
+
+int main(int argc, char *argv[]) {
+
+  filter_rule_t rules[MAX_RULES];
+  filter_t      filter;
+  uint16_t      num_rules = 0;
+  uint8_t       type, result;
+  char          buf[65536];
+  ssize_t       len;
+  int           opt;
+
+  while ((opt = getopt(argc, argv, "r:a:d:v:")) != -1) {
+
+    switch (opt) {
+      case 'r': type = FILTER_RENAME;         break;
+      case 'a': type = FILTER_DROP_ATTRIBUTE; break;
+      case 'd': type = FILTER_DROP_SUBTREE;   break;
+      case 'v': type = FILTER_REPLACE_VALUE;  break;
+      default:  usage();
+    }
+
+    if (num_rules == MAX_RULES) usage();
+    parse_rule(&rules[num_rules++], type, optarg);
+  }
+
+  if (optind != argc) usage();
+
+  if (filter_init(&filter, rules, num_rules, &write_out, stdout) != 0)
+    return 1;
+
+  /*read(2) returns whatever has arrived, rather than waiting for a full
+    buffer, so each piece of input is passed on as soon as it arrives*/
+  result = LILX_MORE;
+  while (result == LILX_MORE) {
+
+    len = read(STDIN_FILENO, buf, sizeof(buf));
+
+    if (len < 0 && errno == EINTR) continue;
+    if (len < 0) {
+      perror("lilxrelay");
+      result = LILX_ERROR;
+      break;
+    }
+
+    result = filter_feed(&filter, buf, len, len == 0);
+    fflush(stdout);
+  }
+
+  filter_free(&filter);
+
+  if (result != LILX_OK) {
+    fprintf(stderr, "lilxrelay: invalid input\n");
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,297 @@
+/**
+ * Schema validation for lilx.
+ *
+ * Paul McCarthy <paul.mccarthy@gmail.com>
+ */
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "lilx.h"
+#include "schema.h"
+
+/*****************************
+ * Private function prototypes
+ ****************************/
+
+/**
+ * Compares a '\0' terminated name with a name of the given length.
+ *
+ * \return 0 if the names are the same, non-0 otherwise.
+ */
+static uint8_t __schema_name_cmp(
+  char    *name, /**< '\0' terminated name */
+  char    *tkn,  /**< other name           */
+  uint16_t len   /**< length of tkn        */
+);
+
+/**
+ * Finds the declaration of the attribute with the given name.
+ *
+ * \return the attribute declaration, or NULL if there isn't one.
+ */
+static schema_attr_t * __schema_find_attr(
+  schema_elem_t *elem, /**< the element declaration */
+  char          *name, /**< the attribute name      */
+  uint16_t       len   /**< length of the name      */
+);
+
+/**
+ * Checks that the given string is of the given type.
+ *
+ * \return 0 if it is, non-0 otherwise.
+ */
+static uint8_t __schema_check_type(
+  uint8_t  type, /**< the type, e.g. SCHEMA_INTEGER */
+  char    *str,  /**< the string to check           */
+  uint16_t len   /**< length of the string          */
+);
+
+/**
+ * Records a validation error.
+ *
+ * \return 1.
+ */
+static uint8_t __schema_error(
+  schema_validator_t *validator, /**< the validator */
+  uint8_t             error      /**< the error     */
+);
+
+/****************************
+ * Public interface functions
+ ***************************/
+
+uint8_t schema_validator_init(
+schema_validator_t *validator, schema_elem_t *document) {
+
+  /*the lilx root element has exactly one
+    child, which is the document element*/
+  validator->document.elem = document;
+  validator->document.min  = 1;
+  validator->document.max  = 1;
+
+  validator->root.name           = "root";
+  validator->root.type           = SCHEMA_EMPTY;
+  validator->root.flags          = 0;
+  validator->root.num_attributes = 0;
+  validator->root.attributes     = NULL;
+  validator->root.num_children   = 1;
+  validator->root.children       = &validator->document;
+
+  validator->frames[0].elem     = &validator->root;
+  validator->frames[0].particle = 0;
+  validator->frames[0].count    = 0;
+
+  validator->error  = SCHEMA_OK;
+  validator->offset = 0;
+
+  return 0;
+}
+
+uint8_t schema_start_element(
+schema_validator_t *validator, uint8_t depth, char *name, uint16_t len) {
+
+  uint8_t            i, count;
+  schema_frame_t    *frame = &validator->frames[depth];
+  schema_elem_t     *elem  = frame->elem;
+  schema_elem_t     *child = NULL;
+  schema_particle_t *particle;
+
+  if (depth >= LILX_STACK_SIZE)
+    return __schema_error(validator, SCHEMA_UNEXPECTED_ELEMENT);
+
+  if (elem != NULL && (elem->flags & SCHEMA_ANY_CHILDREN) == 0) {
+
+    /*find the particle which accepts the element - if nothing in 
+      the rest of the content model does, it doesn't belong here*/
+    for (i = frame->particle; i < elem->num_children; i++) {
+
+      particle = &elem->children[i];
+      count    = (i == frame->particle) ? frame->count : 0;
+
+      if (__schema_name_cmp(particle->elem->name, name, len) == 0 &&
+          (particle->max == 0 || count < particle->max))
+        break;
+    }
+
+    if (i == elem->num_children)
+      return __schema_error(validator, SCHEMA_UNEXPECTED_ELEMENT);
+
+    /*each particle we step past must have occurred often enough*/
+    for (; frame->particle < i; frame->particle++, frame->count = 0)
+      if (frame->count < elem->children[frame->particle].min)
+        return __schema_error(validator, SCHEMA_MISSING_ELEMENT);
+
+    frame->count++;
+    child = elem->children[i].elem;
+  }
+
+  /*open the element*/
+  validator->frames[depth + 1].elem     = child;
+  validator->frames[depth + 1].particle = 0;
+  validator->frames[depth + 1].count    = 0;
+
+  return 0;
+}
+
+uint8_t schema_start_tag_end(
+schema_validator_t *validator, uint8_t depth, element_t *element) {
+
+  uint8_t i, j;
+  schema_elem_t *elem = validator->frames[depth].elem;
+
+  if (elem == NULL) return 0;
+
+  /*all required attributes must be present*/
+  for (i = 0; i < elem->num_attributes; i++) {
+
+    if (elem->attributes[i].required == 0) continue;
+
+    for (j = 0; j < element->num_attributes; j++)
+      if (strcmp(elem->attributes[i].name,
+                 element->attributes[j]->name) == 0)
+        break;
+
+    if (j == element->num_attributes)
+      return __schema_error(validator, SCHEMA_MISSING_ATTRIBUTE);
+  }
+
+  return 0;
+}
+
+uint8_t schema_end_element(
+schema_validator_t *validator, uint8_t depth, element_t *element) {
+
+  uint8_t i, count;
+  schema_frame_t *frame = &validator->frames[depth];
+  schema_elem_t  *elem  = frame->elem;
+
+  if (elem == NULL) return 0;
+
+  /*the rest of the content model must be optional*/
+  if ((elem->flags & SCHEMA_ANY_CHILDREN) == 0) {
+
+    for (i = frame->particle; i < elem->num_children; i++) {
+
+      count = (i == frame->particle) ? frame->count : 0;
+      if (count < elem->children[i].min)
+        return __schema_error(validator, SCHEMA_MISSING_ELEMENT);
+    }
+  }
+
+  return 0;
+}
+
+uint8_t schema_attribute(
+schema_validator_t *validator, uint8_t depth, char *name, uint16_t len) {
+
+  schema_elem_t *elem = validator->frames[depth].elem;
+
+  if (elem == NULL || (elem->flags & SCHEMA_ANY_ATTRIBUTES)) return 0;
+
+  if (__schema_find_attr(elem, name, len) == NULL)
+    return __schema_error(validator, SCHEMA_UNKNOWN_ATTRIBUTE);
+
+  return 0;
+}
+
+uint8_t schema_attribute_value(schema_validator_t *validator,
+uint8_t depth, char *name, char *value, uint16_t len) {
+
+  schema_elem_t *elem = validator->frames[depth].elem;
+  schema_attr_t *attr;
+
+  if (elem == NULL) return 0;
+
+  /*undeclared attributes (SCHEMA_ANY_ATTRIBUTES) can have any value*/
+  attr = __schema_find_attr(elem, name, strlen(name));
+  if (attr == NULL) return 0;
+
+  if (__schema_check_type(attr->type, value, len) != 0)
+    return __schema_error(validator, SCHEMA_BAD_VALUE);
+
+  return 0;
+}
+
+uint8_t schema_body(
+schema_validator_t *validator, uint8_t depth, char *body, uint16_t len) {
+
+  schema_elem_t *elem = validator->frames[depth].elem;
+
+  if (elem == NULL) return 0;
+
+  if (__schema_check_type(elem->type, body, len) != 0)
+    return __schema_error(validator, SCHEMA_BAD_VALUE);
+
+  return 0;
+}
+
+/*******************
+ * Private functions
+ ******************/
+
+uint8_t __schema_name_cmp(char *name, char *tkn, uint16_t len) {
+
+  if (strncmp(name, tkn, len) != 0) return 1;
+  if (name[len] != '\0')            return 1;
+
+  return 0;
+}
+
+schema_attr_t * __schema_find_attr(
+schema_elem_t *elem, char *name, uint16_t len) {
+
+  uint8_t i;
+
+  for (i = 0; i < elem->num_attributes; i++)
+    if (__schema_name_cmp(elem->attributes[i].name, name, len) == 0)
+      return &elem->attributes[i];
+
+  return NULL;
+}
+
+uint8_t __schema_check_type(uint8_t type, char *str, uint16_t len) {
+
+  uint16_t i = 0;
+  uint16_t digits;
+
+  switch (type) {
+
+    case SCHEMA_EMPTY:
+      return 1;
+
+    case SCHEMA_BOOLEAN:
+      if (len == 1) return (str[0] != '0' && str[0] != '1');
+      if (len == 4) return strncmp(str, "true",  4) != 0;
+      if (len == 5) return strncmp(str, "false", 5) != 0;
+      return 1;
+
+    case SCHEMA_INTEGER:
+    case SCHEMA_DECIMAL:
+
+      /*optional sign, followed by at least one digit*/
+      if (i < len && (str[i] == '-' || str[i] == '+')) i++;
+      for (digits = i; i < len && isdigit((unsigned char)str[i]); i++);
+      if (i == digits) return 1;
+
+      if (type == SCHEMA_INTEGER) return i != len;
+
+      /*decimals may have a fractional part*/
+      if (i < len && str[i] == '.') {
+        for (i++, digits = i; i < len && isdigit((unsigned char)str[i]); i++);
+        if (i == digits) return 1;
+      }
+      return i != len;
+
+    default:
+      return 0;
+  }
+}
+
+uint8_t __schema_error(schema_validator_t *validator, uint8_t error) {
+
+  /*keep the first error*/
+  if (validator->error == SCHEMA_OK) validator->error = error;
+
+  return 1;
+}
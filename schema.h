@@ -0,0 +1,211 @@
+/**
+ * Schema validation for lilx. A schema is a tree of schema_elem_t structs,
+ * which describe the allowed attributes, body type and children of each
+ * element. A schema_validator_t checks a document against a schema while it
+ * is being parsed, so an invalid document is rejected as soon as the first
+ * problem is found, without building the rest of the tree.
+ *
+ * The content model of each element is a sequence of particles, each of
+ * which says how many times a particular child element may occur (e.g. one
+ * <name>, then zero or more <alias>, then one or more <phone>). Each open
+ * element keeps its position in the sequence, so checking each child is a
+ * step through a small automaton.
+ *
+ * Element bodies and attribute values are checked against simple types.
+ * Only bodies which are present are checked, so an empty element passes
+ * whatever its body type.
+ *
+ * To validate a document, initialise a validator with the root of your
+ * schema, and point the validator field of a parser at it, after calling
+ * lilx_parser_init. Validation state is not saved by lilx_parser_checkpoint.
+ *
+ * Paul McCarthy <paul.mccarthy@gmail.com>
+ */
+#ifndef __SCHEMA_H__
+#define __SCHEMA_H__
+
+#include <stdint.h>
+
+#include "lilx.h"
+
+/**
+ * Element body and attribute value types.
+ */
+#define SCHEMA_STRING  0 /**< anything                                   */
+#define SCHEMA_EMPTY   1 /**< no body allowed (element bodies only)      */
+#define SCHEMA_INTEGER 2 /**< optional sign, followed by digits          */
+#define SCHEMA_DECIMAL 3 /**< integer, optionally followed by '.' digits */
+#define SCHEMA_BOOLEAN 4 /**< true, false, 1 or 0                        */
+
+/**
+ * Element flags.
+ */
+#define SCHEMA_ANY_ATTRIBUTES 0x01 /**< allow attributes which aren't listed */
+#define SCHEMA_ANY_CHILDREN   0x02 /**< allow any children, unvalidated     */
+
+/**
+ * Validation errors.
+ */
+#define SCHEMA_OK                 0 /**< no problems found               */
+#define SCHEMA_UNEXPECTED_ELEMENT 1 /**< element not allowed here        */
+#define SCHEMA_MISSING_ELEMENT    2 /**< required element didn't occur   */
+#define SCHEMA_UNKNOWN_ATTRIBUTE  3 /**< attribute not allowed           */
+#define SCHEMA_MISSING_ATTRIBUTE  4 /**< required attribute didn't occur */
+#define SCHEMA_BAD_VALUE          5 /**< body or value of the wrong type */
+
+/*******
+ * Types
+ ******/
+
+struct __schema_elem;
+typedef struct __schema_elem schema_elem_t;
+typedef struct __schema_validator schema_validator_t;
+
+/**
+ * An allowed attribute.
+ */
+typedef struct __schema_attr {
+
+  char   *name;     /**< attribute name                     */
+  uint8_t type;     /**< value type, e.g. SCHEMA_STRING      */
+  uint8_t required; /**< non-0 if the attribute must occur   */
+} schema_attr_t;
+
+/**
+ * One step in the content model of an element - the given child element,
+ * occurring between min and max times.
+ */
+typedef struct __schema_particle {
+
+  schema_elem_t *elem; /**< the child element                      */
+  uint8_t        min;  /**< minimum number of occurrences          */
+  uint8_t        max;  /**< maximum number of occurrences, 0 = any */
+} schema_particle_t;
+
+/**
+ * An element declaration.
+ */
+struct __schema_elem {
+
+  char              *name;           /**< element name                   */
+  uint8_t            type;           /**< body type, e.g. SCHEMA_INTEGER */
+  uint8_t            flags;          /**< SCHEMA_ANY_* flags             */
+  uint8_t            num_attributes; /**< number of allowed attributes   */
+  schema_attr_t     *attributes;     /**< the allowed attributes         */
+  uint8_t            num_children;   /**< length of the content model    */
+  schema_particle_t *children;       /**< the content model, in order    */
+};
+
+/**
+ * Validation state for one open element.
+ */
+typedef struct __schema_frame {
+
+  schema_elem_t *elem;     /**< declaration, NULL if unvalidated      */
+  uint8_t        particle; /**< current position in the content model */
+  uint8_t        count;    /**< occurrences of the current particle   */
+} schema_frame_t;
+
+/**
+ * Validation state for one document. The fields should never be accessed
+ * directly, apart from error and offset, which describe the first problem
+ * found.
+ */
+struct __schema_validator {
+
+  schema_elem_t     root;     /**< stands in for the lilx root element   */
+  schema_particle_t document; /**< the document element                  */
+  uint8_t           error;    /**< SCHEMA_OK, or the first problem found */
+  uint32_t          offset;   /**< input offset at which it was found    */
+ 
+  /** validation state for each open element, indexed by depth */
+  schema_frame_t frames[LILX_STACK_SIZE + 1];
+};
+
+/**
+ * Initialises a validator, to check a document against the given schema.
+ *
+ * \return 0.
+ */
+uint8_t schema_validator_init(
+  schema_validator_t *validator, /**< the validator              */
+  schema_elem_t      *document   /**< the document element schema */
+);
+
+/**
+ * Checks that an element with the given name is allowed as the next child
+ * of the open element at the given depth, and opens it at depth + 1.
+ *
+ * \return 0 if the element is allowed, non-0 otherwise.
+ */
+uint8_t schema_start_element(
+  schema_validator_t *validator, /**< the validator            */
+  uint8_t             depth,     /**< depth of the parent      */
+  char               *name,      /**< the element name         */
+  uint16_t            len        /**< length of the name       */
+);
+
+/**
+ * Checks that the element at the given depth, whose start tag has just been
+ * completed, has all of its required attributes.
+ *
+ * \return 0 if the attributes are all there, non-0 otherwise.
+ */
+uint8_t schema_start_tag_end(
+  schema_validator_t *validator, /**< the validator              */
+  uint8_t             depth,     /**< depth of the element       */
+  element_t          *element    /**< the element                */
+);
+
+/**
+ * Checks that the content model of the open element at the given depth has
+ * been satisfied.
+ *
+ * \return 0 if the element is valid, non-0 otherwise.
+ */
+uint8_t schema_end_element(
+  schema_validator_t *validator, /**< the validator              */
+  uint8_t             depth,     /**< depth of the element       */
+  element_t          *element    /**< the element being closed   */
+);
+
+/**
+ * Checks that the open element at the given depth may have an attribute
+ * with the given name.
+ *
+ * \return 0 if the attribute is allowed, non-0 otherwise.
+ */
+uint8_t schema_attribute(
+  schema_validator_t *validator, /**< the validator            */
+  uint8_t             depth,     /**< depth of the element     */
+  char               *name,      /**< the attribute name       */
+  uint16_t            len        /**< length of the name       */
+);
+
+/**
+ * Checks the type of a value of the given attribute of the open element at
+ * the given depth.
+ *
+ * \return 0 if the value is valid, non-0 otherwise.
+ */
+uint8_t schema_attribute_value(
+  schema_validator_t *validator, /**< the validator            */
+  uint8_t             depth,     /**< depth of the element     */
+  char               *name,      /**< the attribute name       */
+  char               *value,     /**< the attribute value      */
+  uint16_t            len        /**< length of the value      */
+);
+
+/**
+ * Checks the type of a body of the open element at the given depth.
+ *
+ * \return 0 if the body is valid, non-0 otherwise.
+ */
+uint8_t schema_body(
+  schema_validator_t *validator, /**< the validator            */
+  uint8_t             depth,     /**< depth of the element     */
+  char               *body,      /**< the body                 */
+  uint16_t            len        /**< length of the body       */
+);
+
+#endif /* __SCHEMA_H__ */
@@ -21,7 +21,7 @@ int8_t stack_create(stack_t *stack, uint8_t size) {
 
 int8_t stack_free(stack_t *stack) {
  
-  stack->top -= (stack->size-1);
+  if (stack->size > 0) stack->top -= (stack->size-1);
   free(stack->top);
  
   return 0;
@@ -46,9 +46,12 @@ void * stack_pop(stack_t *stack) {
  
   if (stack->size == 0 || stack->size > stack->capacity) return NULL;
  
-  element = *(stack->top--);
+  element = *(stack->top);
   stack->size--;
  
+  /*top stays put when the stack becomes empty, as in stack_push*/
+  if (stack->size > 0) stack->top--;
+ 
   return element;
 }
 
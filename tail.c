@@ -0,0 +1,203 @@
+/**
+ * lilxtail - follows an append-only file of XML records, e.g.
+ *
+ *   <log>
+ *    <record>...</record>
+ *    <record>...</record>
+ *
+ * printing each record (child of the document element) as soon as it has
+ * been closed, and then dropping it from the tree, so the tree never holds
+ * more than the record in progress. A self closing record is only known to
+ * be complete once the next tag has started, so if it is the last record in
+ * the file, it is held back until then.
+ * The parser state is checkpointed to a file after every read, so when
+ * lilxtail is restarted, it carries on from where it left off, rather than
+ * parsing the file again from the start.
+ *
+ * usage: lilxtail [-f] file checkpoint_file
+ *
+ * Without -f, lilxtail exits once it reaches the end of the file. With -f,
+ * it waits for the file to grow.
+ *
+ * Paul McCarthy <paul.mccarthy@gmail.com>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "lilx.h"
+
+/**
+ * Maximum size of a checkpoint. The checkpoint holds the record in
+ * progress, so this caps the size of a record which is split across reads.
+ */
+#define MAX_CHECKPOINT_SIZE (1 << 20)
+
+/**
+ * How long to wait for the file to grow in follow mode, in microseconds.
+ */
+#define FOLLOW_INTERVAL 250000
+
+/**
+ * Loads the parser state from the given checkpoint file, or initialises a
+ * new parser if there is no checkpoint file.
+ *
+ * \return 0 on success, non-0 on failure.
+ */
+static int load_checkpoint(
+char *path, uint8_t *blob, parser_t *parser, element_t *root) {
+
+  size_t len;
+  FILE *f = fopen(path, "rb");
+
+  if (f == NULL) return lilx_parser_init(parser, root);
+
+  len = fread(blob, 1, MAX_CHECKPOINT_SIZE, f);
+  fclose(f);
+
+  return lilx_parser_restore(parser, root, blob, len);
+}
+
+/**
+ * Saves the parser state to the given checkpoint file. The state is written
+ * to a temporary file which then replaces the checkpoint file, so the
+ * checkpoint file is never left half written.
+ *
+ * \return 0 on success, non-0 on failure.
+ */
+static int save_checkpoint(char *path, uint8_t *blob, parser_t *parser) {
+
+  char tmp[1024];
+  uint32_t len;
+  FILE *f;
+
+  len = lilx_parser_checkpoint(parser, blob, MAX_CHECKPOINT_SIZE);
+  if (len == 0) return 1;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+  f = fopen(tmp, "wb");
+  if (f == NULL) return 1;
+
+  if (fwrite(blob, 1, len, f) != len) {
+    fclose(f);
+    return 1;
+  }
+
+  if (fclose(f) != 0) return 1;
+
+  return rename(tmp, path);
+}
+
+/**
+ * Event handler - prints each completed child of the document element, and
+ * then drops it, so the tree never holds more than one record.
+ */
+static uint8_t print_record(
+parser_t *parser, uint8_t event, element_t *element) {
+
+  /*at the end of a record, the document element is the innermost open one*/
+  if (event != LILX_EVENT_END || parser->depth != 1) return LILX_CONTINUE;
+
+  lilx_print_tree(element);
+  fflush(stdout);
+
+  return LILX_DROP;
+}
+
+int main(int argc, char *argv[]) {
+
+  parser_t parser;
+  element_t root;
+  char *buf, *path, *checkpoint;
+  uint8_t *blob;
+  uint32_t len = 0, cap = 4096, discard;
+  ssize_t n;
+  int fd, follow = 0;
+
+  if (argc > 1 && strcmp(argv[1], "-f") == 0) {
+    follow = 1;
+    argc--;
+    argv++;
+  }
+
+  if (argc != 3) {
+    printf("usage: lilxtail [-f] file checkpoint_file\n");
+    return 1;
+  }
+
+  path       = argv[1];
+  checkpoint = argv[2];
+
+  blob = (uint8_t *)malloc(MAX_CHECKPOINT_SIZE);
+  if (blob == NULL) return 1;
+
+  if (load_checkpoint(checkpoint, blob, &parser, &root) != 0) {
+    fprintf(stderr, "couldn't load checkpoint %s\n", checkpoint);
+    return 1;
+  }
+
+  parser.handler = &print_record;
+
+  /*resume reading where the checkpoint left off*/
+  fd = open(path, O_RDONLY);
+  if (fd < 0 || lseek(fd, parser.base, SEEK_SET) < 0) {
+    perror(path);
+    return 1;
+  }
+
+  buf = (char *)malloc(cap);
+  if (buf == NULL) return 1;
+
+  while (1) {
+
+    /*make room for more input*/
+    if (len == cap) {
+      cap *= 2;
+      buf  = (char *)realloc(buf, cap);
+      if (buf == NULL) return 1;
+    }
+
+    n = read(fd, buf + len, cap - len);
+
+    if (n < 0) {
+      perror(path);
+      break;
+    }
+
+    /*at the end of the file - wait for it to grow, or finish*/
+    if (n == 0) {
+      if (!follow) break;
+      usleep(FOLLOW_INTERVAL);
+      continue;
+    }
+
+    len += n;
+
+    if (lilx_parse(&parser, buf, len, 0) == LILX_ERROR) {
+      printf("parse failed at offset %lu\n",
+        (unsigned long)(parser.base + parser.pos));
+      return 1;
+    }
+
+    /*drop the input which the parser is finished with*/
+    discard = lilx_parser_discard(&parser);
+    memmove(buf, buf + discard, len - discard);
+    len -= discard;
+
+    /*carrying on would mean reprinting records after a restart*/
+    if (save_checkpoint(checkpoint, blob, &parser) != 0) {
+      fprintf(stderr, "couldn't save checkpoint %s\n", checkpoint);
+      return 1;
+    }
+  }
+
+  close(fd);
+  free(buf);
+  free(blob);
+  lilx_free_tree(&root);
+
+  return 0;
+}
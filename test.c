@@ -1,6 +1,18 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "lilx.h"
+#include "schema.h"
+#include "names.h"
+#include "guide.h"
+#include "filter.h"
+#include "canon.h"
+#include "index.h"
+#include "ingest.h"
+#include "export.h"
 
 char *testxml = "<people>\n\
  <person>\n\
@@ -13,9 +25,1267 @@ char *testxml = "<people>\n\
  </person>\n\
 </people>";
 
+/*a restart part way through - the closed children of the open
+  elements (<r>1</r> and <a>y</a>) must survive the checkpoint*/
+char *restartxml1 = "<log><r>1</r><r><a>y</a>x<b>";
+char *restartxml2 = "z</b>w</r><r>3</r></log>";
+
+/*non-0 if the given trees differ*/
+static int tree_differs(element_t *a, element_t *b) {
+
+  uint16_t i;
+
+  if ((a->name == NULL) != (b->name == NULL)) return 1;
+  if (a->name != NULL && strcmp(a->name, b->name) != 0) return 1;
+  if (a->num_segments != b->num_segments) return 1;
+  if (a->num_segments > 0 && 
+      strcmp(lilx_get_text(a), lilx_get_text(b)) != 0) return 1;
+  if (a->num_attributes != b->num_attributes) return 1;
+  if (a->num_children   != b->num_children)   return 1;
+
+  for (i = 0; i < a->num_attributes; i++) {
+    if (strcmp(a->attributes[i]->name,  b->attributes[i]->name)  != 0 ||
+        strcmp(a->attributes[i]->value, b->attributes[i]->value) != 0)
+      return 1;
+  }
+
+  for (i = 0; i < a->num_children; i++)
+    if (tree_differs(a->children[i], b->children[i])) return 1;
+
+  return 0;
+}
+
+/*parses restartxml in two halves, with a checkpoint and restore in
+  between, and checks the result against parsing it in one go*/
+static int test_restart(void) {
+
+  parser_t  parser;
+  element_t root, whole;
+  uint8_t   blob[1024];
+  uint32_t  len;
+  char      full[64];
+  int       result;
+
+  sprintf(full, "%s%s", restartxml1, restartxml2);
+  if (lilx_create_tree(full, &whole)) return 1;
+
+  lilx_parser_init(&parser, &root);
+  if (lilx_parse(&parser, restartxml1, strlen(restartxml1), 0) != LILX_MORE)
+    return 1;
+
+  len = lilx_parser_checkpoint(&parser, blob, sizeof(blob));
+  lilx_free_tree(&root);
+  if (len == 0 || lilx_parser_restore(&parser, &root, blob, len)) return 1;
+
+  if (lilx_parse(&parser, full + parser.base,
+                 strlen(full) - parser.base, 1) != LILX_OK)
+    return 1;
+
+  result = tree_differs(&root, &whole);
+
+  lilx_free_tree(&root);
+  lilx_free_tree(&whole);
+  return result;
+}
+
+/*a schema for <person id="..." [vip="..."]><name/>[<age/>]</person>*/
+static schema_elem_t schema_name = {"name", SCHEMA_STRING, 0, 0, NULL, 0, NULL};
+static schema_elem_t schema_age  = {"age", SCHEMA_INTEGER, 0, 0, NULL, 0, NULL};
+
+static schema_attr_t schema_person_attributes[] = {
+  {"id",  SCHEMA_INTEGER, 1},
+  {"vip", SCHEMA_BOOLEAN, 0}
+};
+
+static schema_particle_t schema_person_children[] = {
+  {&schema_name, 1, 1},
+  {&schema_age,  0, 1}
+};
+
+static schema_elem_t schema_person = {
+  "person", SCHEMA_EMPTY, 0,
+  2, schema_person_attributes,
+  2, schema_person_children
+};
+
+/*documents, the error which each should give, and the 
+  offset of the token at which it should be found*/
+static struct {
+  char    *xml;
+  uint8_t  error;
+  uint32_t offset;
+} schema_cases[] = {
+  {"<person id=\"1\"><name>Ada</name><age>36</age></person>", SCHEMA_OK, 0},
+  {"<person id=\"1\" vip=\"true\"><name>Ada</name></person>", SCHEMA_OK, 0},
+  {"<person id=\"1\"><other/></person>",       SCHEMA_UNEXPECTED_ELEMENT, 16},
+  {"<person id=\"1\"><name/><name/></person>", SCHEMA_UNEXPECTED_ELEMENT, 23},
+  {"<person id=\"1\"><age>36</age></person>",  SCHEMA_MISSING_ELEMENT,    16},
+  {"<person id=\"1\"></person>",               SCHEMA_MISSING_ELEMENT,    17},
+  {"<person id=\"1\" x=\"1\"><name/></person>",SCHEMA_UNKNOWN_ATTRIBUTE,  15},
+  {"<person><name>Ada</name></person>",        SCHEMA_MISSING_ATTRIBUTE,  1},
+  {"<person id=\"one\"><name/></person>",      SCHEMA_BAD_VALUE,          12},
+  {"<person id=\"1\"><name/><age>x</age></person>", SCHEMA_BAD_VALUE,     27},
+  {"<person id=\"1\">hi<name/></person>",      SCHEMA_BAD_VALUE,          15}
+};
+
+/*checks each of schema_cases against schema_person*/
+static int test_schema(void) {
+
+  parser_t           parser;
+  element_t          root;
+  schema_validator_t validator;
+  uint8_t            result;
+  uint16_t           i;
+
+  for (i = 0; i < sizeof(schema_cases) / sizeof(schema_cases[0]); i++) {
+
+    schema_validator_init(&validator, &schema_person);
+    lilx_parser_init(&parser, &root);
+    parser.validator = &validator;
+
+    result = lilx_parse(&parser, 
+      schema_cases[i].xml, strlen(schema_cases[i].xml), 1);
+
+    if (result == LILX_OK) lilx_free_tree(&root);
+
+    if (validator.error != schema_cases[i].error) return 1;
+    if ((result == LILX_OK) != (schema_cases[i].error == SCHEMA_OK)) return 1;
+    if (validator.error != SCHEMA_OK &&
+        validator.offset != schema_cases[i].offset)
+      return 1;
+  }
+
+  return 0;
+}
+
+/*parses xml with namespace processing on, into root*/
+static uint8_t parse_ns(char *xml, element_t *root, names_t *names) {
+
+  parser_t parser;
+
+  lilx_parser_init(&parser, root);
+  parser.names = names;
+
+  return lilx_parse(&parser, xml, strlen(xml), 1);
+}
+
+/*non-0 unless the element has the given namespace URI and local name*/
+static int ns_differs(
+names_t *names, uint16_t ns, uint16_t local, char *uri, char *name) {
+
+  return strcmp(names_string(names, ns),    uri)  != 0 ||
+         strcmp(names_string(names, local), name) != 0;
+}
+
+/*checks the namespace ids of elements and attributes, across prefixes, 
+  and that prefixes which are not in scope are rejected*/
+static int test_namespaces(void) {
+
+  char *xml = "<a xmlns=\"urn:d\" xmlns:p=\"urn:p\">"
+              "<p:b p:x=\"1\" y=\"2\"/><c/><q:d xmlns:q=\"urn:p\"/></a>";
+  names_t    names;
+  element_t  root, *a, *b;
+  int        result = 0;
+
+  if (names_init(&names)) return 1;
+
+  if (parse_ns(xml, &root, &names) != LILX_OK) {
+    names_free(&names);
+    return 1;
+  }
+
+  a = root.children[0];
+  b = a->children[0];
+
+  result |= ns_differs(&names, a->ns, a->local, "urn:d", "a");
+  result |= ns_differs(&names, b->ns, b->local, "urn:p", "b");
+  result |= ns_differs(&names, 
+    b->attributes[0]->ns, b->attributes[0]->local, "urn:p", "x");
+  result |= ns_differs(&names, 
+    b->attributes[1]->ns, b->attributes[1]->local, "", "y");
+  result |= ns_differs(&names, 
+    a->children[1]->ns, a->children[1]->local, "urn:d", "c");
+
+  /*q:d and p:b are in the same namespace*/
+  result |= lilx_get_child_ns(a, 
+    names_find(&names, "urn:p"), names_find(&names, "d")) != a->children[2];
+  result |= lilx_get_child_ns(a, 
+    names_find(&names, "urn:p"), names_find(&names, "b")) != b;
+
+  lilx_free_tree(&root);
+
+  /*undeclared, and out of scope*/
+  result |= parse_ns("<a><p:b/></a>", &root, &names) != LILX_ERROR;
+  result |= parse_ns("<a><b xmlns:p=\"u\"/><p:c/></a>", 
+                     &root, &names) != LILX_ERROR;
+
+  names_free(&names);
+  return result;
+}
+
+/*the open elements recreated from a checkpoint (and the closed ones 
+  inside them) get their namespace ids once parsing is resumed*/
+static int test_namespaces_restore(void) {
+
+  char *xml = "<a xmlns:p=\"urn:p\"><p:b>1</p:b><p:c><p:d/></p:c></a>";
+  parser_t  parser;
+  element_t root, *a;
+  names_t   names;
+  uint8_t   blob[1024];
+  uint32_t  len;
+  int       result = 0;
+
+  /*stop part way through <p:d/>*/
+  lilx_parser_init(&parser, &root);
+  if (lilx_parse(&parser, xml, 38, 0) != LILX_MORE) return 1;
+
+  len = lilx_parser_checkpoint(&parser, blob, sizeof(blob));
+  lilx_free_tree(&root);
+  if (len == 0 || lilx_parser_restore(&parser, &root, blob, len)) return 1;
+
+  if (names_init(&names)) {
+    lilx_free_tree(&root);
+    return 1;
+  }
+  parser.names = &names;
+
+  if (lilx_parse(&parser, xml + parser.base, 
+                 strlen(xml) - parser.base, 1) != LILX_OK) {
+    names_free(&names);
+    return 1;
+  }
+
+  a = root.children[0];
+  result |= ns_differs(&names, a->ns, a->local, "", "a");
+  result |= ns_differs(&names, 
+    a->children[0]->ns, a->children[0]->local, "urn:p", "b");
+  result |= ns_differs(&names, 
+    a->children[1]->ns, a->children[1]->local, "urn:p", "c");
+  result |= ns_differs(&names, a->children[1]->children[0]->ns,
+    a->children[1]->children[0]->local, "urn:p", "d");
+
+  lilx_free_tree(&root);
+  names_free(&names);
+  return result;
+}
+
+/*mixed content is kept as text segments, each with the number of 
+  children before it, with the layout whitespace trimmed*/
+static int test_segments(void) {
+
+  element_t root, *p;
+  char     *text[]     = {"a", "c", "e f"};
+  uint16_t  position[] = {0, 1, 2};
+  uint16_t  i, len, pos;
+  char     *segment;
+  int       result = 0;
+
+  if (lilx_create_tree("<p>a<b/>c <i>d</i> e f </p>", &root)) return 1;
+  p = root.children[0];
+
+  result |= p->num_segments != 3;
+  result |= strcmp(p->body, "a") != 0;
+
+  for (i = 0; i < 3 && result == 0; i++) {
+
+    segment = lilx_get_segment(p, i, &len, &pos);
+
+    result |= segment == NULL;
+    result |= segment != NULL && strcmp(segment, text[i]) != 0;
+    result |= len != strlen(text[i]) || pos != position[i];
+  }
+
+  /*no such segment, and no text at all*/
+  result |= lilx_get_segment(p, 3, NULL, NULL) != NULL;
+  result |= lilx_get_text(p->children[0]) != NULL;
+
+  result |= strcmp(lilx_get_text(p), "ace f") != 0;
+  result |= strcmp(lilx_get_text(p->children[1]), "d") != 0;
+
+  lilx_free_tree(&root);
+  return result;
+}
+
+/*documents, limits, and the limit which each should exceed (0 if none) - 
+  each limit is tried just below, and at, what the document needs*/
+static struct {
+  char          *xml;
+  lilx_limits_t  limits;
+  uint8_t        exceeded;
+} limit_cases[] = {
+  {"<a><b/></a>",         {10, 0, 0, 0, 0, 0}, LILX_LIMIT_BYTES},
+  {"<a><b/></a>",         {11, 0, 0, 0, 0, 0}, 0},
+  {"<a><b/><c/></a>",     {0,  2, 0, 0, 0, 0}, LILX_LIMIT_ELEMENTS},
+  {"<a><b/><c/></a>",     {0,  3, 0, 0, 0, 0}, 0},
+  {"<a x=\"1\" y=\"2\"/>",  {0,  0, 1, 0, 0, 0}, LILX_LIMIT_ATTRIBUTES},
+  {"<a x=\"1\" y=\"2\"/>",  {0,  0, 2, 0, 0, 0}, 0},
+  {"<a><b><c/></b></a>",  {0,  0, 0, 2, 0, 0}, LILX_LIMIT_DEPTH},
+  {"<a><b><c/></b></a>",  {0,  0, 0, 3, 0, 0}, 0},
+  {"<a x=\"12\">hello</a>", {0,  0, 0, 0, 8, 0}, LILX_LIMIT_STRINGS},
+  {"<a x=\"12\">hello</a>", {0,  0, 0, 0, 9, 0}, 0},
+  {"<a><b/></a>",         {0,  0, 0, 0, 0, 1}, LILX_LIMIT_MEMORY}
+};
+
+/*drops every child of the document element once it has been closed*/
+static uint8_t drop_records(parser_t *parser, uint8_t event, element_t *e) {
+
+  if (event == LILX_EVENT_END && parser->depth == 1) return LILX_DROP;
+  return LILX_CONTINUE;
+}
+
+/*checks that each limit is enforced, and that elements 
+  which a handler drops no longer count against them*/
+static int test_limits(void) {
+
+  char          *log = "<log><r>one</r><r>two</r><r>six</r></log>";
+  parser_t       parser;
+  element_t      root;
+  lilx_limits_t  limits;
+  uint8_t        result, expected;
+  uint16_t       i;
+
+  for (i = 0; i < sizeof(limit_cases) / sizeof(limit_cases[0]); i++) {
+
+    lilx_parser_init(&parser, &root);
+    parser.limits = &limit_cases[i].limits;
+
+    result   = lilx_parse(&parser, 
+      limit_cases[i].xml, strlen(limit_cases[i].xml), 1);
+    expected = limit_cases[i].exceeded ? LILX_LIMIT : LILX_OK;
+
+    if (result == LILX_OK) lilx_free_tree(&root);
+
+    if (result != expected) return 1;
+    if (result == LILX_LIMIT && parser.exceeded != limit_cases[i].exceeded)
+      return 1;
+  }
+
+  /*room for <log> and one record (and its text) at a time*/
+  memset(&limits, 0, sizeof(limits));
+  limits.max_elements = 2;
+  limits.max_strings  = 8;
+
+  /*without the handler, the records pile up*/
+  lilx_parser_init(&parser, &root);
+  parser.limits = &limits;
+  if (lilx_parse(&parser, log, strlen(log), 1) != LILX_LIMIT) return 1;
+  if (parser.exceeded != LILX_LIMIT_ELEMENTS) return 1;
+
+  /*with it, each one is refunded as it is dropped*/
+  lilx_parser_init(&parser, &root);
+  parser.limits  = &limits;
+  parser.handler = &drop_records;
+  if (lilx_parse(&parser, log, strlen(log), 1) != LILX_OK) return 1;
+
+  result = parser.num_elements != 1 || parser.num_strings != 3 ||
+           root.children[0]->num_children != 0;
+
+  lilx_free_tree(&root);
+  return result;
+}
+
+/*parses xml in one go with the given flags, or a step at a time*/
+static uint8_t parse_flags(
+char *xml, element_t *root, uint8_t flags, uint32_t step) {
+
+  parser_t parser;
+  uint8_t  result;
+
+  lilx_parser_init(&parser, root);
+  parser.flags = flags;
+
+  if (step == 0) return lilx_parse(&parser, xml, strlen(xml), 1);
+
+  do result = lilx_parse_step(&parser, xml, strlen(xml), step);
+  while (result == LILX_MORE);
+
+  return result;
+}
+
+/*trusted mode builds the same tree as the validating parser, however 
+  the input is split up, but still fails on what it does check*/
+static int test_trusted(void) {
+
+  char *xml = "<a x=\"1\" y=\"two words\">\n"
+              " <!-- a comment -->\n"
+              " <b>body text</b> mixed <c z=\"3\"/>\n"
+              " <d><e>deep</e></d>\n"
+              "</a>";
+  element_t expected, root;
+  uint32_t  step;
+  int       result = 0;
+
+  if (lilx_create_tree(xml, &expected)) return 1;
+
+  for (step = 0; step <= 16 && result == 0; step += 4) {
+
+    if (parse_flags(xml, &root, LILX_TRUSTED, step) != LILX_OK) {
+      result = 1;
+      break;
+    }
+
+    result = tree_differs(&root, &expected);
+    lilx_free_tree(&root);
+  }
+
+  lilx_free_tree(&expected);
+
+  /*unclosed, and closing an element which was never opened*/
+  result |= parse_flags("<a><b>", &root, LILX_TRUSTED, 0) != LILX_ERROR;
+  result |= parse_flags("<a></a></b>", &root, LILX_TRUSTED, 0) != LILX_ERROR;
+
+  return result;
+}
+
+/*lookups by name on an element wide enough to get a child map give the 
+  same children, in the same order, as on a narrow one, and the map is 
+  rebuilt when the children change*/
+static int test_child_map(void) {
+
+  char       xml[1024], *names[] = {"a", "b", "c"};
+  element_t  root, *list, *child;
+  uint16_t   i, n, it;
+  int        result = 0;
+
+  /*<list><a i="0"/><b i="1"/><c i="2"/><a i="3"/>...</list>*/
+  n = sprintf(xml, "<list>");
+  for (i = 0; i < 3 * LILX_CHILD_MAP_THRESHOLD; i++)
+    n += sprintf(xml + n, "<%s i=\"%u\"/>", names[i % 3], i);
+  sprintf(xml + n, "</list>");
+
+  if (lilx_create_tree(xml, &root)) return 1;
+  list = root.children[0];
+
+  /*every b, in document order*/
+  for (i = 1, it = 0; (child = lilx_get_children(list, "b", &it)) != NULL; 
+       i += 3)
+    result |= child != list->children[i];
+
+  result |= i != 3 * LILX_CHILD_MAP_THRESHOLD + 1;
+  result |= list->child_map == NULL;
+  result |= lilx_get_child(list, "c") != list->children[2];
+  result |= lilx_get_child(list, "d") != NULL;
+
+  /*remove the first child by hand - the next lookup sees the change*/
+  child = list->children[0];
+  memmove(list->children, list->children + 1, 
+          (list->num_children - 1) * sizeof(element_t *));
+  list->num_children--;
+
+  result |= strcmp(lilx_get_attribute_by_name(
+              lilx_get_child(list, "a"), "i")->value, "3") != 0;
+
+  lilx_free_tree(child);
+  free(child);
+  lilx_free_tree(&root);
+  return result;
+}
+
+/*searches by name give the same answers with the summaries as without 
+  them, and find a renamed element once its summary has been reset*/
+static int test_summaries(void) {
+
+  element_t  root, *found[4], *c;
+  int        result = 0;
+
+  if (lilx_create_tree(
+        "<a><b><c/><c/></b><d><e><c/></e></d><f/></a>", &root))
+    return 1;
+
+  /*every summary covers the summaries below it*/
+  c = root.children[0]->children[1]->children[0]->children[0];
+  result |= c->summary == 0 || (root.summary & c->summary) != c->summary;
+
+  result |= lilx_count_elements_by_name(&root, "c") != 3;
+  result |= lilx_count_elements_by_name(&root, "z") != 0;
+  result |= lilx_get_elements_by_name(&root, "c", found, 4) != 3;
+  result |= found[2] != c;
+
+  /*rename <f/> to <z/> - once reset, the search looks inside <a> again*/
+  c = root.children[0]->children[2];
+  free(c->name);
+  c->name = (char *)malloc(2);
+  if (c->name == NULL) {
+    lilx_free_tree(&root);
+    return 1;
+  }
+  strcpy(c->name, "z");
+
+  lilx_reset_summary(c);
+  result |= root.summary != 0 || root.children[0]->summary != 0;
+  result |= lilx_count_elements_by_name(&root, "z") != 1;
+
+  lilx_free_tree(&root);
+  return result;
+}
+
+/*an extracted subtree outlives the tree it came from, and is the same 
+  as the subtree parsed on its own, with working lookups*/
+static int test_extract(void) {
+
+  char       sub[1024], xml[1100];
+  element_t  root, alone, *copy;
+  uint16_t   i, n;
+  int        result;
+
+  /*<keep k="v">a<w i="0"/>b<w i="1"/>...<x/>z</keep>*/
+  n = sprintf(sub, "<keep k=\"v\">a");
+  for (i = 0; i < 2 * LILX_CHILD_MAP_THRESHOLD; i++)
+    n += sprintf(sub + n, "<w i=\"%u\"/>%c", i, 'b' + i % 24);
+  sprintf(sub + n, "<x><y>deep</y></x>z</keep>");
+  sprintf(xml, "<doc><skip/>%s<skip/></doc>", sub);
+
+  if (lilx_create_tree(xml, &root)) return 1;
+  copy = lilx_extract_subtree(root.children[0]->children[1]);
+  lilx_free_tree(&root);
+  if (copy == NULL) return 1;
+
+  if (lilx_create_tree(sub, &alone)) {
+    free(copy);
+    return 1;
+  }
+
+  result  = tree_differs(copy, alone.children[0]);
+  result |= lilx_get_child(copy, "x") != copy->children[copy->num_children - 1];
+  result |= lilx_parent(lilx_get_child(copy, "x")) != copy;
+  result |= lilx_count_elements_by_name(copy, "y") != 1;
+  result |= strcmp(lilx_get_text(copy), lilx_get_text(alone.children[0])) != 0;
+
+  lilx_free_tree(&alone);
+  free(copy);
+  return result;
+}
+
+/*output collected in memory, for the tests of the writers*/
+typedef struct {
+  char     data[4096];
+  uint32_t len;
+} output_t;
+
+/*output function - appends to an output_t, failing once it is full*/
+static uint8_t write_output(void *context, char *data, uint32_t len) {
+
+  output_t *out = (output_t *)context;
+
+  if (out->len + len >= sizeof(out->data)) return 1;
+
+  memcpy(out->data + out->len, data, len);
+  out->len += len;
+  out->data[out->len] = '\0';
+
+  return 0;
+}
+
+/*output function which always fails*/
+static uint8_t write_fail(void *context, char *data, uint32_t len) {
+  return 1;
+}
+
+/*builds a tree, checks that it is serialised (escaped, and indented) as
+  expected and parses back to the same tree, and that misuse of the 
+  builder, and a failing output function, are reported*/
+static int test_builder(void) {
+
+  lilx_builder_t builder;
+  element_t     *built, parsed;
+  output_t       out;
+  int            result = 0;
+
+  lilx_builder_init(&builder);
+  lilx_builder_begin(&builder, "person");
+  lilx_builder_attr (&builder, "id", "4&2\"");
+  lilx_builder_text (&builder, "Ada <L>");
+  lilx_builder_begin(&builder, "b");
+  lilx_builder_end  (&builder);
+  lilx_builder_text (&builder, "tail");
+  lilx_builder_end  (&builder);
+
+  built = lilx_builder_root(&builder);
+  if (built == NULL) {
+    lilx_builder_free(&builder);
+    return 1;
+  }
+
+  out.len = 0;
+  result |= lilx_serialise(built->children[0], 0, &write_output, &out);
+  result |= strcmp(out.data, 
+    "<person id=\"4&amp;2&quot;\">Ada &lt;L&gt;<b/>tail</person>") != 0;
+
+  if (result == 0 && lilx_create_tree(out.data, &parsed) == 0) {
+    result |= tree_differs(&parsed, built);
+    lilx_free_tree(&parsed);
+  }
+  else result = 1;
+
+  result |= lilx_serialise(built->children[0], 0, &write_fail, NULL) == 0;
+  lilx_builder_free(&builder);
+
+  /*elements which only contain elements are indented*/
+  if (lilx_create_tree("<a><b/><c>x</c><d><e/></d></a>", &parsed)) return 1;
+
+  out.len = 0;
+  result |= lilx_serialise(parsed.children[0], 2, &write_output, &out);
+  result |= strcmp(out.data, "<a>\n  <b/>\n  <c>x</c>\n  <d>\n    <e/>\n"
+                             "  </d>\n</a>") != 0;
+  lilx_free_tree(&parsed);
+
+  /*closing with nothing open, and finishing with something open*/
+  lilx_builder_init(&builder);
+  result |= lilx_builder_end(&builder) == 0;
+  result |= lilx_builder_root(&builder) != NULL;
+  lilx_builder_free(&builder);
+
+  lilx_builder_init(&builder);
+  lilx_builder_begin(&builder, "a");
+  result |= lilx_builder_root(&builder) != NULL;
+  lilx_builder_free(&builder);
+
+  return result;
+}
+
+/*passes xml through a filter, step bytes at a time (0 for all at once)*/
+static uint8_t run_filter(char *xml, filter_rule_t *rules, uint16_t num_rules,
+uint32_t step, filter_write_t write, output_t *out) {
+
+  filter_t filter;
+  uint32_t off = 0, len = strlen(xml), n;
+  uint8_t  result;
+
+  out->len     = 0;
+  out->data[0] = '\0';
+
+  if (filter_init(&filter, rules, num_rules, write, out) != 0) return 1;
+
+  do {
+    n      = (step == 0 || len - off < step) ? len - off : step;
+    result = filter_feed(&filter, xml + off, n, off + n == len);
+    off   += n;
+  } while (result == LILX_MORE && off < len);
+
+  filter_free(&filter);
+  return result;
+}
+
+/*each rule is applied, and the rest copied byte for byte, however the 
+  input is split up - and on bad input, what has been written out is
+  the start of what would have been*/
+static int test_filter(void) {
+
+  filter_rule_t rules[] = {
+    {FILTER_RENAME,         "hdr",      NULL,     "header"},
+    {FILTER_DROP_ATTRIBUTE, "*",        "secret", NULL},
+    {FILTER_DROP_SUBTREE,   "debug",    NULL,     NULL},
+    {FILTER_REPLACE_VALUE,  "password", NULL,     "XXX"},
+    {FILTER_REPLACE_VALUE,  "user",     "id",     "0"}
+  };
+  char *xml = "<msg>\n"
+              " <hdr secret=\"s\" v=\"1\">h</hdr>\n"
+              " <!-- c -->\n"
+              " <debug><x/>y</debug>\n"
+              " <password>pw<b/></password>\n"
+              " <user id=\"7\" secret=\"t\"/>\n"
+              "</msg>";
+  char *expected = "<msg>\n"
+                   " <header v=\"1\">h</header>\n"
+                   " <!-- c -->\n"
+                   " \n"
+                   " <password>XXX</password>\n"
+                   " <user id=\"0\"/>\n"
+                   "</msg>";
+  char *good = "<a><header>x</header></a>";
+  output_t out;
+  uint32_t step;
+  int      result = 0;
+
+  for (step = 0; step <= 3; step++) {
+    result |= run_filter(xml, rules, 5, step, &write_output, &out) != LILX_OK;
+    result |= strcmp(out.data, expected) != 0;
+  }
+
+  /*trailing junk, and a mismatched end tag*/
+  result |= run_filter("<a><hdr>x</hdr>junk", rules, 5, 0, 
+                       &write_output, &out) != LILX_ERROR;
+  result |= strncmp(out.data, good, out.len) != 0;
+
+  result |= run_filter("<a><hdr>x</hdr></b>", rules, 5, 1, 
+                       &write_output, &out) != LILX_ERROR;
+  result |= strncmp(out.data, good, out.len) != 0;
+
+  result |= run_filter(xml, rules, 5, 0, &write_fail, &out) != LILX_ERROR;
+
+  return result;
+}
+
+/*canonicalises xml, step bytes at a time (0 for all at once)*/
+static uint8_t run_canon(
+char *xml, uint32_t step, canon_write_t write, void *context) {
+
+  canon_t  canon;
+  uint32_t off = 0, len = strlen(xml), n;
+  uint8_t  result;
+
+  if (canon_init(&canon, write, context) != 0) return 1;
+
+  do {
+    n      = (step == 0 || len - off < step) ? len - off : step;
+    result = canon_feed(&canon, xml + off, n, off + n == len);
+    off   += n;
+  } while (result == LILX_MORE && off < len);
+
+  canon_free(&canon);
+  return result;
+}
+
+/*documents which differ only in layout have the same canonical form, 
+  and hash, and ones which differ in content don't*/
+static int test_canon(void) {
+
+  char *layouts[] = {
+    "<a b=\"x\" z=\"1\"><c></c>t</a>",
+    "<a  z=\"1\"\n   b=\"x\"  >\n <!-- note --> <c/> t </a >"
+  };
+  char         *canonical = "<a b=\"x\" z=\"1\"><c></c>t</a>";
+  output_t      out;
+  canon_hash_t  hash[3];
+  uint16_t      i;
+  int           result = 0;
+
+  for (i = 0; i < 2; i++) {
+
+    out.len = 0;
+    result |= run_canon(layouts[i], i, &write_output, &out) != LILX_OK;
+    result |= strcmp(out.data, canonical) != 0;
+
+    canon_hash_init(&hash[i]);
+    result |= run_canon(layouts[i], 0, &canon_hash_write, &hash[i]);
+  }
+
+  canon_hash_init(&hash[2]);
+  result |= run_canon("<a b=\"x\" z=\"2\"><c/>t</a>", 0, 
+                      &canon_hash_write, &hash[2]);
+
+  result |= hash[0].hash != hash[1].hash;
+  result |= hash[0].hash == hash[2].hash;
+
+  /*malformed input, and a failing output function*/
+  out.len = 0;
+  result |= run_canon("<a b=\"x\"><c></a>", 0, &write_output, &out) != 
+              LILX_ERROR;
+  result |= run_canon(canonical, 0, &write_fail, NULL) != LILX_ERROR;
+
+  return result;
+}
+
+/*writes a file for the tests which need some on disk*/
+static int write_file(char *dir, char *name, char *contents) {
+
+  char  path[256];
+  FILE *f;
+
+  sprintf(path, "%s/%s", dir, name);
+
+  f = fopen(path, "w");
+  if (f == NULL) return 1;
+
+  fputs(contents, f);
+  return fclose(f) != 0;
+}
+
+/*builds an index, saves it, and adds its postings up for the given term*/
+static uint32_t index_count(char *dir, char *idx, char *term) {
+
+  index_t        index;
+  index_reader_t reader;
+  posting_t      posting;
+  uint32_t       total = 0;
+
+  if (index_open(&index, idx)            != 0) return UINT32_MAX;
+  if (index_add (&index, &dir, 1, 2)     != 0 ||
+      index_save(&index, idx)            != 0) {
+    index_free(&index);
+    return UINT32_MAX;
+  }
+  index_free(&index);
+
+  if (index_reader_open(&reader, idx) != 0) return UINT32_MAX;
+  index_lookup(&reader, term, &posting, 1, &total);
+  index_reader_close(&reader);
+
+  return total;
+}
+
+/*builds an index of two files, queries it, reparses a matching element, 
+  and updates it once one of the files has gone*/
+static int test_index(void) {
+
+  char           dir[] = "/tmp/lilxtestXXXXXX", idx[64], path[64];
+  index_reader_t reader;
+  posting_t      postings[4];
+  element_t      root;
+  int            result = 0;
+
+  if (mkdtemp(dir) == NULL) return 1;
+  sprintf(idx, "%s.idx", dir);
+
+  result |= write_file(dir, "a.xml", 
+    "<people><person id=\"1\"><name>Ada Lovelace</name></person></people>");
+  result |= write_file(dir, "b.xml", 
+    "<people><person><name>Alan</name></person></people>");
+
+  result |= index_count(dir, idx, "<person") != 2;
+
+  if (result == 0 && index_reader_open(&reader, idx) == 0) {
+
+    result |= index_lookup(&reader, "@id",      postings, 4, NULL) != 1;
+    result |= index_lookup(&reader, "nothing",  postings, 4, NULL) != 0;
+    result |= index_lookup(&reader, "lovelace", postings, 4, NULL) != 1;
+
+    /*the word is in the body of <name>*/
+    sprintf(path, "%s/a.xml", dir);
+    result |= strcmp(index_file_path(&reader, postings[0].file), path) != 0;
+
+    if (index_extract(path, postings[0].offset, &root) == 0) {
+      result |= strcmp(root.children[0]->name, "name")         != 0;
+      result |= strcmp(root.children[0]->body, "Ada Lovelace") != 0;
+      lilx_free_tree(&root);
+    }
+    else result = 1;
+
+    /*past the end of the file*/
+    result |= index_extract(path, 1000, &root) == 0;
+
+    index_reader_close(&reader);
+  }
+  else result = 1;
+
+  /*b.xml has gone from the directory, so it goes from the index*/
+  sprintf(path, "%s/b.xml", dir);
+  unlink(path);
+  result |= index_count(dir, idx, "<person") != 1;
+
+  sprintf(path, "%s/a.xml", dir);
+  unlink(path);
+  unlink(idx);
+  rmdir(dir);
+
+  /*no such index*/
+  result |= index_reader_open(&reader, idx) == 0;
+
+  return result;
+}
+
+/*what the ingest handler saw of each file*/
+typedef struct {
+  int calls;    /**< number of times the file was handled  */
+  int children; /**< children of its document element, or
+                     -1 if it couldn't be read or parsed   */
+} ingested_t;
+
+/*ingest handler - each file is only ever handled by one worker*/
+static void ingest_record(void *context, uint32_t file, element_t *root) {
+
+  ingested_t *seen = (ingested_t *)context;
+
+  seen[file].calls++;
+  seen[file].children = (root == NULL) ? -1 :
+                        root->children[0]->num_children;
+}
+
+/*writes num_files files to dir, file i having i children, except for
+  the last two, which are malformed and missing, and fills in paths*/
+static int write_ingest_files(
+char *dir, char paths[][64], char **ptrs, uint32_t num_files) {
+
+  char     name[16], xml[8192];
+  uint32_t i, j, n;
+
+  for (i = 0; i < num_files; i++) {
+
+    sprintf(name, "%u.xml", i);
+    sprintf(paths[i], "%s/%s", dir, name);
+    ptrs[i] = paths[i];
+
+    if (i == num_files - 1) continue;
+
+    n = sprintf(xml, "<doc>");
+    for (j = 0; j < i; j++) n += sprintf(xml + n, "<i n=\"%u\"/>", j);
+    if (i < num_files - 2) sprintf(xml + n, "</doc>");
+
+    if (write_file(dir, name, xml)) return 1;
+  }
+
+  return 0;
+}
+
+/*removes what write_ingest_files wrote*/
+static void remove_ingest_files(char *dir, char **paths, uint32_t num_files) {
+
+  uint32_t i;
+
+  for (i = 0; i < num_files; i++) unlink(paths[i]);
+  rmdir(dir);
+}
+
+/*checks that every file was handled once, with the right tree, or NULL
+  for the last two*/
+static int ingest_differs(ingested_t *seen, uint32_t num_files) {
+
+  uint32_t i;
+
+  for (i = 0; i < num_files; i++) {
+
+    if (seen[i].calls != 1) return 1;
+    if (seen[i].children != ((i < num_files - 2) ? (int)i : -1)) return 1;
+  }
+
+  return 0;
+}
+
+/*ingests a directory of files, through io_uring (where it is available)
+  and through pread, with files which are missing and malformed*/
+static int test_ingest(void) {
+
+  char             dir[] = "/tmp/lilxtestXXXXXX";
+  char             paths[16][64], *ptrs[16];
+  ingested_t       seen[16];
+  ingest_options_t options;
+  ingest_stats_t   stats;
+  uint8_t          flags[] = {0, INGEST_PREAD};
+  uint16_t         i;
+  int              result = 0;
+
+  if (mkdtemp(dir) == NULL) return 1;
+  result = write_ingest_files(dir, paths, ptrs, 16);
+
+  for (i = 0; i < 2 && result == 0; i++) {
+
+    ingest_defaults(&options);
+    options.nthreads    = 2;
+    options.queue_depth = 4;
+    options.num_buffers = 8;
+    options.buffer_size = 64;
+    options.flags       = flags[i];
+
+    memset(seen, 0, sizeof(seen));
+    result |= ingest_files(ptrs, 16, &options, &ingest_record, seen, &stats);
+    result |= ingest_differs(seen, 16);
+    result |= stats.files != 14 || stats.failed != 2;
+    if (flags[i] == INGEST_PREAD) 
+      result |= stats.backend != INGEST_BACKEND_PREAD;
+  }
+
+  remove_ingest_files(dir, ptrs, 16);
+  return result;
+}
+
+/*checks the stats of one lane, which should have had num_files files*/
+static int lane_differs(ingest_lane_stats_t *lane, uint32_t num_files) {
+
+  uint32_t i, waits = 0;
+
+  for (i = 0; i < INGEST_WAIT_BUCKETS; i++) waits += lane->waits[i];
+
+  if (lane->files != num_files)                              return 1;
+  if (waits       != num_files)                              return 1;
+  if (lane->max_depth > num_files)                           return 1;
+  if (num_files > 0 && lane->max_depth == 0)                 return 1;
+  if (num_files == 0 && ingest_wait_percentile(lane, 0.99))  return 1;
+  if (ingest_wait_percentile(lane, 0.5) >
+      ingest_wait_percentile(lane, 1))                       return 1;
+
+  return 0;
+}
+
+/*ingests small and large files, with large files parsed in slices, in
+  one go, and not at all (when every file is small)*/
+static int test_ingest_lanes(void) {
+
+  char             dir[] = "/tmp/lilxtestXXXXXX";
+  char             paths[16][64], *ptrs[16];
+  ingested_t       seen[16];
+  ingest_options_t options;
+  ingest_stats_t   stats;
+  struct stat      st;
+  uint32_t         large_sizes[] = {64,  64, UINT32_MAX};
+  uint32_t         slice_sizes[] = {16,  0,  16};
+  uint8_t          nthreads[]    = {1,   2,  2};
+  uint32_t         num_large;
+  uint16_t         i, j;
+  int              result = 0;
+
+  if (mkdtemp(dir) == NULL) return 1;
+  result = write_ingest_files(dir, paths, ptrs, 16);
+
+  for (i = 0; i < 3 && result == 0; i++) {
+
+    /*the missing file is left out, as it has no size to sort it by*/
+    num_large = 0;
+    for (j = 0; j < 15; j++) {
+      if      (stat(ptrs[j], &st) != 0)      result = 1;
+      else if (st.st_size >= large_sizes[i]) num_large++;
+    }
+
+    ingest_defaults(&options);
+    options.nthreads      = nthreads[i];
+    options.large_threads = 1;
+    options.large_size    = large_sizes[i];
+    options.slice_size    = slice_sizes[i];
+
+    /*so that ingest_differs finds the missing file as it expects*/
+    memset(seen, 0, sizeof(seen));
+    seen[15].calls    = 1;
+    seen[15].children = -1;
+
+    result |= ingest_files(ptrs, 15, &options, &ingest_record, seen, &stats);
+    result |= ingest_differs(seen, 16);
+    result |= stats.files != 14 || stats.failed != 1;
+    result |= lane_differs(&stats.lanes[INGEST_LANE_SMALL], 15 - num_large);
+    result |= lane_differs(&stats.lanes[INGEST_LANE_LARGE], num_large);
+    result |= (i < 2) != (num_large > 0);
+  }
+
+  remove_ingest_files(dir, ptrs, 16);
+  return result;
+}
+
+/*writes the tree with lilx_serialise, and with export_tree and export_fd
+  with the given options, and checks that the outputs are the same*/
+static int export_differs(element_t *element, export_options_t *options) {
+
+  output_t expected, out;
+  char     path[] = "/tmp/lilxtestXXXXXX";
+  int      fd, result = 0;
+
+  expected.len = 0;
+  out     .len = 0;
+  if (lilx_serialise(element, options->indent, &write_output, &expected))
+    return 1;
+
+  result |= export_tree(element, options, &write_output, &out);
+  result |= out.len != expected.len;
+  result |= memcmp(out.data, expected.data, expected.len) != 0;
+
+  fd = mkstemp(path);
+  if (fd < 0) return 1;
+  unlink(path);
+
+  result |= export_fd(element, options, fd);
+  result |= lseek(fd, 0, SEEK_SET) != 0;
+  result |= read(fd, out.data, sizeof(out.data)) != (ssize_t)expected.len;
+  result |= memcmp(out.data, expected.data, expected.len) != 0;
+  close(fd);
+
+  return result;
+}
+
+/*exports a tree with wide and deep parts and mixed content, split into
+  units of various sizes, on various numbers of threads, and sequentially,
+  and checks that failed writes are reported*/
+static int test_export(void) {
+
+  lilx_builder_t   builder;
+  element_t       *root;
+  export_options_t options;
+  uint32_t         unit_sizes[] = {1, 3, 16, 1000};
+  uint8_t          nthreads[]   = {1, 2, 4};
+  char             value[16];
+  uint16_t         i, j, k;
+  int              result = 0;
+
+  lilx_builder_init(&builder);
+  lilx_builder_begin(&builder, "r");
+  for (i = 0; i < 6; i++) {
+    lilx_builder_begin(&builder, "s");
+    for (j = 0; j < 5; j++) {
+      sprintf(value, "%u.%u", i, j);
+      lilx_builder_begin(&builder, "e");
+      lilx_builder_attr (&builder, "n", value);
+      lilx_builder_text (&builder, "a&b");
+      if (j % 2) {
+        for (k = 0; k <= i; k++) lilx_builder_begin(&builder, "f");
+        for (k = 0; k <= i; k++) lilx_builder_end  (&builder);
+        lilx_builder_text(&builder, "tail");
+      }
+      lilx_builder_end(&builder);
+    }
+    lilx_builder_end(&builder);
+  }
+  lilx_builder_end(&builder);
+
+  root = lilx_builder_root(&builder);
+  if (root == NULL) {
+    lilx_builder_free(&builder);
+    return 1;
+  }
+
+  for (i = 0; i < 4; i++) {
+    for (j = 0; j < 3; j++) {
+      for (k = 0; k <= 2; k += 2) {
+
+        export_defaults(&options);
+        options.nthreads     = nthreads[j];
+        options.indent       = k;
+        options.unit_size    = unit_sizes[i];
+        options.min_elements = 1;
+        result |= export_differs(root->children[0], &options);
+      }
+    }
+  }
+
+  /*sequentially, as the tree is too small for the default threshold*/
+  export_defaults(&options);
+  result |= export_differs(root->children[0], &options);
+
+  /*a failing output function, and a bad file descriptor*/
+  for (i = 0; i < 2; i++) {
+    options.unit_size    = 3;
+    options.min_elements = i;
+    result |= export_tree(root->children[0], &options, &write_fail, NULL) == 0;
+    result |= export_fd  (root->children[0], &options, -1)                == 0;
+  }
+
+  lilx_builder_free(&builder);
+  return result;
+}
+
+/*parses with a guide, and optionally a handler*/
+static uint8_t parse_guide(
+char *xml, element_t *root, guide_t *guide, handler_t handler) {
+
+  parser_t parser;
+
+  lilx_parser_init(&parser, root);
+  parser.guide   = guide;
+  parser.handler = handler;
+
+  return lilx_parse(&parser, xml, strlen(xml), 1);
+}
+
+/*non-0 unless path is in the guide, and lists elements with the given 
+  bodies ("" for none), in order, each of which knows its path id*/
+static int guide_differs(guide_t *guide, char *path, char **bodies) {
+
+  element_t **elements;
+  uint32_t    num, i;
+  uint16_t    id;
+  char        buf[64];
+
+  id = guide_find(guide, path);
+  if (id == GUIDE_NONE) return 1;
+
+  if (guide_path_string(guide, id, buf, sizeof(buf))) return 1;
+  if (strcmp(buf, path) != 0)                          return 1;
+
+  elements = guide_elements(guide, id, &num);
+
+  for (i = 0; bodies[i] != NULL; i++) {
+    if (i >= num)                                   return 1;
+    if (elements[i]->path != id)                    return 1;
+    if (strcmp(elements[i]->body ? elements[i]->body : "", bodies[i]))
+      return 1;
+  }
+
+  return i != num;
+}
+
+/*checks the paths and per-path element lists of a guide, that path ids 
+  stay the same across documents, and that dropped elements are removed*/
+static int test_guide(void) {
+
+  char *xml = "<people><person><name>A</name></person><x/>"
+              "<person><name>B</name><name>C</name></person></people>";
+  char      *names[]  = {"A", "B", "C", NULL};
+  char      *people[] = {"", NULL};
+  char      *none[]   = {NULL};
+  guide_t    guide;
+  element_t  root;
+  uint16_t   id;
+  char       buf[8];
+  int        result = 0;
+
+  if (guide_init(&guide)) return 1;
+
+  if (parse_guide(xml, &root, &guide, NULL) != LILX_OK) {
+    guide_free(&guide);
+    return 1;
+  }
+
+  result |= guide_find(&guide, "/")                     != 0;
+  result |= guide_num_paths(&guide)                     != 5;
+  result |= guide_differs(&guide, "/people",             people);
+  result |= guide_differs(&guide, "/people/person/name", names);
+  result |= guide_find(&guide, "/people/name")          != GUIDE_NONE;
+  result |= guide_find(&guide, "/people/person/nam")    != GUIDE_NONE;
+  result |= guide_path(&guide, 5)                       != NULL;
+
+  id      = guide_find(&guide, "/people/person/name");
+  result |= guide_path_string(&guide, id, buf, sizeof(buf)) == 0;
+  result |= guide_path_string(&guide, 5,  buf, sizeof(buf)) == 0;
+
+  /*the paths, and their ids, are kept when the guide is cleared*/
+  guide_clear(&guide);
+  lilx_free_tree(&root);
+
+  result |= guide_differs(&guide, "/people/person/name", none);
+
+  if (parse_guide("<people><person><name>D</name></person></people>", 
+                  &root, &guide, NULL) == LILX_OK) {
+    names[0] = "D";
+    names[1] = NULL;
+    result  |= guide_num_paths(&guide) != 5;
+    result  |= guide_find(&guide, "/people/person/name") != id;
+    result  |= guide_differs(&guide, "/people/person/name", names);
+    guide_clear(&guide);
+    lilx_free_tree(&root);
+  }
+  else result = 1;
+
+  /*records which a handler drops are taken out of the guide*/
+  if (parse_guide("<log><r><t>1</t></r><r/><s/></log>", 
+                  &root, &guide, &drop_records) == LILX_OK) {
+    result |= guide_differs(&guide, "/log",     people);
+    result |= guide_differs(&guide, "/log/r",   none);
+    result |= guide_differs(&guide, "/log/r/t", none);
+    result |= guide_differs(&guide, "/log/s",   none);
+    guide_clear(&guide);
+    lilx_free_tree(&root);
+  }
+  else result = 1;
+
+  guide_free(&guide);
+  return result;
+}
+
+/*the tests, in the order they are run*/
+static struct {
+  char *name;
+  int (*run)(void);
+} tests[] = {
+  {"restart from a checkpoint",   test_restart},
+  {"schema validation",           test_schema},
+  {"namespaces",                  test_namespaces},
+  {"namespaces after a restart",  test_namespaces_restore},
+  {"mixed content",               test_segments},
+  {"resource limits",             test_limits},
+  {"trusted mode",                test_trusted},
+  {"child maps",                  test_child_map},
+  {"name summaries",              test_summaries},
+  {"subtree extraction",          test_extract},
+  {"tree builder and serialiser", test_builder},
+  {"rewrite filter",              test_filter},
+  {"canonical form",              test_canon},
+  {"inverted index",              test_index},
+  {"bulk ingest",                 test_ingest},
+  {"ingest lanes",                test_ingest_lanes},
+  {"parallel export",             test_export},
+  {"data guide",                  test_guide}
+};
+
 int main (int argc, char *argv[]) {
 
   element_t root;
+  uint16_t  i;
+  int       failed = 0;
 
   printf("testing liix with this XML snippet:\n");
   printf("%s\n\n", testxml);
@@ -30,5 +1300,14 @@ int main (int argc, char *argv[]) {
   
   lilx_free_tree(&root);
 
-  return 0;
+  for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+
+    if (tests[i].run()) {
+      printf("%s failed :(\n", tests[i].name);
+      failed = 1;
+    }
+    else printf("%s succeeded!\n", tests[i].name);
+  }
+
+  return failed;
 }